@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <execinfo.h>
+
+#include <atomic>
+
+#include "allocwatch.h"
+
+using namespace std;
+
+extern "C" {
+void *	__libc_malloc(size_t size);
+void *	__libc_calloc(size_t count, size_t size);
+void *	__libc_realloc(void * p, size_t size);
+void *	__libc_memalign(size_t alignment, size_t size);
+void *	__libc_valloc(size_t size);
+void *	__libc_pvalloc(size_t size);
+void	__libc_free(void * p);
+}
+
+struct AllocSite
+{
+	void *				stack[ALLOCWATCH_STACK_DEPTH];
+	int					depth;
+	uint64_t			count;
+	uint64_t			bytes;
+};
+
+static atomic<bool>				isArmed(false);
+static atomic<uint64_t>			allocationCount(0);
+static atomic<uint64_t>			freeCount(0);
+static atomic<uint64_t>			allocatedBytes(0);
+
+static pthread_mutex_t			siteMutex = PTHREAD_MUTEX_INITIALIZER;
+static AllocSite				sites[ALLOCWATCH_MAX_SITES];
+static int						numSites = 0;
+
+/*
+** backtrace() may itself allocate, or call something that
+** does...
+*/
+static thread_local bool		isInWatch = false;
+
+static void recordAllocation(size_t size)
+{
+	AllocSite		site;
+	int				i;
+
+	allocationCount.fetch_add(1, memory_order_relaxed);
+	allocatedBytes.fetch_add(size, memory_order_relaxed);
+
+	if (isInWatch) {
+		return;
+	}
+
+	isInWatch = true;
+
+	site.depth = backtrace(site.stack, ALLOCWATCH_STACK_DEPTH);
+
+	pthread_mutex_lock(&siteMutex);
+
+	for (i = 0;i < numSites;i++) {
+		if (sites[i].depth == site.depth && memcmp(sites[i].stack, site.stack, sizeof(void *) * site.depth) == 0) {
+			break;
+		}
+	}
+
+	if (i == numSites && numSites < ALLOCWATCH_MAX_SITES) {
+		memcpy(sites[i].stack, site.stack, sizeof(void *) * site.depth);
+		sites[i].depth = site.depth;
+		sites[i].count = 0;
+		sites[i].bytes = 0;
+
+		numSites++;
+	}
+
+	if (i < numSites) {
+		sites[i].count++;
+		sites[i].bytes += size;
+	}
+
+	pthread_mutex_unlock(&siteMutex);
+
+	isInWatch = false;
+}
+
+extern "C" {
+
+void * malloc(size_t size)
+{
+	if (isArmed.load(memory_order_relaxed)) {
+		recordAllocation(size);
+	}
+
+	return __libc_malloc(size);
+}
+
+void * calloc(size_t count, size_t size)
+{
+	if (isArmed.load(memory_order_relaxed)) {
+		recordAllocation(count * size);
+	}
+
+	return __libc_calloc(count, size);
+}
+
+void * realloc(void * p, size_t size)
+{
+	if (isArmed.load(memory_order_relaxed)) {
+		recordAllocation(size);
+	}
+
+	return __libc_realloc(p, size);
+}
+
+void * memalign(size_t alignment, size_t size)
+{
+	if (isArmed.load(memory_order_relaxed)) {
+		recordAllocation(size);
+	}
+
+	return __libc_memalign(alignment, size);
+}
+
+void * aligned_alloc(size_t alignment, size_t size)
+{
+	return memalign(alignment, size);
+}
+
+int posix_memalign(void ** p, size_t alignment, size_t size)
+{
+	if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+		return EINVAL;
+	}
+
+	*p = memalign(alignment, size);
+
+	return (*p == NULL ? ENOMEM : 0);
+}
+
+void * valloc(size_t size)
+{
+	if (isArmed.load(memory_order_relaxed)) {
+		recordAllocation(size);
+	}
+
+	return __libc_valloc(size);
+}
+
+void * pvalloc(size_t size)
+{
+	if (isArmed.load(memory_order_relaxed)) {
+		recordAllocation(size);
+	}
+
+	return __libc_pvalloc(size);
+}
+
+void free(void * p)
+{
+	if (p != NULL && isArmed.load(memory_order_relaxed)) {
+		freeCount.fetch_add(1, memory_order_relaxed);
+	}
+
+	__libc_free(p);
+}
+
+}
+
+void allocWatchArm()
+{
+	void *			stack[2];
+
+	/*
+	** The first backtrace() loads the unwinder, get that
+	** out of the way first...
+	*/
+	backtrace(stack, 2);
+
+	allocationCount.store(0, memory_order_relaxed);
+	freeCount.store(0, memory_order_relaxed);
+	allocatedBytes.store(0, memory_order_relaxed);
+
+	pthread_mutex_lock(&siteMutex);
+	numSites = 0;
+	pthread_mutex_unlock(&siteMutex);
+
+	isArmed.store(true, memory_order_seq_cst);
+}
+
+void allocWatchDisarm()
+{
+	isArmed.store(false, memory_order_seq_cst);
+}
+
+void allocWatchGetStats(AllocWatchStats * stats)
+{
+	stats->allocationCount = allocationCount.load(memory_order_relaxed);
+	stats->freeCount = freeCount.load(memory_order_relaxed);
+	stats->bytes = allocatedBytes.load(memory_order_relaxed);
+
+	pthread_mutex_lock(&siteMutex);
+	stats->numSites = numSites;
+	pthread_mutex_unlock(&siteMutex);
+}
+
+void allocWatchReport(FILE * fptr)
+{
+	int				i;
+
+	fflush(fptr);
+
+	pthread_mutex_lock(&siteMutex);
+
+	for (i = 0;i < numSites;i++) {
+		fprintf(fptr, "Allocation site %d: %lu call(s), %lu bytes\n", i + 1, (unsigned long)sites[i].count, (unsigned long)sites[i].bytes);
+		fflush(fptr);
+
+		/*
+		** Skipping our own frames...
+		*/
+		backtrace_symbols_fd(&sites[i].stack[2], sites[i].depth - 2, fileno(fptr));
+	}
+
+	pthread_mutex_unlock(&siteMutex);
+}
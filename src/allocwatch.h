@@ -0,0 +1,35 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef _INCL_ALLOCWATCH
+#define _INCL_ALLOCWATCH
+
+#define ALLOCWATCH_MAX_SITES                16
+#define ALLOCWATCH_STACK_DEPTH              12
+
+struct AllocWatchStats
+{
+    uint64_t            allocationCount;
+    uint64_t            freeCount;
+    uint64_t            bytes;
+    int                 numSites;
+};
+
+/*
+** malloc() and friends are replaced with wrappers around
+** glibc's own, which count every call while armed and keep
+** the stack of the first few places that allocate. Disarmed,
+** a wrapper costs one relaxed load...
+*/
+void    allocWatchArm();
+void    allocWatchDisarm();
+
+void    allocWatchGetStats(AllocWatchStats * stats);
+
+/*
+** Prints each allocating call stack, without allocating.
+** Addresses resolve with addr2line -C -f -e bctl...
+*/
+void    allocWatchReport(FILE * fptr);
+
+#endif
@@ -0,0 +1,1022 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "configmgr.h"
+#include "logger.h"
+#include "bctl_error.h"
+#include "currenttime.h"
+#include "resume.h"
+#include "container.h"
+#include "avi.h"
+
+using namespace std;
+
+static uint8_t * putFourCC(uint8_t * p, const char * pszFourCC)
+{
+	memcpy(p, pszFourCC, 4);
+
+	return p + 4;
+}
+
+static uint8_t * put32(uint8_t * p, uint32_t value)
+{
+	memcpy(p, &value, 4);
+
+	return p + 4;
+}
+
+static uint8_t * putChunk(uint8_t * p, const char * pszFourCC, const void * data, uint32_t length)
+{
+	p = putFourCC(p, pszFourCC);
+	p = put32(p, length);
+
+	memcpy(p, data, length);
+
+	return p + length;
+}
+
+const char * getAVICopyModeName(AVICopyMode mode)
+{
+	switch (mode) {
+		case avi_copy_file_range:
+			return "copy_file_range";
+
+		case avi_splice:
+			return "splice";
+
+		case avi_read_write:
+			return "read/write";
+	}
+
+	return "unknown";
+}
+
+/*
+** Walk the marker segments up to the first start of frame with
+** small reads, the Exif thumbnail may come first...
+*/
+bool getJpegDimensions(int fd, off_t offset, size_t length, int * width, int * height)
+{
+	uint8_t			buffer[5];
+	off_t			end = offset + (off_t)length;
+	off_t			p = offset + 2;
+	size_t			segmentLength;
+	uint8_t			marker;
+
+	if (length < 4 || pread(fd, buffer, 2, offset) != 2 || buffer[0] != 0xFF || buffer[1] != 0xD8) {
+		return false;
+	}
+
+	while (p + 4 <= end) {
+		if (pread(fd, buffer, 4, p) != 4 || buffer[0] != 0xFF) {
+			return false;
+		}
+
+		marker = buffer[1];
+
+		if (marker == 0xFF) {
+			p++;
+			continue;
+		}
+
+		segmentLength = ((size_t)buffer[2] << 8) | buffer[3];
+
+		/*
+		** SOF0 to SOF15, except DHT, JPG and DAC...
+		*/
+		if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+			if (p + 9 > end || pread(fd, buffer, 5, p + 4) != 5) {
+				return false;
+			}
+
+			*height = ((int)buffer[1] << 8) | buffer[2];
+			*width = ((int)buffer[3] << 8) | buffer[4];
+
+			return (*width > 0 && *height > 0);
+		}
+
+		if (marker == 0xDA) {
+			return false;
+		}
+
+		p += 2 + (off_t)segmentLength;
+	}
+
+	return false;
+}
+
+AVIWriter::~AVIWriter()
+{
+	if (this->fd >= 0) {
+		try {
+			finish();
+		}
+		catch (bctl_error & e) {
+			::close(this->fd);
+		}
+	}
+
+	if (this->pipeFds[0] >= 0) {
+		::close(this->pipeFds[0]);
+		::close(this->pipeFds[1]);
+	}
+
+	free(this->buffer);
+	free(this->stdIndex);
+	free(this->oldIndex);
+}
+
+void AVIWriter::writeFully(const void * data, size_t length)
+{
+	const uint8_t *		p = (const uint8_t *)data;
+	ssize_t				rtn;
+
+	while (length > 0) {
+		rtn = write(this->fd, p, length);
+
+		if (rtn < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			throw bctl_error(bctl_error::buildMsg("Failed to write AVI: %s", strerror(errno)), __FILE__, __LINE__);
+		}
+
+		p += rtn;
+		length -= (size_t)rtn;
+		this->position += (uint64_t)rtn;
+	}
+}
+
+void AVIWriter::patch(off_t offset, const void * data, size_t length)
+{
+	const uint8_t *		p = (const uint8_t *)data;
+	ssize_t				rtn;
+
+	while (length > 0) {
+		rtn = pwrite(this->fd, p, length, offset);
+
+		if (rtn < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			throw bctl_error(bctl_error::buildMsg("Failed to update AVI: %s", strerror(errno)), __FILE__, __LINE__);
+		}
+
+		p += rtn;
+		offset += rtn;
+		length -= (size_t)rtn;
+	}
+}
+
+/*
+** Appends length bytes from offset in inFd at the current
+** position, falling back to the next copy mode if the kernel
+** or file system won't do the current one...
+*/
+void AVIWriter::copyFrame(int inFd, off_t offset, size_t length)
+{
+	loff_t			inOffset = offset;
+	ssize_t			bytesIn;
+	ssize_t			bytesOut;
+
+	while (length > 0 && this->copyMode == avi_copy_file_range) {
+		bytesIn = copy_file_range(inFd, &inOffset, this->fd, NULL, length, 0);
+
+		if (bytesIn > 0) {
+			length -= (size_t)bytesIn;
+			this->position += (uint64_t)bytesIn;
+		}
+		else if (bytesIn == 0) {
+			throw bctl_error("Frame is shorter than its length", __FILE__, __LINE__);
+		}
+		else if (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP) {
+			this->copyMode = avi_splice;
+		}
+		else if (errno != EINTR) {
+			throw bctl_error(bctl_error::buildMsg("Failed to copy frame: %s", strerror(errno)), __FILE__, __LINE__);
+		}
+	}
+
+	while (length > 0 && this->copyMode == avi_splice) {
+		bytesIn = splice(inFd, &inOffset, this->pipeFds[1], NULL, length, SPLICE_F_MOVE);
+
+		if (bytesIn == 0) {
+			throw bctl_error("Frame is shorter than its length", __FILE__, __LINE__);
+		}
+		else if (bytesIn < 0) {
+			if (errno == EINVAL) {
+				this->copyMode = avi_read_write;
+			}
+			else if (errno != EINTR) {
+				throw bctl_error(bctl_error::buildMsg("Failed to splice frame: %s", strerror(errno)), __FILE__, __LINE__);
+			}
+			continue;
+		}
+
+		while (bytesIn > 0) {
+			bytesOut = splice(this->pipeFds[0], NULL, this->fd, NULL, (size_t)bytesIn, SPLICE_F_MOVE);
+
+			if (bytesOut < 0 && errno == EINTR) {
+				continue;
+			}
+			else if (bytesOut <= 0) {
+				throw bctl_error(bctl_error::buildMsg("Failed to splice frame: %s", strerror(errno)), __FILE__, __LINE__);
+			}
+
+			bytesIn -= bytesOut;
+			length -= (size_t)bytesOut;
+			this->position += (uint64_t)bytesOut;
+		}
+	}
+
+	while (length > 0) {
+		bytesIn = pread(inFd, this->buffer, (length < AVI_COPY_BUFFER_SIZE ? length : AVI_COPY_BUFFER_SIZE), inOffset);
+
+		if (bytesIn == 0) {
+			throw bctl_error("Frame is shorter than its length", __FILE__, __LINE__);
+		}
+		else if (bytesIn < 0) {
+			if (errno != EINTR) {
+				throw bctl_error(bctl_error::buildMsg("Failed to read frame: %s", strerror(errno)), __FILE__, __LINE__);
+			}
+			continue;
+		}
+
+		writeFully(this->buffer, (size_t)bytesIn);
+
+		inOffset += bytesIn;
+		length -= (size_t)bytesIn;
+	}
+}
+
+static void fillHeaders(AVIMainHeader * avih, AVIStreamHeader * strh, int width, int height, uint32_t fps, uint32_t firstRiffFrames, uint32_t frameCount, uint32_t maxFrameSize)
+{
+	memset(avih, 0, sizeof(AVIMainHeader));
+
+	avih->microSecPerFrame = 1000000U / fps;
+	avih->maxBytesPerSec = maxFrameSize * fps;
+	avih->flags = AVIF_HASINDEX;
+	avih->totalFrames = firstRiffFrames;
+	avih->streams = 1;
+	avih->suggestedBufferSize = maxFrameSize + 8;
+	avih->width = (uint32_t)width;
+	avih->height = (uint32_t)height;
+
+	memset(strh, 0, sizeof(AVIStreamHeader));
+
+	memcpy(strh->fccType, "vids", 4);
+	memcpy(strh->fccHandler, "MJPG", 4);
+	strh->scale = 1;
+	strh->rate = fps;
+	strh->length = frameCount;
+	strh->suggestedBufferSize = maxFrameSize + 8;
+	strh->quality = 0xFFFFFFFFU;
+	strh->frameRight = (int16_t)width;
+	strh->frameBottom = (int16_t)height;
+}
+
+/*
+** The first RIFF's header, through to the start of its movi
+** list, with the counts and the super index still empty...
+*/
+void AVIWriter::writeHeader()
+{
+	AVIMainHeader			avih;
+	AVIStreamHeader			strh;
+	AVIBitmapInfo			strf;
+	AVISuperIndexHeader		indx;
+	uint8_t *				p = this->buffer;
+	uint32_t				indxLength = sizeof(AVISuperIndexHeader) + AVI_SUPER_INDEX_ENTRIES * sizeof(AVISuperIndexEntry);
+	uint32_t				strlLength = 4 + (8 + sizeof(AVIStreamHeader)) + (8 + sizeof(AVIBitmapInfo)) + (8 + indxLength);
+	uint32_t				odmlLength = 4 + 8 + AVI_DMLH_LENGTH;
+	uint32_t				hdrlLength = 4 + (8 + sizeof(AVIMainHeader)) + (8 + strlLength) + (8 + odmlLength);
+
+	fillHeaders(&avih, &strh, this->width, this->height, this->fps, 0, 0, 0);
+
+	memset(&strf, 0, sizeof(AVIBitmapInfo));
+
+	strf.size = sizeof(AVIBitmapInfo);
+	strf.width = this->width;
+	strf.height = this->height;
+	strf.planes = 1;
+	strf.bitCount = 24;
+	memcpy(strf.compression, "MJPG", 4);
+	strf.sizeImage = (uint32_t)(this->width * this->height * 3);
+
+	memset(&indx, 0, sizeof(AVISuperIndexHeader));
+
+	indx.longsPerEntry = sizeof(AVISuperIndexEntry) / 4;
+	indx.indexType = AVI_INDEX_OF_INDEXES;
+	memcpy(indx.chunkId, "00dc", 4);
+
+	p = putFourCC(p, "RIFF");
+	p = put32(p, 0);
+	p = putFourCC(p, "AVI ");
+
+	p = putFourCC(p, "LIST");
+	p = put32(p, hdrlLength);
+	p = putFourCC(p, "hdrl");
+
+	this->avihOffset = (p - this->buffer) + 8;
+	p = putChunk(p, "avih", &avih, sizeof(AVIMainHeader));
+
+	p = putFourCC(p, "LIST");
+	p = put32(p, strlLength);
+	p = putFourCC(p, "strl");
+
+	this->strhOffset = (p - this->buffer) + 8;
+	p = putChunk(p, "strh", &strh, sizeof(AVIStreamHeader));
+	p = putChunk(p, "strf", &strf, sizeof(AVIBitmapInfo));
+
+	this->indxOffset = (p - this->buffer) + 8;
+	p = putFourCC(p, "indx");
+	p = put32(p, indxLength);
+	memcpy(p, &indx, sizeof(AVISuperIndexHeader));
+	memset(p + sizeof(AVISuperIndexHeader), 0, indxLength - sizeof(AVISuperIndexHeader));
+	p += indxLength;
+
+	p = putFourCC(p, "LIST");
+	p = put32(p, odmlLength);
+	p = putFourCC(p, "odml");
+
+	this->dmlhOffset = (p - this->buffer) + 8;
+	p = putFourCC(p, "dmlh");
+	p = put32(p, AVI_DMLH_LENGTH);
+	memset(p, 0, AVI_DMLH_LENGTH);
+	p += AVI_DMLH_LENGTH;
+
+	this->moviStart = (uint64_t)(p - this->buffer);
+
+	p = putFourCC(p, "LIST");
+	p = put32(p, 0);
+	p = putFourCC(p, "movi");
+
+	writeFully(this->buffer, (size_t)(p - this->buffer));
+}
+
+void AVIWriter::openRiff()
+{
+	uint8_t			header[24];
+	uint8_t *		p = header;
+
+	if (this->riffCount == AVI_SUPER_INDEX_ENTRIES) {
+		throw bctl_error(bctl_error::buildMsg("AVI is full, %u RIFFs", this->riffCount), __FILE__, __LINE__);
+	}
+
+	this->riffStart = this->position;
+	this->moviStart = this->position + 12;
+
+	p = putFourCC(p, "RIFF");
+	p = put32(p, 0);
+	p = putFourCC(p, "AVIX");
+	p = putFourCC(p, "LIST");
+	p = put32(p, 0);
+	p = putFourCC(p, "movi");
+
+	writeFully(header, sizeof(header));
+}
+
+/*
+** Ends the movi list with this RIFF's index, adds the AVI 1.0
+** index after the first, and fills in the sizes...
+*/
+void AVIWriter::closeRiff()
+{
+	AVIStdIndexHeader		ix;
+	uint8_t					header[9];
+	uint8_t *				p = header;
+	uint32_t				ixLength = sizeof(AVIStdIndexHeader) + this->riffFrames * sizeof(AVIStdIndexEntry);
+	uint32_t				length;
+	uint64_t				ixPosition;
+
+	if (this->isPadPending) {
+		*p++ = 0;
+		this->isPadPending = false;
+	}
+
+	ixPosition = this->position + (uint64_t)(p - header);
+
+	p = putFourCC(p, "ix00");
+	p = put32(p, ixLength);
+
+	memset(&ix, 0, sizeof(AVIStdIndexHeader));
+
+	ix.longsPerEntry = sizeof(AVIStdIndexEntry) / 4;
+	ix.indexType = AVI_INDEX_OF_CHUNKS;
+	ix.entriesInUse = this->riffFrames;
+	memcpy(ix.chunkId, "00dc", 4);
+	ix.baseOffsetLow = (uint32_t)this->riffStart;
+	ix.baseOffsetHigh = (uint32_t)(this->riffStart >> 32);
+
+	writeFully(header, (size_t)(p - header));
+	writeFully(&ix, sizeof(AVIStdIndexHeader));
+	writeFully(this->stdIndex, this->riffFrames * sizeof(AVIStdIndexEntry));
+
+	length = (uint32_t)(this->position - (this->moviStart + 8));
+	patch((off_t)this->moviStart + 4, &length, 4);
+
+	if (this->riffCount == 0) {
+		p = header;
+		p = putFourCC(p, "idx1");
+		p = put32(p, this->riffFrames * sizeof(AVIOldIndexEntry));
+
+		writeFully(header, 8);
+		writeFully(this->oldIndex, this->riffFrames * sizeof(AVIOldIndexEntry));
+
+		this->firstRiffFrames = this->riffFrames;
+	}
+
+	length = (uint32_t)(this->position - (this->riffStart + 8));
+	patch((off_t)this->riffStart + 4, &length, 4);
+
+	this->superIndex[this->riffCount].offset = ixPosition;
+	this->superIndex[this->riffCount].size = 8 + ixLength;
+	this->superIndex[this->riffCount].duration = this->riffFrames;
+
+	this->riffCount++;
+	this->riffFrames = 0;
+
+	updateHeader();
+}
+
+/*
+** Only counts the frames in closed RIFFs, the ones a player
+** can find through the index...
+*/
+void AVIWriter::updateHeader()
+{
+	AVIMainHeader			avih;
+	AVIStreamHeader			strh;
+
+	fillHeaders(&avih, &strh, this->width, this->height, this->fps, this->firstRiffFrames, this->frameCount, this->maxFrameSize);
+
+	patch(this->avihOffset, &avih, sizeof(AVIMainHeader));
+	patch(this->strhOffset, &strh, sizeof(AVIStreamHeader));
+	patch(this->indxOffset + sizeof(AVISuperIndexHeader), this->superIndex, this->riffCount * sizeof(AVISuperIndexEntry));
+	patch(this->indxOffset + offsetof(AVISuperIndexHeader, entriesInUse), &this->riffCount, 4);
+	patch(this->dmlhOffset, &this->frameCount, 4);
+}
+
+void AVIWriter::create(const char * pszPath, int width, int height, uint32_t fps, AVICopyMode mode)
+{
+	/*
+	** Allocated with the first file, and reused...
+	*/
+	if (this->buffer == NULL) {
+		this->buffer = (uint8_t *)malloc(AVI_COPY_BUFFER_SIZE);
+		this->stdIndex = (AVIStdIndexEntry *)malloc(AVI_MAX_RIFF_FRAMES * sizeof(AVIStdIndexEntry));
+		this->oldIndex = (AVIOldIndexEntry *)malloc(AVI_MAX_RIFF_FRAMES * sizeof(AVIOldIndexEntry));
+
+		if (this->buffer == NULL || this->stdIndex == NULL || this->oldIndex == NULL) {
+			throw bctl_error("Failed to allocate AVI index", __FILE__, __LINE__);
+		}
+
+		if (pipe2(this->pipeFds, O_CLOEXEC) < 0) {
+			throw bctl_error(bctl_error::buildMsg("Failed to create the AVI splice pipe: %s", strerror(errno)), __FILE__, __LINE__);
+		}
+	}
+
+	this->fd = open(pszPath, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+
+	if (this->fd < 0) {
+		throw bctl_error(bctl_error::buildMsg("Failed to create AVI %s: %s", pszPath, strerror(errno)), __FILE__, __LINE__);
+	}
+
+	this->width = width;
+	this->height = height;
+	this->fps = fps;
+	this->copyMode = mode;
+
+	this->position = 0;
+	this->riffStart = 0;
+	this->isPadPending = false;
+	this->riffCount = 0;
+	this->riffFrames = 0;
+	this->firstRiffFrames = 0;
+	this->frameCount = 0;
+	this->maxFrameSize = 0;
+
+	memset(this->superIndex, 0, sizeof(this->superIndex));
+
+	writeHeader();
+}
+
+void AVIWriter::append(int inFd, off_t offset, size_t length)
+{
+	uint8_t			header[9];
+	uint8_t *		p = header;
+	uint64_t		chunkLength = 8 + (uint64_t)length + (length & 1);
+	uint64_t		end;
+
+	if (chunkLength > AVI_MAX_RIFF_SIZE / 2) {
+		throw bctl_error(bctl_error::buildMsg("Frame of %lu bytes is too big for an AVI chunk", (unsigned long)length), __FILE__, __LINE__);
+	}
+
+	/*
+	** Room for the frame and its index entries in this RIFF,
+	** and in the first, the AVI 1.0 index too...
+	*/
+	end = this->position + 1 + chunkLength + 8 + sizeof(AVIStdIndexHeader) + (uint64_t)(this->riffFrames + 1) * sizeof(AVIStdIndexEntry);
+
+	if (this->riffCount == 0) {
+		end += 8 + (uint64_t)(this->riffFrames + 1) * sizeof(AVIOldIndexEntry);
+	}
+
+	if (this->riffFrames > 0 && (end - this->riffStart > AVI_MAX_RIFF_SIZE || this->riffFrames == AVI_MAX_RIFF_FRAMES)) {
+		closeRiff();
+		openRiff();
+	}
+
+	if (this->isPadPending) {
+		*p++ = 0;
+		this->isPadPending = false;
+	}
+
+	p = putFourCC(p, "00dc");
+	p = put32(p, (uint32_t)length);
+
+	writeFully(header, (size_t)(p - header));
+
+	this->stdIndex[this->riffFrames].offset = (uint32_t)(this->position - this->riffStart);
+	this->stdIndex[this->riffFrames].size = (uint32_t)length;
+
+	if (this->riffCount == 0) {
+		memcpy(this->oldIndex[this->riffFrames].chunkId, "00dc", 4);
+		this->oldIndex[this->riffFrames].flags = AVIIF_KEYFRAME;
+		this->oldIndex[this->riffFrames].offset = (uint32_t)(this->position - 8 - (this->moviStart + 8));
+		this->oldIndex[this->riffFrames].size = (uint32_t)length;
+	}
+
+	copyFrame(inFd, offset, length);
+
+	this->isPadPending = ((length & 1) != 0);
+
+	this->riffFrames++;
+	this->frameCount++;
+
+	if (length > this->maxFrameSize) {
+		this->maxFrameSize = (uint32_t)length;
+	}
+}
+
+void AVIWriter::finish()
+{
+	int			fd = this->fd;
+
+	try {
+		closeRiff();
+	}
+	catch (bctl_error & e) {
+		this->fd = -1;
+		::close(fd);
+		throw;
+	}
+
+	this->fd = -1;
+
+	if (::close(fd) < 0) {
+		throw bctl_error(bctl_error::buildMsg("Failed to close AVI: %s", strerror(errno)), __FILE__, __LINE__);
+	}
+}
+
+FrameMuxer::FrameMuxer()
+{
+	char			szDir[PATH_MAX];
+	char			szTemplate[PATH_MAX];
+	uint32_t		filesScanned;
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	pthread_mutex_init(&this->mutex, NULL);
+
+	memset(&this->stats, 0, sizeof(TimelapseStats));
+
+	this->stats.copyMode = avi_copy_file_range;
+	this->fps = (uint32_t)cfg.getValueAsInteger(CFG_TIMELAPSE_FPS);
+
+	/*
+	** Never append to an existing file, start a new one...
+	*/
+	splitOutputPath(cfg.getValue(CFG_TIMELAPSE_TEMPLATE), szDir, szTemplate);
+
+	DirectoryScan scan(szTemplate, 1);
+
+	scan.scan(szDir, &this->stats.fileNumber, &filesScanned);
+}
+
+FrameMuxer::~FrameMuxer()
+{
+	pthread_mutex_destroy(&this->mutex);
+}
+
+/*
+** Must be called with the mutex held...
+*/
+void FrameMuxer::nextFile(int width, int height)
+{
+	char			szTemplate[PATH_MAX];
+	char			szPath[PATH_MAX];
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+	Logger & log = Logger::getInstance();
+
+	if (this->writer.isOpen()) {
+		log.logStatus("Finishing timelapse %u with %u frames", this->stats.fileNumber, this->writer.getFrameCount());
+		this->writer.finish();
+	}
+
+	this->stats.fileNumber++;
+
+	cfg.getValue(CFG_TIMELAPSE_TEMPLATE, szTemplate, PATH_MAX);
+
+	if (!formatOutputTemplate(szTemplate, this->stats.fileNumber, szPath, PATH_MAX)) {
+		throw bctl_error(bctl_error::buildMsg("Invalid timelapse template '%s'", szTemplate), __FILE__, __LINE__);
+	}
+
+	this->writer.create(szPath, width, height, this->fps, this->stats.copyMode);
+
+	this->stats.width = width;
+	this->stats.height = height;
+
+	log.logStatus("Started timelapse %s, %dx%d at %u fps", szPath, width, height, this->fps);
+}
+
+void FrameMuxer::frameAvailable(const CaptureFrame & frame)
+{
+	struct stat		st;
+	uint64_t		startTime;
+	uint64_t		latency;
+	int				width;
+	int				height;
+	int				fd;
+
+	Logger & log = Logger::getInstance();
+
+	fd = open(frame.szPath, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		log.logError("Failed to open frame %s for the timelapse: %s", frame.szPath, strerror(errno));
+
+		if (fd >= 0) {
+			close(fd);
+		}
+
+		pthread_mutex_lock(&this->mutex);
+		this->stats.errorCount++;
+		pthread_mutex_unlock(&this->mutex);
+		return;
+	}
+
+	if (!getJpegDimensions(fd, 0, (size_t)st.st_size, &width, &height)) {
+		close(fd);
+
+		pthread_mutex_lock(&this->mutex);
+		this->stats.skippedCount++;
+		pthread_mutex_unlock(&this->mutex);
+		return;
+	}
+
+	pthread_mutex_lock(&this->mutex);
+
+	if (this->isFinished) {
+		pthread_mutex_unlock(&this->mutex);
+		close(fd);
+		return;
+	}
+
+	startTime = CurrentTime::getStopwatchTime();
+
+	try {
+		/*
+		** Every frame in an AVI has the size in its header...
+		*/
+		if (!this->writer.isOpen() || width != this->writer.getWidth() || height != this->writer.getHeight()) {
+			nextFile(width, height);
+		}
+
+		this->writer.append(fd, 0, (size_t)st.st_size);
+	}
+	catch (bctl_error & e) {
+		this->stats.errorCount++;
+
+		/*
+		** Whatever was half written, the next frame starts
+		** a new file...
+		*/
+		if (this->writer.isOpen()) {
+			try {
+				this->writer.finish();
+			}
+			catch (bctl_error & e2) {
+			}
+		}
+
+		pthread_mutex_unlock(&this->mutex);
+		close(fd);
+
+		log.logError("Failed to add frame %s to the timelapse: %s", frame.szPath, e.what());
+		return;
+	}
+
+	latency = CurrentTime::getStopwatchTime() - startTime;
+
+	this->stats.fileFrames = this->writer.getFrameCount();
+	this->stats.riffCount = this->writer.getRiffCount();
+	this->stats.fileSize = this->writer.getSize();
+	this->stats.copyMode = this->writer.getCopyMode();
+	this->stats.frameCount++;
+	this->stats.totalBytes += (uint64_t)st.st_size;
+	this->stats.totalLatency += latency;
+
+	if (latency > this->stats.maxLatency) {
+		this->stats.maxLatency = latency;
+	}
+
+	pthread_mutex_unlock(&this->mutex);
+
+	close(fd);
+}
+
+/*
+** Index and close the file at shutdown, frames after this
+** are ignored...
+*/
+void FrameMuxer::finish()
+{
+	pthread_mutex_lock(&this->mutex);
+
+	this->isFinished = true;
+
+	if (this->writer.isOpen()) {
+		try {
+			this->writer.finish();
+
+			Logger::getInstance().logStatus("Finished timelapse %u with %u frames", this->stats.fileNumber, this->stats.fileFrames);
+		}
+		catch (bctl_error & e) {
+			Logger::getInstance().logError("Failed to finish timelapse %u: %s", this->stats.fileNumber, e.what());
+		}
+	}
+
+	pthread_mutex_unlock(&this->mutex);
+}
+
+void FrameMuxer::getStats(TimelapseStats * stats)
+{
+	pthread_mutex_lock(&this->mutex);
+	memcpy(stats, &this->stats, sizeof(TimelapseStats));
+	pthread_mutex_unlock(&this->mutex);
+}
+
+struct TimelapseFrame
+{
+	uint32_t		sequence;
+	int				segment;
+	off_t			offset;
+	size_t			length;
+};
+
+/*
+** In sequence order, a loose frame before the same frame
+** in a segment...
+*/
+static bool compareFrames(const TimelapseFrame & a, const TimelapseFrame & b)
+{
+	if (a.sequence != b.sequence) {
+		return (a.sequence < b.sequence);
+	}
+
+	return (a.segment < b.segment);
+}
+
+static void findSegmentFrames(vector<TimelapseFrame> & frames, vector<int> & segmentFds)
+{
+	ContainerReader					reader;
+	const ContainerIndexEntry *		entry;
+	TimelapseFrame					f;
+	struct dirent *					d;
+	char							szDir[PATH_MAX];
+	char							szTemplate[PATH_MAX];
+	char							szPath[PATH_MAX];
+	uint32_t						number;
+	int								fd;
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	splitOutputPath(cfg.getValue(CFG_CONTAINER_TEMPLATE), szDir, szTemplate);
+
+	DIR * dir = opendir(szDir);
+
+	if (dir == NULL) {
+		return;
+	}
+
+	while ((d = readdir(dir)) != NULL) {
+		if (!matchOutputTemplate(szTemplate, d->d_name, &number) || snprintf(szPath, PATH_MAX, "%s/%s", szDir, d->d_name) >= PATH_MAX) {
+			continue;
+		}
+
+		try {
+			reader.open(szPath);
+		}
+		catch (bctl_error & e) {
+			fprintf(stderr, "Skipping segment %s: %s\n", szPath, e.what());
+			continue;
+		}
+
+		fd = open(szPath, O_RDONLY | O_CLOEXEC);
+
+		if (fd >= 0) {
+			segmentFds.push_back(fd);
+
+			for (uint32_t i = 0;i < reader.getFrameCount();i++) {
+				entry = reader.getEntry(i);
+
+				f.sequence = entry->sequence;
+				f.segment = (int)segmentFds.size() - 1;
+				f.offset = (off_t)(entry->offset + sizeof(ContainerRecord));
+				f.length = entry->length;
+
+				frames.push_back(f);
+			}
+		}
+
+		reader.close();
+	}
+
+	closedir(dir);
+}
+
+/*
+** bctl -timelapse <file>, every frame there is, loose or packed
+** in a segment, into one AVI in sequence order. Frames with a
+** different size from the first are left out...
+*/
+int muxTimelapse(const char * pszOutput)
+{
+	vector<TimelapseFrame>		frames;
+	vector<int>					segmentFds;
+	TimelapseFrame				f;
+	AVIWriter					writer;
+	struct dirent *				d;
+	struct stat					st;
+	char						szDir[PATH_MAX];
+	char						szTemplate[PATH_MAX];
+	char						szPath[PATH_MAX];
+	uint64_t					startTime;
+	uint64_t					elapsed;
+	uint64_t					bytes = 0;
+	uint32_t					numLoose = 0;
+	uint32_t					numSkipped = 0;
+	uint32_t					fps;
+	size_t						i;
+	int							width;
+	int							height;
+	int							fd;
+	int							rtn = 0;
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	fps = (uint32_t)cfg.getValueAsInteger(CFG_TIMELAPSE_FPS);
+
+	splitOutputPath(cfg.getValue(CFG_CAPTURE_OUTPUTTEMPLATE), szDir, szTemplate);
+
+	DIR * dir = opendir(szDir);
+
+	if (dir == NULL) {
+		fprintf(stderr, "Failed to open %s: %s\n", szDir, strerror(errno));
+		return -1;
+	}
+
+	while ((d = readdir(dir)) != NULL) {
+		if (matchOutputTemplate(szTemplate, d->d_name, &f.sequence)) {
+			f.segment = -1;
+			f.offset = 0;
+			f.length = 0;
+
+			frames.push_back(f);
+			numLoose++;
+		}
+	}
+
+	closedir(dir);
+
+	findSegmentFrames(frames, segmentFds);
+
+	sort(frames.begin(), frames.end(), compareFrames);
+
+	printf(
+		"Muxing %lu frame(s), %u loose and %lu from %lu segment(s), into %s at %u fps\n",
+		(unsigned long)frames.size(),
+		numLoose,
+		(unsigned long)(frames.size() - numLoose),
+		(unsigned long)segmentFds.size(),
+		pszOutput,
+		fps);
+
+	startTime = CurrentTime::getStopwatchTime();
+
+	try {
+		for (i = 0;i < frames.size();i++) {
+			if (i > 0 && frames[i].sequence == frames[i - 1].sequence) {
+				continue;
+			}
+
+			if (frames[i].segment < 0) {
+				formatOutputTemplate(cfg.getValue(CFG_CAPTURE_OUTPUTTEMPLATE), frames[i].sequence, szPath, PATH_MAX);
+
+				fd = open(szPath, O_RDONLY | O_CLOEXEC);
+
+				if (fd < 0 || fstat(fd, &st) < 0) {
+					fprintf(stderr, "Skipping frame %u, failed to open %s: %s\n", frames[i].sequence, szPath, strerror(errno));
+
+					if (fd >= 0) {
+						close(fd);
+					}
+
+					numSkipped++;
+					continue;
+				}
+
+				frames[i].length = (size_t)st.st_size;
+			}
+			else {
+				fd = segmentFds[frames[i].segment];
+			}
+
+			if (!getJpegDimensions(fd, frames[i].offset, frames[i].length, &width, &height)) {
+				fprintf(stderr, "Skipping frame %u, not a JPEG\n", frames[i].sequence);
+				numSkipped++;
+			}
+			else if (writer.isOpen() && (width != writer.getWidth() || height != writer.getHeight())) {
+				fprintf(stderr, "Skipping frame %u, %dx%d not %dx%d\n", frames[i].sequence, width, height, writer.getWidth(), writer.getHeight());
+				numSkipped++;
+			}
+			else {
+				if (!writer.isOpen()) {
+					writer.create(pszOutput, width, height, fps, avi_copy_file_range);
+				}
+
+				writer.append(fd, frames[i].offset, frames[i].length);
+
+				bytes += frames[i].length;
+			}
+
+			if (frames[i].segment < 0) {
+				close(fd);
+			}
+		}
+
+		if (writer.isOpen()) {
+			uint32_t frameCount = writer.getFrameCount();
+			uint32_t riffCount = writer.getRiffCount();
+			uint64_t size = writer.getSize();
+			AVICopyMode mode = writer.getCopyMode();
+
+			writer.finish();
+
+			elapsed = CurrentTime::getStopwatchTime() - startTime;
+
+			printf(
+				"Wrote %u frame(s), %dx%d, %.1f MB in %u RIFF(s) with %s in %.2fs, %.1f frames/s, %.1f MB/s\n",
+				frameCount,
+				writer.getWidth(),
+				writer.getHeight(),
+				(double)size / (1024.0 * 1024.0),
+				riffCount,
+				getAVICopyModeName(mode),
+				(double)elapsed / 1000000.0,
+				(elapsed > 0 ? ((double)frameCount * 1000000.0) / (double)elapsed : 0.0),
+				(elapsed > 0 ? (double)bytes / (double)elapsed : 0.0));
+		}
+		else {
+			fprintf(stderr, "No frames to mux\n");
+			rtn = -1;
+		}
+	}
+	catch (bctl_error & e) {
+		fprintf(stderr, "%s\n", e.what());
+		rtn = -1;
+	}
+
+	if (numSkipped > 0) {
+		printf("Skipped %u frame(s)\n", numSkipped);
+	}
+
+	for (i = 0;i < segmentFds.size();i++) {
+		close(segmentFds[i]);
+	}
+
+	return rtn;
+}
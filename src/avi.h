@@ -0,0 +1,289 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "capturebackend.h"
+
+#ifndef _INCL_AVI
+#define _INCL_AVI
+
+/*
+** An OpenDML (AVI 2.0) file of MJPEG frames, written in one
+** pass with the JPEGs copied in as they are:
+**
+**   RIFF 'AVI '
+**     LIST 'hdrl'    avih, LIST 'strl' (strh, strf, indx), LIST 'odml' (dmlh)
+**     LIST 'movi'    '00dc' frame chunks, then the 'ix00' index
+**     idx1           the AVI 1.0 index, for old players
+**   RIFF 'AVIX'      as many as needed, each up to AVI_MAX_RIFF_SIZE
+**     LIST 'movi'    '00dc' frame chunks, then the 'ix00' index
+**
+** Each RIFF's index is built in memory as its frames go in and
+** written when it is closed, along with its entry in the super
+** index (indx) and the frame counts in the header, so all but
+** the last RIFF are indexed should the writer never finish. All
+** fields are little endian...
+*/
+#define AVI_MAX_RIFF_SIZE                   (1024ULL * 1024ULL * 1024ULL)
+#define AVI_MAX_RIFF_FRAMES                 32768
+#define AVI_SUPER_INDEX_ENTRIES             256
+
+#define AVI_COPY_BUFFER_SIZE                (64 * 1024)
+
+#define AVIF_HASINDEX                       0x00000010U
+#define AVIIF_KEYFRAME                      0x00000010U
+
+#define AVI_INDEX_OF_INDEXES                0x00
+#define AVI_INDEX_OF_CHUNKS                 0x01
+
+#define AVI_DMLH_LENGTH                     248
+
+struct AVIMainHeader
+{
+    uint32_t            microSecPerFrame;
+    uint32_t            maxBytesPerSec;
+    uint32_t            paddingGranularity;
+    uint32_t            flags;
+    uint32_t            totalFrames;
+    uint32_t            initialFrames;
+    uint32_t            streams;
+    uint32_t            suggestedBufferSize;
+    uint32_t            width;
+    uint32_t            height;
+    uint32_t            reserved[4];
+};
+
+struct AVIStreamHeader
+{
+    char                fccType[4];
+    char                fccHandler[4];
+    uint32_t            flags;
+    uint16_t            priority;
+    uint16_t            language;
+    uint32_t            initialFrames;
+    uint32_t            scale;
+    uint32_t            rate;
+    uint32_t            start;
+    uint32_t            length;
+    uint32_t            suggestedBufferSize;
+    uint32_t            quality;
+    uint32_t            sampleSize;
+    int16_t             frameLeft;
+    int16_t             frameTop;
+    int16_t             frameRight;
+    int16_t             frameBottom;
+};
+
+struct AVIBitmapInfo
+{
+    uint32_t            size;
+    int32_t             width;
+    int32_t             height;
+    uint16_t            planes;
+    uint16_t            bitCount;
+    char                compression[4];
+    uint32_t            sizeImage;
+    int32_t             xPelsPerMeter;
+    int32_t             yPelsPerMeter;
+    uint32_t            clrUsed;
+    uint32_t            clrImportant;
+};
+
+struct AVISuperIndexHeader
+{
+    uint16_t            longsPerEntry;
+    uint8_t             indexSubType;
+    uint8_t             indexType;
+    uint32_t            entriesInUse;
+    char                chunkId[4];
+    uint32_t            reserved[3];
+};
+
+struct AVISuperIndexEntry
+{
+    uint64_t            offset;
+    uint32_t            size;
+    uint32_t            duration;
+};
+
+/*
+** baseOffset is split so the header packs to 24 bytes...
+*/
+struct AVIStdIndexHeader
+{
+    uint16_t            longsPerEntry;
+    uint8_t             indexSubType;
+    uint8_t             indexType;
+    uint32_t            entriesInUse;
+    char                chunkId[4];
+    uint32_t            baseOffsetLow;
+    uint32_t            baseOffsetHigh;
+    uint32_t            reserved;
+};
+
+struct AVIStdIndexEntry
+{
+    uint32_t            offset;
+    uint32_t            size;
+};
+
+struct AVIOldIndexEntry
+{
+    char                chunkId[4];
+    uint32_t            flags;
+    uint32_t            offset;
+    uint32_t            size;
+};
+
+static_assert(sizeof(AVIMainHeader) == 56, "AVIMainHeader layout changed");
+static_assert(sizeof(AVIStreamHeader) == 56, "AVIStreamHeader layout changed");
+static_assert(sizeof(AVIBitmapInfo) == 40, "AVIBitmapInfo layout changed");
+static_assert(sizeof(AVISuperIndexHeader) == 24, "AVISuperIndexHeader layout changed");
+static_assert(sizeof(AVISuperIndexEntry) == 16, "AVISuperIndexEntry layout changed");
+static_assert(sizeof(AVIStdIndexHeader) == 24, "AVIStdIndexHeader layout changed");
+static_assert(sizeof(AVIStdIndexEntry) == 8, "AVIStdIndexEntry layout changed");
+static_assert(sizeof(AVIOldIndexEntry) == 16, "AVIOldIndexEntry layout changed");
+
+/*
+** How frames get from their file into the AVI. copy_file_range()
+** first, within the kernel and maybe without copying at all, then
+** splice() through a pipe, then plain read() and write()...
+*/
+enum AVICopyMode {
+    avi_copy_file_range,
+    avi_splice,
+    avi_read_write
+};
+
+class AVIWriter
+{
+private:
+    int                 fd = -1;
+    int                 pipeFds[2] = {-1, -1};
+    AVICopyMode         copyMode = avi_copy_file_range;
+
+    uint8_t *           buffer = NULL;
+    AVIStdIndexEntry *  stdIndex = NULL;
+    AVIOldIndexEntry *  oldIndex = NULL;
+
+    int                 width = 0;
+    int                 height = 0;
+    uint32_t            fps = 0;
+
+    /*
+    ** Where the header fields that are filled in later are...
+    */
+    off_t               avihOffset = 0;
+    off_t               strhOffset = 0;
+    off_t               indxOffset = 0;
+    off_t               dmlhOffset = 0;
+
+    uint64_t            position = 0;
+    uint64_t            riffStart = 0;
+    uint64_t            moviStart = 0;
+    bool                isPadPending = false;
+
+    AVISuperIndexEntry  superIndex[AVI_SUPER_INDEX_ENTRIES];
+    uint32_t            riffCount = 0;
+    uint32_t            riffFrames = 0;
+    uint32_t            firstRiffFrames = 0;
+    uint32_t            frameCount = 0;
+    uint32_t            maxFrameSize = 0;
+
+    void                writeFully(const void * data, size_t length);
+    void                patch(off_t offset, const void * data, size_t length);
+    void                copyFrame(int inFd, off_t offset, size_t length);
+    void                writeHeader();
+    void                openRiff();
+    void                closeRiff();
+    void                updateHeader();
+
+public:
+    AVIWriter() {}
+    ~AVIWriter();
+
+    void                create(const char * pszPath, int width, int height, uint32_t fps, AVICopyMode mode);
+    void                append(int inFd, off_t offset, size_t length);
+    void                finish();
+
+    bool                isOpen() {
+        return (this->fd >= 0);
+    }
+
+    int                 getWidth() {
+        return this->width;
+    }
+
+    int                 getHeight() {
+        return this->height;
+    }
+
+    uint32_t            getFrameCount() {
+        return this->frameCount;
+    }
+
+    uint32_t            getRiffCount() {
+        return this->riffCount + (this->fd >= 0 ? 1 : 0);
+    }
+
+    uint64_t            getSize() {
+        return this->position;
+    }
+
+    AVICopyMode         getCopyMode() {
+        return this->copyMode;
+    }
+};
+
+struct TimelapseStats
+{
+    uint32_t            fileNumber;
+    int                 width;
+    int                 height;
+    uint32_t            fileFrames;
+    uint32_t            riffCount;
+    uint64_t            fileSize;
+    uint32_t            frameCount;
+    uint32_t            skippedCount;
+    uint32_t            errorCount;
+    uint64_t            totalBytes;
+    uint64_t            totalLatency;
+    uint64_t            maxLatency;
+    AVICopyMode         copyMode;
+};
+
+/*
+** The timelapse stage, appends each completed frame to an AVI
+** as it's captured, starting a new file numbered from
+** timelapse.template on each run or when the resolution
+** changes...
+*/
+class FrameMuxer : public FrameListener
+{
+private:
+    pthread_mutex_t     mutex;
+    AVIWriter           writer;
+    TimelapseStats      stats;
+    uint32_t            fps;
+    bool                isFinished = false;
+
+    void                nextFile(int width, int height);
+
+public:
+    FrameMuxer();
+    ~FrameMuxer();
+
+    void                frameAvailable(const CaptureFrame & frame);
+
+    void                finish();
+
+    void                getStats(TimelapseStats * stats);
+};
+
+const char *    getAVICopyModeName(AVICopyMode mode);
+bool            getJpegDimensions(int fd, off_t offset, size_t length, int * width, int * height);
+int             muxTimelapse(const char * pszOutput);
+
+#endif
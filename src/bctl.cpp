@@ -1,20 +1,29 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <signal.h>
 #include <syslog.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <string.h>
 #include <sys/stat.h>
 
+#include <atomic>
+
 #include "threads.h"
 #include "logger.h"
+#include "currenttime.h"
 #include "configmgr.h"
 #include "posixthread.h"
 #include "bctl_error.h"
+#include "trace.h"
 #include "bctl.h"
 
 void capturePhoto(pid_t pid)
 {
+	TRACE_SPAN("capturePhoto");
+
 	/*
 	** Send SIGUSR1 to the capture program to signal it
 	** to capture a photo...
@@ -24,6 +33,273 @@ void capturePhoto(pid_t pid)
 	}
 }
 
+class LogLevelListener : public ConfigListener
+{
+public:
+	void configChanged(ConfigKey key, const char * value) {
+		Logger::getInstance().setLogLevel(value);
+	}
+};
+
+static LogLevelListener		logLevelListener;
+
+class TraceListener : public ConfigListener
+{
+public:
+	void configChanged(ConfigKey key, const char * value) {
+		ConfigManager & cfg = ConfigManager::getInstance();
+
+		if (key == CFG_TRACE_BUFFERSIZE) {
+			Tracer::getInstance().setBufferLength((uint32_t)cfg.getValueAsInteger(key));
+		}
+		else if (key == CFG_TRACE_ENABLE) {
+			Tracer::getInstance().enable(cfg.getValueAsBoolean(key));
+		}
+	}
+};
+
+static TraceListener		traceListener;
+
+void registerConfigListeners()
+{
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	cfg.subscribe(CFG_LOG_LEVEL, &logLevelListener);
+	cfg.subscribe(CFG_TRACE_BUFFERSIZE, &traceListener);
+	cfg.subscribe(CFG_TRACE_ENABLE, &traceListener);
+
+	/*
+	** The buffer size first, before any thread
+	** can start tracing...
+	*/
+	traceListener.configChanged(CFG_TRACE_BUFFERSIZE, cfg.getValue(CFG_TRACE_BUFFERSIZE));
+	traceListener.configChanged(CFG_TRACE_ENABLE, cfg.getValue(CFG_TRACE_ENABLE));
+}
+
+/*
+** Write the recorded trace, to trace.file if no path is
+** given...
+*/
+bool saveTrace(const char * pszPath)
+{
+	TraceStats		ts;
+	char			szPath[PATH_MAX];
+
+	Logger & log = Logger::getInstance();
+
+	if (pszPath == NULL) {
+		pszPath = ConfigManager::getInstance().getValue(CFG_TRACE_FILE, szPath, PATH_MAX);
+	}
+
+	if (Tracer::getInstance().writeJSON(pszPath) < 0) {
+		log.logError("Failed to write trace to %s: %s", pszPath, strerror(errno));
+		return false;
+	}
+
+	Tracer::getInstance().getStats(&ts);
+
+	log.logStatus(
+			"Wrote trace of %d thread(s) to %s, %lu event(s) recorded, %lu overwritten",
+			ts.numThreads,
+			pszPath,
+			(unsigned long)ts.eventCount,
+			(unsigned long)ts.overwrittenCount);
+
+	return true;
+}
+
+/*
+** Save whatever has been traced as bctl exits. It takes the
+** logger's and stdio's locks, so never from a signal
+** handler...
+*/
+void saveTraceOnExit()
+{
+	TraceStats		ts;
+
+	Tracer::getInstance().getStats(&ts);
+
+	if (ts.eventCount > 0) {
+		saveTrace(NULL);
+	}
+}
+
+/*
+** Reload the config file, subscribers are notified of the keys
+** that have changed. Called from the event thread...
+*/
+bool reloadConfig()
+{
+	ConfigCacheStats	before;
+	ConfigCacheStats	after;
+	uint64_t			startTime;
+	int					numChanged;
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+	Logger & log = Logger::getInstance();
+
+	cfg.getFileCacheStats(&before);
+
+	startTime = CurrentTime::getStopwatchTime();
+
+	try {
+		numChanged = cfg.readConfig();
+	}
+	catch (bctl_error & e) {
+		log.logError("Failed to reload config: %s", e.what());
+		return false;
+	}
+
+	uint64_t elapsed = CurrentTime::getStopwatchTime() - startTime;
+
+	cfg.getFileCacheStats(&after);
+
+	log.logStatus(
+			"Reloaded config in %luus, %d key(s) changed, %u of %u <file> value(s) re-read",
+			(unsigned long)elapsed,
+			numChanged,
+			after.misses - before.misses,
+			(after.hits - before.hits) + (after.misses - before.misses));
+
+	return true;
+}
+
+/*
+** Fork and exec the capture program, numbering frames from
+** frameStart. The child reports its PID over the named pipe
+** to the CaptureThread. Returns the child PID, or -1 if the
+** fork failed...
+*/
+pid_t spawnCaptureProgram(uint32_t frameStart)
+{
+	pid_t			pid;
+	int				pipeFd;
+	char			szPipeName[PATH_MAX];
+	char			szProgName[PATH_MAX];
+	char			szOutputTemplate[PATH_MAX];
+	char			szEncoding[16];
+	char			szQuality[16];
+	char			szISO[16];
+	char			szFrameStart[16];
+	char			szWidth[16];
+	char			szHeight[16];
+	int				width;
+	int				height;
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	/*
+	** The capture thread restarts the program, so this may
+	** run alongside a reload...
+	*/
+	const char * pipename = cfg.getValue(CFG_CAPTURE_PIPENAME, szPipeName, PATH_MAX);
+
+	snprintf(szFrameStart, sizeof(szFrameStart), "%u", frameStart);
+
+	getCaptureResolution(&width, &height);
+
+	snprintf(szWidth, sizeof(szWidth), "%d", width);
+	snprintf(szHeight, sizeof(szHeight), "%d", height);
+
+	const char * args[] = {
+		cfg.getValue(CFG_CAPTURE_PROGNAME, szProgName, PATH_MAX),
+		"-n",
+		"-s",
+		"-e",
+		cfg.getValue(CFG_CAPTURE_ENCODING, szEncoding, sizeof(szEncoding)),
+		"-q",
+		cfg.getValue(CFG_CAPTURE_JPGQUALITY, szQuality, sizeof(szQuality)),
+		"-fs",
+		szFrameStart,
+		"-w",
+		szWidth,
+		"-h",
+		szHeight,
+		"-ISO",
+		cfg.getValue(CFG_CAPTURE_ISO, szISO, sizeof(szISO)),
+		"-o",
+		cfg.getValue(CFG_CAPTURE_OUTPUTTEMPLATE, szOutputTemplate, PATH_MAX),
+		(char *)NULL
+	};
+
+	pid = fork();
+
+	if (pid == 0) {
+		/*
+		** Child process...
+		*/
+		pid = getpid();
+
+		/*
+		** We inherit the daemon's SIGUSR1 handler until exec, so
+		** reset it, otherwise the readiness probe would see it as
+		** caught before the capture program is up...
+		*/
+		sigset_t mask;
+
+		signal(SIGUSR1, SIG_DFL);
+
+		/*
+		** And the shutdown handlers, which would wake the
+		** daemon's timer wheel through the eventfd we share
+		** with it...
+		*/
+		signal(SIGINT, SIG_DFL);
+		signal(SIGTERM, SIG_DFL);
+		sigemptyset(&mask);
+		sigaddset(&mask, SIGUSR1);
+		sigprocmask(SIG_UNBLOCK, &mask, NULL);
+
+		pipeFd = open(pipename, O_WRONLY);
+
+		if (pipeFd < 0) {
+			fprintf(stderr, "Failed to open named pipe %s", pipename);
+			exit(-1);
+		}
+
+		write(pipeFd, &pid, sizeof(pid_t));
+
+		fprintf(stdout, "Child process forked with pid %d\n", pid);
+
+		fprintf(stdout, "Running process: "); 
+
+		for (int i = 0;i < 17;i++) {
+			fprintf(stdout, "%s ", args[i]);
+		}
+
+		/*
+		** Execute the capture program...
+		*/
+		int rtn = execlp(
+			args[0], 
+			args[0], 
+			args[1], 
+			args[2], 
+			args[3], 
+			args[4], 
+			args[5], 
+			args[6], 
+			args[7], 
+			args[8], 
+			args[9], 
+			args[10], 
+			args[11], 
+			args[12], 
+			args[13], 
+			args[14], 
+			args[15], 
+			args[16], 
+			args[17]); 
+
+		if (rtn) {
+			fprintf(stderr, "Failed to execute capture process: [%s]\n", strerror(errno));
+			exit(-1);
+		}
+	}
+
+	return pid;
+}
+
 void daemonise()
 {
 	pid_t			pid;
@@ -72,31 +348,56 @@ void daemonise()
 //	close(STDERR_FILENO);
 }
 
+/*
+** Millidegrees, or INT32_MIN to read the real sensor...
+*/
+static atomic<int32_t>      simulatedCPUTemp(INT32_MIN);
+
+void setSimulatedCPUTemp(float cpuTemp)
+{
+    simulatedCPUTemp.store((int32_t)(cpuTemp * 1000.0), memory_order_relaxed);
+}
+
 float getCPUTemp()
 {
     float       cpuTemp = -299.0;
-#ifdef __arm__
-    FILE *      fptr;
-    char        szTemp[8];
-    int         i = 0;
+    int32_t     simulated = simulatedCPUTemp.load(memory_order_relaxed);
+
+    if (simulated != INT32_MIN) {
+        return (float)simulated / 1000.0;
+    }
+#if defined(__arm__) || defined(__aarch64__)
+    char        szTemp[16];
+    char        szPath[PATH_MAX];
+    ssize_t     bytesRead;
+    int         fd;
 
     ConfigManager & cfg = ConfigManager::getInstance();
     Logger & log = Logger::getInstance();
 
-    fptr = fopen(cfg.getValue("wctl.cputempfile"), "rt");
+    /*
+    ** Read with plain read() into the stack, this is called for
+    ** every frame and a FILE would come off the heap...
+    */
+    cfg.getValue(CFG_BCTL_CPUTEMPFILE, szPath, PATH_MAX);
+
+    fd = open(szPath, O_RDONLY | O_CLOEXEC);
 
-    if (fptr == NULL) {
-        log.logError("Could not open cpu temperature file %s", cfg.getValue("wctl.cputempfile"));
+    if (fd < 0) {
+        log.logError("Could not open cpu temperature file %s", szPath);
         return 0.0;
     }
 
-    while (!feof(fptr)) {
-        szTemp[i++] = (char)fgetc(fptr);
+    bytesRead = read(fd, szTemp, sizeof(szTemp) - 1);
+
+    close(fd);
+
+    if (bytesRead <= 0) {
+        log.logError("Could not read cpu temperature file %s", szPath);
+        return 0.0;
     }
-    
-    szTemp[i] = 0;
 
-    fclose(fptr);
+    szTemp[bytesRead] = 0;
 
     cpuTemp = atof(szTemp) / 1000.0;
 
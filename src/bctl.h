@@ -1,10 +1,17 @@
+#include <stdint.h>
 #include <unistd.h>
 
 #ifndef _INCL_BCTL
 #define _INCL_BCTL
 
 void    capturePhoto(pid_t pid);
+pid_t   spawnCaptureProgram(uint32_t frameStart);
 void    daemonise();
 float   getCPUTemp();
+void    setSimulatedCPUTemp(float cpuTemp);
+bool    reloadConfig();
+void    registerConfigListeners();
+bool    saveTrace(const char * pszPath);
+void    saveTraceOnExit();
 
 #endif
\ No newline at end of file
@@ -9,46 +9,45 @@ using namespace std;
 #ifndef _WCTL_ERROR
 #define _WCTL_ERROR
 
+/*
+** Messages are held in the exception itself and built in a
+** fixed buffer, so nothing here allocates but the exception...
+*/
+#define BCTL_ERROR_MAX_LENGTH           512
+
 class bctl_error : public exception
 {
     private:
-        string      message;
+        char        message[BCTL_ERROR_MAX_LENGTH];
 
     public:
         bctl_error() {
-            this->message.assign("BCTL error");
+            strcpy(this->message, "BCTL error");
         }
 
         bctl_error(const char * msg) {
-            this->message.assign("BCTL error: ");
-            this->message.append(msg);
+            snprintf(this->message, BCTL_ERROR_MAX_LENGTH, "BCTL error: %s", msg);
         }
 
         bctl_error(const char * msg, const char * file, int line) {
-            char lineNumBuf[8];
-
-            sprintf(lineNumBuf, ":%d", line);
-
-            this->message.assign("BCTL error: ");
-            this->message.append(msg);
-            this->message.append(" at ");
-            this->message.append(file);
-            this->message.append(lineNumBuf);
+            snprintf(this->message, BCTL_ERROR_MAX_LENGTH, "BCTL error: %s at %s:%d", msg, file, line);
         }
 
         virtual const char * what() const noexcept {
-            return this->message.c_str();
+            return this->message;
         }
 
+        /*
+        ** The message is only good until the next call on the
+        ** same thread, so pass it straight to the constructor...
+        */
         static const char * buildMsg(const char * fmt, ...) {
-            va_list     args;
-            char *      buffer;
+            static thread_local char    buffer[BCTL_ERROR_MAX_LENGTH];
+            va_list                     args;
 
             va_start(args, fmt);
             
-            buffer = (char *)malloc(strlen(fmt) + 80);
-            
-            vsprintf(buffer, fmt, args);
+            vsnprintf(buffer, BCTL_ERROR_MAX_LENGTH, fmt, args);
             
             va_end(args);
 
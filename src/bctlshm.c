@@ -0,0 +1,205 @@
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bctlshm.h"
+
+#define MAX_WORDS(a, b)         ((a) > (b) ? (a) : (b))
+#define BLOCK_WORDS             MAX_WORDS(BCTL_SHM_WORDS(struct bctl_shm_frame), BCTL_SHM_WORDS(struct bctl_shm_telemetry))
+
+/*
+** A version of 2n means n writes are complete, odd means one
+** is under way...
+*/
+static void write_block(uint32_t * version, uint32_t * words, const void * block, size_t length)
+{
+    uint32_t        buffer[BLOCK_WORDS];
+    uint32_t        s;
+    size_t          i;
+
+    buffer[(length + 3) / 4 - 1] = 0;
+    memcpy(buffer, block, length);
+
+    /*
+    ** Still odd if bctl died mid write, the block is
+    ** just written again...
+    */
+    s = __atomic_load_n(version, __ATOMIC_RELAXED) | 1;
+
+    __atomic_store_n(version, s, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for (i = 0;i < (length + 3) / 4;i++) {
+        __atomic_store_n(&words[i], buffer[i], __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(version, s + 1, __ATOMIC_RELEASE);
+}
+
+static int64_t read_block(const uint32_t * version, const uint32_t * words, void * block, size_t length)
+{
+    uint32_t        buffer[BLOCK_WORDS];
+    uint32_t        s1;
+    uint32_t        s2;
+    size_t          i;
+    int             tries;
+
+    for (tries = 0;tries < BCTL_SHM_MAX_RETRIES;tries++) {
+        s1 = __atomic_load_n(version, __ATOMIC_ACQUIRE);
+
+        if (s1 & 1) {
+            continue;
+        }
+
+        for (i = 0;i < (length + 3) / 4;i++) {
+            buffer[i] = __atomic_load_n(&words[i], __ATOMIC_RELAXED);
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        s2 = __atomic_load_n(version, __ATOMIC_RELAXED);
+
+        if (s1 == s2) {
+            memcpy(block, buffer, length);
+            return (int64_t)(s1 / 2);
+        }
+    }
+
+    errno = EAGAIN;
+
+    return -1;
+}
+
+int bctl_shm_open(const char * name, bctl_shm_reader * reader)
+{
+    const struct bctl_shm_segment * segment;
+    struct stat     st;
+    void *          p;
+    int             fd;
+
+    fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    /*
+    ** bctl may be creating it right now...
+    */
+    if ((size_t)st.st_size < sizeof(struct bctl_shm_segment)) {
+        close(fd);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    p = mmap(NULL, sizeof(struct bctl_shm_segment), PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+
+    segment = (const struct bctl_shm_segment *)p;
+
+    if (__atomic_load_n(&segment->header.magic, __ATOMIC_ACQUIRE) != BCTL_SHM_MAGIC) {
+        munmap(p, sizeof(struct bctl_shm_segment));
+        errno = EAGAIN;
+        return -1;
+    }
+
+    if (segment->header.version != BCTL_SHM_VERSION || segment->header.size != sizeof(struct bctl_shm_segment)) {
+        munmap(p, sizeof(struct bctl_shm_segment));
+        errno = EPROTO;
+        return -1;
+    }
+
+    reader->segment = segment;
+    reader->length = sizeof(struct bctl_shm_segment);
+
+    return 0;
+}
+
+void bctl_shm_close(bctl_shm_reader * reader)
+{
+    if (reader->segment != NULL) {
+        munmap((void *)reader->segment, reader->length);
+        reader->segment = NULL;
+    }
+}
+
+int64_t bctl_shm_read_frame(const bctl_shm_reader * reader, struct bctl_shm_frame * frame)
+{
+    return read_block(&reader->segment->frameVersion, reader->segment->frameWords, frame, sizeof(struct bctl_shm_frame));
+}
+
+int64_t bctl_shm_read_telemetry(const bctl_shm_reader * reader, struct bctl_shm_telemetry * telemetry)
+{
+    return read_block(&reader->segment->telemetryVersion, reader->segment->telemetryWords, telemetry, sizeof(struct bctl_shm_telemetry));
+}
+
+/*
+** Creates the segment, or takes over the one a previous run
+** left behind, keeping the last frame and telemetry it had...
+*/
+struct bctl_shm_segment * bctl_shm_create(const char * name, uint32_t pid, uint64_t startTime)
+{
+    struct bctl_shm_segment *   segment;
+    void *          p;
+    int             fd;
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (ftruncate(fd, sizeof(struct bctl_shm_segment)) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    p = mmap(NULL, sizeof(struct bctl_shm_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+
+    segment = (struct bctl_shm_segment *)p;
+
+    if (segment->header.version != BCTL_SHM_VERSION || segment->header.size != sizeof(struct bctl_shm_segment)) {
+        __atomic_store_n(&segment->header.magic, 0, __ATOMIC_RELEASE);
+
+        memset(&segment->frameVersion, 0, sizeof(struct bctl_shm_segment) - offsetof(struct bctl_shm_segment, frameVersion));
+    }
+
+    segment->header.version = BCTL_SHM_VERSION;
+    segment->header.size = sizeof(struct bctl_shm_segment);
+    segment->header.pid = pid;
+    segment->header.startTime = startTime;
+
+    __atomic_store_n(&segment->header.magic, BCTL_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    return segment;
+}
+
+void bctl_shm_write_frame(struct bctl_shm_segment * segment, const struct bctl_shm_frame * frame)
+{
+    write_block(&segment->frameVersion, segment->frameWords, frame, sizeof(struct bctl_shm_frame));
+}
+
+void bctl_shm_write_telemetry(struct bctl_shm_segment * segment, const struct bctl_shm_telemetry * telemetry)
+{
+    write_block(&segment->telemetryVersion, segment->telemetryWords, telemetry, sizeof(struct bctl_shm_telemetry));
+}
@@ -0,0 +1,145 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef _INCL_BCTLSHM
+#define _INCL_BCTLSHM
+
+/*
+** The layout of the POSIX shared memory segment bctl publishes
+** the latest frame and its telemetry in, and a small reader
+** library for other processes on the payload. Plain C, so it can
+** be copied into a radio or display program as is.
+**
+** Each block is guarded by its own sequence number, odd while
+** bctl is writing it. A reader copies the block and retries if
+** the sequence moved, so it never takes a lock, never makes a
+** system call and never holds bctl up...
+*/
+#define BCTL_SHM_MAGIC                      0x4C544342U
+#define BCTL_SHM_VERSION                    1
+#define BCTL_SHM_DEFAULT_NAME               "/bctl"
+
+#define BCTL_SHM_PATH_MAX                   256
+
+/*
+** A reader gives up with EAGAIN after this many tries, which only
+** happens if bctl died in the middle of a write...
+*/
+#define BCTL_SHM_MAX_RETRIES                100000
+
+#define BCTL_SHM_FRAME_HAS_CRC              0x0001
+#define BCTL_SHM_FRAME_PATH_TRUNCATED       0x0002
+#define BCTL_SHM_FRAME_HAS_SIMILARITY       0x0004
+#define BCTL_SHM_FRAME_SIMILAR              0x0008
+
+#define BCTL_SHM_TELEMETRY_HAS_FIX          0x0001
+#define BCTL_SHM_TELEMETRY_HAS_TEMP         0x0002
+#define BCTL_SHM_TELEMETRY_HAS_PHASE        0x0004
+
+/*
+** Times are microseconds, monotonic ones on bctl's clock. The
+** similarity is the frame's score against the last frame kept,
+** in 1/100 grey levels...
+*/
+struct bctl_shm_frame
+{
+    uint32_t            sequence;
+    uint32_t            flags;
+    uint64_t            triggerTime;
+    uint64_t            completedTime;
+    uint64_t            publishedTime;
+    uint64_t            wallTime;
+    uint64_t            size;
+    uint32_t            crc32c;
+    uint32_t            similarity;
+    char                path[BCTL_SHM_PATH_MAX];
+};
+
+/*
+** Position as in the GPS fix, 1e-7 degrees and mm above mean sea
+** level, speed in mm/s and course in 1/100 degrees. The vertical
+** rate is mm/s, the CPU temperature in 1/1000 degrees C and the
+** phase a FlightPhase...
+*/
+struct bctl_shm_telemetry
+{
+    uint64_t            updateTime;
+    uint64_t            wallTime;
+    uint64_t            fixTime;
+    int32_t             latitude;
+    int32_t             longitude;
+    int32_t             altitude;
+    uint32_t            speed;
+    uint16_t            course;
+    uint8_t             quality;
+    uint8_t             satellites;
+    uint32_t            flags;
+    int32_t             cpuTemp;
+    uint32_t            phase;
+    int32_t             verticalRate;
+    int32_t             maxAltitude;
+    uint32_t            captureCount;
+    uint32_t            frameCount;
+    uint32_t            lastSequence;
+};
+
+/*
+** The blocks are held as 32 bit words, so both sides can copy
+** them a word at a time with atomic loads and stores, which are
+** plain loads and stores on anything bctl runs on...
+*/
+#define BCTL_SHM_WORDS(type)                ((sizeof(type) + 3) / 4)
+
+struct bctl_shm_header
+{
+    uint32_t            magic;
+    uint32_t            version;
+    uint32_t            size;
+    uint32_t            pid;
+    uint64_t            startTime;
+    uint8_t             reserved[40];
+};
+
+struct bctl_shm_segment
+{
+    struct bctl_shm_header  header;
+
+    uint32_t            frameVersion;
+    uint32_t            frameWords[BCTL_SHM_WORDS(struct bctl_shm_frame)];
+
+    /*
+    ** Telemetry on a cache line of its own...
+    */
+    uint8_t             pad[64 - ((4 + 4 * BCTL_SHM_WORDS(struct bctl_shm_frame)) % 64)];
+
+    uint32_t            telemetryVersion;
+    uint32_t            telemetryWords[BCTL_SHM_WORDS(struct bctl_shm_telemetry)];
+};
+
+typedef struct
+{
+    const struct bctl_shm_segment * segment;
+    size_t              length;
+}
+bctl_shm_reader;
+
+/*
+** Reader side. The read functions return the block's version, a
+** count of how many times bctl has written it, 0 if it never has,
+** or -1 with errno set to EAGAIN...
+*/
+int         bctl_shm_open(const char * name, bctl_shm_reader * reader);
+void        bctl_shm_close(bctl_shm_reader * reader);
+
+int64_t     bctl_shm_read_frame(const bctl_shm_reader * reader, struct bctl_shm_frame * frame);
+int64_t     bctl_shm_read_telemetry(const bctl_shm_reader * reader, struct bctl_shm_telemetry * telemetry);
+
+/*
+** Writer side, for bctl. Only ever one writer per block...
+*/
+struct bctl_shm_segment *   bctl_shm_create(const char * name, uint32_t pid, uint64_t startTime);
+
+void        bctl_shm_write_frame(struct bctl_shm_segment * segment, const struct bctl_shm_frame * frame);
+void        bctl_shm_write_telemetry(struct bctl_shm_segment * segment, const struct bctl_shm_telemetry * telemetry);
+
+#endif
@@ -0,0 +1,1506 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "configmgr.h"
+#include "bctl_error.h"
+#include "currenttime.h"
+#include "capturebackend.h"
+#include "resume.h"
+#include "crc32c.h"
+#include "container.h"
+#include "avi.h"
+#include "similarity.h"
+#include "reedsolomon.h"
+#include "ssdv.h"
+#include "downlink.h"
+#include "gps.h"
+#include "exif.h"
+#include "trace.h"
+#include "clock.h"
+#include "timerwheel.h"
+#include "benchmark.h"
+
+using namespace std;
+
+typedef int (* BenchmarkFunction)();
+
+struct Benchmark
+{
+	const char *		pszName;
+	const char *		pszDescription;
+	BenchmarkFunction	function;
+};
+
+static void reportRate(const char * pszLabel, uint64_t iterations, uint64_t elapsed)
+{
+	printf(
+		"  %-36s %10.1f ns/op %12.0f ops/s\n",
+		pszLabel,
+		(elapsed * 1000.0) / (double)iterations,
+		(elapsed > 0 ? ((double)iterations * 1000000.0) / (double)elapsed : 0.0));
+}
+
+static void reportThroughput(const char * pszLabel, uint64_t iterations, uint64_t bytes, uint64_t elapsed)
+{
+	printf(
+		"  %-36s %10.1f frames/s %10.1f MB/s\n",
+		pszLabel,
+		(elapsed > 0 ? ((double)iterations * 1000000.0) / (double)elapsed : 0.0),
+		(elapsed > 0 ? (double)bytes / (double)elapsed : 0.0));
+}
+
+static void reportPacketRate(const char * pszLabel, uint64_t packets, uint64_t elapsed)
+{
+	printf(
+		"  %-36s %10.0f packets/s %8.1f MB/s\n",
+		pszLabel,
+		(elapsed > 0 ? ((double)packets * 1000000.0) / (double)elapsed : 0.0),
+		(elapsed > 0 ? ((double)packets * SSDV_PACKET_LENGTH) / (double)elapsed : 0.0));
+}
+
+/*
+** Compare the old map<string, string> lookup by name against
+** the compile-time key ID lookup...
+*/
+static int benchConfigLookup()
+{
+	map<string, string>		values;
+	const uint64_t			iterations = 2000000ULL;
+	uint64_t				startTime;
+	uint64_t				checksum = 0;
+	uint64_t				i;
+
+	const char * names[] = {
+		"capture.frequency",
+		"capture.hres",
+		"log.level",
+		"bctl.cputempfile"
+	};
+
+	const ConfigKey keys[] = {
+		CFG_CAPTURE_FREQUENCY,
+		CFG_CAPTURE_HRES,
+		CFG_LOG_LEVEL,
+		CFG_BCTL_CPUTEMPFILE
+	};
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	for (i = 0;i < 4;i++) {
+		values[names[i]] = cfg.getValue(keys[i]);
+	}
+
+	printf("Config lookup, %lu iterations:\n", (unsigned long)iterations);
+
+	startTime = CurrentTime::getMonotonicTime();
+
+	for (i = 0;i < iterations;i++) {
+		checksum += values[names[i & 3]].length();
+	}
+
+	reportRate("map<string, string> by name", iterations, CurrentTime::getMonotonicTime() - startTime);
+
+	startTime = CurrentTime::getMonotonicTime();
+
+	for (i = 0;i < iterations;i++) {
+		checksum += atoi(values[names[i & 1]].c_str());
+	}
+
+	reportRate("map<string, string> + atoi()", iterations, CurrentTime::getMonotonicTime() - startTime);
+
+	startTime = CurrentTime::getMonotonicTime();
+
+	for (i = 0;i < iterations;i++) {
+		checksum += (uintptr_t)cfg.getValue(keys[i & 3]);
+	}
+
+	reportRate("getValue(ConfigKey)", iterations, CurrentTime::getMonotonicTime() - startTime);
+
+	startTime = CurrentTime::getMonotonicTime();
+
+	for (i = 0;i < iterations;i++) {
+		checksum += cfg.getValueAsInteger(keys[i & 1]);
+	}
+
+	reportRate("getValueAsInteger(ConfigKey)", iterations, CurrentTime::getMonotonicTime() - startTime);
+
+	startTime = CurrentTime::getMonotonicTime();
+
+	for (i = 0;i < iterations;i++) {
+		checksum += ConfigManager::lookupKey(names[i & 3]);
+	}
+
+	reportRate("lookupKey(name) at load time", iterations, CurrentTime::getMonotonicTime() - startTime);
+
+	printf("  (checksum %lu)\n", (unsigned long)checksum);
+
+	return 0;
+}
+
+/*
+** How fast the synthetic backend can produce frames at the
+** configured resolution and frame size, encoding alone and
+** encoding plus writing each frame to a file...
+*/
+static int benchSynthetic()
+{
+	char			szPath[] = "/tmp/bctl_synthetic_XXXXXX";
+	const uint64_t	iterations = 500ULL;
+	uint64_t		startTime;
+	uint64_t		bytes = 0;
+	uint64_t		i;
+	size_t			length;
+	int				fd;
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	int width = cfg.getValueAsInteger(CFG_CAPTURE_HRES);
+	int height = cfg.getValueAsInteger(CFG_CAPTURE_VRES);
+	int quality = cfg.getValueAsInteger(CFG_CAPTURE_JPGQUALITY);
+	size_t frameSize = (size_t)cfg.getValueAsInteger(CFG_SYNTHETIC_FRAMESIZE);
+
+	size_t bufferLength = getSyntheticJpegMaxLength(width, height, frameSize);
+	uint8_t * buffer = (uint8_t *)malloc(bufferLength);
+
+	if (buffer == NULL) {
+		fprintf(stderr, "Failed to allocate %lu bytes\n", (unsigned long)bufferLength);
+		return -1;
+	}
+
+	fd = mkstemp(szPath);
+
+	if (fd < 0) {
+		fprintf(stderr, "Failed to create %s\n", szPath);
+		free(buffer);
+		return -1;
+	}
+
+	printf("Synthetic capture %dx%d, %lu iterations:\n", width, height, (unsigned long)iterations);
+
+	startTime = CurrentTime::getMonotonicTime();
+
+	for (i = 0;i < iterations;i++) {
+		bytes += synthesiseJpeg(buffer, bufferLength, width, height, quality, (uint32_t)i, frameSize);
+	}
+
+	reportThroughput("synthesiseJpeg()", iterations, bytes, CurrentTime::getMonotonicTime() - startTime);
+
+	printf("  (%lu bytes/frame)\n", (unsigned long)(bytes / iterations));
+
+	bytes = 0;
+	startTime = CurrentTime::getMonotonicTime();
+
+	for (i = 0;i < iterations;i++) {
+		length = synthesiseJpeg(buffer, bufferLength, width, height, quality, (uint32_t)i, frameSize);
+
+		if (pwrite(fd, buffer, length, 0) != (ssize_t)length || ftruncate(fd, (off_t)length) < 0) {
+			fprintf(stderr, "Failed to write %s\n", szPath);
+			break;
+		}
+
+		bytes += length;
+	}
+
+	reportThroughput("synthesiseJpeg() + write", iterations, bytes, CurrentTime::getMonotonicTime() - startTime);
+
+	close(fd);
+	unlink(szPath);
+	free(buffer);
+
+	return 0;
+}
+
+/*
+** Time to find where to resume frame numbering in a directory of
+** 100k frames, readdir() against the getdents64() scan with
+** increasing numbers of threads and against the checkpoint...
+*/
+static int benchResume()
+{
+	char			szDir[] = "/tmp/bctl_resume_XXXXXX";
+	char			szTemplate[PATH_MAX];
+	char			szName[PATH_MAX];
+	char			szPath[PATH_MAX];
+	const uint32_t	numFiles = 100000;
+	const int		numRuns = 5;
+	struct dirent *	entry;
+	uint64_t		startTime;
+	uint64_t		elapsed;
+	uint32_t		lastSequence = 0;
+	uint32_t		filesScanned = 0;
+	uint32_t		sequence;
+	uint32_t		i;
+	int				threads;
+	int				run;
+	int				fd;
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	splitOutputPath(cfg.getValue(CFG_CAPTURE_OUTPUTTEMPLATE), szPath, szName);
+
+	if (mkdtemp(szDir) == NULL) {
+		fprintf(stderr, "Failed to create %s\n", szDir);
+		return -1;
+	}
+
+	if (snprintf(szTemplate, PATH_MAX, "%s/%s", szDir, szName) >= PATH_MAX) {
+		fprintf(stderr, "Output template too long\n");
+		rmdir(szDir);
+		return -1;
+	}
+
+	printf("Resume scan of %u files in %s:\n", numFiles, szDir);
+
+	for (i = 1;i <= numFiles;i++) {
+		formatOutputTemplate(szTemplate, i, szPath, PATH_MAX);
+
+		fd = open(szPath, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+
+	startTime = CurrentTime::getMonotonicTime();
+
+	for (run = 0;run < numRuns;run++) {
+		DIR * dir = opendir(szDir);
+
+		lastSequence = 0;
+		filesScanned = 0;
+
+		while ((entry = readdir(dir)) != NULL) {
+			filesScanned++;
+
+			if (matchOutputTemplate(szName, entry->d_name, &sequence) && sequence > lastSequence) {
+				lastSequence = sequence;
+			}
+		}
+
+		closedir(dir);
+	}
+
+	elapsed = (CurrentTime::getMonotonicTime() - startTime) / numRuns;
+
+	printf("  %-36s %10.2f ms (last frame %u of %u entries)\n", "readdir()", (double)elapsed / 1000.0, lastSequence, filesScanned);
+
+	for (threads = 1;threads <= 8;threads *= 2) {
+		char		szLabel[64];
+
+		DirectoryScan scan(szName, threads);
+
+		startTime = CurrentTime::getMonotonicTime();
+
+		for (run = 0;run < numRuns;run++) {
+			scan.scan(szDir, &lastSequence, &filesScanned);
+		}
+
+		elapsed = (CurrentTime::getMonotonicTime() - startTime) / numRuns;
+
+		snprintf(szLabel, sizeof(szLabel), "getdents64() scan, %d thread(s)", threads);
+
+		printf("  %-36s %10.2f ms (last frame %u of %u entries)\n", szLabel, (double)elapsed / 1000.0, lastSequence, filesScanned);
+	}
+
+	/*
+	** The checkpoint, validated as at startup...
+	*/
+	snprintf(szPath, PATH_MAX, "%s/checkpoint", szDir);
+
+	fd = open(szPath, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+
+	if (fd >= 0) {
+		char	szRecord[16];
+		int		length = snprintf(szRecord, sizeof(szRecord), "%010u\n", numFiles);
+
+		write(fd, szRecord, length);
+		close(fd);
+	}
+
+	startTime = CurrentTime::getMonotonicTime();
+
+	for (run = 0;run < numRuns;run++) {
+		resumeFromCheckpoint(szPath, szTemplate, &lastSequence);
+	}
+
+	elapsed = (CurrentTime::getMonotonicTime() - startTime) / numRuns;
+
+	printf("  %-36s %10.2f ms (last frame %u)\n", "checkpoint", (double)elapsed / 1000.0, lastSequence);
+
+	unlink(szPath);
+
+	for (i = 1;i <= numFiles;i++) {
+		formatOutputTemplate(szTemplate, i, szPath, PATH_MAX);
+		unlink(szPath);
+	}
+
+	rmdir(szDir);
+
+	return 0;
+}
+
+static void reportLatency(const char * pszLabel, vector<uint64_t> & latencies, uint64_t bytes, uint64_t elapsed)
+{
+	sort(latencies.begin(), latencies.end());
+
+	printf(
+		"  %-28s %8.1f MB/s  avg %6.1fus  p99 %7.1fus  max %7.1fus\n",
+		pszLabel,
+		(elapsed > 0 ? (double)bytes / (double)elapsed : 0.0),
+		(double)elapsed / (double)latencies.size(),
+		(double)latencies[(latencies.size() * 99) / 100],
+		(double)latencies.back());
+}
+
+/*
+** Writing synthetic frames as loose files against appending them
+** to a segment, then random access reads back out of the segment...
+*/
+static int benchContainer()
+{
+	char				szDir[] = "/tmp/bctl_container_XXXXXX";
+	char				szPath[PATH_MAX];
+	char				szSegment[PATH_MAX];
+	const uint32_t		numFrames = 1000;
+	vector<uint64_t>	latencies;
+	uint64_t			startTime;
+	uint64_t			frameStart;
+	uint64_t			bytes = 0;
+	uint32_t			numBad = 0;
+	uint32_t			i;
+	size_t				length;
+	int					fd;
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	int width = cfg.getValueAsInteger(CFG_CAPTURE_HRES);
+	int height = cfg.getValueAsInteger(CFG_CAPTURE_VRES);
+	int quality = cfg.getValueAsInteger(CFG_CAPTURE_JPGQUALITY);
+	size_t frameSize = (size_t)cfg.getValueAsInteger(CFG_SYNTHETIC_FRAMESIZE);
+
+	size_t bufferLength = getSyntheticJpegMaxLength(width, height, frameSize);
+	uint8_t * buffer = (uint8_t *)malloc(bufferLength);
+
+	if (buffer == NULL || mkdtemp(szDir) == NULL) {
+		fprintf(stderr, "Failed to set up container benchmark\n");
+		free(buffer);
+		return -1;
+	}
+
+	length = synthesiseJpeg(buffer, bufferLength, width, height, quality, 1, frameSize);
+
+	printf("Container, %u frames of %lu bytes in %s:\n", numFrames, (unsigned long)length, szDir);
+
+	latencies.reserve(numFrames);
+
+	startTime = CurrentTime::getMonotonicTime();
+
+	for (i = 1;i <= numFrames;i++) {
+		frameStart = CurrentTime::getMonotonicTime();
+
+		snprintf(szPath, PATH_MAX, "%s/img_%05u.jpg", szDir, i);
+
+		fd = open(szPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+		if (fd < 0 || write(fd, buffer, length) != (ssize_t)length) {
+			fprintf(stderr, "Failed to write %s\n", szPath);
+			break;
+		}
+
+		close(fd);
+
+		bytes += length;
+		latencies.push_back(CurrentTime::getMonotonicTime() - frameStart);
+	}
+
+	reportLatency("loose files", latencies, bytes, CurrentTime::getMonotonicTime() - startTime);
+
+	for (i = 1;i <= numFrames;i++) {
+		snprintf(szPath, PATH_MAX, "%s/img_%05u.jpg", szDir, i);
+		unlink(szPath);
+	}
+
+	snprintf(szSegment, PATH_MAX, "%s/seg_0001.bcs", szDir);
+
+	uint64_t segmentSize = CONTAINER_ALIGN((uint64_t)numFrames * (length + 64) + (1024ULL * 1024ULL), 1024ULL * 1024ULL);
+
+	try {
+		ContainerWriter writer;
+
+		writer.create(szSegment, 1, segmentSize, numFrames);
+
+		latencies.clear();
+		bytes = 0;
+
+		startTime = CurrentTime::getMonotonicTime();
+
+		for (i = 1;i <= numFrames;i++) {
+			frameStart = CurrentTime::getMonotonicTime();
+
+			writer.append(i, frameStart, buffer, length, crc32c(0, buffer, length));
+
+			bytes += length;
+			latencies.push_back(CurrentTime::getMonotonicTime() - frameStart);
+		}
+
+		reportLatency("segment append + CRC", latencies, bytes, CurrentTime::getMonotonicTime() - startTime);
+
+		writer.seal();
+
+		ContainerReader reader;
+
+		reader.open(szSegment);
+
+		latencies.clear();
+		bytes = 0;
+
+		startTime = CurrentTime::getMonotonicTime();
+
+		for (i = 0;i < numFrames;i++) {
+			frameStart = CurrentTime::getMonotonicTime();
+
+			const ContainerIndexEntry * entry = reader.findFrame(1 + ((i * 7919U) % numFrames));
+
+			if (entry == NULL || !reader.verifyFrame(entry)) {
+				numBad++;
+			}
+			else {
+				bytes += entry->length;
+			}
+
+			latencies.push_back(CurrentTime::getMonotonicTime() - frameStart);
+		}
+
+		reportLatency("random read + verify", latencies, bytes, CurrentTime::getMonotonicTime() - startTime);
+
+		if (numBad > 0) {
+			printf("  %u frame(s) failed to verify\n", numBad);
+		}
+	}
+	catch (bctl_error & e) {
+		fprintf(stderr, "%s\n", e.what());
+	}
+
+	unlink(szSegment);
+	rmdir(szDir);
+	free(buffer);
+
+	return (numBad > 0 ? 1 : 0);
+}
+
+/*
+** Muxing tens of thousands of loose frames into an AVI, with each
+** way of copying them in...
+*/
+static int benchTimelapse()
+{
+	char				szDir[] = "/tmp/bctl_timelapse_XXXXXX";
+	char				szPath[PATH_MAX];
+	char				szAVI[PATH_MAX];
+	const uint32_t		numFrames = 20000;
+	uint64_t			startTime;
+	uint64_t			bytes;
+	uint32_t			i;
+	size_t				length;
+	int					fd;
+	int					rtn = 0;
+
+	const AVICopyMode modes[] = {
+		avi_copy_file_range,
+		avi_splice,
+		avi_read_write
+	};
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	int width = cfg.getValueAsInteger(CFG_CAPTURE_HRES);
+	int height = cfg.getValueAsInteger(CFG_CAPTURE_VRES);
+	int quality = cfg.getValueAsInteger(CFG_CAPTURE_JPGQUALITY);
+	size_t frameSize = (size_t)cfg.getValueAsInteger(CFG_SYNTHETIC_FRAMESIZE);
+
+	size_t bufferLength = getSyntheticJpegMaxLength(width, height, frameSize);
+	uint8_t * buffer = (uint8_t *)malloc(bufferLength);
+
+	if (buffer == NULL || mkdtemp(szDir) == NULL) {
+		fprintf(stderr, "Failed to set up timelapse benchmark\n");
+		free(buffer);
+		return -1;
+	}
+
+	length = synthesiseJpeg(buffer, bufferLength, width, height, quality, 1, frameSize);
+
+	printf("Timelapse, %u frames of %lu bytes in %s:\n", numFrames, (unsigned long)length, szDir);
+
+	for (i = 1;i <= numFrames;i++) {
+		snprintf(szPath, PATH_MAX, "%s/img_%05u.jpg", szDir, i);
+
+		fd = open(szPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+		if (fd < 0 || write(fd, buffer, length) != (ssize_t)length) {
+			fprintf(stderr, "Failed to write %s\n", szPath);
+			rtn = -1;
+			break;
+		}
+
+		close(fd);
+	}
+
+	snprintf(szAVI, PATH_MAX, "%s/timelapse.avi", szDir);
+
+	for (int m = 0;m < 3 && rtn == 0;m++) {
+		try {
+			AVIWriter writer;
+
+			bytes = 0;
+
+			startTime = CurrentTime::getMonotonicTime();
+
+			writer.create(szAVI, width, height, 25, modes[m]);
+
+			for (i = 1;i <= numFrames;i++) {
+				snprintf(szPath, PATH_MAX, "%s/img_%05u.jpg", szDir, i);
+
+				fd = open(szPath, O_RDONLY | O_CLOEXEC);
+
+				if (fd < 0) {
+					throw bctl_error(bctl_error::buildMsg("Failed to open %s", szPath), __FILE__, __LINE__);
+				}
+
+				writer.append(fd, 0, length);
+				close(fd);
+
+				bytes += length;
+			}
+
+			AVICopyMode mode = writer.getCopyMode();
+			uint32_t riffCount = writer.getRiffCount();
+
+			writer.finish();
+
+			char szLabel[64];
+
+			snprintf(szLabel, sizeof(szLabel), "%s, %u RIFF(s)", getAVICopyModeName(mode), riffCount);
+
+			reportThroughput(szLabel, numFrames, bytes, CurrentTime::getMonotonicTime() - startTime);
+		}
+		catch (bctl_error & e) {
+			fprintf(stderr, "%s\n", e.what());
+			rtn = -1;
+		}
+
+		unlink(szAVI);
+	}
+
+	for (i = 1;i <= numFrames;i++) {
+		snprintf(szPath, PATH_MAX, "%s/img_%05u.jpg", szDir, i);
+		unlink(szPath);
+	}
+
+	rmdir(szDir);
+	free(buffer);
+
+	return rtn;
+}
+
+/*
+** Check the thumbnails of frames the synthetic backend repeats
+** match and the SAD implementations agree, then time taking the
+** thumbnail from the DC coefficients, scoring it with each SAD,
+** and the two together...
+*/
+static int benchSimilarity()
+{
+	static JpegDCDecoder	decoder;
+	char				szLabel[64];
+	const int			numFrames = 64;
+	const uint64_t		iterations = 2000ULL;
+	const uint64_t		sadIterations = 100000ULL;
+	uint8_t *			frames[numFrames];
+	size_t				lengths[numFrames];
+	Thumbnail			thumbnails[2];
+	SADFunction			simd = sadGetSIMDFunction();
+	uint64_t			startTime;
+	uint64_t			bytes = 0;
+	uint64_t			sum = 0;
+	uint64_t			i;
+	size_t				numPixels;
+	int					j;
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	int width = cfg.getValueAsInteger(CFG_CAPTURE_HRES);
+	int height = cfg.getValueAsInteger(CFG_CAPTURE_VRES);
+	int quality = cfg.getValueAsInteger(CFG_CAPTURE_JPGQUALITY);
+
+	size_t bufferLength = getSyntheticJpegMaxLength(width, height, 0);
+
+	uint8_t * buffer = (uint8_t *)malloc(bufferLength * numFrames + 2 * THUMBNAIL_MAX_PIXELS);
+
+	if (buffer == NULL) {
+		return -1;
+	}
+
+	for (j = 0;j < numFrames;j++) {
+		frames[j] = &buffer[bufferLength * j];
+		lengths[j] = synthesiseJpeg(frames[j], bufferLength, width, height, quality, (uint32_t)j, 0);
+		bytes += lengths[j];
+	}
+
+	thumbnails[0].pixels = &buffer[bufferLength * numFrames];
+	thumbnails[1].pixels = &buffer[bufferLength * numFrames + THUMBNAIL_MAX_PIXELS];
+
+	/*
+	** The synthetic pattern repeats every 32 frames...
+	*/
+	if (!extractDCThumbnail(&decoder, frames[0], lengths[0], &thumbnails[0]) || !extractDCThumbnail(&decoder, frames[32], lengths[32], &thumbnails[1])) {
+		printf("  Failed to take the thumbnail of a %dx%d frame\n", width, height);
+		free(buffer);
+		return 1;
+	}
+
+	numPixels = (size_t)thumbnails[0].width * (size_t)thumbnails[0].height;
+
+	if (sadScalar(thumbnails[0].pixels, thumbnails[1].pixels, numPixels) != 0) {
+		printf("  Thumbnails of identical frames differ\n");
+		free(buffer);
+		return 1;
+	}
+
+	extractDCThumbnail(&decoder, frames[1], lengths[1], &thumbnails[1]);
+
+	if (simd != NULL && simd(thumbnails[0].pixels, thumbnails[1].pixels, numPixels) != sadScalar(thumbnails[0].pixels, thumbnails[1].pixels, numPixels)) {
+		printf("  %s SAD disagrees with scalar\n", sadImplementation());
+		free(buffer);
+		return 1;
+	}
+
+	for (j = 0;j < numFrames;j++) {
+		extractDCThumbnail(&decoder, frames[j], lengths[j], &thumbnails[0]);
+	}
+
+	printf(
+		"Similarity of %dx%d frames by a %dx%d DC thumbnail, SAD is %s:\n",
+		width,
+		height,
+		thumbnails[0].width,
+		thumbnails[0].height,
+		sadImplementation());
+
+	startTime = CurrentTime::getMonotonicTime();
+
+	for (i = 0;i < iterations;i++) {
+		extractDCThumbnail(&decoder, frames[i % numFrames], lengths[i % numFrames], &thumbnails[0]);
+	}
+
+	reportThroughput("extractDCThumbnail()", iterations, (bytes * iterations) / numFrames, CurrentTime::getMonotonicTime() - startTime);
+
+	startTime = CurrentTime::getMonotonicTime();
+
+	for (i = 0;i < sadIterations;i++) {
+		sum += sadScalar(thumbnails[0].pixels, thumbnails[1].pixels, numPixels);
+	}
+
+	reportRate("SAD scalar", sadIterations, CurrentTime::getMonotonicTime() - startTime);
+
+	if (simd != NULL) {
+		startTime = CurrentTime::getMonotonicTime();
+
+		for (i = 0;i < sadIterations;i++) {
+			sum += simd(thumbnails[0].pixels, thumbnails[1].pixels, numPixels);
+		}
+
+		snprintf(szLabel, sizeof(szLabel), "SAD %s", sadImplementation());
+		reportRate(szLabel, sadIterations, CurrentTime::getMonotonicTime() - startTime);
+	}
+
+	startTime = CurrentTime::getMonotonicTime();
+
+	for (i = 0;i < iterations;i++) {
+		extractDCThumbnail(&decoder, frames[i % numFrames], lengths[i % numFrames], &thumbnails[i & 1]);
+		sum += thumbnailSAD(thumbnails[0].pixels, thumbnails[1].pixels, numPixels);
+	}
+
+	reportThroughput("thumbnail + score", iterations, (bytes * iterations) / numFrames, CurrentTime::getMonotonicTime() - startTime);
+
+	/*
+	** Printing the sum keeps the SAD loops from being
+	** optimised away...
+	*/
+	printf("  (synthetic frames have no AC coefficients to skip, camera frames take longer, sum %llu)\n", (unsigned long long)sum);
+
+	free(buffer);
+
+	return 0;
+}
+
+/*
+** Check each CRC32C implementation against the standard test
+** vector, then compare their throughput...
+*/
+static int benchCRC()
+{
+	struct Implementation {
+		const char *	pszName;
+		uint32_t		(* function)(uint32_t, const void *, size_t);
+	};
+
+	const Implementation implementations[] = {
+		{"bytewise table",		crc32cBytewise},
+		{"slicing-by-8",		crc32cSlicing8},
+		{"hardware",			crc32cHardware}
+	};
+
+	const size_t		length = 8 * 1024 * 1024;
+	const int			iterations = 20;
+	uint64_t			startTime;
+	uint64_t			elapsed;
+	uint32_t			crc = 0;
+	int					rtn = 0;
+	int					i;
+	int					j;
+
+	uint8_t * buffer = (uint8_t *)malloc(length);
+
+	if (buffer == NULL) {
+		return -1;
+	}
+
+	for (i = 0;i < (int)length;i++) {
+		buffer[i] = (uint8_t)((i * 2654435761U) >> 24);
+	}
+
+	printf("CRC32C over %lu bytes, selected implementation is %s:\n", (unsigned long)length, crc32cImplementation());
+
+	for (i = 0;i < 3;i++) {
+		if (i == 2 && !crc32cHasHardware()) {
+			printf("  %-36s not supported on this CPU\n", implementations[i].pszName);
+			continue;
+		}
+
+		if (implementations[i].function(0, "123456789", 9) != 0xE3069283U) {
+			printf("  %-36s FAILED the check value\n", implementations[i].pszName);
+			rtn = 1;
+			continue;
+		}
+
+		startTime = CurrentTime::getMonotonicTime();
+
+		for (j = 0;j < iterations;j++) {
+			crc = implementations[i].function(crc, buffer, length);
+		}
+
+		elapsed = CurrentTime::getMonotonicTime() - startTime;
+
+		printf(
+			"  %-36s %10.1f MB/s (crc %08x)\n",
+			implementations[i].pszName,
+			(elapsed > 0 ? ((double)length * iterations) / (double)elapsed : 0.0),
+			implementations[i].function(0, buffer, length));
+	}
+
+	free(buffer);
+
+	return rtn;
+}
+
+/*
+** Check the scalar and SIMD RS encoders agree and produce valid
+** codewords, then time them, the whole packetiser, and sending
+** the packets over UDP on localhost...
+*/
+static int benchSSDV()
+{
+	struct sockaddr_in	addr;
+	socklen_t			addrLength = sizeof(addr);
+	uint8_t				packet[SSDV_PACKET_LENGTH];
+	uint8_t				parity[RS_PARITY_LENGTH];
+	uint8_t				codeword[RS_SYMBOLS];
+	char				szSink[64];
+	char				szLabel[64];
+	const int			iterations = 100000;
+	const int			numFrames = 20;
+	uint64_t			startTime;
+	uint64_t			numPackets;
+	RSEncodeFunction	simd = rsGetSIMDEncoder();
+	SSDVEncoder			encoder;
+	SSDVSink			sink;
+	int					rtn = 0;
+	int					receiver;
+	int					i;
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	int width = cfg.getValueAsInteger(CFG_CAPTURE_HRES);
+	int height = cfg.getValueAsInteger(CFG_CAPTURE_VRES);
+	int quality = cfg.getValueAsInteger(CFG_CAPTURE_JPGQUALITY);
+
+	size_t bufferLength = getSyntheticJpegMaxLength(width, height, 0);
+	uint8_t * buffer = (uint8_t *)malloc(bufferLength);
+
+	if (buffer == NULL) {
+		return -1;
+	}
+
+	size_t length = synthesiseJpeg(buffer, bufferLength, width, height, quality, 1, 0);
+
+	for (i = 0;i < RS_DATA_LENGTH;i++) {
+		codeword[i] = (uint8_t)((i * 2654435761U) >> 24);
+	}
+
+	rsEncodeScalar(codeword, &codeword[RS_DATA_LENGTH]);
+
+	if (!rsCheck(codeword)) {
+		printf("  scalar RS encoder produced an invalid codeword\n");
+		rtn = 1;
+	}
+
+	if (simd != NULL) {
+		simd(codeword, parity);
+
+		if (memcmp(parity, &codeword[RS_DATA_LENGTH], RS_PARITY_LENGTH) != 0) {
+			printf("  %s RS encoder disagrees with scalar\n", rsImplementation());
+			rtn = 1;
+		}
+	}
+
+	codeword[100] ^= 0x01;
+
+	if (rsCheck(codeword)) {
+		printf("  RS check missed a corrupted byte\n");
+		rtn = 1;
+	}
+
+	printf("SSDV packets from a %dx%d frame of %lu bytes, RS(255,223) is %s:\n", width, height, (unsigned long)length, rsImplementation());
+
+	startTime = CurrentTime::getMonotonicTime();
+
+	for (i = 0;i < iterations;i++) {
+		codeword[i % RS_DATA_LENGTH] ^= (uint8_t)i;
+		rsEncodeScalar(codeword, parity);
+	}
+
+	reportPacketRate("RS encode (scalar)", iterations, CurrentTime::getMonotonicTime() - startTime);
+
+	if (simd != NULL) {
+		startTime = CurrentTime::getMonotonicTime();
+
+		for (i = 0;i < iterations;i++) {
+			codeword[i % RS_DATA_LENGTH] ^= (uint8_t)i;
+			simd(codeword, parity);
+		}
+
+		snprintf(szLabel, sizeof(szLabel), "RS encode (%s)", rsImplementation());
+
+		reportPacketRate(szLabel, iterations, CurrentTime::getMonotonicTime() - startTime);
+	}
+
+	encoder.setCallsign("BCTL");
+
+	numPackets = 0;
+	startTime = CurrentTime::getMonotonicTime();
+
+	for (i = 0;i < numFrames;i++) {
+		encoder.begin(buffer, length, (uint8_t)i);
+
+		while (encoder.nextPacket(packet)) {
+			numPackets++;
+		}
+	}
+
+	reportPacketRate("packetise, CRC32 + FEC", numPackets, CurrentTime::getMonotonicTime() - startTime);
+
+	if (!rsCheck(&packet[1]) || ssdvCRC32(&packet[1], SSDV_CRC_OFFSET - 1) != (((uint32_t)packet[220] << 24) | ((uint32_t)packet[221] << 16) | ((uint32_t)packet[222] << 8) | packet[223])) {
+		printf("  last packet failed its CRC or FEC check\n");
+		rtn = 1;
+	}
+
+	/*
+	** Send to our own socket, draining it as we go so
+	** nothing is lost to a full receive buffer...
+	*/
+	receiver = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (receiver < 0 || bind(receiver, (struct sockaddr *)&addr, sizeof(addr)) < 0 || getsockname(receiver, (struct sockaddr *)&addr, &addrLength) < 0) {
+		printf("  failed to create a UDP receiver\n");
+	}
+	else {
+		snprintf(szSink, sizeof(szSink), "udp:127.0.0.1:%u", ntohs(addr.sin_port));
+
+		sink.configure(szSink);
+
+		if (sink.open()) {
+			uint64_t numReceived = 0;
+
+			numPackets = 0;
+			startTime = CurrentTime::getMonotonicTime();
+
+			for (i = 0;i < numFrames;i++) {
+				encoder.begin(buffer, length, (uint8_t)i);
+
+				while (encoder.nextPacket(packet)) {
+					if (sink.send(packet)) {
+						numPackets++;
+					}
+
+					if (recv(receiver, codeword, sizeof(codeword), MSG_DONTWAIT) > 0) {
+						numReceived++;
+					}
+				}
+			}
+
+			while (recv(receiver, codeword, sizeof(codeword), MSG_DONTWAIT) > 0) {
+				numReceived++;
+			}
+
+			reportPacketRate("packetise + UDP localhost", numPackets, CurrentTime::getMonotonicTime() - startTime);
+
+			printf("  (%lu sent, %lu received)\n", (unsigned long)numPackets, (unsigned long)numReceived);
+		}
+	}
+
+	if (receiver >= 0) {
+		close(receiver);
+	}
+
+	free(buffer);
+
+	return rtn;
+}
+
+/*
+** Scheduler queue operations at the largest queue length, kept
+** full so every new frame evicts one...
+*/
+static int benchDownlink()
+{
+	DownlinkScheduler	scheduler;
+	DownlinkCandidate	candidate;
+	DownlinkCandidate	evicted;
+	const uint64_t		iterations = 2000000ULL;
+	uint64_t			startTime;
+	uint64_t			checksum = 0;
+	uint64_t			i;
+
+	memset(&candidate, 0, sizeof(DownlinkCandidate));
+
+	scheduler.configure(DOWNLINK_MAX_QUEUE_LENGTH, 0, 10000000ULL);
+
+	printf("Downlink scheduler, %d frame queue:\n", DOWNLINK_MAX_QUEUE_LENGTH);
+
+	startTime = CurrentTime::getMonotonicTime();
+
+	for (i = 0;i < iterations;i++) {
+		candidate.sequence = (uint32_t)i;
+		candidate.time = i * 1000ULL;
+		candidate.score = (uint32_t)((i * 2654435761U) >> 8);
+		candidate.cost = 25600;
+
+		if (scheduler.addCandidate(candidate, &evicted)) {
+			checksum += evicted.sequence;
+		}
+	}
+
+	reportRate("add (full, evicting)", iterations, CurrentTime::getMonotonicTime() - startTime);
+
+	startTime = CurrentTime::getMonotonicTime();
+
+	for (i = 0;i < iterations;i++) {
+		candidate.sequence = (uint32_t)i;
+		candidate.time = (iterations + i) * 1000ULL;
+		candidate.score = (uint32_t)((i * 2654435761U) >> 8);
+
+		scheduler.addCandidate(candidate, &evicted);
+
+		if (scheduler.nextFrame(candidate.time, &candidate)) {
+			checksum += candidate.sequence;
+		}
+	}
+
+	reportRate("add + next", iterations, CurrentTime::getMonotonicTime() - startTime);
+
+	printf("  (checksum %lu)\n", (unsigned long)checksum);
+
+	return 0;
+}
+
+/*
+** Parse a buffer of typical GGA and RMC sentences, plus one
+** the parser ignores and one with a bad checksum...
+*/
+static int benchNMEA()
+{
+	const char *		sentences[] = {
+		"$GNGGA,123520.00,4807.03900,N,01131.00100,E,2,12,0.7,30125.7,M,46.9,M,,*79",
+		"$GPRMC,123519.00,A,4807.03812,N,01131.00024,E,022.4,084.4,230394,003.1,W*41",
+		"$GPGSV,2,1,08,01,40,083,46,02,17,308,41,12,07,344,39,14,22,228,45*75",
+		"$GPGGA,123519.00,4807.03812,N,01131.00024,E,1,08,0.9,545.4,M,46.9,M,,*6D"
+	};
+
+	const uint64_t		iterations = 4000000ULL;
+	NMEAResult			expected[4];
+	GPSFix				fix;
+	size_t				lengths[4];
+	uint64_t			startTime;
+	uint64_t			bytes = 0;
+	uint64_t			counts[5] = {0, 0, 0, 0, 0};
+	uint64_t			elapsed;
+	uint64_t			i;
+	int					j;
+	int					rtn = 0;
+
+	memset(&fix, 0, sizeof(GPSFix));
+
+	for (j = 0;j < 4;j++) {
+		lengths[j] = strlen(sentences[j]);
+		expected[j] = parseNMEASentence(sentences[j], lengths[j], &fix);
+
+		printf("  %.40s... %s\n", sentences[j],
+			(expected[j] == nmea_gga ? "GGA" : (expected[j] == nmea_rmc ? "RMC" : (expected[j] == nmea_ignored ? "ignored" : (expected[j] == nmea_checksum_error ? "bad checksum" : "format error")))));
+	}
+
+	printf("  last fix %.7f %.7f %.1fm, %u sats\n", (double)fix.latitude / 10000000.0, (double)fix.longitude / 10000000.0, (double)fix.altitude / 1000.0, fix.satellites);
+
+	if (expected[0] != nmea_gga || expected[1] != nmea_rmc || expected[2] != nmea_ignored || expected[3] != nmea_checksum_error || fix.latitude != 481173020 || fix.altitude != 30125700) {
+		printf("  unexpected parse results\n");
+		rtn = 1;
+	}
+
+	startTime = CurrentTime::getMonotonicTime();
+
+	for (i = 0;i < iterations;i++) {
+		j = (int)(i & 3);
+
+		counts[parseNMEASentence(sentences[j], lengths[j], &fix)]++;
+		bytes += lengths[j];
+	}
+
+	elapsed = CurrentTime::getMonotonicTime() - startTime;
+
+	reportRate("parseNMEASentence()", iterations, elapsed);
+
+	printf("  %-36s %10.1f MB/s\n", "", (elapsed > 0 ? (double)bytes / (double)elapsed : 0.0));
+
+	return rtn;
+}
+
+/*
+** Tagging fresh frames, which have to be rewritten, against
+** retagging frames that already have our segment...
+*/
+static int benchExif()
+{
+	char				szDir[] = "/tmp/bctl_exif_XXXXXX";
+	char				szPath[PATH_MAX];
+	const int			iterations = 200;
+	vector<uint64_t>	latencies;
+	ExifTelemetry		telemetry;
+	ExifTagger			tagger;
+	uint64_t			startTime;
+	uint64_t			elapsed;
+	uint64_t			frameStart;
+	uint64_t			bytes = 0;
+	off_t				newSize = 0;
+	int					rtn = 0;
+	int					fd;
+	int					i;
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	int width = cfg.getValueAsInteger(CFG_CAPTURE_HRES);
+	int height = cfg.getValueAsInteger(CFG_CAPTURE_VRES);
+	int quality = cfg.getValueAsInteger(CFG_CAPTURE_JPGQUALITY);
+	size_t frameSize = (size_t)cfg.getValueAsInteger(CFG_SYNTHETIC_FRAMESIZE);
+
+	size_t bufferLength = getSyntheticJpegMaxLength(width, height, frameSize);
+	uint8_t * buffer = (uint8_t *)malloc(bufferLength);
+
+	if (buffer == NULL || mkdtemp(szDir) == NULL) {
+		free(buffer);
+		return -1;
+	}
+
+	snprintf(szPath, PATH_MAX, "%s/frame.jpg", szDir);
+
+	size_t length = synthesiseJpeg(buffer, bufferLength, width, height, quality, 1, frameSize);
+
+	memset(&telemetry, 0, sizeof(ExifTelemetry));
+
+	telemetry.wallTime = 1792411200000000ULL;
+	telemetry.cpuTemp = 47.2f;
+	telemetry.hasFix = true;
+	telemetry.fix.latitude = 521234567;
+	telemetry.fix.longitude = -12345678;
+	telemetry.fix.altitude = 30125700;
+	telemetry.fix.timeOfDay = 43200123;
+	telemetry.fix.date = 191026;
+	telemetry.fix.quality = GPS_FIX_GPS;
+	telemetry.fix.isValid = 1;
+
+	printf("Exif tagging a %dx%d frame of %lu bytes:\n", width, height, (unsigned long)length);
+
+	elapsed = 0;
+
+	for (i = 0;i < iterations;i++) {
+		fd = open(szPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+		if (fd < 0 || write(fd, buffer, length) != (ssize_t)length) {
+			fprintf(stderr, "Failed to write %s\n", szPath);
+			rtn = -1;
+			break;
+		}
+
+		close(fd);
+
+		telemetry.sequence = (uint32_t)i;
+
+		frameStart = CurrentTime::getMonotonicTime();
+
+		if (!tagger.tagFile(szPath, telemetry, &newSize)) {
+			fprintf(stderr, "Failed to tag %s: %s\n", szPath, strerror(errno));
+			rtn = 1;
+			break;
+		}
+
+		latencies.push_back(CurrentTime::getMonotonicTime() - frameStart);
+
+		elapsed += latencies.back();
+		bytes += (uint64_t)newSize;
+	}
+
+	if (!latencies.empty()) {
+		reportLatency("insert (rewrite + splice)", latencies, bytes, elapsed);
+	}
+
+	latencies.clear();
+	bytes = 0;
+
+	startTime = CurrentTime::getMonotonicTime();
+
+	for (i = 0;i < iterations && rtn == 0;i++) {
+		telemetry.sequence = (uint32_t)i;
+
+		frameStart = CurrentTime::getMonotonicTime();
+
+		if (!tagger.tagFile(szPath, telemetry, &newSize)) {
+			fprintf(stderr, "Failed to retag %s: %s\n", szPath, strerror(errno));
+			rtn = 1;
+			break;
+		}
+
+		latencies.push_back(CurrentTime::getMonotonicTime() - frameStart);
+		bytes += (uint64_t)newSize;
+	}
+
+	if (!latencies.empty()) {
+		reportLatency("update in place (mmap)", latencies, bytes, CurrentTime::getMonotonicTime() - startTime);
+	}
+
+	if (newSize != (off_t)(length + EXIF_SEGMENT_LENGTH)) {
+		printf("  tagged frame is %ld bytes, expected %lu\n", (long)newSize, (unsigned long)(length + EXIF_SEGMENT_LENGTH));
+		rtn = 1;
+	}
+
+	unlink(szPath);
+	rmdir(szDir);
+	free(buffer);
+
+	return rtn;
+}
+
+/*
+** What a span costs with tracing off, which is how it runs
+** most of the time, and with it on...
+*/
+static volatile uint64_t	traceWork;
+
+static void __attribute__((noinline)) tracedWork()
+{
+	TRACE_SPAN("bench.span");
+
+	traceWork = traceWork + 1;
+}
+
+static void __attribute__((noinline)) untracedWork()
+{
+	traceWork = traceWork + 1;
+}
+
+static int benchTrace()
+{
+	char			szPath[] = "/tmp/bctl_trace_XXXXXX";
+	const uint64_t	iterations = 20000000ULL;
+	TraceStats		ts;
+	uint64_t		startTime;
+	uint64_t		baseline;
+	uint64_t		elapsed;
+	uint64_t		i;
+	struct stat		st;
+	int				fd;
+	int				rtn = 0;
+
+	Tracer & tracer = Tracer::getInstance();
+
+	traceSetThreadName("benchmark");
+
+	startTime = CurrentTime::getStopwatchTime();
+
+	for (i = 0;i < iterations;i++) {
+		untracedWork();
+	}
+
+	baseline = CurrentTime::getStopwatchTime() - startTime;
+
+	reportRate("no span", iterations, baseline);
+
+	tracer.enable(false);
+
+	startTime = CurrentTime::getStopwatchTime();
+
+	for (i = 0;i < iterations;i++) {
+		tracedWork();
+	}
+
+	elapsed = CurrentTime::getStopwatchTime() - startTime;
+
+	reportRate("span, tracing off", iterations, elapsed);
+
+	tracer.enable(true);
+
+	startTime = CurrentTime::getStopwatchTime();
+
+	for (i = 0;i < iterations;i++) {
+		tracedWork();
+	}
+
+	elapsed = CurrentTime::getStopwatchTime() - startTime;
+
+	reportRate("span, tracing on", iterations, elapsed);
+
+	startTime = CurrentTime::getStopwatchTime();
+
+	for (i = 0;i < iterations;i++) {
+		TRACE_INSTANT("bench.instant");
+	}
+
+	elapsed = CurrentTime::getStopwatchTime() - startTime;
+
+	tracer.enable(false);
+
+	reportRate("instant, tracing on", iterations, elapsed);
+
+	fd = mkstemp(szPath);
+
+	if (fd < 0) {
+		fprintf(stderr, "Failed to create %s: %s\n", szPath, strerror(errno));
+		return -1;
+	}
+
+	close(fd);
+
+	tracer.getStats(&ts);
+
+	startTime = CurrentTime::getStopwatchTime();
+
+	if (tracer.writeJSON(szPath) < 0 || stat(szPath, &st) < 0) {
+		fprintf(stderr, "Failed to write trace to %s: %s\n", szPath, strerror(errno));
+		rtn = -1;
+	}
+	else {
+		elapsed = CurrentTime::getStopwatchTime() - startTime;
+
+		printf(
+			"  %-36s %10.1f ms %10.1f MB, %u event(s) per thread\n",
+			"writeJSON()",
+			(double)elapsed / 1000.0,
+			(double)st.st_size / 1000000.0,
+			ts.bufferLength);
+	}
+
+	unlink(szPath);
+
+	return rtn;
+}
+
+class BenchTimerListener : public TimerListener
+{
+public:
+	atomic<uint64_t>	count;
+
+	BenchTimerListener() : count(0) {}
+
+	void timerExpired(TimerJob * job) {
+		count.fetch_add(1, memory_order_relaxed);
+	}
+};
+
+/*
+** Periodic jobs at random phases on the running wheel, for a
+** second, reporting how often the wheel woke up for them...
+*/
+static void runPeriodicTimers(const char * pszLabel, vector<TimerJob> & jobs, uint64_t period, uint64_t slack)
+{
+	TimerStats		before;
+	TimerStats		after;
+	uint64_t		now;
+	size_t			i;
+
+	TimerWheel & wheel = TimerWheel::getInstance();
+
+	wheel.getStats(&before);
+
+	now = Clock::getInstance().getMonotonicTime();
+
+	for (i = 0;i < jobs.size();i++) {
+		wheel.schedule(&jobs[i], now + (uint64_t)(rand() % (int)period), period, slack);
+	}
+
+	PosixThread::sleep(PosixThread::seconds, 1);
+
+	for (i = 0;i < jobs.size();i++) {
+		wheel.cancel(&jobs[i]);
+	}
+
+	wheel.getStats(&after);
+
+	uint64_t expired = after.expiredCount - before.expiredCount;
+
+	printf(
+		"  %-36s %8lu expired %8lu wake ups, delay avg %luus max %luus\n",
+		pszLabel,
+		(unsigned long)expired,
+		(unsigned long)(after.wakeupCount - before.wakeupCount),
+		(expired > 0 ? (unsigned long)((after.totalDelay - before.totalDelay) / expired) : 0UL),
+		(unsigned long)after.maxDelay);
+}
+
+static int benchTimer()
+{
+	const size_t			numJobs = 100000;
+	const size_t			numPeriodic = 64;
+	BenchTimerListener		listener;
+	uint64_t				startTime;
+	uint64_t				now;
+	size_t					i;
+
+	TimerWheel & wheel = TimerWheel::getInstance();
+
+	vector<TimerJob> jobs(numJobs, TimerJob(&listener));
+	vector<uint64_t> dueTimes(numJobs);
+
+	srand(1);
+
+	/*
+	** Anything up to an hour out, to fill every level...
+	*/
+	now = Clock::getInstance().getMonotonicTime();
+
+	for (i = 0;i < numJobs;i++) {
+		dueTimes[i] = now + 1000000ULL + ((uint64_t)rand() % 3600000000ULL);
+	}
+
+	startTime = CurrentTime::getStopwatchTime();
+
+	for (i = 0;i < numJobs;i++) {
+		wheel.schedule(&jobs[i], dueTimes[i], 0, 0);
+	}
+
+	reportRate("schedule()", numJobs, CurrentTime::getStopwatchTime() - startTime);
+
+	startTime = CurrentTime::getStopwatchTime();
+
+	for (i = 0;i < numJobs;i++) {
+		wheel.schedule(&jobs[i], dueTimes[numJobs - i - 1], 0, 0);
+	}
+
+	reportRate("schedule() again, moving it", numJobs, CurrentTime::getStopwatchTime() - startTime);
+
+	startTime = CurrentTime::getStopwatchTime();
+
+	for (i = 0;i < numJobs;i++) {
+		wheel.cancel(&jobs[i]);
+	}
+
+	reportRate("cancel()", numJobs, CurrentTime::getStopwatchTime() - startTime);
+
+	if (!wheel.start()) {
+		fprintf(stderr, "Failed to start the timer wheel\n");
+		return -1;
+	}
+
+	jobs.resize(numPeriodic);
+
+	runPeriodicTimers("64 x 10ms, no slack", jobs, 10000ULL, 0ULL);
+	runPeriodicTimers("64 x 10ms, 5ms slack", jobs, 10000ULL, 5000ULL);
+
+	return 0;
+}
+
+static const Benchmark benchmarks[] = {
+	{"config",		"Config value lookup by name vs key ID",		benchConfigLookup},
+	{"synthetic",	"Synthetic JPEG frame generation",				benchSynthetic},
+	{"resume",		"Finding the resume frame in 100k files",		benchResume},
+	{"container",	"Loose frame files vs segment container",		benchContainer},
+	{"timelapse",	"Muxing 20k frames into an MJPEG AVI",			benchTimelapse},
+	{"similarity",	"DC thumbnail and SAD frame similarity",		benchSimilarity},
+	{"crc",			"CRC32C implementations",						benchCRC},
+	{"ssdv",		"SSDV packetiser and Reed-Solomon FEC",			benchSSDV},
+	{"downlink",	"Downlink scheduler queue operations",			benchDownlink},
+	{"nmea",		"NMEA sentence parsing",						benchNMEA},
+	{"exif",		"Exif insertion and in place update per frame",	benchExif},
+	{"trace",		"Trace span cost with tracing off and on",		benchTrace},
+	{"timer",		"Timer wheel operations and wake up coalescing",	benchTimer}
+};
+
+#define NUM_BENCHMARKS				(int)(sizeof(benchmarks) / sizeof(Benchmark))
+
+void listBenchmarks()
+{
+	printf("Available benchmarks:\n");
+
+	for (int i = 0;i < NUM_BENCHMARKS;i++) {
+		printf("  %-12s %s\n", benchmarks[i].pszName, benchmarks[i].pszDescription);
+	}
+}
+
+int runBenchmark(const char * pszName)
+{
+	for (int i = 0;i < NUM_BENCHMARKS;i++) {
+		if (strcmp(pszName, benchmarks[i].pszName) == 0 || strcmp(pszName, "all") == 0) {
+			int rtn = benchmarks[i].function();
+
+			if (rtn != 0 || strcmp(pszName, "all") != 0) {
+				return rtn;
+			}
+		}
+	}
+
+	if (strcmp(pszName, "all") == 0) {
+		return 0;
+	}
+
+	fprintf(stderr, "Unknown benchmark '%s'\n", pszName);
+	listBenchmarks();
+
+	return -1;
+}
@@ -0,0 +1,11 @@
+#ifndef _INCL_BENCHMARK
+#define _INCL_BENCHMARK
+
+/*
+** Micro-benchmarks built into the daemon, run with
+** 'bctl -cfg <file> -bench <name>'...
+*/
+int     runBenchmark(const char * pszName);
+void    listBenchmarks();
+
+#endif
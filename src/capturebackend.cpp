@@ -0,0 +1,523 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include <atomic>
+
+#include "configmgr.h"
+#include "logger.h"
+#include "bctl_error.h"
+#include "currenttime.h"
+#include "capturebackend.h"
+#include "startup.h"
+#include "resume.h"
+#include "watchdog.h"
+#include "bctl.h"
+
+/*
+** If the readiness probe can't tell, how long we give the
+** capture program to initialise the camera before the first
+** trigger...
+*/
+#define PROGRAM_READY_TIMEOUT_US            10000000ULL
+
+using namespace std;
+
+/*
+** Width in the top half, height in the bottom, zero for
+** the configured resolution...
+*/
+static atomic<uint32_t>		resolutionOverride(0);
+
+TriggerQueue::TriggerQueue()
+{
+	pthread_mutex_init(&this->mutex, NULL);
+}
+
+TriggerQueue::~TriggerQueue()
+{
+	pthread_mutex_destroy(&this->mutex);
+}
+
+void TriggerQueue::push(uint64_t triggerTime)
+{
+	pthread_mutex_lock(&this->mutex);
+
+	/*
+	** If frames stop arriving, drop the oldest trigger
+	** rather than grow...
+	*/
+	if (this->count == CAPTURE_MAX_PENDING_TRIGGERS) {
+		this->head = (this->head + 1) % CAPTURE_MAX_PENDING_TRIGGERS;
+		this->count--;
+	}
+
+	this->triggerTimes[(this->head + this->count) % CAPTURE_MAX_PENDING_TRIGGERS] = triggerTime;
+	this->count++;
+
+	pthread_mutex_unlock(&this->mutex);
+}
+
+uint64_t TriggerQueue::pop()
+{
+	uint64_t		triggerTime = 0;
+
+	pthread_mutex_lock(&this->mutex);
+
+	if (this->count > 0) {
+		triggerTime = this->triggerTimes[this->head];
+		this->head = (this->head + 1) % CAPTURE_MAX_PENDING_TRIGGERS;
+		this->count--;
+	}
+
+	pthread_mutex_unlock(&this->mutex);
+
+	return triggerTime;
+}
+
+void TriggerQueue::clear()
+{
+	pthread_mutex_lock(&this->mutex);
+	this->head = 0;
+	this->count = 0;
+	pthread_mutex_unlock(&this->mutex);
+}
+
+/*
+** Split a printf style output template such as img_%04d.jpg
+** around its single %d conversion. Returns false if there
+** isn't exactly one...
+*/
+static bool splitOutputTemplate(const char * pszTemplate, int * prefixLength, int * width, const char ** pszSuffix)
+{
+	const char *	p = strchr(pszTemplate, '%');
+	const char *	spec;
+
+	if (p == NULL) {
+		return false;
+	}
+
+	*prefixLength = (int)(p - pszTemplate);
+
+	spec = p + 1;
+	*width = 0;
+
+	while (*spec >= '0' && *spec <= '9') {
+		*width = (*width * 10) + (*spec - '0');
+		spec++;
+	}
+
+	if (*spec != 'd' || strchr(spec, '%') != NULL) {
+		return false;
+	}
+
+	*pszSuffix = spec + 1;
+
+	return true;
+}
+
+bool matchOutputTemplate(const char * pszTemplate, const char * pszName, uint32_t * sequence)
+{
+	const char *	pszSuffix;
+	const char *	p;
+	int				prefixLength;
+	int				width;
+	uint32_t		value = 0;
+
+	if (!splitOutputTemplate(pszTemplate, &prefixLength, &width, &pszSuffix)) {
+		return false;
+	}
+
+	if (strncmp(pszName, pszTemplate, prefixLength) != 0) {
+		return false;
+	}
+
+	p = &pszName[prefixLength];
+
+	if (*p < '0' || *p > '9') {
+		return false;
+	}
+
+	while (*p >= '0' && *p <= '9') {
+		value = (value * 10) + (uint32_t)(*p - '0');
+		p++;
+	}
+
+	if (strcmp(p, pszSuffix) != 0) {
+		return false;
+	}
+
+	*sequence = value;
+
+	return true;
+}
+
+/*
+** Split the output template into the directory and the file
+** name template, both buffers must be PATH_MAX...
+*/
+void splitOutputPath(const char * pszTemplate, char * pszDir, char * pszName)
+{
+	const char *	pszSlash = strrchr(pszTemplate, '/');
+
+	if (pszSlash != NULL) {
+		snprintf(pszDir, PATH_MAX, "%.*s", (int)(pszSlash - pszTemplate), pszTemplate);
+		snprintf(pszName, PATH_MAX, "%s", pszSlash + 1);
+	}
+	else {
+		strcpy(pszDir, ".");
+		snprintf(pszName, PATH_MAX, "%s", pszTemplate);
+	}
+}
+
+bool formatOutputTemplate(const char * pszTemplate, uint32_t sequence, char * pszPath, size_t length)
+{
+	const char *	pszSuffix;
+	int				prefixLength;
+	int				width;
+	int				rtn;
+
+	if (!splitOutputTemplate(pszTemplate, &prefixLength, &width, &pszSuffix)) {
+		return false;
+	}
+
+	rtn = snprintf(pszPath, length, "%.*s%0*u%s", prefixLength, pszTemplate, width, sequence, pszSuffix);
+
+	return (rtn > 0 && (size_t)rtn < length);
+}
+
+/*
+** raspistill in signal mode sits in sigwait() for SIGUSR1 once the
+** camera is set up, before then SIGUSR1 would kill it. So the child
+** is ready when SIGUSR1 shows as blocked or caught in its status.
+** Returns 1 if ready, 0 if not yet and -1 if the child has gone...
+*/
+static int probeCaptureProgram(pid_t pid)
+{
+	char				szStatusFile[32];
+	char				buffer[4096];
+	const char *		p;
+	unsigned long long	blocked = 0;
+	unsigned long long	caught = 0;
+	unsigned long long	usr1 = 1ULL << (SIGUSR1 - 1);
+	ssize_t				length;
+	int					fd;
+
+	snprintf(szStatusFile, sizeof(szStatusFile), "/proc/%d/status", pid);
+
+	fd = open(szStatusFile, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	length = read(fd, buffer, sizeof(buffer) - 1);
+
+	close(fd);
+
+	if (length <= 0) {
+		return -1;
+	}
+
+	buffer[length] = 0;
+
+	p = strstr(buffer, "\nState:");
+
+	if (p != NULL) {
+		p += 7;
+
+		while (*p == ' ' || *p == '\t') {
+			p++;
+		}
+
+		if (*p == 'Z' || *p == 'X') {
+			return -1;
+		}
+	}
+
+	p = strstr(buffer, "\nSigBlk:");
+
+	if (p != NULL) {
+		blocked = strtoull(p + 8, NULL, 16);
+	}
+
+	p = strstr(buffer, "\nSigCgt:");
+
+	if (p != NULL) {
+		caught = strtoull(p + 8, NULL, 16);
+	}
+
+	return ((blocked | caught) & usr1) ? 1 : 0;
+}
+
+/*
+** Override capture.hres and capture.vres, 0x0 goes back to
+** the config. Takes effect the next time a backend starts,
+** returns true if the resolution changed...
+*/
+bool setCaptureResolution(int width, int height)
+{
+	uint32_t resolution = ((uint32_t)width << 16) | ((uint32_t)height & 0xFFFF);
+
+	return (resolutionOverride.exchange(resolution, memory_order_relaxed) != resolution);
+}
+
+void getCaptureResolution(int * width, int * height)
+{
+	uint32_t resolution = resolutionOverride.load(memory_order_relaxed);
+
+	if (resolution != 0) {
+		*width = (int)(resolution >> 16);
+		*height = (int)(resolution & 0xFFFF);
+	}
+	else {
+		ConfigManager & cfg = ConfigManager::getInstance();
+
+		*width = cfg.getValueAsInteger(CFG_CAPTURE_HRES);
+		*height = cfg.getValueAsInteger(CFG_CAPTURE_VRES);
+	}
+}
+
+CaptureBackend * createCaptureBackend()
+{
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	const char * pszBackend = cfg.getValue(CFG_CAPTURE_BACKEND);
+
+	if (strcmp(pszBackend, "program") == 0) {
+		return new ProgramBackend();
+	}
+	else if (strcmp(pszBackend, "synthetic") == 0) {
+		return new SyntheticBackend();
+	}
+
+	throw bctl_error(bctl_error::buildMsg("Unknown capture backend '%s'", pszBackend), __FILE__, __LINE__);
+}
+
+ProgramBackend::ProgramBackend()
+{
+	this->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if (this->inotifyFd < 0) {
+		throw bctl_error(bctl_error::buildMsg("Failed to initialise inotify: %s", strerror(errno)), __FILE__, __LINE__);
+	}
+
+	this->szOutputDir[0] = 0;
+	this->szOutputTemplate[0] = 0;
+}
+
+ProgramBackend::~ProgramBackend()
+{
+	shutdown();
+
+	close(this->inotifyFd);
+}
+
+void ProgramBackend::start()
+{
+	pid_t			capturePid = 0;
+	ResumeResult	resume;
+	uint32_t		frameStart;
+	char			szTemplate[PATH_MAX];
+	char			szPipeName[PATH_MAX];
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+	Logger & log = Logger::getInstance();
+
+	/*
+	** Watch the directory the capture program writes to, it
+	** may have changed since we were last started...
+	*/
+	splitOutputPath(cfg.getValue(CFG_CAPTURE_OUTPUTTEMPLATE, szTemplate, PATH_MAX), this->szOutputDir, this->szOutputTemplate);
+
+	if (this->watchDescriptor >= 0) {
+		inotify_rm_watch(this->inotifyFd, this->watchDescriptor);
+	}
+
+	this->watchDescriptor = inotify_add_watch(this->inotifyFd, this->szOutputDir, IN_CLOSE_WRITE | IN_MOVED_TO);
+
+	if (this->watchDescriptor < 0) {
+		log.logError("Failed to watch output directory %s: %s", this->szOutputDir, strerror(errno));
+	}
+
+	const char * pipename = cfg.getValue(CFG_CAPTURE_PIPENAME, szPipeName, PATH_MAX);
+
+	if (mkfifo(pipename, 0644) && errno != EEXIST) {
+		log.logStatus("Failed to create named pipe %s: %s", pipename, strerror(errno));
+	}
+
+	frameStart = findResumeSequence(&resume);
+
+	capturePid = spawnCaptureProgram(frameStart);
+
+	if (capturePid < 0) {
+		throw bctl_error(bctl_error::buildMsg("Failed to fork capture program: %s", strerror(errno)), __FILE__, __LINE__);
+	}
+
+	/*
+	** Known from here on, so the next shutdown() or an abort()
+	** gets the child even if it never reports back...
+	*/
+	this->pid = capturePid;
+
+	watchdogPoint("capture.pipe");
+
+	/*
+	** The child reports its PID over the pipe...
+	*/
+	int pipeFd = open(pipename, O_RDONLY);
+
+	if (pipeFd < 0) {
+		throw bctl_error(bctl_error::buildMsg("Failed to open named pipe %s: %s", pipename, strerror(errno)), __FILE__, __LINE__);
+	}
+
+	ssize_t bytesRead = read(pipeFd, &capturePid, sizeof(pid_t));
+
+	if (bytesRead != sizeof(pid_t)) {
+		close(pipeFd);
+		throw bctl_error(bctl_error::buildMsg("Failed to read capture PID: %s", (bytesRead < 0 ? strerror(errno) : "pipe closed")), __FILE__, __LINE__);
+	}
+
+	close(pipeFd);
+
+	log.logDebug("Got capture process PID %d", capturePid);
+
+	this->pid = capturePid;
+	this->startTime = CurrentTime::getMonotonicTime();
+	this->isProgramReady = false;
+
+	this->triggers.clear();
+
+	StartupTimeline::getInstance().mark(STARTUP_CAPTURE_SPAWNED);
+}
+
+bool ProgramBackend::isReady()
+{
+	uint64_t		elapsed;
+	int				state;
+
+	Logger & log = Logger::getInstance();
+
+	if (this->pid == 0) {
+		return false;
+	}
+
+	if (this->isProgramReady) {
+		return true;
+	}
+
+	elapsed = CurrentTime::getMonotonicTime() - this->startTime;
+	state = probeCaptureProgram(this->pid);
+
+	if (state > 0) {
+		log.logDebug("Capture program with PID %d ready after %lums", this->pid, (unsigned long)(elapsed / 1000ULL));
+		this->isProgramReady = true;
+	}
+	else if (elapsed >= PROGRAM_READY_TIMEOUT_US) {
+		log.logStatus(
+				"Capture program with PID %d %s after %lums, assuming it is ready",
+				this->pid,
+				(state < 0 ? "could not be probed" : "did not report ready"),
+				(unsigned long)(elapsed / 1000ULL));
+		this->isProgramReady = true;
+	}
+
+	return this->isProgramReady;
+}
+
+bool ProgramBackend::trigger()
+{
+	if (this->pid == 0) {
+		return false;
+	}
+
+	this->triggers.push(CurrentTime::getMonotonicTime());
+
+	capturePhoto(this->pid);
+
+	return true;
+}
+
+void ProgramBackend::shutdown()
+{
+	Logger & log = Logger::getInstance();
+
+	if (this->pid > 0) {
+		log.logStatus("Stopping capture program with PID %d", this->pid);
+		kill(this->pid, SIGTERM);
+	}
+
+	this->pid = 0;
+	this->isProgramReady = false;
+}
+
+void ProgramBackend::abort()
+{
+	pid_t			capturePid = this->pid;
+	char			szPipeName[PATH_MAX];
+
+	if (capturePid > 0) {
+		kill(capturePid, SIGKILL);
+	}
+
+	/*
+	** Opening the write end and closing it again lets a start()
+	** stuck opening the pipe through, to read nothing...
+	*/
+	int pipeFd = open(ConfigManager::getInstance().getValue(CFG_CAPTURE_PIPENAME, szPipeName, PATH_MAX), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+
+	if (pipeFd >= 0) {
+		close(pipeFd);
+	}
+}
+
+bool ProgramBackend::nextFrame(CaptureFrame * frame)
+{
+	struct inotify_event *	event;
+	struct stat				st;
+	uint32_t				sequence;
+
+	while (1) {
+		if (this->eventPosition >= this->eventLength) {
+			this->eventPosition = 0;
+			this->eventLength = read(this->inotifyFd, this->eventBuffer, sizeof(this->eventBuffer));
+
+			if (this->eventLength <= 0) {
+				this->eventLength = 0;
+				return false;
+			}
+		}
+
+		event = (struct inotify_event *)&this->eventBuffer[this->eventPosition];
+		this->eventPosition += sizeof(struct inotify_event) + event->len;
+
+		/*
+		** raspistill writes to name~ and renames it when the frame
+		** is complete, which the template will not match...
+		*/
+		if (event->len == 0 || !matchOutputTemplate(this->szOutputTemplate, event->name, &sequence)) {
+			continue;
+		}
+
+		if (snprintf(frame->szPath, PATH_MAX, "%s/%s", this->szOutputDir, event->name) >= PATH_MAX) {
+			continue;
+		}
+
+		frame->sequence = sequence;
+		frame->triggerTime = this->triggers.pop();
+		frame->completedTime = CurrentTime::getMonotonicTime();
+		frame->size = (stat(frame->szPath, &st) == 0 ? st.st_size : 0);
+		frame->hasCRC = false;
+		frame->hasSimilarity = false;
+		frame->isSimilar = false;
+		frame->isSkipped = false;
+
+		return true;
+	}
+}
@@ -0,0 +1,243 @@
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "posixthread.h"
+
+#ifndef _INCL_CAPTUREBACKEND
+#define _INCL_CAPTUREBACKEND
+
+#define CAPTURE_MAX_PENDING_TRIGGERS        64
+#define CAPTURE_MAX_PENDING_FRAMES          64
+
+/*
+** A completed frame on disk. The similarity is its score against
+** the last frame that was kept, in 1/100 grey levels, and a
+** skipped frame has been removed and goes no further down the
+** pipeline...
+*/
+struct CaptureFrame
+{
+    uint32_t            sequence;
+    uint64_t            triggerTime;
+    uint64_t            completedTime;
+    off_t               size;
+    uint32_t            crc;
+    bool                hasCRC;
+    uint32_t            similarity;
+    bool                hasSimilarity;
+    bool                isSimilar;
+    bool                isSkipped;
+    char                szPath[PATH_MAX];
+};
+
+class FrameListener
+{
+public:
+    virtual ~FrameListener() {}
+
+    virtual void        frameAvailable(const CaptureFrame & frame) = 0;
+};
+
+/*
+** Runs as a pipeline stage and may change the frame on disk,
+** updating its size to match for the stages after it...
+*/
+class FrameProcessor
+{
+public:
+    virtual ~FrameProcessor() {}
+
+    virtual void        processFrame(CaptureFrame * frame) = 0;
+};
+
+/*
+** Records trigger times, so each completed frame can be matched
+** with the trigger that produced it...
+*/
+class TriggerQueue
+{
+private:
+    pthread_mutex_t     mutex;
+    uint64_t            triggerTimes[CAPTURE_MAX_PENDING_TRIGGERS];
+    int                 head = 0;
+    int                 count = 0;
+
+public:
+    TriggerQueue();
+    ~TriggerQueue();
+
+    void                push(uint64_t triggerTime);
+    uint64_t            pop();
+    void                clear();
+};
+
+/*
+** Everything the CaptureThread needs from a source of frames.
+** start() and shutdown() may be called repeatedly to restart
+** the backend with the current config. getFrameEventFd() is
+** pollable, it becomes readable when nextFrame() may have a
+** frame to return...
+*/
+class CaptureBackend
+{
+public:
+    virtual ~CaptureBackend() {}
+
+    virtual const char *    getName() = 0;
+
+    virtual void            start() = 0;
+    virtual bool            isReady() = 0;
+    virtual bool            trigger() = 0;
+    virtual void            shutdown() = 0;
+
+    virtual int             getFrameEventFd() = 0;
+    virtual bool            nextFrame(CaptureFrame * frame) = 0;
+
+    virtual pid_t           getPID() {
+        return 0;
+    }
+
+    /*
+    ** From another thread, when the capture thread is stuck in
+    ** the backend. Kill whatever it's waiting on, so start() or
+    ** trigger() fails and capture can be restarted...
+    */
+    virtual void            abort() {
+    }
+};
+
+/*
+** The original backend, forks capture.progname (raspistill) in
+** signal mode and sends it SIGUSR1 for each photo. Completed
+** frames are detected with inotify on the output directory...
+*/
+class ProgramBackend : public CaptureBackend
+{
+private:
+    pid_t               pid = 0;
+    uint64_t            startTime = 0;
+    bool                isProgramReady = false;
+    int                 inotifyFd = -1;
+    int                 watchDescriptor = -1;
+    char                szOutputDir[PATH_MAX];
+    char                szOutputTemplate[PATH_MAX];
+
+    char                eventBuffer[4096];
+    int                 eventLength = 0;
+    int                 eventPosition = 0;
+
+    TriggerQueue        triggers;
+
+public:
+    ProgramBackend();
+    ~ProgramBackend();
+
+    const char *        getName() {
+        return "program";
+    }
+
+    void                start();
+    bool                isReady();
+    bool                trigger();
+    void                shutdown();
+
+    int                 getFrameEventFd() {
+        return this->inotifyFd;
+    }
+
+    bool                nextFrame(CaptureFrame * frame);
+
+    pid_t               getPID() {
+        return this->pid;
+    }
+
+    void                abort();
+};
+
+class SyntheticBackend;
+
+class SyntheticThread : public PosixThread
+{
+private:
+    SyntheticBackend *  pBackend;
+
+public:
+    SyntheticThread(SyntheticBackend * pBackend) : PosixThread(false) {
+        this->pBackend = pBackend;
+    }
+
+    void *              run();
+};
+
+/*
+** Generates synthetic JPEG frames in-process, at a configurable
+** size and rate, on a trigger or free running. For exercising
+** everything downstream of capture without a camera...
+*/
+class SyntheticBackend : public CaptureBackend
+{
+private:
+    SyntheticThread *   pThread = NULL;
+
+    pthread_mutex_t     mutex;
+    pthread_cond_t      wakeup;
+    int                 eventFd = -1;
+
+    bool                isRunning = false;
+    bool                isStopping = false;
+    int                 triggersPending = 0;
+    uint32_t            sequence = 0;
+
+    int                 width = 0;
+    int                 height = 0;
+    int                 quality = 0;
+    unsigned long       rate = 0;
+    size_t              frameSize = 0;
+    char                szOutputTemplate[PATH_MAX];
+
+    uint8_t *           buffer = NULL;
+    size_t              bufferLength = 0;
+
+    CaptureFrame        frames[CAPTURE_MAX_PENDING_FRAMES];
+    int                 frameHead = 0;
+    int                 frameCount = 0;
+
+    TriggerQueue        triggers;
+
+    void                writeFrame(uint64_t triggerTime);
+
+public:
+    SyntheticBackend();
+    ~SyntheticBackend();
+
+    const char *        getName() {
+        return "synthetic";
+    }
+
+    void                start();
+    bool                isReady();
+    bool                trigger();
+    void                shutdown();
+
+    int                 getFrameEventFd() {
+        return this->eventFd;
+    }
+
+    bool                nextFrame(CaptureFrame * frame);
+
+    void                generate();
+};
+
+CaptureBackend *    createCaptureBackend();
+bool                setCaptureResolution(int width, int height);
+void                getCaptureResolution(int * width, int * height);
+bool                matchOutputTemplate(const char * pszTemplate, const char * pszName, uint32_t * sequence);
+void                splitOutputPath(const char * pszTemplate, char * pszDir, char * pszName);
+bool                formatOutputTemplate(const char * pszTemplate, uint32_t sequence, char * pszPath, size_t length);
+
+size_t              getSyntheticJpegMaxLength(int width, int height, size_t frameSize);
+size_t              synthesiseJpeg(uint8_t * buffer, size_t bufferLength, int width, int height, int quality, uint32_t frameNumber, size_t frameSize);
+
+#endif
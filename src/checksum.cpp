@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <map>
+#include <string>
+#include <vector>
+#include <atomic>
+
+#include "configmgr.h"
+#include "logger.h"
+#include "bctl_error.h"
+#include "currenttime.h"
+#include "crc32c.h"
+#include "checksum.h"
+
+using namespace std;
+
+/*
+** Checksum a whole file through a read only mapping, returns
+** false if it can't be read...
+*/
+bool checksumFile(const char * pszPath, uint32_t * crc, size_t * length)
+{
+	struct stat		st;
+	void *			p;
+	int				fd;
+
+	fd = open(pszPath, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		return false;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return false;
+	}
+
+	*length = (size_t)st.st_size;
+
+	if (*length == 0) {
+		close(fd);
+		*crc = 0;
+		return true;
+	}
+
+	p = mmap(NULL, *length, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (p == MAP_FAILED) {
+		return false;
+	}
+
+	madvise(p, *length, MADV_SEQUENTIAL);
+
+	*crc = crc32c(0, p, *length);
+
+	munmap(p, *length);
+
+	return true;
+}
+
+/*
+** The manifest lives alongside the frames, pszPath
+** must be PATH_MAX...
+*/
+void getManifestPath(char * pszPath)
+{
+	char			szDir[PATH_MAX];
+	char			szName[PATH_MAX];
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	splitOutputPath(cfg.getValue(CFG_CAPTURE_OUTPUTTEMPLATE), szDir, szName);
+
+	if (snprintf(pszPath, PATH_MAX, "%s/%s", szDir, cfg.getValue(CFG_CHECKSUM_MANIFEST)) >= PATH_MAX) {
+		throw bctl_error("Checksum manifest path is too long", __FILE__, __LINE__);
+	}
+}
+
+FrameChecksummer::FrameChecksummer()
+{
+	char			szManifest[PATH_MAX];
+
+	pthread_mutex_init(&this->mutex, NULL);
+
+	memset(&this->stats, 0, sizeof(ChecksumStats));
+
+	getManifestPath(szManifest);
+
+	this->manifestFd = open(szManifest, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+	if (this->manifestFd < 0) {
+		throw bctl_error(bctl_error::buildMsg("Failed to open checksum manifest %s: %s", szManifest, strerror(errno)), __FILE__, __LINE__);
+	}
+
+	Logger::getInstance().logStatus("Checksumming frames with CRC32C (%s) into %s", crc32cImplementation(), szManifest);
+}
+
+FrameChecksummer::~FrameChecksummer()
+{
+	close(this->manifestFd);
+
+	pthread_mutex_destroy(&this->mutex);
+}
+
+void FrameChecksummer::getStats(ChecksumStats * stats)
+{
+	pthread_mutex_lock(&this->mutex);
+	memcpy(stats, &this->stats, sizeof(ChecksumStats));
+	pthread_mutex_unlock(&this->mutex);
+}
+
+/*
+** Called on a checksum stage worker...
+*/
+void FrameChecksummer::processFrame(CaptureFrame * frame)
+{
+	char			szLine[PATH_MAX + 16];
+	const char *	pszName;
+	uint64_t		startTime;
+	uint64_t		elapsed;
+	uint32_t		crc;
+	size_t			length;
+	int				lineLength;
+
+	Logger & log = Logger::getInstance();
+
+	startTime = CurrentTime::getStopwatchTime();
+
+	if (!checksumFile(frame->szPath, &crc, &length)) {
+		log.logError("Failed to checksum frame %s: %s", frame->szPath, strerror(errno));
+
+		pthread_mutex_lock(&this->mutex);
+		this->stats.errorCount++;
+		pthread_mutex_unlock(&this->mutex);
+		return;
+	}
+
+	elapsed = CurrentTime::getStopwatchTime() - startTime;
+
+	frame->crc = crc;
+	frame->hasCRC = true;
+
+	pszName = strrchr(frame->szPath, '/');
+	pszName = (pszName != NULL ? pszName + 1 : frame->szPath);
+
+	/*
+	** A single write to an O_APPEND file, so lines are
+	** never interleaved or torn by a restart, however many
+	** workers there are...
+	*/
+	lineLength = snprintf(szLine, sizeof(szLine), "%08x  %s\n", crc, pszName);
+
+	if (write(this->manifestFd, szLine, lineLength) != lineLength) {
+		log.logError("Failed to write checksum for %s: %s", frame->szPath, strerror(errno));
+	}
+
+	log.logDebug("Frame %s CRC32C %08x, %lu bytes in %luus", pszName, crc, (unsigned long)length, (unsigned long)elapsed);
+
+	pthread_mutex_lock(&this->mutex);
+	this->stats.frameCount++;
+	this->stats.totalBytes += length;
+	this->stats.totalTime += elapsed;
+	pthread_mutex_unlock(&this->mutex);
+}
+
+struct VerifyEntry
+{
+	string			name;
+	uint32_t		crc;
+};
+
+struct VerifyJob
+{
+	const char *			pszDir;
+	vector<VerifyEntry>		entries;
+	atomic<size_t>			next;
+
+	pthread_mutex_t			mutex;
+	uint64_t				totalBytes;
+	uint32_t				numBad;
+	uint32_t				numMissing;
+};
+
+class VerifyThread : public PosixThread
+{
+private:
+	VerifyJob *		pJob;
+
+public:
+	VerifyThread(VerifyJob * pJob) : PosixThread(false) {
+		this->pJob = pJob;
+	}
+
+	void * run() {
+		char			szPath[PATH_MAX];
+		uint64_t		totalBytes = 0;
+		uint32_t		numBad = 0;
+		uint32_t		numMissing = 0;
+		uint32_t		crc;
+		size_t			length;
+		size_t			i;
+
+		while ((i = this->pJob->next.fetch_add(1, memory_order_relaxed)) < this->pJob->entries.size()) {
+			const VerifyEntry & entry = this->pJob->entries[i];
+
+			snprintf(szPath, PATH_MAX, "%s/%s", this->pJob->pszDir, entry.name.c_str());
+
+			if (!checksumFile(szPath, &crc, &length)) {
+				fprintf(stderr, "MISSING %s\n", szPath);
+				numMissing++;
+				continue;
+			}
+
+			if (crc != entry.crc) {
+				fprintf(stderr, "BAD     %s (expected %08x, got %08x)\n", szPath, entry.crc, crc);
+				numBad++;
+			}
+
+			totalBytes += length;
+		}
+
+		pthread_mutex_lock(&this->pJob->mutex);
+		this->pJob->totalBytes += totalBytes;
+		this->pJob->numBad += numBad;
+		this->pJob->numMissing += numMissing;
+		pthread_mutex_unlock(&this->pJob->mutex);
+
+		return NULL;
+	}
+};
+
+/*
+** Re-read every frame in the manifest and check it against its
+** recorded CRC, spread across a thread per CPU. Only the latest
+** entry for each file counts. Returns 0 if everything matched...
+*/
+int verifyChecksums()
+{
+	VerifyThread *				threads[CHECKSUM_MAX_VERIFY_THREADS];
+	map<string, uint32_t>		latest;
+	VerifyJob					job;
+	char						szManifest[PATH_MAX];
+	char						szDir[PATH_MAX];
+	char						szName[PATH_MAX];
+	char						szTemplate[PATH_MAX];
+	char						szLine[PATH_MAX + 16];
+	uint64_t					startTime;
+	uint64_t					elapsed;
+	unsigned int				crc;
+	int							numThreads;
+	int							numStarted = 0;
+	int							i;
+	FILE *						fptr;
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	try {
+		getManifestPath(szManifest);
+	}
+	catch (bctl_error & e) {
+		fprintf(stderr, "%s\n", e.what());
+		return -1;
+	}
+
+	splitOutputPath(cfg.getValue(CFG_CAPTURE_OUTPUTTEMPLATE, szTemplate, PATH_MAX), szDir, szName);
+
+	fptr = fopen(szManifest, "rt");
+
+	if (fptr == NULL) {
+		fprintf(stderr, "Failed to open checksum manifest %s: %s\n", szManifest, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(szLine, sizeof(szLine), fptr) != NULL) {
+		if (sscanf(szLine, "%8x  %4095[^\n]", &crc, szName) == 2) {
+			latest[szName] = (uint32_t)crc;
+		}
+	}
+
+	fclose(fptr);
+
+	for (auto it = latest.begin(); it != latest.end(); ++it) {
+		VerifyEntry entry;
+
+		entry.name = it->first;
+		entry.crc = it->second;
+
+		job.entries.push_back(entry);
+	}
+
+	job.pszDir = szDir;
+	job.next = 0;
+	job.totalBytes = 0;
+	job.numBad = 0;
+	job.numMissing = 0;
+
+	pthread_mutex_init(&job.mutex, NULL);
+
+	numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	numThreads = (numThreads < 1 ? 1 : (numThreads > CHECKSUM_MAX_VERIFY_THREADS ? CHECKSUM_MAX_VERIFY_THREADS : numThreads));
+
+	printf("Verifying %lu frame(s) from %s with CRC32C (%s), %d thread(s)\n", (unsigned long)job.entries.size(), szManifest, crc32cImplementation(), numThreads);
+
+	startTime = CurrentTime::getStopwatchTime();
+
+	for (i = 0;i < numThreads;i++) {
+		threads[i] = new VerifyThread(&job);
+
+		if (!threads[i]->start()) {
+			delete threads[i];
+			break;
+		}
+
+		numStarted++;
+	}
+
+	/*
+	** If no threads would start, do it ourselves...
+	*/
+	if (numStarted == 0) {
+		VerifyThread verifier(&job);
+		verifier.run();
+	}
+
+	for (i = 0;i < numStarted;i++) {
+		threads[i]->join();
+		delete threads[i];
+	}
+
+	elapsed = CurrentTime::getStopwatchTime() - startTime;
+
+	pthread_mutex_destroy(&job.mutex);
+
+	printf(
+		"Verified %.1f MB in %.1f ms, %.1f MB/s: %lu OK, %u bad, %u missing\n",
+		(double)job.totalBytes / 1000000.0,
+		(double)elapsed / 1000.0,
+		(elapsed > 0 ? (double)job.totalBytes / (double)elapsed : 0.0),
+		(unsigned long)(job.entries.size() - job.numBad - job.numMissing),
+		job.numBad,
+		job.numMissing);
+
+	return ((job.numBad + job.numMissing) > 0 ? 1 : 0);
+}
@@ -0,0 +1,50 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "posixthread.h"
+#include "capturebackend.h"
+
+#ifndef _INCL_CHECKSUM
+#define _INCL_CHECKSUM
+
+#define CHECKSUM_MAX_VERIFY_THREADS         16
+
+struct ChecksumStats
+{
+    uint32_t            frameCount;
+    uint32_t            errorCount;
+    uint64_t            totalBytes;
+    uint64_t            totalTime;
+};
+
+/*
+** Checksums each completed frame with CRC32C and appends the
+** result to a manifest in the output directory, one
+** '<crc>  <file name>' line per frame. It runs as a pipeline
+** stage, so off the frame thread and maybe on several threads
+** at once, and leaves the CRC in the frame for later stages...
+*/
+class FrameChecksummer : public FrameProcessor
+{
+private:
+    pthread_mutex_t     mutex;
+
+    int                 manifestFd = -1;
+    ChecksumStats       stats;
+
+public:
+    FrameChecksummer();
+    ~FrameChecksummer();
+
+    void                processFrame(CaptureFrame * frame);
+
+    void                getStats(ChecksumStats * stats);
+};
+
+bool    checksumFile(const char * pszPath, uint32_t * crc, size_t * length);
+void    getManifestPath(char * pszPath);
+int     verifyChecksums();
+
+#endif
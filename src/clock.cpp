@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <atomic>
+#include <vector>
+
+#include "clock.h"
+#include "heartbeat.h"
+
+using namespace std;
+
+static inline uint64_t getClockTime(clockid_t clockID)
+{
+	struct timespec		ts;
+
+	clock_gettime(clockID, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000000ULL) + ((uint64_t)ts.tv_nsec / 1000ULL);
+}
+
+static inline void toTimespec(uint64_t t, struct timespec * ts)
+{
+	ts->tv_sec = (time_t)(t / 1000000ULL);
+	ts->tv_nsec = (long)((t % 1000000ULL) * 1000ULL);
+}
+
+/*
+** The real clocks...
+*/
+class SystemClock : public Clock
+{
+public:
+	bool isVirtual() {
+		return false;
+	}
+
+	uint64_t getMonotonicTime() {
+		return getClockTime(CLOCK_MONOTONIC);
+	}
+
+	uint64_t getWallTime() {
+		return getClockTime(CLOCK_REALTIME);
+	}
+
+	void sleepUntil(uint64_t dueTime) {
+		struct timespec		ts;
+
+		toTimespec(dueTime, &ts);
+
+		/*
+		** Anything waiting on the clock is waiting as long as
+		** it means to, not stalled...
+		*/
+		watchdogWait();
+
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+
+		watchdogBeat();
+	}
+
+	void waitUntil(pthread_cond_t * condition, pthread_mutex_t * mutex, uint64_t dueTime) {
+		struct timespec		ts;
+
+		watchdogWait();
+
+		if (dueTime == CLOCK_FOREVER) {
+			pthread_cond_wait(condition, mutex);
+		}
+		else {
+			toTimespec(dueTime, &ts);
+			pthread_cond_timedwait(condition, mutex, &ts);
+		}
+
+		watchdogBeat();
+	}
+
+	void signal(pthread_cond_t * condition) {
+		pthread_cond_signal(condition);
+	}
+};
+
+struct ClockWaiter
+{
+	uint64_t			dueTime;
+	uint64_t			sequence;
+	pthread_cond_t *	condition;
+	pthread_cond_t		wakeup;
+	bool				isWoken;
+	bool				isAttached;
+};
+
+static thread_local bool	isAttachedThread = false;
+
+/*
+** Time only moves when every attached thread is waiting on
+** the clock, then it jumps straight to the earliest wake up.
+** Waiters due at the same time are woken one at a time, in
+** the order they started waiting, so a schedule runs as fast
+** as the CPU allows and plays out the same on every run...
+*/
+class VirtualClock : public Clock
+{
+private:
+	pthread_mutex_t			mutex;
+	atomic<uint64_t>		monotonicTime;
+	uint64_t				wallOffset;
+	int						numRunning = 0;
+	int						numReserved = 0;
+	uint64_t				sequence = 0;
+
+	vector<ClockWaiter *>	waiters;
+
+	/*
+	** All of these must be called with the mutex held...
+	*/
+	void wake(size_t i) {
+		ClockWaiter * w = this->waiters[i];
+
+		this->waiters[i] = this->waiters.back();
+		this->waiters.pop_back();
+
+		w->isWoken = true;
+
+		if (w->isAttached) {
+			this->numRunning++;
+		}
+
+		pthread_cond_signal(&w->wakeup);
+	}
+
+	void advance() {
+		ClockWaiter *	w;
+		size_t			next;
+		size_t			i;
+
+		while (this->numRunning == 0 && !this->waiters.empty()) {
+			next = 0;
+
+			for (i = 1;i < this->waiters.size();i++) {
+				w = this->waiters[i];
+
+				if (w->dueTime < this->waiters[next]->dueTime ||
+					(w->dueTime == this->waiters[next]->dueTime && w->sequence < this->waiters[next]->sequence))
+				{
+					next = i;
+				}
+			}
+
+			/*
+			** Everyone is waiting for a signal, only something
+			** outside the clock can move things on now...
+			*/
+			if (this->waiters[next]->dueTime == CLOCK_FOREVER) {
+				break;
+			}
+
+			if (this->waiters[next]->dueTime > this->monotonicTime.load(memory_order_relaxed)) {
+				this->monotonicTime.store(this->waiters[next]->dueTime, memory_order_relaxed);
+			}
+
+			wake(next);
+		}
+	}
+
+	void block(pthread_cond_t * condition, pthread_mutex_t * mutex, uint64_t dueTime) {
+		ClockWaiter		w;
+
+		pthread_mutex_lock(&this->mutex);
+
+		if (dueTime <= this->monotonicTime.load(memory_order_relaxed)) {
+			pthread_mutex_unlock(&this->mutex);
+			return;
+		}
+
+		w.dueTime = dueTime;
+		w.sequence = this->sequence++;
+		w.condition = condition;
+		w.isWoken = false;
+		w.isAttached = isAttachedThread;
+
+		pthread_cond_init(&w.wakeup, NULL);
+
+		this->waiters.push_back(&w);
+
+		if (w.isAttached) {
+			this->numRunning--;
+		}
+
+		advance();
+
+		/*
+		** Anyone signalling the condition needs both locks,
+		** so releasing the caller's now can't lose a wake up...
+		*/
+		if (mutex != NULL) {
+			pthread_mutex_unlock(mutex);
+		}
+
+		while (!w.isWoken) {
+			pthread_cond_wait(&w.wakeup, &this->mutex);
+		}
+
+		pthread_mutex_unlock(&this->mutex);
+
+		pthread_cond_destroy(&w.wakeup);
+
+		if (mutex != NULL) {
+			pthread_mutex_lock(mutex);
+		}
+	}
+
+public:
+	VirtualClock() {
+		uint64_t now = getClockTime(CLOCK_MONOTONIC);
+
+		pthread_mutex_init(&this->mutex, NULL);
+
+		/*
+		** Start from the real time, so nothing already
+		** timed sees the clock go backwards...
+		*/
+		this->monotonicTime.store(now, memory_order_relaxed);
+		this->wallOffset = getClockTime(CLOCK_REALTIME) - now;
+	}
+
+	bool isVirtual() {
+		return true;
+	}
+
+	uint64_t getMonotonicTime() {
+		return this->monotonicTime.load(memory_order_relaxed);
+	}
+
+	uint64_t getWallTime() {
+		return this->monotonicTime.load(memory_order_relaxed) + this->wallOffset;
+	}
+
+	void sleepUntil(uint64_t dueTime) {
+		block(NULL, NULL, dueTime);
+	}
+
+	void waitUntil(pthread_cond_t * condition, pthread_mutex_t * mutex, uint64_t dueTime) {
+		block(condition, mutex, dueTime);
+	}
+
+	void signal(pthread_cond_t * condition) {
+		size_t		i = 0;
+
+		pthread_mutex_lock(&this->mutex);
+
+		while (i < this->waiters.size()) {
+			if (this->waiters[i]->condition == condition) {
+				wake(i);
+			}
+			else {
+				i++;
+			}
+		}
+
+		pthread_mutex_unlock(&this->mutex);
+	}
+
+	void reserve() {
+		pthread_mutex_lock(&this->mutex);
+
+		this->numReserved++;
+		this->numRunning++;
+
+		pthread_mutex_unlock(&this->mutex);
+	}
+
+	void attach() {
+		pthread_mutex_lock(&this->mutex);
+
+		isAttachedThread = true;
+
+		/*
+		** A reserved thread is already counted...
+		*/
+		if (this->numReserved > 0) {
+			this->numReserved--;
+		}
+		else {
+			this->numRunning++;
+		}
+
+		pthread_mutex_unlock(&this->mutex);
+	}
+
+	void detach() {
+		if (!isAttachedThread) {
+			return;
+		}
+
+		pthread_mutex_lock(&this->mutex);
+
+		isAttachedThread = false;
+		this->numRunning--;
+
+		advance();
+
+		pthread_mutex_unlock(&this->mutex);
+	}
+};
+
+static SystemClock		systemClock;
+static Clock *			activeClock = &systemClock;
+
+Clock & Clock::getInstance()
+{
+	return *activeClock;
+}
+
+void Clock::useVirtualClock()
+{
+	if (!activeClock->isVirtual()) {
+		activeClock = new VirtualClock();
+	}
+}
@@ -0,0 +1,75 @@
+#include <stdint.h>
+#include <pthread.h>
+
+#ifndef _INCL_CLOCK
+#define _INCL_CLOCK
+
+#define CLOCK_FOREVER                       0xFFFFFFFFFFFFFFFFULL
+
+/*
+** Where the time comes from, for everything that schedules
+** against it. Times are microseconds, monotonic from an
+** arbitrary point or wall clock from the epoch.
+**
+** Conditions waited on with waitUntil() must be created
+** against CLOCK_MONOTONIC and signalled with signal()...
+*/
+class Clock
+{
+public:
+    static Clock &      getInstance();
+
+    /*
+    ** Switch to a virtual clock, before any thread
+    ** starts...
+    */
+    static void         useVirtualClock();
+
+    virtual ~Clock() {}
+
+    virtual bool        isVirtual() = 0;
+
+    virtual uint64_t    getMonotonicTime() = 0;
+    virtual uint64_t    getWallTime() = 0;
+
+    virtual void        sleepUntil(uint64_t dueTime) = 0;
+    virtual void        waitUntil(pthread_cond_t * condition, pthread_mutex_t * mutex, uint64_t dueTime) = 0;
+    virtual void        signal(pthread_cond_t * condition) = 0;
+
+    /*
+    ** A virtual clock only moves on once every attached
+    ** thread is waiting on it, so each thread that drives
+    ** the schedule attaches for as long as it runs. Whoever
+    ** starts such a thread reserves its place first, so the
+    ** clock can't move on before the thread gets going...
+    */
+    virtual void        reserve() {}
+    virtual void        attach() {}
+    virtual void        detach() {}
+
+    void                sleep(uint64_t us) {
+        sleepUntil(getMonotonicTime() + us);
+    }
+
+    void                wait(pthread_cond_t * condition, pthread_mutex_t * mutex) {
+        waitUntil(condition, mutex, CLOCK_FOREVER);
+    }
+};
+
+/*
+** Attaches the calling thread to the clock for its
+** lifetime...
+*/
+class ClockAttachment
+{
+public:
+    ClockAttachment() {
+        Clock::getInstance().attach();
+    }
+
+    ~ClockAttachment() {
+        Clock::getInstance().detach();
+    }
+};
+
+#endif
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "configcache.h"
+#include "bctl_error.h"
+
+using namespace std;
+
+ConfigFileCache::ConfigFileCache()
+{
+    memset(&stats, 0, sizeof(ConfigCacheStats));
+
+    pageSize = sysconf(_SC_PAGESIZE);
+}
+
+ConfigFileCache::~ConfigFileCache()
+{
+    for (auto it = files.begin(); it != files.end(); ++it) {
+        releaseFile(it->second);
+    }
+
+    for (auto it = retired.begin(); it != retired.end(); ++it) {
+        releaseFile(*it);
+    }
+}
+
+void ConfigFileCache::releaseFile(CachedFile * file)
+{
+    if (file->isMapped) {
+        munmap(file->content, file->mappedLength);
+    }
+    else {
+        free(file->content);
+    }
+
+    delete file;
+}
+
+CachedFile * ConfigFileCache::readFile(const char * pszPath, struct stat * st)
+{
+    CachedFile *        file;
+    size_t              length = (size_t)st->st_size;
+    size_t              bytesRead = 0;
+    ssize_t             rtn;
+    int                 fd;
+
+    fd = open(pszPath, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        syslog(LOG_ERR, "Failed to open cfg item file %s with error %s", pszPath, strerror(errno));
+        throw bctl_error(bctl_error::buildMsg("ERROR reading config item file %s: %s", pszPath, strerror(errno)), __FILE__, __LINE__);
+    }
+
+    file = new CachedFile;
+
+    file->device = st->st_dev;
+    file->inode = st->st_ino;
+    file->modifiedTime = st->st_mtim;
+    file->size = st->st_size;
+    file->isUsed = true;
+
+    if (length >= CFG_CACHE_MMAP_THRESHOLD) {
+        /*
+        ** Reserve one byte more than the file, then map the file
+        ** over the start of it. The tail of the last file page is
+        ** zero filled by the kernel and if the file fills its last
+        ** page exactly, the terminator comes from the reservation...
+        */
+        file->mappedLength = ((length + 1 + pageSize - 1) / pageSize) * pageSize;
+        file->isMapped = true;
+
+        void * reserved = mmap(NULL, file->mappedLength, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (reserved == MAP_FAILED) {
+            close(fd);
+            delete file;
+            throw bctl_error(bctl_error::buildMsg("Failed to reserve %lu bytes for config item file %s", (unsigned long)length, pszPath), __FILE__, __LINE__);
+        }
+
+        void * mapped = mmap(reserved, length, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+
+        if (mapped == MAP_FAILED) {
+            munmap(reserved, file->mappedLength);
+            close(fd);
+            delete file;
+            throw bctl_error(bctl_error::buildMsg("Failed to mmap config item file %s: %s", pszPath, strerror(errno)), __FILE__, __LINE__);
+        }
+
+        file->content = (char *)mapped;
+
+        stats.mapCount++;
+        stats.bytesMapped += length;
+    }
+    else {
+        file->mappedLength = 0;
+        file->isMapped = false;
+        file->content = (char *)malloc(length + 1);
+
+        if (file->content == NULL) {
+            close(fd);
+            delete file;
+            throw bctl_error(bctl_error::buildMsg("Failed to allocate %lu bytes for config item file %s", (unsigned long)length + 1, pszPath), __FILE__, __LINE__);
+        }
+
+        while (bytesRead < length) {
+            rtn = read(fd, &file->content[bytesRead], length - bytesRead);
+
+            if (rtn < 0 && errno == EINTR) {
+                continue;
+            }
+            else if (rtn <= 0) {
+                /*
+                ** Either an error, or the file shrank under us...
+                */
+                const char * pszMsg = bctl_error::buildMsg(
+                                        "Read %lu of %lu bytes from config item file %s: %s",
+                                        (unsigned long)bytesRead,
+                                        (unsigned long)length,
+                                        pszPath,
+                                        (rtn < 0 ? strerror(errno) : "unexpected end of file"));
+                close(fd);
+                free(file->content);
+                delete file;
+                throw bctl_error(pszMsg, __FILE__, __LINE__);
+            }
+
+            bytesRead += (size_t)rtn;
+        }
+
+        file->content[length] = 0;
+
+        stats.bytesCopied += length;
+    }
+
+    close(fd);
+
+    return file;
+}
+
+void ConfigFileCache::begin()
+{
+    for (auto it = files.begin(); it != files.end(); ++it) {
+        it->second->isUsed = false;
+    }
+}
+
+/*
+** Returns the NUL terminated content of the file, throws
+** bctl_error if it cannot be read...
+*/
+const char * ConfigFileCache::load(const char * pszPath)
+{
+    struct stat         st;
+    CachedFile *        file;
+
+    if (stat(pszPath, &st) < 0) {
+        syslog(LOG_ERR, "Failed to stat cfg item file %s with error %s", pszPath, strerror(errno));
+        throw bctl_error(bctl_error::buildMsg("ERROR reading config item file %s: %s", pszPath, strerror(errno)), __FILE__, __LINE__);
+    }
+
+    auto it = files.find(pszPath);
+
+    if (it != files.end()) {
+        file = it->second;
+
+        if (file->device == st.st_dev &&
+            file->inode == st.st_ino &&
+            file->size == st.st_size &&
+            file->modifiedTime.tv_sec == st.st_mtim.tv_sec &&
+            file->modifiedTime.tv_nsec == st.st_mtim.tv_nsec)
+        {
+            file->isUsed = true;
+            stats.hits++;
+
+            return file->content;
+        }
+
+        /*
+        ** Changed since we last read it, the live config may
+        ** still point at the old content...
+        */
+        retired.push_back(file);
+        files.erase(it);
+    }
+
+    file = readFile(pszPath, &st);
+
+    files[pszPath] = file;
+    stats.misses++;
+
+    return file->content;
+}
+
+/*
+** Called once the config that used this pass's content has
+** been applied, releases anything no longer referenced...
+*/
+void ConfigFileCache::commit()
+{
+    for (auto it = retired.begin(); it != retired.end(); ++it) {
+        releaseFile(*it);
+    }
+
+    retired.clear();
+
+    for (auto it = files.begin(); it != files.end();) {
+        if (!it->second->isUsed) {
+            releaseFile(it->second);
+            it = files.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+void ConfigFileCache::getStats(ConfigCacheStats * stats)
+{
+    memcpy(stats, &this->stats, sizeof(ConfigCacheStats));
+
+    stats->numFiles = (uint32_t)files.size();
+}
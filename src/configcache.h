@@ -0,0 +1,73 @@
+#include <string>
+#include <map>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+using namespace std;
+
+#ifndef _INCL_CONFIGCACHE
+#define _INCL_CONFIGCACHE
+
+/*
+** Files at least this big are mmapped rather than
+** copied onto the heap...
+*/
+#define CFG_CACHE_MMAP_THRESHOLD        4096
+
+struct CachedFile
+{
+    dev_t               device;
+    ino_t               inode;
+    struct timespec     modifiedTime;
+    off_t               size;
+
+    char *              content;
+    size_t              mappedLength;
+    bool                isMapped;
+    bool                isUsed;
+};
+
+struct ConfigCacheStats
+{
+    uint32_t            hits;
+    uint32_t            misses;
+    uint32_t            numFiles;
+    uint32_t            mapCount;
+    uint64_t            bytesCopied;
+    uint64_t            bytesMapped;
+};
+
+/*
+** Content cache for the <file> indirections in the config file,
+** keyed by path and validated against the file's inode, mtime
+** and size, so an unchanged file costs a stat() on reload.
+**
+** Content is NUL terminated. A file that changes is replaced by
+** a fresh entry, the old content is retired and only released on
+** commit(), once the new config no longer references it...
+*/
+class ConfigFileCache
+{
+private:
+    map<string, CachedFile *>   files;
+    vector<CachedFile *>        retired;
+    ConfigCacheStats            stats;
+    long                        pageSize;
+
+    CachedFile *        readFile(const char * pszPath, struct stat * st);
+    void                releaseFile(CachedFile * file);
+
+public:
+    ConfigFileCache();
+    ~ConfigFileCache();
+
+    void                begin();
+    const char *        load(const char * pszPath);
+    void                commit();
+
+    void                getStats(ConfigCacheStats * stats);
+};
+
+#endif
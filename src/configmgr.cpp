@@ -4,12 +4,14 @@
 #include <limits.h>
 #include <syslog.h>
 #include <errno.h>
+#include <ctype.h>
 
 #include <map>
 #include <vector>
 
 #include "configmgr.h"
 #include "bctl_error.h"
+#include "trace.h"
 
 extern "C" {
 #include "strutils.h"
@@ -17,6 +19,64 @@ extern "C" {
 
 using namespace std;
 
+static const ConfigKeyDef   configSchema[] = { CONFIG_SCHEMA(CFG_KEY_DEF) };
+
+struct ConfigSchemaTable
+{
+    const ConfigKeyDef *    slots[CFG_TABLE_SIZE];
+
+    ConfigSchemaTable() {
+        memset(slots, 0, sizeof(slots));
+
+        for (int i = 0;i < CFG_NUM_KEYS;i++) {
+            slots[configSchema[i].key] = &configSchema[i];
+        }
+    }
+};
+
+static ConfigSchemaTable & getSchemaTable()
+{
+    static ConfigSchemaTable    table;
+    return table;
+}
+
+ConfigManager::ConfigManager()
+{
+    pthread_mutex_init(&mutex, NULL);
+
+    for (int i = 0;i < CFG_TABLE_SIZE;i++) {
+        entries[i].def = getSchemaTable().slots[i];
+        entries[i].pszFileValue = NULL;
+        entries[i].integerValue = 0;
+        entries[i].booleanValue = false;
+    }
+}
+
+/*
+** Map a key name from the config file to its ID, the runtime
+** hash is the same one that assigned the IDs at compile time...
+*/
+ConfigKey ConfigManager::lookupKey(const char * pszName)
+{
+    uint16_t                slot = cfg_slot(pszName);
+    const ConfigKeyDef *    def = getSchemaTable().slots[slot];
+
+    if (def == NULL || strcmp(def->pszName, pszName) != 0) {
+        return CFG_UNKNOWN;
+    }
+
+    return def->key;
+}
+
+const ConfigKeyDef * ConfigManager::getKeyDef(ConfigKey key)
+{
+    if (key >= CFG_TABLE_SIZE) {
+        return NULL;
+    }
+
+    return getSchemaTable().slots[key];
+}
+
 void ConfigManager::initialise(char * pszConfigFileName)
 {
     strcpy(this->szConfigFileName, pszConfigFileName);
@@ -24,26 +84,108 @@ void ConfigManager::initialise(char * pszConfigFileName)
     readConfig();
 }
 
-void ConfigManager::readConfig()
+/*
+** Throws if the value is not valid for the key's type or
+** is out of range...
+*/
+void ConfigManager::validate(const ConfigKeyDef * def, const char * pszValue, long * integerValue, bool * booleanValue)
 {
-    values.clear();
+    char *          pszEnd;
+
+    *integerValue = 0;
+    *booleanValue = false;
+
+    switch (def->type) {
+        case cfg_string:
+            break;
+
+        case cfg_integer:
+            errno = 0;
+            *integerValue = strtol(pszValue, &pszEnd, 10);
+
+            if (pszEnd == pszValue || *pszEnd != 0 || errno == ERANGE) {
+                throw bctl_error(bctl_error::buildMsg("Config %s value '%s' is not an integer", def->pszName, pszValue), __FILE__, __LINE__);
+            }
+
+            if (*integerValue < def->minimum || *integerValue > def->maximum) {
+                throw bctl_error(
+                    bctl_error::buildMsg(
+                        "Config %s value %ld is outside the range %ld to %ld",
+                        def->pszName,
+                        *integerValue,
+                        def->minimum,
+                        def->maximum),
+                    __FILE__,
+                    __LINE__);
+            }
+            break;
+
+        case cfg_boolean:
+            if (strcmp(pszValue, "yes") == 0 || strcmp(pszValue, "true") == 0 || strcmp(pszValue, "on") == 0) {
+                *booleanValue = true;
+            }
+            else if (strcmp(pszValue, "no") != 0 && strcmp(pszValue, "false") != 0 && strcmp(pszValue, "off") != 0) {
+                throw bctl_error(bctl_error::buildMsg("Config %s value '%s' is not a boolean", def->pszName, pszValue), __FILE__, __LINE__);
+            }
+            break;
+    }
+}
+
+/*
+** Trim a string where it lies, rather than copying it...
+*/
+static char * trimTrailingInPlace(char * str)
+{
+    size_t          length = strlen(str);
+
+    while (length > 0 && isspace((unsigned char)str[length - 1])) {
+        str[--length] = 0;
+    }
+
+    return str;
+}
+
+static char * trimInPlace(char * str)
+{
+    while (isspace((unsigned char)*str)) {
+        str++;
+    }
+
+    return trimTrailingInPlace(str);
+}
+
+/*
+** Parse and validate the config file, then apply only what has
+** changed. Nothing is applied if any key is unknown or invalid.
+** Listeners are notified of each changed key. Returns the number
+** of keys that changed...
+*/
+int ConfigManager::readConfig()
+{
+    vector<string>          newValues(CFG_TABLE_SIZE);
+    vector<const char *>    newFileValues(CFG_TABLE_SIZE, (const char *)NULL);
+    vector<bool>            isSet(CFG_TABLE_SIZE, false);
+    vector<long>            integerValues(CFG_TABLE_SIZE, 0);
+    vector<bool>            booleanValues(CFG_TABLE_SIZE, false);
+    vector<ConfigKey>       changedKeys;
+    ConfigKey               key;
 
 	FILE *			fptr;
 	char *			pszConfigLine;
     char *          pszKey;
     char *          pszValue;
-    char *          pszUntrimmedValue;
+    char *          pszDelim;
+    char *          pszComment;
 	char *			config = NULL;
     char *          reference = NULL;
-    char *          pszCfgItemFile;
+    const char *    pszFileValue = NULL;
 	int				fileLength = 0;
 	int				bytesRead = 0;
     int             i;
-    int             j;
-    int             valueLen = 0;
-    int             delimPos = 0;
 	const char *	delimiters = "\n\r";
 
+    TRACE_SPAN("readConfig");
+
 	fptr = fopen(szConfigFileName, "rt");
 
 	if (fptr == NULL) {
@@ -92,6 +234,8 @@ void ConfigManager::readConfig()
     */
     config[fileLength] = 0;
 
+    fileCache.begin();
+
 	pszConfigLine = strtok_r(config, delimiters, &reference);
 
 	while (pszConfigLine != NULL) {
@@ -103,113 +247,271 @@ void ConfigManager::readConfig()
             continue;
         }
 
-        if (strlen(pszConfigLine) > 0) {
-            for (i = 0;i < (int)strlen(pszConfigLine);i++) {
-                if (pszConfigLine[i] == '=') {
-                    pszKey = strndup(pszConfigLine, i);
-                    delimPos = i;
-                }
-                if (delimPos) {
-                    valueLen = strlen(pszConfigLine) - delimPos;
-
-                    for (j = delimPos + 1;j < (int)strlen(pszConfigLine);j++) {
-                        if (pszConfigLine[j] == '#') {
-                            valueLen = (j - delimPos - 1);
-                            break;
-                        }
-                    }
-
-                    pszUntrimmedValue = strndup(&pszConfigLine[delimPos + 1], valueLen);
-                    pszValue = str_trim_trailing(pszUntrimmedValue);
-
-                    /*
-                    ** Read the value from the file specified between <>...
-                    */
-                    if (pszValue[0] == '<' && str_endswith(pszValue, ">")) {
-                        pszValue[strlen(pszValue) - 1] = 0;
-                        pszCfgItemFile = str_trim(&pszValue[1]);
-
-                        free(pszValue);  
-
-                        FILE * f = fopen(pszCfgItemFile, "rt");
-
-                        if (f == NULL) {
-                            syslog(LOG_ERR, "Failed to open cfg item file %s with error %s", pszCfgItemFile, strerror(errno));
-                            throw bctl_error(bctl_error::buildMsg("ERROR reading config item file %s: %s", pszCfgItemFile, strerror(errno)), __FILE__, __LINE__);
-                        }
-
-                        fseek(f, 0L, SEEK_END);
-                        long propFileLength = ftell(f);
-                        rewind(f);
-
-                        pszValue = (char *)malloc(propFileLength + 1);
-
-                        if (pszValue == NULL) {
-                            syslog(LOG_ERR, "Failed to alocate %ld bytes for config item %s", propFileLength + 1, pszKey);
-                            throw bctl_error(bctl_error::buildMsg("Failed to allocate %ld bytes for config item %s", propFileLength + 1, pszKey), __FILE__, __LINE__);
-                        }
-
-                        fread(pszValue, propFileLength, 1, f);
-                        pszValue[propFileLength] = 0;
-
-                        fclose(f);
-                    }
-                    free(pszUntrimmedValue);
-                    break;
-                }
+        pszDelim = strchr(pszConfigLine, '=');
+
+        if (pszDelim == NULL) {
+            /*
+            ** Ignore lines that are only whitespace, anything
+            ** else without a key is an error...
+            */
+            if (strlen(trimInPlace(pszConfigLine)) > 0) {
+                const char * pszMsg = bctl_error::buildMsg("Malformed line in config file %s: '%s'", szConfigFileName, pszConfigLine);
+
+                free(config);
+                throw bctl_error(pszMsg, __FILE__, __LINE__);
+            }
+
+            pszConfigLine = strtok_r(NULL, delimiters, &reference);
+            continue;
+        }
+
+        /*
+        ** Split the line where it lies, the value runs up to
+        ** any trailing comment...
+        */
+        *pszDelim = 0;
+
+        pszKey = trimInPlace(pszConfigLine);
+        pszValue = &pszDelim[1];
+
+        pszComment = strchr(pszValue, '#');
+
+        if (pszComment != NULL) {
+            *pszComment = 0;
+        }
+
+        trimTrailingInPlace(pszValue);
+
+        /*
+        ** Read the value from the file specified between <>...
+        */
+        if (pszValue[0] == '<' && str_endswith(pszValue, ">")) {
+            pszValue[strlen(pszValue) - 1] = 0;
+
+            try {
+                pszFileValue = fileCache.load(trimInPlace(&pszValue[1]));
+            }
+            catch (bctl_error & e) {
+                free(config);
+                throw;
             }
 
-            delimPos = 0;
-            valueLen = 0;
+            pszValue[0] = 0;
+        }
+
+        key = lookupKey(pszKey);
 
-            values[string(pszKey)] = string(pszValue);
+        if (key == CFG_UNKNOWN) {
+            syslog(LOG_ERR, "Unknown key %s in config file %s", pszKey, szConfigFileName);
 
-            free(pszKey);
-            free(pszValue);
+            const char * pszMsg = bctl_error::buildMsg("Unknown config key '%s' in config file %s", pszKey, szConfigFileName);
+
+            free(config);
+
+            throw bctl_error(pszMsg, __FILE__, __LINE__);
         }
 
+        newValues[key] = string(pszValue);
+        newFileValues[key] = pszFileValue;
+        isSet[key] = true;
+
+        pszFileValue = NULL;
+
         pszConfigLine = strtok_r(NULL, delimiters, &reference);
 	}
 
 	free(config);
 
+    /*
+    ** Keys not in the file take their default, then validate
+    ** everything before any of it is applied...
+    */
+    for (i = 0;i < CFG_TABLE_SIZE;i++) {
+        const ConfigKeyDef * def = getSchemaTable().slots[i];
+
+        if (def == NULL) {
+            continue;
+        }
+
+        if (!isSet[i]) {
+            newValues[i] = string(def->pszDefault);
+        }
+
+        long integerValue;
+        bool booleanValue;
+
+        validate(
+                def,
+                (newFileValues[i] != NULL ? newFileValues[i] : newValues[i].c_str()),
+                &integerValue,
+                &booleanValue);
+
+        integerValues[i] = integerValue;
+        booleanValues[i] = booleanValue;
+    }
+
+    /*
+    ** Unchanged values are left alone, so pointers previously
+    ** returned by getValue() for them remain valid. A changed
+    ** value's old storage goes, so threads that read a key while
+    ** a reload may be going on copy it with getValue(key, buffer,
+    ** length) instead...
+    */
+    pthread_mutex_lock(&mutex);
+
+    for (i = 0;i < CFG_TABLE_SIZE;i++) {
+        ConfigEntry & entry = entries[i];
+
+        if (entry.def == NULL) {
+            continue;
+        }
+
+        /*
+        ** Content from a file is compared by identity, the
+        ** cache hands back the same pointer if it's unchanged...
+        */
+        if (!isConfigured || entry.pszFileValue != newFileValues[i] || entry.value != newValues[i]) {
+            entry.value = newValues[i];
+            entry.pszFileValue = newFileValues[i];
+            entry.integerValue = integerValues[i];
+            entry.booleanValue = booleanValues[i];
+
+            changedKeys.push_back(entry.def->key);
+        }
+    }
+
     isConfigured = true;
+
+    /*
+    ** Nothing live references retired file content now...
+    */
+    fileCache.commit();
+
+    pthread_mutex_unlock(&mutex);
+
+    notifyListeners(changedKeys);
+
+    return (int)changedKeys.size();
 }
 
-const char * ConfigManager::getValue(const char * key)
+void ConfigManager::subscribe(ConfigKey key, ConfigListener * listener)
 {
+    pthread_mutex_lock(&mutex);
+    listeners.insert(pair<ConfigKey, ConfigListener *>(key, listener));
+    pthread_mutex_unlock(&mutex);
+}
+
+void ConfigManager::notifyListeners(vector<ConfigKey> & changedKeys)
+{
+    vector< pair<ConfigListener *, ConfigKey> >     notifications;
+
+    pthread_mutex_lock(&mutex);
+
+    for (auto key = changedKeys.cbegin(); key != changedKeys.cend(); ++key) {
+        auto range = listeners.equal_range(*key);
+
+        for (auto it = range.first; it != range.second; ++it) {
+            notifications.push_back(pair<ConfigListener *, ConfigKey>(it->second, *key));
+        }
+    }
+
+    pthread_mutex_unlock(&mutex);
+
+    /*
+    ** Called without the lock held, listeners are free
+    ** to call back into getValue()...
+    */
+    for (auto it = notifications.cbegin(); it != notifications.cend(); ++it) {
+        it->first->configChanged(it->second, getValue(it->second));
+    }
+}
+
+const char * ConfigManager::getKeyName(ConfigKey key)
+{
+    const ConfigKeyDef * def = getKeyDef(key);
+
+    return (def != NULL ? def->pszName : "<unknown>");
+}
+
+const char * ConfigManager::getValue(ConfigKey key)
+{
+    const char *        pszValue;
+
     if (!isConfigured) {
         readConfig();
     }
 
-    string & value = values[key];
+    pthread_mutex_lock(&mutex);
+
+    if (entries[key].pszFileValue != NULL) {
+        pszValue = entries[key].pszFileValue;
+    }
+    else {
+        pszValue = entries[key].value.c_str();
+    }
+
+    pthread_mutex_unlock(&mutex);
 
-    return value.c_str();
+    return pszValue;
 }
 
-bool ConfigManager::getValueAsBoolean(const char * key)
+/*
+** Copies the value under the lock, the copy stays good whatever
+** a reload does to the key...
+*/
+const char * ConfigManager::getValue(ConfigKey key, char * pszBuffer, size_t bufferLength)
 {
-    const char *        pszValue;
+    if (!isConfigured) {
+        readConfig();
+    }
 
-    pszValue = getValue(key);
+    pthread_mutex_lock(&mutex);
 
-    return ((strcmp(pszValue, "yes") == 0 || strcmp(pszValue, "true") == 0 || strcmp(pszValue, "on") == 0) ? true : false);
+    if (entries[key].pszFileValue != NULL) {
+        snprintf(pszBuffer, bufferLength, "%s", entries[key].pszFileValue);
+    }
+    else {
+        snprintf(pszBuffer, bufferLength, "%s", entries[key].value.c_str());
+    }
+
+    pthread_mutex_unlock(&mutex);
+
+    return pszBuffer;
 }
 
-int ConfigManager::getValueAsInteger(const char * key)
+bool ConfigManager::getValueAsBoolean(ConfigKey key)
 {
-    const char *        pszValue;
+    if (!isConfigured) {
+        readConfig();
+    }
 
-    pszValue = getValue(key);
+    return entries[key].booleanValue;
+}
 
-    return atoi(pszValue);
+int ConfigManager::getValueAsInteger(ConfigKey key)
+{
+    if (!isConfigured) {
+        readConfig();
+    }
+
+    return (int)entries[key].integerValue;
+}
+
+void ConfigManager::getFileCacheStats(ConfigCacheStats * stats)
+{
+    pthread_mutex_lock(&mutex);
+    fileCache.getStats(stats);
+    pthread_mutex_unlock(&mutex);
 }
 
 void ConfigManager::dumpConfig()
 {
+    /*
+    ** Unchanged <file> values cost only a stat()...
+    */
     readConfig();
 
-    for (auto it = values.cbegin(); it != values.cend(); ++it) {
-        printf("'%s' = '%s'\n", it->first.c_str(), it->second.c_str());
+    for (int i = 0;i < CFG_NUM_KEYS;i++) {
+        printf("'%s' = '%s'\n", configSchema[i].pszName, getValue(configSchema[i].key));
     }
 }
\ No newline at end of file
@@ -2,12 +2,37 @@
 #include <map>
 #include <vector>
 #include <limits.h>
+#include <pthread.h>
+
+#include "configschema.h"
+#include "configcache.h"
 
 using namespace std;
 
 #ifndef _INCL_CONFIGMGR
 #define _INCL_CONFIGMGR
 
+/*
+** Implemented by anything that needs to react when the value
+** of a config key changes on reload...
+*/
+class ConfigListener
+{
+public:
+    virtual ~ConfigListener() {}
+
+    virtual void            configChanged(ConfigKey key, const char * value) = 0;
+};
+
+struct ConfigEntry
+{
+    const ConfigKeyDef *    def;
+    string                  value;
+    const char *            pszFileValue;
+    long                    integerValue;
+    bool                    booleanValue;
+};
+
 class ConfigManager
 {
 public:
@@ -18,22 +43,37 @@ public:
 
 private:
     char                    szConfigFileName[PATH_MAX];
-    map<string, string>     values;
+    ConfigEntry             entries[CFG_TABLE_SIZE];
+    ConfigFileCache         fileCache;
+    multimap<ConfigKey, ConfigListener *>   listeners;
+    pthread_mutex_t         mutex;
     bool                    isConfigured = false;
 
-    ConfigManager() {}
+    ConfigManager();
+
+    void                    notifyListeners(vector<ConfigKey> & changedKeys);
+    void                    validate(const ConfigKeyDef * def, const char * pszValue, long * integerValue, bool * booleanValue);
 
 public:
     ~ConfigManager() {}
 
+    static ConfigKey        lookupKey(const char * pszName);
+    static const ConfigKeyDef * getKeyDef(ConfigKey key);
+
     void                    initialise(char * pszConfigFileName);
-    void                    readConfig();
+    int                     readConfig();
+
+    void                    subscribe(ConfigKey key, ConfigListener * listener);
+
+    const char *            getKeyName(ConfigKey key);
+    const char *            getValue(ConfigKey key);
+    const char *            getValue(ConfigKey key, char * pszBuffer, size_t bufferLength);
+    bool                    getValueAsBoolean(ConfigKey key);
+    int                     getValueAsInteger(ConfigKey key);
 
-    const char *            getValue(const char * key);
-    bool                    getValueAsBoolean(const char * key);
-    int                     getValueAsInteger(const char * key);
+    void                    getFileCacheStats(ConfigCacheStats * stats);
 
     void                    dumpConfig();
 };
 
-#endif
\ No newline at end of file
+#endif
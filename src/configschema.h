@@ -0,0 +1,163 @@
+#include <stdint.h>
+
+#ifndef _INCL_CONFIGSCHEMA
+#define _INCL_CONFIGSCHEMA
+
+enum ConfigType {
+    cfg_string,
+    cfg_integer,
+    cfg_boolean
+};
+
+/*
+** Every config key bctl understands, as:
+**
+**   X(id, name, type, default, minimum, maximum)
+**
+** The range only applies to integer keys. Anything in the
+** config file that is not declared here is rejected at load
+** time, as is an integer outside its range...
+*/
+#define CONFIG_SCHEMA(X) \
+    X(LOG_FILENAME,             "log.filename",             cfg_string,     "",                                                     0,      0) \
+    X(LOG_LEVEL,                "log.level",                cfg_string,     "LOG_LEVEL_INFO | LOG_LEVEL_ERROR | LOG_LEVEL_FATAL",   0,      0) \
+    X(CAPTURE_PROGNAME,         "capture.progname",         cfg_string,     "raspistill",                                           0,      0) \
+    X(CAPTURE_ENCODING,         "capture.encoding",         cfg_string,     "jpg",                                                  0,      0) \
+    X(CAPTURE_JPGQUALITY,       "capture.jpgquality",       cfg_integer,    "75",                                                   1,      100) \
+    X(CAPTURE_HRES,             "capture.hres",             cfg_integer,    "1280",                                                 64,     4056) \
+    X(CAPTURE_VRES,             "capture.vres",             cfg_integer,    "720",                                                  64,     3040) \
+    X(CAPTURE_ISO,              "capture.iso",              cfg_integer,    "200",                                                  100,    800) \
+    X(CAPTURE_OUTPUTTEMPLATE,   "capture.outputtemplate",   cfg_string,     "img_%04d.jpg",                                         0,      0) \
+    X(CAPTURE_FREQUENCY,        "capture.frequency",        cfg_integer,    "4",                                                    1,      86400) \
+    X(CAPTURE_PIPENAME,         "capture.pipename",         cfg_string,     "pidpipe",                                              0,      0) \
+    X(CAPTURE_BURSTINTERVAL,    "capture.burstinterval",    cfg_integer,    "1000",                                                 100,    60000) \
+    X(CAPTURE_CHECKPOINTFILE,   "capture.checkpointfile",   cfg_string,     "bctl.checkpoint",                                      0,      0) \
+    X(CAPTURE_SCANTHREADS,      "capture.scanthreads",      cfg_integer,    "2",                                                    1,      16) \
+    X(CONTAINER_ENABLE,         "container.enable",         cfg_boolean,    "no",                                                   0,      0) \
+    X(CONTAINER_TEMPLATE,       "container.template",       cfg_string,     "seg_%04d.bcs",                                         0,      0) \
+    X(CONTAINER_SEGMENTSIZE,    "container.segmentsize",    cfg_integer,    "256",                                                  1,      4095) \
+    X(CONTAINER_MAXFRAMES,      "container.maxframes",      cfg_integer,    "4096",                                                 16,     65536) \
+    X(CONTAINER_REMOVEFRAMES,   "container.removeframes",   cfg_boolean,    "yes",                                                  0,      0) \
+    X(CHECKSUM_ENABLE,          "checksum.enable",          cfg_boolean,    "yes",                                                  0,      0) \
+    X(CHECKSUM_MANIFEST,        "checksum.manifest",        cfg_string,     "bctl.crc32c",                                          0,      0) \
+    X(CAPTURE_BACKEND,          "capture.backend",          cfg_string,     "program",                                              0,      0) \
+    X(SYNTHETIC_RATE,           "synthetic.rate",           cfg_integer,    "0",                                                    0,      1000) \
+    X(SYNTHETIC_FRAMESIZE,      "synthetic.framesize",      cfg_integer,    "0",                                                    0,      16777216) \
+    X(SSDV_ENABLE,              "ssdv.enable",              cfg_boolean,    "no",                                                   0,      0) \
+    X(SSDV_CALLSIGN,            "ssdv.callsign",            cfg_string,     "BCTL",                                                 0,      0) \
+    X(SSDV_SINK,                "ssdv.sink",                cfg_string,     "udp:127.0.0.1:7300",                                   0,      0) \
+    X(SSDV_FEC,                 "ssdv.fec",                 cfg_boolean,    "yes",                                                  0,      0) \
+    X(DOWNLINK_BUDGET,          "downlink.budget",          cfg_integer,    "0",                                                    0,      10000000) \
+    X(DOWNLINK_WINDOW,          "downlink.window",          cfg_integer,    "600",                                                  0,      86400) \
+    X(DOWNLINK_QUEUELENGTH,     "downlink.queuelength",     cfg_integer,    "32",                                                   2,      1024) \
+    X(GPS_ENABLE,               "gps.enable",               cfg_boolean,    "no",                                                   0,      0) \
+    X(GPS_DEVICE,               "gps.device",               cfg_string,     "/dev/serial0",                                         0,      0) \
+    X(GPS_BAUD,                 "gps.baud",                 cfg_integer,    "9600",                                                 4800,   115200) \
+    X(EXIF_ENABLE,              "exif.enable",              cfg_boolean,    "no",                                                   0,      0) \
+    X(PHASE_ENABLE,             "phase.enable",             cfg_boolean,    "no",                                                   0,      0) \
+    X(PHASE_PRELAUNCH_FREQUENCY, "phase.prelaunch.frequency", cfg_integer,    "60",                                                   0,      86400) \
+    X(PHASE_PRELAUNCH_RESOLUTION, "phase.prelaunch.resolution", cfg_string,     "",                                                     0,      0) \
+    X(PHASE_ASCENT_FREQUENCY,   "phase.ascent.frequency",   cfg_integer,    "0",                                                    0,      86400) \
+    X(PHASE_ASCENT_RESOLUTION,  "phase.ascent.resolution",  cfg_string,     "",                                                     0,      0) \
+    X(PHASE_FLOAT_FREQUENCY,    "phase.float.frequency",    cfg_integer,    "0",                                                    0,      86400) \
+    X(PHASE_FLOAT_RESOLUTION,   "phase.float.resolution",   cfg_string,     "",                                                     0,      0) \
+    X(PHASE_BURST_FREQUENCY,    "phase.burst.frequency",    cfg_integer,    "1",                                                    0,      86400) \
+    X(PHASE_BURST_RESOLUTION,   "phase.burst.resolution",   cfg_string,     "",                                                     0,      0) \
+    X(PHASE_DESCENT_FREQUENCY,  "phase.descent.frequency",  cfg_integer,    "0",                                                    0,      86400) \
+    X(PHASE_DESCENT_RESOLUTION, "phase.descent.resolution", cfg_string,     "",                                                     0,      0) \
+    X(PHASE_LANDED_FREQUENCY,   "phase.landed.frequency",   cfg_integer,    "300",                                                  0,      86400) \
+    X(PHASE_LANDED_RESOLUTION,  "phase.landed.resolution",  cfg_string,     "",                                                     0,      0) \
+    X(TRACE_ENABLE,             "trace.enable",             cfg_boolean,    "no",                                                   0,      0) \
+    X(TRACE_FILE,               "trace.file",               cfg_string,     "bctl.trace.json",                                      0,      0) \
+    X(TRACE_BUFFERSIZE,         "trace.buffersize",         cfg_integer,    "16384",                                                256,    1048576) \
+    X(RESOURCES_ENABLE,         "resources.enable",         cfg_boolean,    "yes",                                                  0,      0) \
+    X(RESOURCES_INTERVAL,       "resources.interval",       cfg_integer,    "10",                                                   1,      3600) \
+    X(RESOURCES_HISTORY,        "resources.history",        cfg_integer,    "60",                                                   2,      1440) \
+    X(CAPTURE_SLACK,            "capture.slack",            cfg_integer,    "0",                                                    0,      60000) \
+    X(PIPELINE_TAG,             "pipeline.tag",             cfg_string,     "block:16",                                             0,      0) \
+    X(PIPELINE_CHECKSUM,        "pipeline.checksum",        cfg_string,     "drop:64",                                              0,      0) \
+    X(PIPELINE_SSDV,            "pipeline.ssdv",            cfg_string,     "sample:32",                                            0,      0) \
+    X(PIPELINE_PACK,            "pipeline.pack",            cfg_string,     "block:64",                                             0,      0) \
+    X(PIPELINE_PUBLISH,         "pipeline.publish",         cfg_string,     "drop:4",                                               0,      0) \
+    X(PIPELINE_PREVIEW,         "pipeline.preview",         cfg_string,     "drop:4",                                               0,      0) \
+    X(PIPELINE_TIMELAPSE,       "pipeline.timelapse",       cfg_string,     "drop:64",                                              0,      0) \
+    X(PIPELINE_SIMILARITY,      "pipeline.similarity",      cfg_string,     "drop:16:2",                                            0,      0) \
+    X(SHM_ENABLE,               "shm.enable",               cfg_boolean,    "yes",                                                  0,      0) \
+    X(SHM_NAME,                 "shm.name",                 cfg_string,     "/bctl",                                                0,      0) \
+    X(SHM_INTERVAL,             "shm.interval",             cfg_integer,    "1000",                                                 100,    60000) \
+    X(PREVIEW_ENABLE,           "preview.enable",           cfg_boolean,    "no",                                                   0,      0) \
+    X(PREVIEW_ADDRESS,          "preview.address",          cfg_string,     "127.0.0.1",                                            0,      0) \
+    X(PREVIEW_PORT,             "preview.port",             cfg_integer,    "8080",                                                 1,      65535) \
+    X(PREVIEW_MAXCLIENTS,       "preview.maxclients",       cfg_integer,    "4",                                                    1,      32) \
+    X(TIMELAPSE_ENABLE,         "timelapse.enable",         cfg_boolean,    "no",                                                   0,      0) \
+    X(TIMELAPSE_TEMPLATE,       "timelapse.template",       cfg_string,     "timelapse_%04d.avi",                                   0,      0) \
+    X(TIMELAPSE_FPS,            "timelapse.fps",            cfg_integer,    "25",                                                   1,      120) \
+    X(SIMILARITY_ENABLE,        "similarity.enable",        cfg_boolean,    "no",                                                   0,      0) \
+    X(SIMILARITY_THRESHOLD,     "similarity.threshold",     cfg_integer,    "150",                                                  0,      25500) \
+    X(SIMILARITY_ACTION,        "similarity.action",        cfg_string,     "tag",                                                  0,      0) \
+    X(WATCHDOG_ENABLE,          "watchdog.enable",          cfg_boolean,    "yes",                                                  0,      0) \
+    X(WATCHDOG_TIMEOUT,         "watchdog.timeout",         cfg_integer,    "30",                                                   1,      3600) \
+    X(WATCHDOG_INTERVAL,        "watchdog.interval",        cfg_integer,    "1000",                                                 100,    60000) \
+    X(WATCHDOG_ACTION,          "watchdog.action",          cfg_string,     "capture",                                              0,      0) \
+    X(CONTROL_SOCKETNAME,       "control.socketname",       cfg_string,     "bctl.sock",                                            0,      0) \
+    X(BCTL_CPUTEMPFILE,         "bctl.cputempfile",         cfg_string,     "/sys/class/thermal/thermal_zone0/temp",                0,      0)
+
+/*
+** Key IDs are slots in a perfect hash table, computed at compile
+** time from the key name with a seeded FNV-1a hash. If adding a
+** key trips the static_assert below, pick another CFG_HASH_SEED...
+*/
+#define CFG_TABLE_SIZE                  256
+#define CFG_HASH_SEED                   0x814D8E7FU
+
+constexpr uint32_t cfg_hash(const char * s, uint32_t h)
+{
+    return (*s ? cfg_hash(s + 1, (h ^ (uint8_t)*s) * 16777619U) : h);
+}
+
+constexpr uint32_t cfg_mix(uint32_t h)
+{
+    return ((h ^ (h >> 15)) & (CFG_TABLE_SIZE - 1));
+}
+
+constexpr uint16_t cfg_slot(const char * pszName)
+{
+    return (uint16_t)cfg_mix(cfg_hash(pszName, CFG_HASH_SEED));
+}
+
+#define CFG_KEY_ENUM(id, name, type, dflt, min, max)    CFG_##id = cfg_slot(name),
+#define CFG_KEY_ID(id, name, type, dflt, min, max)      CFG_##id,
+#define CFG_KEY_DEF(id, name, type, dflt, min, max)     {CFG_##id, name, type, dflt, min, max},
+
+enum ConfigKey : uint16_t {
+    CONFIG_SCHEMA(CFG_KEY_ENUM)
+    CFG_UNKNOWN = CFG_TABLE_SIZE
+};
+
+struct ConfigKeyDef
+{
+    ConfigKey       key;
+    const char *    pszName;
+    ConfigType      type;
+    const char *    pszDefault;
+    long            minimum;
+    long            maximum;
+};
+
+constexpr ConfigKey     configKeyIDs[] = { CONFIG_SCHEMA(CFG_KEY_ID) };
+
+#define CFG_NUM_KEYS                    (int)(sizeof(configKeyIDs) / sizeof(ConfigKey))
+
+constexpr bool cfg_isUniqueFrom(int i, int j)
+{
+    return (j >= CFG_NUM_KEYS ? true : (configKeyIDs[i] != configKeyIDs[j] && cfg_isUniqueFrom(i, j + 1)));
+}
+
+constexpr bool cfg_isPerfect(int i)
+{
+    return (i >= CFG_NUM_KEYS ? true : (cfg_isUniqueFrom(i, i + 1) && cfg_isPerfect(i + 1)));
+}
+
+static_assert(cfg_isPerfect(0), "Config key hash collision, choose a new CFG_HASH_SEED");
+
+#endif
@@ -0,0 +1,661 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include "configmgr.h"
+#include "logger.h"
+#include "bctl_error.h"
+#include "currenttime.h"
+#include "crc32c.h"
+#include "resume.h"
+#include "container.h"
+
+static uint64_t getWallClockTime()
+{
+	struct timeval		tv;
+
+	gettimeofday(&tv, NULL);
+
+	return ((uint64_t)tv.tv_sec * 1000000ULL) + (uint64_t)tv.tv_usec;
+}
+
+static void writeFully(int fd, const void * data, size_t length, off_t offset)
+{
+	const uint8_t *		p = (const uint8_t *)data;
+	ssize_t				rtn;
+
+	while (length > 0) {
+		rtn = pwrite(fd, p, length, offset);
+
+		if (rtn < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			throw bctl_error(bctl_error::buildMsg("Failed to write segment: %s", strerror(errno)), __FILE__, __LINE__);
+		}
+
+		p += rtn;
+		offset += rtn;
+		length -= (size_t)rtn;
+	}
+}
+
+ContainerWriter::~ContainerWriter()
+{
+	if (this->fd >= 0) {
+		try {
+			seal();
+		}
+		catch (bctl_error & e) {
+			::close(this->fd);
+		}
+	}
+}
+
+void ContainerWriter::create(const char * pszPath, uint32_t segmentNumber, uint64_t segmentSize, uint32_t maxFrames)
+{
+	this->fd = open(pszPath, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+
+	if (this->fd < 0) {
+		throw bctl_error(bctl_error::buildMsg("Failed to create segment %s: %s", pszPath, strerror(errno)), __FILE__, __LINE__);
+	}
+
+	memset(&this->header, 0, sizeof(ContainerHeader));
+
+	memcpy(this->header.magic, CONTAINER_MAGIC, sizeof(this->header.magic));
+	this->header.version = CONTAINER_VERSION;
+	this->header.segmentNumber = segmentNumber;
+	this->header.maxFrames = maxFrames;
+	this->header.segmentSize = segmentSize;
+	this->header.dataOffset = CONTAINER_ALIGN(CONTAINER_HEADER_SIZE + (uint64_t)maxFrames * sizeof(ContainerIndexEntry), 4096);
+	this->header.createdTime = getWallClockTime();
+
+	/*
+	** Allocate the whole segment up front, so appending a frame
+	** doesn't have to touch the FAT. If the filesystem can't,
+	** the file just grows as we go...
+	*/
+	if (fallocate(this->fd, 0, 0, (off_t)segmentSize) < 0) {
+		Logger::getInstance().logDebug("Could not pre-allocate segment %s: %s", pszPath, strerror(errno));
+
+		if (ftruncate(this->fd, (off_t)this->header.dataOffset) < 0) {
+			throw bctl_error(bctl_error::buildMsg("Failed to size segment %s: %s", pszPath, strerror(errno)), __FILE__, __LINE__);
+		}
+	}
+
+	writeFully(this->fd, &this->header, sizeof(ContainerHeader), 0);
+}
+
+bool ContainerWriter::hasSpace(size_t length)
+{
+	uint64_t		recordLength = CONTAINER_ALIGN(sizeof(ContainerRecord) + length, 8);
+
+	return (this->header.frameCount < this->header.maxFrames &&
+			this->header.dataOffset + this->header.dataLength + recordLength <= this->header.segmentSize);
+}
+
+/*
+** The frame goes in first, then its index entry, then the header
+** with the new count, so a reader never sees a partial frame...
+*/
+void ContainerWriter::append(uint32_t sequence, uint64_t timestamp, const uint8_t * data, size_t length, uint32_t crc)
+{
+	ContainerRecord			record;
+	ContainerIndexEntry		entry;
+	struct iovec			iov[2];
+	uint64_t				offset = this->header.dataOffset + this->header.dataLength;
+	ssize_t					rtn;
+
+	record.magic = CONTAINER_RECORD_MAGIC;
+	record.sequence = sequence;
+	record.length = (uint32_t)length;
+	record.crc = crc;
+
+	iov[0].iov_base = &record;
+	iov[0].iov_len = sizeof(ContainerRecord);
+	iov[1].iov_base = (void *)data;
+	iov[1].iov_len = length;
+
+	rtn = pwritev(this->fd, iov, 2, (off_t)offset);
+
+	if (rtn < 0 || (size_t)rtn != sizeof(ContainerRecord) + length) {
+		/*
+		** Short writes are rare enough to just finish off
+		** the slow way...
+		*/
+		if (rtn < 0 && errno != EINTR) {
+			throw bctl_error(bctl_error::buildMsg("Failed to write frame %u: %s", sequence, strerror(errno)), __FILE__, __LINE__);
+		}
+
+		writeFully(this->fd, &record, sizeof(ContainerRecord), (off_t)offset);
+		writeFully(this->fd, data, length, (off_t)(offset + sizeof(ContainerRecord)));
+	}
+
+	entry.sequence = sequence;
+	entry.length = (uint32_t)length;
+	entry.offset = offset;
+	entry.timestamp = timestamp;
+	entry.crc = crc;
+	entry.reserved = 0;
+
+	writeFully(
+		this->fd,
+		&entry,
+		sizeof(ContainerIndexEntry),
+		(off_t)(CONTAINER_HEADER_SIZE + (uint64_t)this->header.frameCount * sizeof(ContainerIndexEntry)));
+
+	this->header.frameCount++;
+	this->header.dataLength += CONTAINER_ALIGN(sizeof(ContainerRecord) + length, 8);
+
+	writeFully(this->fd, &this->header, sizeof(ContainerHeader), 0);
+}
+
+/*
+** Give back the unused part of the pre-allocation and
+** make sure it's all on the card...
+*/
+void ContainerWriter::seal()
+{
+	int			segmentFd = this->fd;
+
+	this->fd = -1;
+
+	this->header.isSealed = 1;
+
+	writeFully(segmentFd, &this->header, sizeof(ContainerHeader), 0);
+
+	if (ftruncate(segmentFd, (off_t)(this->header.dataOffset + this->header.dataLength)) < 0) {
+		Logger::getInstance().logError("Failed to trim segment %u: %s", this->header.segmentNumber, strerror(errno));
+	}
+
+	fdatasync(segmentFd);
+	::close(segmentFd);
+}
+
+ContainerReader::~ContainerReader()
+{
+	close();
+}
+
+void ContainerReader::open(const char * pszPath)
+{
+	struct stat		st;
+	int				fd;
+
+	close();
+
+	fd = ::open(pszPath, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		throw bctl_error(bctl_error::buildMsg("Failed to open segment %s: %s", pszPath, strerror(errno)), __FILE__, __LINE__);
+	}
+
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < CONTAINER_HEADER_SIZE) {
+		::close(fd);
+		throw bctl_error(bctl_error::buildMsg("Segment %s is truncated", pszPath), __FILE__, __LINE__);
+	}
+
+	void * p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+	::close(fd);
+
+	if (p == MAP_FAILED) {
+		throw bctl_error(bctl_error::buildMsg("Failed to mmap segment %s: %s", pszPath, strerror(errno)), __FILE__, __LINE__);
+	}
+
+	this->base = (uint8_t *)p;
+	this->mappedLength = (size_t)st.st_size;
+	this->header = (const ContainerHeader *)this->base;
+	this->index = (const ContainerIndexEntry *)(this->base + CONTAINER_HEADER_SIZE);
+
+	if (memcmp(this->header->magic, CONTAINER_MAGIC, sizeof(this->header->magic)) != 0 || this->header->version != CONTAINER_VERSION) {
+		close();
+		throw bctl_error(bctl_error::buildMsg("%s is not a bctl segment", pszPath), __FILE__, __LINE__);
+	}
+
+	this->frameCount = this->header->frameCount;
+
+	if (this->frameCount > this->header->maxFrames) {
+		this->frameCount = this->header->maxFrames;
+	}
+
+	/*
+	** Don't trust anything that runs off the end of the file,
+	** it may not have been sealed...
+	*/
+	while (this->frameCount > 0) {
+		const ContainerIndexEntry * last = &this->index[this->frameCount - 1];
+
+		if (CONTAINER_HEADER_SIZE + (uint64_t)this->frameCount * sizeof(ContainerIndexEntry) <= this->mappedLength &&
+			last->offset + sizeof(ContainerRecord) + last->length <= this->mappedLength)
+		{
+			break;
+		}
+
+		this->frameCount--;
+	}
+}
+
+void ContainerReader::close()
+{
+	if (this->base != NULL) {
+		munmap(this->base, this->mappedLength);
+	}
+
+	this->base = NULL;
+	this->mappedLength = 0;
+	this->header = NULL;
+	this->index = NULL;
+	this->frameCount = 0;
+}
+
+const ContainerIndexEntry * ContainerReader::getEntry(uint32_t i)
+{
+	if (i >= this->frameCount) {
+		return NULL;
+	}
+
+	return &this->index[i];
+}
+
+/*
+** Frames are appended in sequence order, so binary search the
+** index, falling back to a linear search in case the sequence
+** was ever reset...
+*/
+const ContainerIndexEntry * ContainerReader::findFrame(uint32_t sequence)
+{
+	uint32_t		low = 0;
+	uint32_t		high = this->frameCount;
+	uint32_t		i;
+
+	while (low < high) {
+		uint32_t middle = low + ((high - low) / 2);
+
+		if (this->index[middle].sequence < sequence) {
+			low = middle + 1;
+		}
+		else {
+			high = middle;
+		}
+	}
+
+	if (low < this->frameCount && this->index[low].sequence == sequence) {
+		return &this->index[low];
+	}
+
+	for (i = 0;i < this->frameCount;i++) {
+		if (this->index[i].sequence == sequence) {
+			return &this->index[i];
+		}
+	}
+
+	return NULL;
+}
+
+const uint8_t * ContainerReader::getFrameData(const ContainerIndexEntry * entry)
+{
+	return this->base + entry->offset + sizeof(ContainerRecord);
+}
+
+bool ContainerReader::verifyFrame(const ContainerIndexEntry * entry)
+{
+	const ContainerRecord * record = (const ContainerRecord *)(this->base + entry->offset);
+
+	if (record->magic != CONTAINER_RECORD_MAGIC || record->sequence != entry->sequence || record->length != entry->length) {
+		return false;
+	}
+
+	return (crc32c(0, getFrameData(entry), entry->length) == entry->crc);
+}
+
+/*
+** The highest numbered segment in the directory, 0 if none...
+*/
+static uint32_t findLastSegment(const char * pszDir, const char * pszTemplate)
+{
+	uint32_t		lastSegment = 0;
+	uint32_t		filesScanned;
+
+	DirectoryScan scan(pszTemplate, 1);
+
+	scan.scan(pszDir, &lastSegment, &filesScanned);
+
+	return lastSegment;
+}
+
+/*
+** The sequence of the last frame packed into the newest segment,
+** for resuming when the loose frames have been removed...
+*/
+bool findLastPackedFrame(uint32_t * sequence)
+{
+	char			szSegmentTemplate[PATH_MAX];
+	char			szDir[PATH_MAX];
+	char			szTemplate[PATH_MAX];
+	char			szPath[PATH_MAX];
+	uint32_t		segmentNumber;
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	cfg.getValue(CFG_CONTAINER_TEMPLATE, szSegmentTemplate, PATH_MAX);
+
+	splitOutputPath(szSegmentTemplate, szDir, szTemplate);
+
+	segmentNumber = findLastSegment(szDir, szTemplate);
+
+	/*
+	** The newest segment may have been created just before a
+	** crash and still be empty...
+	*/
+	while (segmentNumber > 0) {
+		if (formatOutputTemplate(szSegmentTemplate, segmentNumber, szPath, PATH_MAX)) {
+			try {
+				ContainerReader reader;
+
+				reader.open(szPath);
+
+				if (reader.getFrameCount() > 0) {
+					*sequence = reader.getEntry(reader.getFrameCount() - 1)->sequence;
+					return true;
+				}
+			}
+			catch (bctl_error & e) {
+				Logger::getInstance().logError("Skipping segment %s: %s", szPath, e.what());
+			}
+		}
+
+		segmentNumber--;
+	}
+
+	return false;
+}
+
+FramePacker::FramePacker(FrameCheckpoint * pCheckpoint)
+{
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	this->pCheckpoint = pCheckpoint;
+
+	pthread_mutex_init(&this->mutex, NULL);
+
+	memset(&this->stats, 0, sizeof(ContainerStats));
+
+	splitOutputPath(cfg.getValue(CFG_CONTAINER_TEMPLATE), this->szDir, this->szTemplate);
+
+	this->segmentSize = (uint64_t)cfg.getValueAsInteger(CFG_CONTAINER_SEGMENTSIZE) * 1024ULL * 1024ULL;
+	this->maxFrames = (uint32_t)cfg.getValueAsInteger(CFG_CONTAINER_MAXFRAMES);
+	this->isRemoveFrames = cfg.getValueAsBoolean(CFG_CONTAINER_REMOVEFRAMES);
+
+	/*
+	** Never append to an existing segment, start a new one...
+	*/
+	this->stats.segmentNumber = findLastSegment(this->szDir, this->szTemplate);
+
+	this->buffer = (uint8_t *)malloc(CONTAINER_FRAME_BUFFER_SIZE);
+
+	if (this->buffer == NULL) {
+		throw bctl_error("Failed to allocate frame buffer for packing", __FILE__, __LINE__);
+	}
+
+	this->bufferLength = CONTAINER_FRAME_BUFFER_SIZE;
+}
+
+FramePacker::~FramePacker()
+{
+	if (this->buffer != NULL) {
+		free(this->buffer);
+	}
+
+	pthread_mutex_destroy(&this->mutex);
+}
+
+void FramePacker::nextSegment()
+{
+	char			szTemplate[PATH_MAX];
+	char			szPath[PATH_MAX];
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+	Logger & log = Logger::getInstance();
+
+	if (this->writer.isOpen()) {
+		log.logStatus("Sealing segment %u with %u frames", this->stats.segmentNumber, this->writer.getFrameCount());
+		this->writer.seal();
+	}
+
+	this->stats.segmentNumber++;
+
+	cfg.getValue(CFG_CONTAINER_TEMPLATE, szTemplate, PATH_MAX);
+
+	if (!formatOutputTemplate(szTemplate, this->stats.segmentNumber, szPath, PATH_MAX)) {
+		throw bctl_error(bctl_error::buildMsg("Invalid container template '%s'", szTemplate), __FILE__, __LINE__);
+	}
+
+	this->writer.create(szPath, this->stats.segmentNumber, this->segmentSize, this->maxFrames);
+
+	log.logStatus("Started segment %s", szPath);
+}
+
+void FramePacker::frameAvailable(const CaptureFrame & frame)
+{
+	struct stat		st;
+	size_t			length;
+	size_t			bytesRead = 0;
+	ssize_t			rtn;
+	uint64_t		startTime;
+	uint64_t		latency;
+	uint32_t		crc;
+	int				fd;
+
+	Logger & log = Logger::getInstance();
+
+	fd = open(frame.szPath, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		log.logError("Failed to open frame %s for packing: %s", frame.szPath, strerror(errno));
+
+		if (fd >= 0) {
+			close(fd);
+		}
+
+		pthread_mutex_lock(&this->mutex);
+		this->stats.errorCount++;
+		pthread_mutex_unlock(&this->mutex);
+		return;
+	}
+
+	length = (size_t)st.st_size;
+
+	if (length > this->bufferLength) {
+		size_t newLength = this->bufferLength;
+
+		while (newLength < length) {
+			newLength <<= 1;
+		}
+
+		uint8_t * newBuffer = (uint8_t *)realloc(this->buffer, newLength);
+
+		if (newBuffer == NULL) {
+			log.logError("Failed to allocate %lu bytes for packing", (unsigned long)newLength);
+			close(fd);
+			return;
+		}
+
+		log.logStatus("Grew packing buffer to %lu bytes for frame %u", (unsigned long)newLength, frame.sequence);
+
+		this->buffer = newBuffer;
+		this->bufferLength = newLength;
+	}
+
+	while (bytesRead < length) {
+		rtn = read(fd, &this->buffer[bytesRead], length - bytesRead);
+
+		if (rtn < 0 && errno == EINTR) {
+			continue;
+		}
+		else if (rtn <= 0) {
+			break;
+		}
+
+		bytesRead += (size_t)rtn;
+	}
+
+	close(fd);
+
+	if (bytesRead < length) {
+		log.logError("Short read packing frame %s", frame.szPath);
+
+		pthread_mutex_lock(&this->mutex);
+		this->stats.errorCount++;
+		pthread_mutex_unlock(&this->mutex);
+		return;
+	}
+
+	crc = crc32c(0, this->buffer, length);
+
+	pthread_mutex_lock(&this->mutex);
+
+	startTime = CurrentTime::getStopwatchTime();
+
+	try {
+		if (!this->writer.isOpen() || !this->writer.hasSpace(length)) {
+			nextSegment();
+		}
+
+		if (!this->writer.hasSpace(length)) {
+			throw bctl_error(bctl_error::buildMsg("Frame of %lu bytes won't fit in a segment", (unsigned long)length), __FILE__, __LINE__);
+		}
+
+		this->writer.append(frame.sequence, getWallClockTime(), this->buffer, length, crc);
+	}
+	catch (bctl_error & e) {
+		this->stats.errorCount++;
+		pthread_mutex_unlock(&this->mutex);
+
+		log.logError("Failed to pack frame %s: %s", frame.szPath, e.what());
+		return;
+	}
+
+	latency = CurrentTime::getStopwatchTime() - startTime;
+
+	this->stats.frameCount++;
+	this->stats.totalBytes += length;
+	this->stats.totalLatency += latency;
+
+	if (latency > this->stats.maxLatency) {
+		this->stats.maxLatency = latency;
+	}
+
+	pthread_mutex_unlock(&this->mutex);
+
+	/*
+	** The checkpoint is marked first, so it never names a
+	** missing frame...
+	*/
+	if (this->isRemoveFrames) {
+		if (this->pCheckpoint != NULL) {
+			this->pCheckpoint->frameRemoved(frame.sequence);
+		}
+
+		unlink(frame.szPath);
+	}
+}
+
+void FramePacker::getStats(ContainerStats * stats)
+{
+	pthread_mutex_lock(&this->mutex);
+	memcpy(stats, &this->stats, sizeof(ContainerStats));
+	pthread_mutex_unlock(&this->mutex);
+}
+
+/*
+** Write the frames in a segment back out as loose files, named
+** by capture.outputtemplate in the current directory. Extracts
+** every frame, or just the one given if sequence >= 0...
+*/
+int extractContainer(const char * pszSegment, int64_t sequence)
+{
+	ContainerReader					reader;
+	const ContainerIndexEntry *		entry;
+	char							szDir[PATH_MAX];
+	char							szTemplate[PATH_MAX];
+	char							szPath[PATH_MAX];
+	uint32_t						numExtracted = 0;
+	uint32_t						numBad = 0;
+	uint32_t						i;
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	splitOutputPath(cfg.getValue(CFG_CAPTURE_OUTPUTTEMPLATE), szDir, szTemplate);
+
+	try {
+		reader.open(pszSegment);
+	}
+	catch (bctl_error & e) {
+		fprintf(stderr, "%s\n", e.what());
+		return -1;
+	}
+
+	printf(
+		"Segment %u, %u frame(s), %s\n",
+		reader.getHeader()->segmentNumber,
+		reader.getFrameCount(),
+		(reader.getHeader()->isSealed ? "sealed" : "not sealed"));
+
+	for (i = 0;i < reader.getFrameCount();i++) {
+		if (sequence >= 0) {
+			entry = reader.findFrame((uint32_t)sequence);
+
+			if (entry == NULL) {
+				fprintf(stderr, "Frame %ld is not in %s\n", (long)sequence, pszSegment);
+				return -1;
+			}
+		}
+		else {
+			entry = reader.getEntry(i);
+		}
+
+		if (!reader.verifyFrame(entry)) {
+			fprintf(stderr, "Frame %u failed its CRC check\n", entry->sequence);
+			numBad++;
+		}
+
+		formatOutputTemplate(szTemplate, entry->sequence, szPath, PATH_MAX);
+
+		int fd = open(szPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+		if (fd < 0) {
+			fprintf(stderr, "Failed to create %s: %s\n", szPath, strerror(errno));
+			return -1;
+		}
+
+		try {
+			writeFully(fd, reader.getFrameData(entry), entry->length, 0);
+		}
+		catch (bctl_error & e) {
+			fprintf(stderr, "Failed to write %s: %s\n", szPath, e.what());
+			close(fd);
+			return -1;
+		}
+
+		close(fd);
+
+		numExtracted++;
+
+		if (sequence >= 0) {
+			break;
+		}
+	}
+
+	printf("Extracted %u frame(s), %u failed CRC check\n", numExtracted, numBad);
+
+	return (numBad > 0 ? 1 : 0);
+}
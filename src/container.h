@@ -0,0 +1,182 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "capturebackend.h"
+
+#ifndef _INCL_CONTAINER
+#define _INCL_CONTAINER
+
+/*
+** A segment file packs many frames into one pre-allocated file:
+**
+**   ContainerHeader          at 0, padded to CONTAINER_HEADER_SIZE
+**   ContainerIndexEntry[]    maxFrames entries
+**   frame data               from dataOffset, page aligned
+**
+** Each frame in the data area is preceded by a ContainerRecord,
+** so frames can be recovered if the index is damaged. The index
+** and header are updated in place after each frame, so a segment
+** that was never sealed is still readable. All fields are little
+** endian...
+*/
+#define CONTAINER_MAGIC                     "BCTLSEG1"
+#define CONTAINER_VERSION                   1
+#define CONTAINER_HEADER_SIZE               4096
+#define CONTAINER_RECORD_MAGIC              0x314D5246U
+
+/*
+** The packer reads each frame into a buffer allocated up
+** front, big enough for any JPEG at the usual resolutions.
+** Should a frame outgrow it the buffer is doubled...
+*/
+#define CONTAINER_FRAME_BUFFER_SIZE         (1024 * 1024)
+
+#define CONTAINER_ALIGN(n, a)               ((((n) + (a) - 1) / (a)) * (a))
+
+struct ContainerHeader
+{
+    char                magic[8];
+    uint32_t            version;
+    uint32_t            segmentNumber;
+    uint32_t            maxFrames;
+    uint32_t            frameCount;
+    uint64_t            segmentSize;
+    uint64_t            dataOffset;
+    uint64_t            dataLength;
+    uint64_t            createdTime;
+    uint32_t            isSealed;
+    uint32_t            reserved;
+};
+
+struct ContainerIndexEntry
+{
+    uint32_t            sequence;
+    uint32_t            length;
+    uint64_t            offset;
+    uint64_t            timestamp;
+    uint32_t            crc;
+    uint32_t            reserved;
+};
+
+struct ContainerRecord
+{
+    uint32_t            magic;
+    uint32_t            sequence;
+    uint32_t            length;
+    uint32_t            crc;
+};
+
+static_assert(sizeof(ContainerHeader) == 64, "ContainerHeader layout changed");
+static_assert(sizeof(ContainerIndexEntry) == 32, "ContainerIndexEntry layout changed");
+static_assert(sizeof(ContainerRecord) == 16, "ContainerRecord layout changed");
+
+class ContainerWriter
+{
+private:
+    int                 fd = -1;
+    ContainerHeader     header;
+
+public:
+    ContainerWriter() {}
+    ~ContainerWriter();
+
+    void                create(const char * pszPath, uint32_t segmentNumber, uint64_t segmentSize, uint32_t maxFrames);
+    bool                hasSpace(size_t length);
+    void                append(uint32_t sequence, uint64_t timestamp, const uint8_t * data, size_t length, uint32_t crc);
+    void                seal();
+
+    bool                isOpen() {
+        return (this->fd >= 0);
+    }
+
+    uint32_t            getFrameCount() {
+        return this->header.frameCount;
+    }
+};
+
+/*
+** Random access to the frames in a segment, through a read
+** only mapping of the whole file...
+*/
+class ContainerReader
+{
+private:
+    uint8_t *           base = NULL;
+    size_t              mappedLength = 0;
+    const ContainerHeader *     header = NULL;
+    const ContainerIndexEntry * index = NULL;
+    uint32_t            frameCount = 0;
+
+public:
+    ContainerReader() {}
+    ~ContainerReader();
+
+    void                open(const char * pszPath);
+    void                close();
+
+    uint32_t            getFrameCount() {
+        return this->frameCount;
+    }
+
+    const ContainerHeader *     getHeader() {
+        return this->header;
+    }
+
+    const ContainerIndexEntry * getEntry(uint32_t i);
+    const ContainerIndexEntry * findFrame(uint32_t sequence);
+    const uint8_t *     getFrameData(const ContainerIndexEntry * entry);
+    bool                verifyFrame(const ContainerIndexEntry * entry);
+};
+
+struct ContainerStats
+{
+    uint32_t            segmentNumber;
+    uint32_t            frameCount;
+    uint32_t            errorCount;
+    uint64_t            totalBytes;
+    uint64_t            totalLatency;
+    uint64_t            maxLatency;
+};
+
+class FrameCheckpoint;
+
+/*
+** The packing stage, appends each completed frame to the current
+** segment, starting a new one when it is full, and optionally
+** removes the loose file...
+*/
+class FramePacker : public FrameListener
+{
+private:
+    FrameCheckpoint *   pCheckpoint;
+    pthread_mutex_t     mutex;
+    ContainerWriter     writer;
+    ContainerStats      stats;
+
+    char                szDir[PATH_MAX];
+    char                szTemplate[PATH_MAX];
+    uint64_t            segmentSize;
+    uint32_t            maxFrames;
+    bool                isRemoveFrames;
+
+    uint8_t *           buffer = NULL;
+    size_t              bufferLength = 0;
+
+    void                nextSegment();
+
+public:
+    FramePacker(FrameCheckpoint * pCheckpoint);
+    ~FramePacker();
+
+    void                frameAvailable(const CaptureFrame & frame);
+
+    void                getStats(ContainerStats * stats);
+};
+
+bool    findLastPackedFrame(uint32_t * sequence);
+int     extractContainer(const char * pszSegment, int64_t sequence);
+
+#endif
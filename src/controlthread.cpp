@@ -0,0 +1,1428 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "configmgr.h"
+#include "logger.h"
+#include "bctl_error.h"
+#include "currenttime.h"
+#include "threads.h"
+#include "controlthread.h"
+#include "startup.h"
+#include "container.h"
+#include "checksum.h"
+#include "publisher.h"
+#include "preview.h"
+#include "avi.h"
+#include "similarity.h"
+#include "ssdv.h"
+#include "reedsolomon.h"
+#include "gps.h"
+#include "flightphase.h"
+#include "exif.h"
+#include "crc32c.h"
+#include "resources.h"
+#include "timerwheel.h"
+#include "pipeline.h"
+#include "trace.h"
+#include "watchdog.h"
+#include "bctl.h"
+
+#define CONTROL_LISTEN_BACKLOG			16
+#define CONTROL_MAX_EVENTS				16
+
+/*
+** epoll user data for the two non-client descriptors, clients
+** are identified by their index in the client table...
+*/
+#define CONTROL_ID_LISTEN				-1
+#define CONTROL_ID_EVENT				-2
+
+struct LogCategory
+{
+	const char *	pszName;
+	int				level;
+};
+
+static const LogCategory logCategories[] = {
+	{"info",	LOG_LEVEL_INFO},
+	{"status",	LOG_LEVEL_STATUS},
+	{"debug",	LOG_LEVEL_DEBUG},
+	{"error",	LOG_LEVEL_ERROR},
+	{"fatal",	LOG_LEVEL_FATAL}
+};
+
+#define NUM_LOG_CATEGORIES				(int)(sizeof(logCategories) / sizeof(LogCategory))
+
+ControlThread::ControlThread() : PosixThread(true)
+{
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	strncpy(this->szSocketName, cfg.getValue(CFG_CONTROL_SOCKETNAME), PATH_MAX - 1);
+	this->szSocketName[PATH_MAX - 1] = 0;
+
+	memset(&this->stats, 0, sizeof(ControlStats));
+
+	for (int i = 0;i < CONTROL_MAX_CLIENTS;i++) {
+		this->clients[i].fd = -1;
+	}
+
+	/*
+	** Created up front so that requestReload() is usable
+	** as soon as the thread object exists...
+	*/
+	this->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+ControlThread::~ControlThread()
+{
+	for (int i = 0;i < CONTROL_MAX_CLIENTS;i++) {
+		if (this->clients[i].fd >= 0) {
+			close(this->clients[i].fd);
+		}
+	}
+
+	if (this->listenFd >= 0) {
+		close(this->listenFd);
+	}
+
+	if (this->epollFd >= 0) {
+		close(this->epollFd);
+	}
+
+	if (this->eventFd >= 0) {
+		close(this->eventFd);
+	}
+}
+
+void ControlThread::requestReload()
+{
+	uint64_t		count = 1;
+
+	if (this->eventFd >= 0) {
+		write(this->eventFd, &count, sizeof(count));
+	}
+	else {
+		reloadConfig();
+	}
+}
+
+void ControlThread::openSocket()
+{
+	struct sockaddr_un		addr;
+	struct epoll_event		ev;
+
+	if (strlen(this->szSocketName) == 0) {
+		return;
+	}
+
+	if (strlen(this->szSocketName) >= sizeof(addr.sun_path)) {
+		throw bctl_error(bctl_error::buildMsg("Control socket name %s is too long", this->szSocketName), __FILE__, __LINE__);
+	}
+
+	this->listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (this->listenFd < 0) {
+		throw bctl_error(bctl_error::buildMsg("Failed to create control socket: %s", strerror(errno)), __FILE__, __LINE__);
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, this->szSocketName);
+
+	/*
+	** Remove any stale socket left behind by a previous run...
+	*/
+	unlink(this->szSocketName);
+
+	if (bind(this->listenFd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		throw bctl_error(bctl_error::buildMsg("Failed to bind control socket %s: %s", this->szSocketName, strerror(errno)), __FILE__, __LINE__);
+	}
+
+	if (listen(this->listenFd, CONTROL_LISTEN_BACKLOG) < 0) {
+		throw bctl_error(bctl_error::buildMsg("Failed to listen on control socket %s: %s", this->szSocketName, strerror(errno)), __FILE__, __LINE__);
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.u64 = 0;
+	ev.data.fd = CONTROL_ID_LISTEN;
+
+	epoll_ctl(this->epollFd, EPOLL_CTL_ADD, this->listenFd, &ev);
+}
+
+void ControlThread::acceptClients()
+{
+	struct epoll_event		ev;
+	int						fd;
+	int						i;
+
+	Logger & log = Logger::getInstance();
+
+	while ((fd = accept4(this->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		for (i = 0;i < CONTROL_MAX_CLIENTS;i++) {
+			if (this->clients[i].fd < 0) {
+				break;
+			}
+		}
+
+		if (i == CONTROL_MAX_CLIENTS) {
+			const char * pszBusy = "ERR too many clients\n";
+
+			write(fd, pszBusy, strlen(pszBusy));
+			close(fd);
+
+			this->stats.rejectedCount++;
+			continue;
+		}
+
+		ControlClient * client = &this->clients[i];
+
+		client->fd = fd;
+		client->inLength = 0;
+		client->outLength = 0;
+		client->outPosition = 0;
+
+		ev.events = EPOLLIN;
+		ev.data.u64 = 0;
+		ev.data.fd = i;
+
+		epoll_ctl(this->epollFd, EPOLL_CTL_ADD, fd, &ev);
+
+		this->stats.connectionCount++;
+
+		log.logDebug("Accepted control client %d", i);
+	}
+}
+
+void ControlThread::closeClient(ControlClient * client)
+{
+	epoll_ctl(this->epollFd, EPOLL_CTL_DEL, client->fd, NULL);
+	close(client->fd);
+
+	client->fd = -1;
+}
+
+void ControlThread::readClient(ControlClient * client)
+{
+	int			bytesRead;
+	int			i;
+	int			lineStart;
+
+	while (1) {
+		bytesRead = read(
+						client->fd,
+						&client->inBuffer[client->inLength],
+						CONTROL_MAX_REQUEST_LENGTH - client->inLength);
+
+		if (bytesRead == 0) {
+			closeClient(client);
+			return;
+		}
+		else if (bytesRead < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				closeClient(client);
+			}
+			return;
+		}
+
+		client->inLength += bytesRead;
+		lineStart = 0;
+
+		/*
+		** Handle each complete request line, a client may
+		** pipeline several in a single write...
+		*/
+		for (i = 0;i < client->inLength;i++) {
+			if (client->inBuffer[i] == '\n') {
+				client->inBuffer[i] = 0;
+
+				if (i > lineStart && client->inBuffer[i - 1] == '\r') {
+					client->inBuffer[i - 1] = 0;
+				}
+
+				handleCommand(client, &client->inBuffer[lineStart]);
+
+				if (client->fd < 0) {
+					return;
+				}
+
+				lineStart = i + 1;
+			}
+		}
+
+		if (lineStart > 0) {
+			memmove(client->inBuffer, &client->inBuffer[lineStart], client->inLength - lineStart);
+			client->inLength -= lineStart;
+		}
+		else if (client->inLength == CONTROL_MAX_REQUEST_LENGTH) {
+			/*
+			** No line terminator in a full buffer, the client
+			** is not talking our protocol...
+			*/
+			closeClient(client);
+			return;
+		}
+	}
+}
+
+void ControlThread::writeClient(ControlClient * client)
+{
+	struct epoll_event		ev;
+	int						bytesWritten;
+
+	while (client->outPosition < client->outLength) {
+		bytesWritten = write(
+							client->fd,
+							&client->outBuffer[client->outPosition],
+							client->outLength - client->outPosition);
+
+		if (bytesWritten < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+
+			closeClient(client);
+			return;
+		}
+
+		client->outPosition += bytesWritten;
+	}
+
+	ev.data.u64 = 0;
+	ev.data.fd = (int)(client - this->clients);
+
+	if (client->outPosition < client->outLength) {
+		/*
+		** The client is slow to read, wait until its
+		** socket is writable rather than blocking...
+		*/
+		ev.events = EPOLLIN | EPOLLOUT;
+	}
+	else {
+		client->outPosition = 0;
+		client->outLength = 0;
+		ev.events = EPOLLIN;
+	}
+
+	epoll_ctl(this->epollFd, EPOLL_CTL_MOD, client->fd, &ev);
+}
+
+void ControlThread::handleCommand(ControlClient * client, char * request)
+{
+	char			response[CONTROL_MAX_RESPONSE_LENGTH - 64];
+	uint64_t		startTime;
+	uint64_t		latency;
+	bool			isOK;
+	int				length;
+
+	startTime = CurrentTime::getStopwatchTime();
+
+	response[0] = 0;
+
+	isOK = dispatchCommand(request, response, sizeof(response));
+
+	latency = CurrentTime::getStopwatchTime() - startTime;
+
+	this->stats.commandCount++;
+	this->stats.totalLatency += latency;
+
+	if (latency > this->stats.maxLatency) {
+		this->stats.maxLatency = latency;
+	}
+
+	if (!isOK) {
+		this->stats.errorCount++;
+	}
+
+	/*
+	** Compact any partially written output to make room...
+	*/
+	if (client->outPosition > 0) {
+		memmove(client->outBuffer, &client->outBuffer[client->outPosition], client->outLength - client->outPosition);
+		client->outLength -= client->outPosition;
+		client->outPosition = 0;
+	}
+
+	if (isOK) {
+		length = snprintf(
+					&client->outBuffer[client->outLength],
+					CONTROL_MAX_RESPONSE_LENGTH - client->outLength,
+					"%sOK latency=%luus\n",
+					response,
+					(unsigned long)latency);
+	}
+	else {
+		length = snprintf(
+					&client->outBuffer[client->outLength],
+					CONTROL_MAX_RESPONSE_LENGTH - client->outLength,
+					"ERR %s latency=%luus\n",
+					response,
+					(unsigned long)latency);
+	}
+
+	if (length < 0 || length >= CONTROL_MAX_RESPONSE_LENGTH - client->outLength) {
+		/*
+		** The client has let too many responses back up...
+		*/
+		closeClient(client);
+		return;
+	}
+
+	client->outLength += length;
+
+	writeClient(client);
+}
+
+bool ControlThread::execute(const char * pszCommand, char * response, int responseLength)
+{
+	char			request[CONTROL_MAX_REQUEST_LENGTH];
+
+	snprintf(request, sizeof(request), "%s", pszCommand);
+
+	response[0] = 0;
+
+	return dispatchCommand(request, response, responseLength);
+}
+
+bool ControlThread::dispatchCommand(char * request, char * response, int responseLength)
+{
+	char *			reference;
+	char *			pszCommand;
+	char *			pszArg1;
+	char *			pszArg2;
+	char *			pszEnd;
+	int				length = 0;
+	int				i;
+
+	Logger & log = Logger::getInstance();
+	CaptureThread * pCaptureThread = ThreadManager::getInstance().getCaptureThread();
+
+	pszCommand = strtok_r(request, " \t", &reference);
+	pszArg1 = strtok_r(NULL, " \t", &reference);
+	pszArg2 = strtok_r(NULL, " \t", &reference);
+
+	if (pszCommand == NULL) {
+		snprintf(response, responseLength, "empty command");
+		return false;
+	}
+
+	if (strcmp(pszCommand, "help") == 0) {
+		snprintf(
+			response,
+			responseLength,
+			"trigger                  Capture a photo now\n" \
+			"burst <count>            Capture count photos at the burst interval\n" \
+			"interval <seconds>       Set the capture interval\n" \
+			"loglevel [<cat> on|off]  Show or set a log category\n" \
+			"stats                    Dump daemon statistics\n" \
+			"startup                  Show the startup timeline\n" \
+			"container                Show frame packing statistics\n" \
+			"checksum                 Show frame checksum statistics\n" \
+			"pipeline                 Show frame pipeline stages\n" \
+			"shm                      Show shared memory publishing statistics\n" \
+			"preview                  Show preview server statistics\n" \
+			"timelapse                Show timelapse statistics\n" \
+			"similarity               Show frame similarity statistics\n" \
+			"ssdv                     Show SSDV downlink statistics\n" \
+			"gps                      Show the latest GPS fix\n" \
+			"phase                    Show the flight phase\n" \
+			"exif                     Show Exif tagging statistics\n" \
+			"trace [on|off|save [f]]  Show, switch or write the trace\n" \
+			"resources [history]      Show CPU and memory use by thread\n" \
+			"watchdog                 Show the watchdog and each thread's heartbeat\n" \
+			"reload                   Reload the config file\n");
+	}
+	else if (strcmp(pszCommand, "trigger") == 0) {
+		pCaptureThread->triggerNow();
+	}
+	else if (strcmp(pszCommand, "burst") == 0) {
+		long count = (pszArg1 != NULL ? strtol(pszArg1, &pszEnd, 10) : 0);
+
+		if (pszArg1 == NULL || *pszEnd != 0 || count <= 0) {
+			snprintf(response, responseLength, "usage: burst <count>");
+			return false;
+		}
+
+		pCaptureThread->startBurst((int)count);
+	}
+	else if (strcmp(pszCommand, "interval") == 0) {
+		double seconds = (pszArg1 != NULL ? strtod(pszArg1, &pszEnd) : 0.0);
+
+		if (pszArg1 == NULL || *pszEnd != 0 || seconds <= 0.0) {
+			snprintf(response, responseLength, "usage: interval <seconds>");
+			return false;
+		}
+
+		pCaptureThread->setInterval((unsigned long)(seconds * 1000.0));
+
+		log.logStatus("Capture interval set to %.3fs", seconds);
+	}
+	else if (strcmp(pszCommand, "loglevel") == 0) {
+		if (pszArg1 != NULL) {
+			for (i = 0;i < NUM_LOG_CATEGORIES;i++) {
+				if (strcmp(pszArg1, logCategories[i].pszName) == 0) {
+					break;
+				}
+			}
+
+			if (i == NUM_LOG_CATEGORIES || pszArg2 == NULL || (strcmp(pszArg2, "on") != 0 && strcmp(pszArg2, "off") != 0)) {
+				snprintf(response, responseLength, "usage: loglevel <info|status|debug|error|fatal> <on|off>");
+				return false;
+			}
+
+			if (strcmp(pszArg2, "on") == 0) {
+				log.setLogLevel(log.getLogLevel() | logCategories[i].level);
+			}
+			else {
+				log.setLogLevel(log.getLogLevel() & ~logCategories[i].level);
+			}
+		}
+
+		for (i = 0;i < NUM_LOG_CATEGORIES && length < responseLength;i++) {
+			length += snprintf(
+						&response[length],
+						responseLength - length,
+						"%s=%s\n",
+						logCategories[i].pszName,
+						(log.isLogLevel(logCategories[i].level) ? "on" : "off"));
+		}
+	}
+	else if (strcmp(pszCommand, "stats") == 0) {
+		CaptureStats		cs;
+		FrameStats			fs;
+		TimerStats			ts;
+		uint64_t			now = CurrentTime::getMonotonicTime();
+
+		ResourceThread *	pResourceThread = ThreadManager::getInstance().getResourceThread();
+		ResourceSample		latest;
+		ResourceSample		previous;
+		ResourceStats		rs;
+
+		pCaptureThread->getStats(&cs);
+		ThreadManager::getInstance().getFrameThread()->getStats(&fs);
+		TimerWheel::getInstance().getStats(&ts);
+
+		length = snprintf(
+			response,
+			responseLength,
+			"uptime=%s\n" \
+			"capture.backend=%s\n" \
+			"capture.pid=%d\n" \
+			"capture.interval=%lums\n" \
+			"capture.burstinterval=%lums\n" \
+			"capture.slack=%lums\n" \
+			"capture.burstremaining=%d\n" \
+			"capture.count=%u\n" \
+			"capture.manual=%u\n" \
+			"capture.burst=%u\n" \
+			"capture.lastago=%lums\n" \
+			"frame.count=%u\n" \
+			"frame.lastsequence=%u\n" \
+			"frame.bytes=%llu\n" \
+			"frame.lastago=%lums\n" \
+			"frame.latency.avg=%luus\n" \
+			"frame.latency.max=%luus\n" \
+			"control.connections=%u\n" \
+			"control.rejected=%u\n" \
+			"control.commands=%u\n" \
+			"control.errors=%u\n" \
+			"control.latency.avg=%luus\n" \
+			"control.latency.max=%luus\n" \
+			"timer.jobs=%u\n" \
+			"timer.jobs.max=%u\n" \
+			"timer.levels=%u/%u/%u/%u\n" \
+			"timer.expired=%lu\n" \
+			"timer.cancelled=%lu\n" \
+			"timer.wakeups=%lu\n" \
+			"timer.cascades=%lu\n" \
+			"timer.delay.avg=%luus\n" \
+			"timer.delay.max=%luus\n" \
+			"timer.late=%lu\n" \
+			"timer.lateness.avg=%luus\n" \
+			"timer.lateness.max=%luus\n",
+			CurrentTime::getUptime(),
+			cs.pszBackend,
+			cs.pid,
+			cs.intervalMs,
+			cs.burstIntervalMs,
+			cs.slackMs,
+			cs.burstRemaining,
+			cs.captureCount,
+			cs.manualCount,
+			cs.burstCount,
+			(cs.lastCaptureTime > 0 ? (unsigned long)((now - cs.lastCaptureTime) / 1000ULL) : 0UL),
+			fs.frameCount,
+			fs.lastSequence,
+			(unsigned long long)fs.totalBytes,
+			(fs.lastFrameTime > 0 ? (unsigned long)((now - fs.lastFrameTime) / 1000ULL) : 0UL),
+			(fs.latencyCount > 0 ? (unsigned long)(fs.totalLatency / fs.latencyCount) : 0UL),
+			(unsigned long)fs.maxLatency,
+			this->stats.connectionCount,
+			this->stats.rejectedCount,
+			this->stats.commandCount,
+			this->stats.errorCount,
+			(this->stats.commandCount > 0 ? (unsigned long)(this->stats.totalLatency / this->stats.commandCount) : 0UL),
+			(unsigned long)this->stats.maxLatency,
+			ts.scheduledCount,
+			ts.maxScheduledCount,
+			ts.levelCount[0],
+			ts.levelCount[1],
+			ts.levelCount[2],
+			ts.levelCount[3],
+			(unsigned long)ts.expiredCount,
+			(unsigned long)ts.cancelledCount,
+			(unsigned long)ts.wakeupCount,
+			(unsigned long)ts.cascadeCount,
+			(ts.expiredCount > 0 ? (unsigned long)(ts.totalDelay / ts.expiredCount) : 0UL),
+			(unsigned long)ts.maxDelay,
+			(unsigned long)ts.lateCount,
+			(ts.lateCount > 0 ? (unsigned long)(ts.totalLateness / ts.lateCount) : 0UL),
+			(unsigned long)ts.maxLateness);
+
+		if (pResourceThread != NULL && length < responseLength && pResourceThread->getSample(0, &latest)) {
+			pResourceThread->getStats(&rs);
+
+			/*
+			** The CPU share over the last interval, or since
+			** the sampler started...
+			*/
+			if (!pResourceThread->getSample(1, &previous)) {
+				memset(&previous, 0, sizeof(ResourceSample));
+				previous.time = rs.startTime;
+			}
+
+			snprintf(
+				&response[length],
+				responseLength - length,
+				"resources.cpu=%.1f%%\n" \
+				"resources.rss=%lukB\n" \
+				"resources.fds=%u\n" \
+				"resources.threads=%u\n" \
+				"resources.freespace=%.1fMB\n" \
+				"resources.samples=%u\n" \
+				"resources.sampler.cpu=%.3f%%\n",
+				getCPUShare(previous.cpuTime, latest.cpuTime, previous.time, latest.time),
+				(unsigned long)(latest.rss / 1024ULL),
+				latest.fdCount,
+				latest.numThreads,
+				(double)latest.freeSpace / 1000000.0,
+				rs.sampleCount,
+				getCPUShare(0, rs.samplerTime, rs.startTime, CurrentTime::getStopwatchTime()));
+		}
+	}
+	else if (strcmp(pszCommand, "container") == 0) {
+		ContainerStats		cs;
+		FramePacker *		pPacker = ThreadManager::getInstance().getFramePacker();
+
+		if (pPacker == NULL) {
+			snprintf(response, responseLength, "container packing is not enabled");
+			return false;
+		}
+
+		pPacker->getStats(&cs);
+
+		snprintf(
+			response,
+			responseLength,
+			"container.segment=%u\n" \
+			"container.frames=%u\n" \
+			"container.errors=%u\n" \
+			"container.bytes=%llu\n" \
+			"container.latency.avg=%luus\n" \
+			"container.latency.max=%luus\n",
+			cs.segmentNumber,
+			cs.frameCount,
+			cs.errorCount,
+			(unsigned long long)cs.totalBytes,
+			(cs.frameCount > 0 ? (unsigned long)(cs.totalLatency / cs.frameCount) : 0UL),
+			(unsigned long)cs.maxLatency);
+	}
+	else if (strcmp(pszCommand, "checksum") == 0) {
+		ChecksumStats		cs;
+		PipelineStageStats	ps;
+		FrameChecksummer *	pChecksummer = ThreadManager::getInstance().getChecksummer();
+
+		if (pChecksummer == NULL) {
+			snprintf(response, responseLength, "checksums are not enabled");
+			return false;
+		}
+
+		pChecksummer->getStats(&cs);
+
+		if (!ThreadManager::getInstance().getFrameThread()->getPipeline().findStats("checksum", &ps)) {
+			memset(&ps, 0, sizeof(PipelineStageStats));
+		}
+
+		snprintf(
+			response,
+			responseLength,
+			"checksum.implementation=%s\n" \
+			"checksum.frames=%u\n" \
+			"checksum.errors=%u\n" \
+			"checksum.dropped=%llu\n" \
+			"checksum.bytes=%llu\n" \
+			"checksum.throughput=%.1fMB/s\n",
+			crc32cImplementation(),
+			cs.frameCount,
+			cs.errorCount,
+			(unsigned long long)(ps.droppedCount + ps.sampledCount),
+			(unsigned long long)cs.totalBytes,
+			(cs.totalTime > 0 ? (double)cs.totalBytes / (double)cs.totalTime : 0.0));
+	}
+	else if (strcmp(pszCommand, "pipeline") == 0) {
+		FramePipeline &		pipeline = ThreadManager::getInstance().getFrameThread()->getPipeline();
+		PipelineStageStats	ps;
+		uint64_t			now = CurrentTime::getMonotonicTime();
+		double				seconds;
+
+		if (pipeline.getStageCount() == 0) {
+			snprintf(response, responseLength, "No pipeline stages are enabled");
+			return false;
+		}
+
+		length = snprintf(
+					response,
+					responseLength,
+					"pipeline: %llu frame(s) in, %llu through\n",
+					(unsigned long long)pipeline.getSubmittedCount(),
+					(unsigned long long)pipeline.getCompletedCount());
+
+		length += snprintf(
+					&response[length],
+					responseLength - length,
+					"%-10s %-6s %-5s %3s %14s %8s %8s %8s %8s %9s %8s %8s %7s\n",
+					"stage",
+					"policy",
+					"queue",
+					"wkr",
+					"depth/max/len",
+					"frames",
+					"dropped",
+					"sampled",
+					"blocked",
+					"blk(ms)",
+					"avg(us)",
+					"max(us)",
+					"fps");
+
+		for (i = 0;i < pipeline.getStageCount() && length < responseLength - 128;i++) {
+			pipeline.getStats(i, &ps);
+
+			seconds = (now > ps.startTime ? (double)(now - ps.startTime) / 1000000.0 : 0.0);
+
+			length += snprintf(
+						&response[length],
+						responseLength - length,
+						"%-10s %-6s %-5s %3d %4u/%4u/%-4u %8llu %8llu %8llu %8llu %9llu %8lu %8lu %7.2f\n",
+						ps.pszName,
+						getPipelinePolicyName(ps.policy),
+						(ps.isSPSC ? "spsc" : "mpmc"),
+						ps.numWorkers,
+						ps.depth,
+						ps.maxDepth,
+						ps.queueLength,
+						(unsigned long long)ps.frameCount,
+						(unsigned long long)ps.droppedCount,
+						(unsigned long long)ps.sampledCount,
+						(unsigned long long)ps.blockedCount,
+						(unsigned long long)(ps.blockedTime / 1000ULL),
+						(ps.frameCount > 0 ? (unsigned long)(ps.totalTime / ps.frameCount) : 0UL),
+						(unsigned long)ps.maxTime,
+						(seconds > 0.0 ? (double)ps.frameCount / seconds : 0.0));
+		}
+	}
+	else if (strcmp(pszCommand, "shm") == 0) {
+		PublisherStats		ps;
+		FramePublisher *	pPublisher = ThreadManager::getInstance().getPublisher();
+
+		if (pPublisher == NULL) {
+			snprintf(response, responseLength, "Shared memory publishing is not enabled");
+			return false;
+		}
+
+		pPublisher->getStats(&ps);
+
+		snprintf(
+			response,
+			responseLength,
+			"shm.name=%s\n" \
+			"shm.size=%lu\n" \
+			"shm.interval=%lums\n" \
+			"shm.frames=%u\n" \
+			"shm.lastsequence=%u\n" \
+			"shm.truncated=%u\n" \
+			"shm.telemetry=%u\n",
+			ps.pszName,
+			(unsigned long)sizeof(struct bctl_shm_segment),
+			ps.intervalMs,
+			ps.frameCount,
+			ps.lastSequence,
+			ps.truncatedCount,
+			ps.telemetryCount);
+	}
+	else if (strcmp(pszCommand, "preview") == 0) {
+		PreviewStats		vs;
+		PreviewServer *		pPreviewServer = ThreadManager::getInstance().getPreviewServer();
+
+		if (pPreviewServer == NULL) {
+			snprintf(response, responseLength, "The preview server is not enabled");
+			return false;
+		}
+
+		pPreviewServer->getStats(&vs);
+
+		snprintf(
+			response,
+			responseLength,
+			"preview.address=%s\n" \
+			"preview.clients=%d/%d\n" \
+			"preview.streams=%d\n" \
+			"preview.connections=%u\n" \
+			"preview.rejected=%u\n" \
+			"preview.requests=%u\n" \
+			"preview.notfound=%u\n" \
+			"preview.frames=%u\n" \
+			"preview.skipped=%u\n" \
+			"preview.dropped=%u\n" \
+			"preview.bytes=%llu\n",
+			vs.szAddress,
+			vs.numClients,
+			vs.maxClients,
+			vs.numStreams,
+			vs.connectionCount,
+			vs.rejectedCount,
+			vs.requestCount,
+			vs.notFoundCount,
+			vs.frameCount,
+			vs.skippedCount,
+			vs.droppedCount,
+			(unsigned long long)vs.bytesSent);
+	}
+	else if (strcmp(pszCommand, "timelapse") == 0) {
+		TimelapseStats		ts;
+		FrameMuxer *		pMuxer = ThreadManager::getInstance().getMuxer();
+
+		if (pMuxer == NULL) {
+			snprintf(response, responseLength, "The timelapse is not enabled");
+			return false;
+		}
+
+		pMuxer->getStats(&ts);
+
+		snprintf(
+			response,
+			responseLength,
+			"timelapse.file=%u\n" \
+			"timelapse.size=%dx%d\n" \
+			"timelapse.fileframes=%u\n" \
+			"timelapse.riffs=%u\n" \
+			"timelapse.filebytes=%llu\n" \
+			"timelapse.frames=%u\n" \
+			"timelapse.skipped=%u\n" \
+			"timelapse.errors=%u\n" \
+			"timelapse.copy=%s\n" \
+			"timelapse.avglatency=%luus\n" \
+			"timelapse.maxlatency=%luus\n",
+			ts.fileNumber,
+			ts.width,
+			ts.height,
+			ts.fileFrames,
+			ts.riffCount,
+			(unsigned long long)ts.fileSize,
+			ts.frameCount,
+			ts.skippedCount,
+			ts.errorCount,
+			getAVICopyModeName(ts.copyMode),
+			(ts.frameCount > 0 ? (unsigned long)(ts.totalLatency / ts.frameCount) : 0UL),
+			(unsigned long)ts.maxLatency);
+	}
+	else if (strcmp(pszCommand, "similarity") == 0) {
+		SimilarityStats		ss;
+		FrameSimilarity *	pSimilarity = ThreadManager::getInstance().getSimilarity();
+
+		if (pSimilarity == NULL) {
+			snprintf(response, responseLength, "Similarity detection is not enabled");
+			return false;
+		}
+
+		pSimilarity->getStats(&ss);
+
+		ConfigManager & cfg = ConfigManager::getInstance();
+
+		int threshold = cfg.getValueAsInteger(CFG_SIMILARITY_THRESHOLD);
+		unsigned long avgScore = (ss.comparedCount > 0 ? (unsigned long)(ss.totalScore / ss.comparedCount) : 0UL);
+
+		snprintf(
+			response,
+			responseLength,
+			"similarity.sad=%s\n" \
+			"similarity.action=%s\n" \
+			"similarity.threshold=%d.%02d\n" \
+			"similarity.thumbnail=%dx%d\n" \
+			"similarity.frames=%u\n" \
+			"similarity.compared=%u\n" \
+			"similarity.similar=%u\n" \
+			"similarity.skipped=%u\n" \
+			"similarity.errors=%u\n" \
+			"similarity.reference=%u\n" \
+			"similarity.score.last=%u.%02u\n" \
+			"similarity.score.avg=%lu.%02lu\n" \
+			"similarity.rate=%.0fframes/s\n" \
+			"similarity.latency.avg=%luus\n" \
+			"similarity.latency.max=%luus\n",
+			sadImplementation(),
+			cfg.getValue(CFG_SIMILARITY_ACTION),
+			threshold / 100,
+			threshold % 100,
+			ss.width,
+			ss.height,
+			ss.frameCount,
+			ss.comparedCount,
+			ss.similarCount,
+			ss.skippedCount,
+			ss.errorCount,
+			ss.referenceSequence,
+			ss.lastScore / 100,
+			ss.lastScore % 100,
+			avgScore / 100,
+			avgScore % 100,
+			(ss.totalTime > 0 ? (double)ss.frameCount * 1000000.0 / (double)ss.totalTime : 0.0),
+			(ss.frameCount > 0 ? (unsigned long)(ss.totalTime / ss.frameCount) : 0UL),
+			(unsigned long)ss.maxTime);
+	}
+	else if (strcmp(pszCommand, "ssdv") == 0) {
+		SSDVStats		ss;
+		DownlinkStats	ds;
+		SSDVThread *	pSSDVThread = ThreadManager::getInstance().getSSDVThread();
+
+		if (pSSDVThread == NULL) {
+			snprintf(response, responseLength, "SSDV is not enabled");
+			return false;
+		}
+
+		pSSDVThread->getStats(&ss, &ds);
+
+		snprintf(
+			response,
+			responseLength,
+			"ssdv.fec=%s\n" \
+			"ssdv.images=%u\n" \
+			"ssdv.packets=%u\n" \
+			"ssdv.errors=%u\n" \
+			"ssdv.dropped=%u\n" \
+			"ssdv.rate=%.0fpackets/s\n" \
+			"downlink.offered=%u\n" \
+			"downlink.sent=%u\n" \
+			"downlink.evicted=%u\n" \
+			"downlink.owed=%u\n" \
+			"downlink.windows=%u/%u\n" \
+			"downlink.bytes=%llu\n",
+			(ConfigManager::getInstance().getValueAsBoolean(CFG_SSDV_FEC) ? rsImplementation() : "off"),
+			ss.imageCount,
+			ss.packetCount,
+			ss.errorCount,
+			ss.droppedCount,
+			(ss.totalTime > 0 ? (double)ss.packetCount * 1000000.0 / (double)ss.totalTime : 0.0),
+			ds.offeredCount,
+			ds.sentCount,
+			ds.evictedCount,
+			ds.owedCount,
+			ds.coveredCount,
+			ds.windowCount,
+			(unsigned long long)ds.bytesSent);
+	}
+	else if (strcmp(pszCommand, "gps") == 0) {
+		GPSFix			f;
+		NMEAStats		ns;
+		GPSThread *		pGPSThread = ThreadManager::getInstance().getGPSThread();
+
+		if (pGPSThread == NULL) {
+			snprintf(response, responseLength, "GPS is not enabled");
+			return false;
+		}
+
+		if (pGPSThread->getFix(&f) == 0) {
+			memset(&f, 0, sizeof(GPSFix));
+		}
+
+		pGPSThread->getStats(&ns);
+
+		snprintf(
+			response,
+			responseLength,
+			"gps.valid=%s\n" \
+			"gps.quality=%u\n" \
+			"gps.satellites=%u\n" \
+			"gps.latitude=%.7f\n" \
+			"gps.longitude=%.7f\n" \
+			"gps.altitude=%.1fm\n" \
+			"gps.speed=%.1fm/s\n" \
+			"gps.course=%.1f\n" \
+			"gps.time=%02u:%02u:%02u.%03u\n" \
+			"gps.date=%06u\n" \
+			"gps.age=%lums\n" \
+			"gps.sentences=%u\n" \
+			"gps.checksumerrors=%u\n" \
+			"gps.formaterrors=%u\n",
+			(f.isValid ? "yes" : "no"),
+			f.quality,
+			f.satellites,
+			(double)f.latitude / 10000000.0,
+			(double)f.longitude / 10000000.0,
+			(double)f.altitude / 1000.0,
+			(double)f.speed / 1000.0,
+			(double)f.course / 100.0,
+			f.timeOfDay / 3600000,
+			(f.timeOfDay / 60000) % 60,
+			(f.timeOfDay / 1000) % 60,
+			f.timeOfDay % 1000,
+			f.date,
+			(f.updateTime > 0 ? (unsigned long)((CurrentTime::getMonotonicTime() - f.updateTime) / 1000ULL) : 0UL),
+			ns.sentenceCount,
+			ns.checksumErrors,
+			ns.formatErrors);
+	}
+	else if (strcmp(pszCommand, "phase") == 0) {
+		FlightPhaseStatus	fs;
+		CaptureStats		cs;
+		int					width;
+		int					height;
+		FlightPhaseThread *	pFlightPhaseThread = ThreadManager::getInstance().getFlightPhaseThread();
+
+		if (pFlightPhaseThread == NULL) {
+			snprintf(response, responseLength, "Flight phase detection is not enabled");
+			return false;
+		}
+
+		pFlightPhaseThread->getStatus(&fs);
+		pCaptureThread->getStats(&cs);
+
+		getCaptureResolution(&width, &height);
+
+		snprintf(
+			response,
+			responseLength,
+			"phase.current=%s\n" \
+			"phase.age=%lus\n" \
+			"phase.altitude=%.1fm\n" \
+			"phase.rate=%.1fm/s\n" \
+			"phase.launch=%.1fm\n" \
+			"phase.max=%.1fm\n" \
+			"phase.samples=%u\n" \
+			"phase.transitions=%u\n" \
+			"phase.interval=%lums\n" \
+			"phase.resolution=%dx%d\n",
+			getFlightPhaseName(fs.phase),
+			(fs.sampleCount > 0 ? (unsigned long)((CurrentTime::getMonotonicTime() - fs.phaseStartTime) / 1000000ULL) : 0UL),
+			(double)fs.altitude / 1000.0,
+			(double)fs.rate / 1000.0,
+			(double)fs.launchAltitude / 1000.0,
+			(double)fs.maxAltitude / 1000.0,
+			fs.sampleCount,
+			fs.transitionCount,
+			cs.intervalMs,
+			width,
+			height);
+	}
+	else if (strcmp(pszCommand, "exif") == 0) {
+		ExifStats		es;
+		ExifTagger *	pExifTagger = ThreadManager::getInstance().getExifTagger();
+
+		if (pExifTagger == NULL) {
+			snprintf(response, responseLength, "Exif tagging is not enabled");
+			return false;
+		}
+
+		pExifTagger->getStats(&es);
+
+		snprintf(
+			response,
+			responseLength,
+			"exif.frames=%u\n" \
+			"exif.inplace=%u\n" \
+			"exif.rewritten=%u\n" \
+			"exif.errors=%u\n" \
+			"exif.latency.avg=%luus\n" \
+			"exif.latency.max=%luus\n",
+			es.frameCount,
+			es.inPlaceCount,
+			es.rewriteCount,
+			es.errorCount,
+			(es.frameCount > 0 ? (unsigned long)(es.totalTime / es.frameCount) : 0UL),
+			(unsigned long)es.maxTime);
+	}
+	else if (strcmp(pszCommand, "trace") == 0) {
+		TraceStats		ts;
+
+		if (pszArg1 != NULL) {
+			if (strcmp(pszArg1, "on") == 0) {
+				Tracer::getInstance().enable(true);
+			}
+			else if (strcmp(pszArg1, "off") == 0) {
+				Tracer::getInstance().enable(false);
+			}
+			else if (strcmp(pszArg1, "save") == 0) {
+				if (!saveTrace(pszArg2)) {
+					snprintf(response, responseLength, "failed to write trace, see log");
+					return false;
+				}
+			}
+			else {
+				snprintf(response, responseLength, "usage: trace [on|off|save [file]]");
+				return false;
+			}
+		}
+
+		Tracer::getInstance().getStats(&ts);
+
+		snprintf(
+			response,
+			responseLength,
+			"trace.enabled=%s\n" \
+			"trace.threads=%d\n" \
+			"trace.buffer=%u\n" \
+			"trace.events=%lu\n" \
+			"trace.overwritten=%lu\n",
+			(ts.isEnabled ? "yes" : "no"),
+			ts.numThreads,
+			ts.bufferLength,
+			(unsigned long)ts.eventCount,
+			(unsigned long)ts.overwrittenCount);
+	}
+	else if (strcmp(pszCommand, "resources") == 0) {
+		ResourceThread *	pResourceThread = ThreadManager::getInstance().getResourceThread();
+		ResourceSample		latest;
+		ResourceSample		previous;
+		ResourceStats		rs;
+		uint32_t			age;
+		int					j;
+
+		if (pResourceThread == NULL) {
+			snprintf(response, responseLength, "Resource sampling is not enabled");
+			return false;
+		}
+
+		pResourceThread->getStats(&rs);
+
+		if (!pResourceThread->getSample(0, &latest) || !pResourceThread->getSample(1, &previous)) {
+			snprintf(response, responseLength, "Not enough samples yet, one every %lums", rs.intervalMs * rs.backoff);
+			return false;
+		}
+
+		length = snprintf(
+					response,
+					responseLength,
+					"sampler: %u sample(s), %u error(s), every %lums, avg %luus max %luus, %.3f%% CPU\n",
+					rs.sampleCount,
+					rs.errorCount,
+					rs.intervalMs * rs.backoff,
+					(rs.sampleCount > 0 ? (unsigned long)(rs.samplerTime / (rs.sampleCount + rs.errorCount)) : 0UL),
+					(unsigned long)rs.maxSampleTime,
+					getCPUShare(0, rs.samplerTime, rs.startTime, CurrentTime::getStopwatchTime()));
+
+		if (pszArg1 != NULL && strcmp(pszArg1, "history") == 0) {
+			length += snprintf(
+						&response[length],
+						responseLength - length,
+						"%8s %7s %9s %5s %10s\n",
+						"age(s)",
+						"cpu%",
+						"rss(kB)",
+						"fds",
+						"free(MB)");
+
+			/*
+			** As many as fit, newest first...
+			*/
+			for (age = 0;length < responseLength - 64 && pResourceThread->getSample(age + 1, &previous);age++) {
+				pResourceThread->getSample(age, &latest);
+
+				length += snprintf(
+							&response[length],
+							responseLength - length,
+							"%8lu %7.1f %9lu %5u %10.1f\n",
+							(unsigned long)((CurrentTime::getStopwatchTime() - latest.time) / 1000000ULL),
+							getCPUShare(previous.cpuTime, latest.cpuTime, previous.time, latest.time),
+							(unsigned long)(latest.rss / 1024ULL),
+							latest.fdCount,
+							(double)latest.freeSpace / 1000000.0);
+			}
+		}
+		else {
+			/*
+			** Each thread over the last interval, matched up
+			** with its previous sample by thread ID...
+			*/
+			length += snprintf(
+						&response[length],
+						responseLength - length,
+						"%7s %-15s %7s %10s %10s %12s\n",
+						"tid",
+						"name",
+						"cpu%",
+						"cpu(ms)",
+						"vol/s",
+						"invol/s");
+
+			double seconds = (double)(latest.time - previous.time) / 1000000.0;
+
+			for (i = 0;i < (int)latest.numThreads && length < responseLength - 80;i++) {
+				ThreadResources * t = &latest.threads[i];
+				ThreadResources * p = NULL;
+
+				for (j = 0;j < (int)previous.numThreads;j++) {
+					if (previous.threads[j].tid == t->tid) {
+						p = &previous.threads[j];
+						break;
+					}
+				}
+
+				length += snprintf(
+							&response[length],
+							responseLength - length,
+							"%7d %-15s %7.1f %10lu %10.1f %12.1f\n",
+							(int)t->tid,
+							t->szName,
+							(p != NULL ? getCPUShare(p->cpuTime, t->cpuTime, previous.time, latest.time) : 0.0),
+							(unsigned long)(t->cpuTime / 1000ULL),
+							(p != NULL && seconds > 0.0 ? (double)(t->voluntaryCount - p->voluntaryCount) / seconds : 0.0),
+							(p != NULL && seconds > 0.0 ? (double)(t->involuntaryCount - p->involuntaryCount) / seconds : 0.0));
+			}
+		}
+	}
+	else if (strcmp(pszCommand, "watchdog") == 0) {
+		WatchdogStats			ws;
+		WatchdogThreadStats		threads[WATCHDOG_MAX_THREADS];
+		int						numThreads;
+
+		numThreads = Watchdog::getInstance().getStats(&ws, threads, WATCHDOG_MAX_THREADS);
+
+		if (!ws.isRunning) {
+			snprintf(response, responseLength, "The watchdog is not running");
+			return false;
+		}
+
+		length = snprintf(
+					response,
+					responseLength,
+					"watchdog: %d thread(s), deadline %lus, up to '%s', %u check(s), %u stall(s), %u recovered, %u interrupt(s), %u capture restart(s)\n" \
+					"%7s %-15s %-8s %10s %10s %6s %7s %s\n",
+					ws.numThreads,
+					(unsigned long)(ws.timeout / 1000000ULL),
+					getWatchdogActionName(ws.action),
+					ws.checkCount,
+					ws.stallCount,
+					ws.recoveredCount,
+					ws.interruptCount,
+					ws.captureRestartCount,
+					"tid",
+					"name",
+					"state",
+					"age(ms)",
+					"limit(ms)",
+					"level",
+					"stalls",
+					"point");
+
+		for (i = 0;i < numThreads && length < responseLength - 80;i++) {
+			WatchdogThreadStats * t = &threads[i];
+
+			length += snprintf(
+						&response[length],
+						responseLength - length,
+						"%7d %-15s %-8s %10lu %10lu %6d %7u %s\n",
+						(int)t->tid,
+						t->szName,
+						(t->isStalled ? "stalled" : (t->isWaiting ? "waiting" : "running")),
+						(unsigned long)(t->age / 1000ULL),
+						(unsigned long)(t->deadline / 1000ULL),
+						t->level,
+						t->stallCount,
+						(t->pszPoint != NULL ? t->pszPoint : "-"));
+		}
+	}
+	else if (strcmp(pszCommand, "startup") == 0) {
+		size_t length = StartupTimeline::getInstance().format(response, responseLength);
+
+		snprintf(&response[length], responseLength - length, "\n");
+	}
+	else if (strcmp(pszCommand, "reload") == 0) {
+		if (!reloadConfig()) {
+			snprintf(response, responseLength, "failed to reload config, see log");
+			return false;
+		}
+	}
+	else {
+		snprintf(response, responseLength, "unknown command '%s', try 'help'", pszCommand);
+		return false;
+	}
+
+	return true;
+}
+
+void * ControlThread::run()
+{
+	struct epoll_event		events[CONTROL_MAX_EVENTS];
+	struct epoll_event		ev;
+	uint64_t				count;
+	int						numEvents;
+	int						i;
+
+	Logger & log = Logger::getInstance();
+
+	traceSetThreadName("control");
+
+	if (this->epollFd < 0) {
+		this->epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+		if (this->epollFd < 0) {
+			throw bctl_error(bctl_error::buildMsg("Failed to create epoll instance: %s", strerror(errno)), __FILE__, __LINE__);
+		}
+
+		ev.events = EPOLLIN;
+		ev.data.u64 = 0;
+		ev.data.fd = CONTROL_ID_EVENT;
+
+		epoll_ctl(this->epollFd, EPOLL_CTL_ADD, this->eventFd, &ev);
+
+		openSocket();
+
+		if (this->listenFd >= 0) {
+			log.logStatus("Listening for control commands on %s", this->szSocketName);
+		}
+	}
+
+	while (1) {
+		watchdogWait();
+
+		numEvents = epoll_wait(this->epollFd, events, CONTROL_MAX_EVENTS, -1);
+
+		watchdogBeat();
+
+		if (numEvents < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			throw bctl_error(bctl_error::buildMsg("epoll_wait failed: %s", strerror(errno)), __FILE__, __LINE__);
+		}
+
+		for (i = 0;i < numEvents;i++) {
+			int id = events[i].data.fd;
+
+			if (id == CONTROL_ID_LISTEN) {
+				acceptClients();
+			}
+			else if (id == CONTROL_ID_EVENT) {
+				if (read(this->eventFd, &count, sizeof(count)) == sizeof(count)) {
+					reloadConfig();
+				}
+			}
+			else {
+				ControlClient * client = &this->clients[id];
+
+				if (client->fd < 0) {
+					continue;
+				}
+
+				if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+					closeClient(client);
+					continue;
+				}
+
+				if (events[i].events & EPOLLOUT) {
+					writeClient(client);
+				}
+
+				if (client->fd >= 0 && (events[i].events & EPOLLIN)) {
+					readClient(client);
+				}
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/*
+** Client side, used by 'bctl -ctl <command>'. Prints the
+** response and returns 0 if the daemon answered OK...
+*/
+int sendControlCommand(const char * pszSocketName, const char * pszCommand)
+{
+	struct sockaddr_un		addr;
+	char					buffer[CONTROL_MAX_RESPONSE_LENGTH];
+	int						fd;
+	int						bytesRead;
+	int						length = 0;
+	int						lineStart = 0;
+	int						rtn = -1;
+	int						i;
+
+	if (strlen(pszSocketName) == 0 || strlen(pszSocketName) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Invalid control socket name '%s'\n", pszSocketName);
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (fd < 0) {
+		fprintf(stderr, "Failed to create socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, pszSocketName);
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "Failed to connect to %s: %s\n", pszSocketName, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	write(fd, pszCommand, strlen(pszCommand));
+	write(fd, "\n", 1);
+
+	while ((bytesRead = read(fd, &buffer[length], sizeof(buffer) - length - 1)) > 0) {
+		length += bytesRead;
+
+		for (i = lineStart;i < length;i++) {
+			if (buffer[i] == '\n') {
+				buffer[i] = 0;
+
+				printf("%s\n", &buffer[lineStart]);
+
+				if (strncmp(&buffer[lineStart], "OK", 2) == 0) {
+					rtn = 0;
+				}
+				else if (strncmp(&buffer[lineStart], "ERR", 3) == 0) {
+					rtn = 1;
+				}
+
+				lineStart = i + 1;
+			}
+		}
+
+		if (rtn >= 0) {
+			break;
+		}
+
+		if (lineStart > 0) {
+			memmove(buffer, &buffer[lineStart], length - lineStart);
+			length -= lineStart;
+			lineStart = 0;
+		}
+	}
+
+	close(fd);
+
+	return rtn;
+}
@@ -0,0 +1,83 @@
+#include <stdint.h>
+#include <limits.h>
+
+#include "posixthread.h"
+
+#ifndef _INCL_CONTROLTHREAD
+#define _INCL_CONTROLTHREAD
+
+#define CONTROL_MAX_CLIENTS             64
+#define CONTROL_MAX_REQUEST_LENGTH      256
+#define CONTROL_MAX_RESPONSE_LENGTH     4096
+
+struct ControlClient
+{
+    int             fd;
+    int             inLength;
+    int             outLength;
+    int             outPosition;
+    char            inBuffer[CONTROL_MAX_REQUEST_LENGTH];
+    char            outBuffer[CONTROL_MAX_RESPONSE_LENGTH];
+};
+
+struct ControlStats
+{
+    uint32_t        connectionCount;
+    uint32_t        rejectedCount;
+    uint32_t        commandCount;
+    uint32_t        errorCount;
+    uint64_t        totalLatency;
+    uint64_t        maxLatency;
+};
+
+/*
+** The daemon's event thread. Serves runtime commands over a
+** Unix-domain socket and performs deferred work requested from
+** signal handlers (e.g. config reload), so none of it runs on
+** the capture path...
+*/
+class ControlThread : public PosixThread
+{
+private:
+    char                szSocketName[PATH_MAX];
+    int                 listenFd = -1;
+    int                 epollFd = -1;
+    int                 eventFd = -1;
+
+    ControlClient       clients[CONTROL_MAX_CLIENTS];
+    ControlStats        stats;
+
+    void                openSocket();
+    void                acceptClients();
+    void                closeClient(ControlClient * client);
+    void                readClient(ControlClient * client);
+    void                writeClient(ControlClient * client);
+    void                handleCommand(ControlClient * client, char * request);
+    bool                dispatchCommand(char * request, char * response, int responseLength);
+
+public:
+    ControlThread();
+    ~ControlThread();
+
+    void *              run();
+
+    /*
+    ** Async-signal-safe request to reload the config
+    ** from the event thread...
+    */
+    void                requestReload();
+
+    /*
+    ** Runs a command directly, as a client would, from any
+    ** thread. For the simulation...
+    */
+    bool                execute(const char * pszCommand, char * response, int responseLength);
+
+    const char *        getSocketName() {
+        return this->szSocketName;
+    }
+};
+
+int     sendControlCommand(const char * pszSocketName, const char * pszCommand);
+
+#endif
@@ -0,0 +1,230 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#include "crc32c.h"
+
+/*
+** Reflected Castagnoli polynomial...
+*/
+#define CRC32C_POLYNOMIAL					0x82F63B78U
+
+typedef uint32_t (* CRC32CFunction)(uint32_t crc, const void * data, size_t length);
+
+/*
+** tables[0] is the classic byte at a time table, tables[k] advances
+** a byte through k further zero bytes, so 8 bytes can be folded
+** in with 8 independent lookups...
+*/
+struct CRC32CTables
+{
+	uint32_t		tables[8][256];
+
+	CRC32CTables() {
+		uint32_t	i;
+		int			j;
+
+		for (i = 0;i < 256;i++) {
+			uint32_t crc = i;
+
+			for (j = 0;j < 8;j++) {
+				crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLYNOMIAL : 0);
+			}
+
+			tables[0][i] = crc;
+		}
+
+		for (i = 0;i < 256;i++) {
+			for (j = 1;j < 8;j++) {
+				tables[j][i] = (tables[j - 1][i] >> 8) ^ tables[0][tables[j - 1][i] & 0xFF];
+			}
+		}
+	}
+};
+
+static const CRC32CTables & getTables()
+{
+	static const CRC32CTables	tables;
+
+	return tables;
+}
+
+uint32_t crc32cBytewise(uint32_t crc, const void * data, size_t length)
+{
+	const CRC32CTables & t = getTables();
+
+	const uint8_t *	p = (const uint8_t *)data;
+
+	crc = ~crc;
+
+	while (length--) {
+		crc = t.tables[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	}
+
+	return ~crc;
+}
+
+uint32_t crc32cSlicing8(uint32_t crc, const void * data, size_t length)
+{
+	const CRC32CTables & t = getTables();
+
+	const uint8_t *	p = (const uint8_t *)data;
+	uint32_t		low;
+	uint32_t		high;
+
+	crc = ~crc;
+
+	while (length > 0 && ((uintptr_t)p & 7) != 0) {
+		crc = t.tables[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+		length--;
+	}
+
+	/*
+	** Assumes a little endian CPU, as are x86 and the Pi...
+	*/
+	while (length >= 8) {
+		memcpy(&low, p, 4);
+		memcpy(&high, p + 4, 4);
+
+		low ^= crc;
+
+		crc = t.tables[7][low & 0xFF] ^
+			  t.tables[6][(low >> 8) & 0xFF] ^
+			  t.tables[5][(low >> 16) & 0xFF] ^
+			  t.tables[4][low >> 24] ^
+			  t.tables[3][high & 0xFF] ^
+			  t.tables[2][(high >> 8) & 0xFF] ^
+			  t.tables[1][(high >> 16) & 0xFF] ^
+			  t.tables[0][high >> 24];
+
+		p += 8;
+		length -= 8;
+	}
+
+	while (length--) {
+		crc = t.tables[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	}
+
+	return ~crc;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse4.2")))
+uint32_t crc32cHardware(uint32_t crc, const void * data, size_t length)
+{
+	const uint8_t *	p = (const uint8_t *)data;
+	uint64_t		crc64;
+	uint64_t		value;
+
+	crc = ~crc;
+
+	while (length > 0 && ((uintptr_t)p & 7) != 0) {
+		crc = __builtin_ia32_crc32qi(crc, *p++);
+		length--;
+	}
+
+	crc64 = crc;
+
+	while (length >= 8) {
+		memcpy(&value, p, 8);
+		crc64 = __builtin_ia32_crc32di(crc64, value);
+		p += 8;
+		length -= 8;
+	}
+
+	crc = (uint32_t)crc64;
+
+	while (length--) {
+		crc = __builtin_ia32_crc32qi(crc, *p++);
+	}
+
+	return ~crc;
+}
+
+bool crc32cHasHardware()
+{
+	return __builtin_cpu_supports("sse4.2");
+}
+
+#elif defined(__aarch64__)
+
+uint32_t crc32cHardware(uint32_t crc, const void * data, size_t length)
+{
+	const uint8_t *	p = (const uint8_t *)data;
+	uint64_t		value;
+
+	crc = ~crc;
+
+	while (length > 0 && ((uintptr_t)p & 7) != 0) {
+		__asm__(".arch_extension crc\n\tcrc32cb %w0, %w0, %w1" : "+r"(crc) : "r"(*p));
+		p++;
+		length--;
+	}
+
+	while (length >= 8) {
+		memcpy(&value, p, 8);
+		__asm__(".arch_extension crc\n\tcrc32cx %w0, %w0, %x1" : "+r"(crc) : "r"(value));
+		p += 8;
+		length -= 8;
+	}
+
+	while (length--) {
+		__asm__(".arch_extension crc\n\tcrc32cb %w0, %w0, %w1" : "+r"(crc) : "r"(*p));
+		p++;
+	}
+
+	return ~crc;
+}
+
+bool crc32cHasHardware()
+{
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+
+#else
+
+/*
+** 32 bit ARM, even on an ARMv8 Pi, gets the table version...
+*/
+uint32_t crc32cHardware(uint32_t crc, const void * data, size_t length)
+{
+	return crc32cSlicing8(crc, data, length);
+}
+
+bool crc32cHasHardware()
+{
+	return false;
+}
+
+#endif
+
+static CRC32CFunction selectImplementation()
+{
+	return (crc32cHasHardware() ? crc32cHardware : crc32cSlicing8);
+}
+
+uint32_t crc32c(uint32_t crc, const void * data, size_t length)
+{
+	static const CRC32CFunction		function = selectImplementation();
+
+	return function(crc, data, length);
+}
+
+const char * crc32cImplementation()
+{
+	if (crc32cHasHardware()) {
+#if defined(__x86_64__)
+		return "SSE4.2";
+#else
+		return "ARMv8 CRC";
+#endif
+	}
+
+	return "slicing-by-8";
+}
@@ -0,0 +1,26 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef _INCL_CRC32C
+#define _INCL_CRC32C
+
+/*
+** CRC32C (Castagnoli), as used by iSCSI and ext4. Pass 0 as the
+** initial crc, or the result of a previous call to continue.
+** Uses the SSE4.2 or ARMv8 CRC instructions if the CPU has them,
+** slicing-by-8 otherwise...
+*/
+uint32_t        crc32c(uint32_t crc, const void * data, size_t length);
+
+/*
+** The individual implementations, for benchmarking. Calling
+** crc32cHardware() is only valid if crc32cHasHardware()...
+*/
+uint32_t        crc32cBytewise(uint32_t crc, const void * data, size_t length);
+uint32_t        crc32cSlicing8(uint32_t crc, const void * data, size_t length);
+uint32_t        crc32cHardware(uint32_t crc, const void * data, size_t length);
+
+bool            crc32cHasHardware();
+const char *    crc32cImplementation();
+
+#endif
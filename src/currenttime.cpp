@@ -6,9 +6,10 @@
 #include <sys/time.h>
 
 #include "logger.h"
+#include "clock.h"
 #include "currenttime.h"
 
-time_t		startTime;
+uint64_t	startTime;
 
 CurrentTime::CurrentTime()
 {
@@ -17,17 +18,36 @@ CurrentTime::CurrentTime()
 
 void CurrentTime::initialiseUptimeClock()
 {
-	startTime = time(0);
+	startTime = Clock::getInstance().getMonotonicTime();
+}
+
+/*
+** Microseconds from an arbitrary fixed point, unaffected by
+** changes to the wall clock. Virtual when simulating...
+*/
+uint64_t CurrentTime::getMonotonicTime()
+{
+	return Clock::getInstance().getMonotonicTime();
+}
+
+/*
+** Always the real monotonic clock, for timing how long
+** a piece of work takes, even when simulating...
+*/
+uint64_t CurrentTime::getStopwatchTime()
+{
+	struct timespec		ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000000ULL) + ((uint64_t)ts.tv_nsec / 1000ULL);
 }
 
 char * CurrentTime::getUptime()
 {
-	time_t		t;
 	uint32_t	seconds;
 
-	t = time(0);
-
-	seconds = (uint32_t)difftime(t, startTime);
+	seconds = (uint32_t)((Clock::getInstance().getMonotonicTime() - startTime) / 1000000ULL);
 
 	return getUptime(seconds);
 }
@@ -71,15 +91,20 @@ char * CurrentTime::getUptime(uint32_t uptimeSeconds)
 
 void CurrentTime::updateTime()
 {
-	struct timeval		tv;
+	uint64_t			wallTime;
 	time_t				t;
 
-	gettimeofday(&tv, NULL);
+	wallTime = Clock::getInstance().getWallTime();
+
+	t = (time_t)(wallTime / 1000000ULL);
 
-	t = tv.tv_sec;
+	this->usec = (int)(wallTime % 1000000ULL);
 
-	this->usec = tv.tv_usec;
-	this->localTime = localtime(&t);
+	/*
+	** localtime() re-reads the timezone each call, which
+	** allocates...
+	*/
+	localtime_r(&t, &this->localTime);
 }
 
 char * CurrentTime::getTimeStamp(bool includeMicroseconds)
@@ -120,37 +145,37 @@ char * CurrentTime::getTimeStamp()
 
 int CurrentTime::getYear()
 {
-	return localTime->tm_year + 1900;
+	return localTime.tm_year + 1900;
 }
 
 int CurrentTime::getMonth()
 {
-	return localTime->tm_mon + 1;
+	return localTime.tm_mon + 1;
 }
 
 int CurrentTime::getDay()
 {
-	return localTime->tm_mday;
+	return localTime.tm_mday;
 }
 
 int CurrentTime::getDayOfWeek()
 {
-	return localTime->tm_wday + 1;
+	return localTime.tm_wday + 1;
 }
 
 int CurrentTime::getHour()
 {
-	return localTime->tm_hour;
+	return localTime.tm_hour;
 }
 
 int CurrentTime::getMinute()
 {
-	return localTime->tm_min;
+	return localTime.tm_min;
 }
 
 int CurrentTime::getSecond()
 {
-	return localTime->tm_sec;
+	return localTime.tm_sec;
 }
 
 int CurrentTime::getMicrosecond()
@@ -19,7 +19,7 @@
 class CurrentTime
 {
 private:
-	struct tm *		localTime;
+	struct tm		localTime;
 	int				usec;
 	char			szTimeStr[28];
 
@@ -27,6 +27,8 @@ public:
 	CurrentTime();
 
 	static void		initialiseUptimeClock();
+	static uint64_t	getMonotonicTime();
+	static uint64_t	getStopwatchTime();
 	static char *	getUptime();
 	static char *	getUptime(uint32_t uptimeSeconds);
 
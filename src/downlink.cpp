@@ -0,0 +1,607 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include <vector>
+
+#include "configmgr.h"
+#include "ssdv.h"
+#include "downlink.h"
+
+using namespace std;
+
+#define DOWNLINK_DQT_BUFFER_LENGTH			1024
+
+/*
+** Higher score wins, then the newer frame...
+*/
+static bool isBetterCandidate(const DownlinkCandidate & a, const DownlinkCandidate & b)
+{
+	if (a.score != b.score) {
+		return (a.score > b.score);
+	}
+
+	if (a.time != b.time) {
+		return (a.time > b.time);
+	}
+
+	return (a.sequence > b.sequence);
+}
+
+DownlinkScheduler::DownlinkScheduler()
+{
+	configure(DOWNLINK_MAX_QUEUE_LENGTH, 0, 0);
+}
+
+void DownlinkScheduler::configure(int capacity, uint64_t budget, uint64_t windowLength)
+{
+	int		i;
+
+	if (capacity < 2) {
+		capacity = 2;
+	}
+	else if (capacity > DOWNLINK_MAX_QUEUE_LENGTH) {
+		capacity = DOWNLINK_MAX_QUEUE_LENGTH;
+	}
+
+	this->capacity = capacity;
+	this->budget = budget;
+	this->windowLength = windowLength;
+
+	this->count = 0;
+	this->numFree = 0;
+
+	for (i = capacity - 1;i >= 0;i--) {
+		this->freeSlots[this->numFree++] = i;
+	}
+
+	this->owedHead = 0;
+	this->owedCount = 0;
+	this->window = 0;
+	this->isWindowStarted = false;
+	this->isWindowCovered = false;
+	this->windowBest = -1;
+	this->availableTime = 0;
+
+	memset(&this->stats, 0, sizeof(DownlinkStats));
+}
+
+/*
+** The best heap has the best candidate at the root, the
+** worst heap the worst...
+*/
+bool DownlinkScheduler::isBefore(int a, int b, bool isBestHeap)
+{
+	if (isBestHeap) {
+		return isBetterCandidate(this->slots[a], this->slots[b]);
+	}
+
+	return isBetterCandidate(this->slots[b], this->slots[a]);
+}
+
+void DownlinkScheduler::swap(int * heap, int * position, int i, int j)
+{
+	int		slot = heap[i];
+
+	heap[i] = heap[j];
+	heap[j] = slot;
+
+	position[heap[i]] = i;
+	position[heap[j]] = j;
+}
+
+void DownlinkScheduler::siftUp(int * heap, int * position, int i, bool isBestHeap)
+{
+	int		parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+
+		if (!isBefore(heap[i], heap[parent], isBestHeap)) {
+			break;
+		}
+
+		swap(heap, position, i, parent);
+		i = parent;
+	}
+}
+
+void DownlinkScheduler::siftDown(int * heap, int * position, int i, int n, bool isBestHeap)
+{
+	int		child;
+
+	while ((child = 2 * i + 1) < n) {
+		if (child + 1 < n && isBefore(heap[child + 1], heap[child], isBestHeap)) {
+			child++;
+		}
+
+		if (!isBefore(heap[child], heap[i], isBestHeap)) {
+			break;
+		}
+
+		swap(heap, position, i, child);
+		i = child;
+	}
+}
+
+/*
+** Move the last entry into the hole and let it find its
+** level, the heap shrinks by one...
+*/
+void DownlinkScheduler::removeFromHeap(int * heap, int * position, int i, bool isBestHeap)
+{
+	int		last = this->count - 1;
+
+	if (i != last) {
+		swap(heap, position, i, last);
+		siftDown(heap, position, i, last, isBestHeap);
+		siftUp(heap, position, i, isBestHeap);
+	}
+}
+
+void DownlinkScheduler::removeSlot(int slot)
+{
+	removeFromHeap(this->bestHeap, this->bestPosition, this->bestPosition[slot], true);
+	removeFromHeap(this->worstHeap, this->worstPosition, this->worstPosition[slot], false);
+
+	this->count--;
+	this->freeSlots[this->numFree++] = slot;
+
+	if (slot == this->windowBest) {
+		this->windowBest = -1;
+	}
+}
+
+/*
+** The worst candidate, unless that's the one this window is
+** relying on, in which case the worse of its children...
+*/
+int DownlinkScheduler::findVictim()
+{
+	int		victim = this->worstHeap[0];
+
+	if (victim == this->windowBest) {
+		victim = this->worstHeap[1];
+
+		if (this->count > 2 && isBefore(this->worstHeap[2], victim, false)) {
+			victim = this->worstHeap[2];
+		}
+	}
+
+	return victim;
+}
+
+void DownlinkScheduler::rollWindow(uint64_t now)
+{
+	uint64_t		w;
+
+	if (this->windowLength == 0) {
+		return;
+	}
+
+	w = now / this->windowLength;
+
+	if (w <= this->window) {
+		return;
+	}
+
+	if (!this->isWindowCovered && this->windowBest >= 0 && this->owedCount < DOWNLINK_MAX_OWED) {
+		memcpy(&this->owed[(this->owedHead + this->owedCount) % DOWNLINK_MAX_OWED], &this->slots[this->windowBest], sizeof(DownlinkCandidate));
+		this->owedCount++;
+
+		removeSlot(this->windowBest);
+
+		this->stats.owedCount++;
+	}
+
+	this->window = w;
+	this->isWindowStarted = false;
+	this->isWindowCovered = false;
+	this->windowBest = -1;
+}
+
+/*
+** Returns true if a candidate had to go to make room, which
+** may be the new one...
+*/
+bool DownlinkScheduler::addCandidate(const DownlinkCandidate & candidate, DownlinkCandidate * evicted)
+{
+	bool		isEvicted = false;
+	bool		isInWindow;
+	bool		isNewBest;
+	int			victim;
+	int			slot;
+
+	rollWindow(candidate.time);
+
+	this->stats.offeredCount++;
+
+	isInWindow = (this->windowLength > 0 && candidate.time / this->windowLength == this->window);
+
+	if (isInWindow && !this->isWindowStarted) {
+		this->isWindowStarted = true;
+		this->stats.windowCount++;
+	}
+
+	isNewBest = (isInWindow && !this->isWindowCovered && (this->windowBest < 0 || isBetterCandidate(candidate, this->slots[this->windowBest])));
+
+	if (this->count == this->capacity) {
+		victim = findVictim();
+
+		if (!isNewBest && !isBetterCandidate(candidate, this->slots[victim])) {
+			memcpy(evicted, &candidate, sizeof(DownlinkCandidate));
+			this->stats.evictedCount++;
+			return true;
+		}
+
+		memcpy(evicted, &this->slots[victim], sizeof(DownlinkCandidate));
+		removeSlot(victim);
+
+		this->stats.evictedCount++;
+		isEvicted = true;
+	}
+
+	slot = this->freeSlots[--this->numFree];
+
+	memcpy(&this->slots[slot], &candidate, sizeof(DownlinkCandidate));
+
+	this->bestHeap[this->count] = slot;
+	this->bestPosition[slot] = this->count;
+	this->worstHeap[this->count] = slot;
+	this->worstPosition[slot] = this->count;
+
+	this->count++;
+
+	siftUp(this->bestHeap, this->bestPosition, this->bestPosition[slot], true);
+	siftUp(this->worstHeap, this->worstPosition, this->worstPosition[slot], false);
+
+	if (isNewBest) {
+		this->windowBest = slot;
+	}
+
+	return isEvicted;
+}
+
+/*
+** The frame to send now, if the budget allows and there is
+** one. Owed frames go first, then the best...
+*/
+bool DownlinkScheduler::nextFrame(uint64_t now, DownlinkCandidate * candidate)
+{
+	int			slot;
+
+	rollWindow(now);
+
+	if (this->budget > 0 && now < this->availableTime) {
+		return false;
+	}
+
+	if (this->owedCount > 0) {
+		memcpy(candidate, &this->owed[this->owedHead], sizeof(DownlinkCandidate));
+
+		this->owedHead = (this->owedHead + 1) % DOWNLINK_MAX_OWED;
+		this->owedCount--;
+
+		this->stats.coveredCount++;
+	}
+	else if (this->count > 0) {
+		slot = this->bestHeap[0];
+
+		memcpy(candidate, &this->slots[slot], sizeof(DownlinkCandidate));
+
+		removeSlot(slot);
+
+		if (this->windowLength > 0 && candidate->time / this->windowLength == this->window && !this->isWindowCovered) {
+			this->isWindowCovered = true;
+			this->windowBest = -1;
+			this->stats.coveredCount++;
+		}
+	}
+	else {
+		return false;
+	}
+
+	/*
+	** Spend the budget, without banking any from
+	** while the link was idle...
+	*/
+	if (this->budget > 0) {
+		this->availableTime = (now > this->availableTime ? now : this->availableTime) + ((uint64_t)candidate->cost * 1000000ULL) / this->budget;
+	}
+
+	this->stats.sentCount++;
+	this->stats.bytesSent += candidate->cost;
+
+	return true;
+}
+
+/*
+** For emptying the queue at shutdown, ignores the budget...
+*/
+bool DownlinkScheduler::takeAny(DownlinkCandidate * candidate)
+{
+	if (this->owedCount > 0) {
+		memcpy(candidate, &this->owed[this->owedHead], sizeof(DownlinkCandidate));
+
+		this->owedHead = (this->owedHead + 1) % DOWNLINK_MAX_OWED;
+		this->owedCount--;
+
+		return true;
+	}
+
+	if (this->count > 0) {
+		memcpy(candidate, &this->slots[this->bestHeap[0]], sizeof(DownlinkCandidate));
+		removeSlot(this->bestHeap[0]);
+
+		return true;
+	}
+
+	return false;
+}
+
+/*
+** When nextFrame() is next worth calling, returns false if
+** there is nothing to send...
+*/
+bool DownlinkScheduler::getWakeTime(uint64_t now, uint64_t * wakeTime)
+{
+	if (this->count == 0 && this->owedCount == 0) {
+		return false;
+	}
+
+	*wakeTime = ((this->budget == 0 || now >= this->availableTime) ? now : this->availableTime);
+
+	return true;
+}
+
+void DownlinkScheduler::getStats(DownlinkStats * stats)
+{
+	memcpy(stats, &this->stats, sizeof(DownlinkStats));
+}
+
+/*
+** A cheap guess at how much is in a frame, without decoding it:
+** bits per pixel of entropy coded data, scaled by the average
+** luminance quantiser, as a coarser quantiser squeezes the same
+** detail into fewer bits. Headers, EXIF thumbnails and padding
+** don't count. Only reads the marker segments...
+*/
+bool scoreJpegFile(int fd, uint32_t * score)
+{
+	uint8_t			buffer[DOWNLINK_DQT_BUFFER_LENGTH];
+	struct stat		st;
+	off_t			offset = 2;
+	off_t			scanOffset = 0;
+	uint64_t		quantSum = 0;
+	uint64_t		value;
+	size_t			segmentLength;
+	size_t			readLength;
+	size_t			tableLength;
+	size_t			i;
+	int				width = 0;
+	int				height = 0;
+	int				j;
+	uint8_t			marker;
+
+	if (fstat(fd, &st) < 0 || pread(fd, buffer, 2, 0) != 2 || buffer[0] != 0xFF || buffer[1] != 0xD8) {
+		return false;
+	}
+
+	while (scanOffset == 0) {
+		if (pread(fd, buffer, 4, offset) != 4 || buffer[0] != 0xFF) {
+			return false;
+		}
+
+		marker = buffer[1];
+
+		if (marker == 0xFF) {
+			offset++;
+			continue;
+		}
+
+		segmentLength = ((size_t)buffer[2] << 8) | buffer[3];
+
+		if (segmentLength < 2) {
+			return false;
+		}
+
+		if (marker == 0xDB) {
+			readLength = segmentLength - 2;
+
+			if (readLength > sizeof(buffer)) {
+				readLength = sizeof(buffer);
+			}
+
+			if (pread(fd, buffer, readLength, offset + 4) != (ssize_t)readLength) {
+				return false;
+			}
+
+			/*
+			** A DQT may hold several tables, luminance is 0...
+			*/
+			for (i = 0;i < readLength;i += tableLength) {
+				tableLength = 1 + ((buffer[i] >> 4) ? 128 : 64);
+
+				if (i + tableLength > readLength) {
+					break;
+				}
+
+				if ((buffer[i] & 0x0F) == 0) {
+					for (j = 0;j < 64;j++) {
+						value = ((buffer[i] >> 4) ? (((uint64_t)buffer[i + 1 + j * 2] << 8) | buffer[i + 2 + j * 2]) : buffer[i + 1 + j]);
+						quantSum += value;
+					}
+				}
+			}
+		}
+		else if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+			if (pread(fd, buffer, 5, offset + 4) != 5) {
+				return false;
+			}
+
+			height = ((int)buffer[1] << 8) | buffer[2];
+			width = ((int)buffer[3] << 8) | buffer[4];
+		}
+		else if (marker == 0xDA) {
+			scanOffset = offset + 2 + segmentLength;
+		}
+
+		offset += 2 + segmentLength;
+	}
+
+	if (quantSum == 0 || width == 0 || height == 0 || st.st_size <= scanOffset) {
+		return false;
+	}
+
+	value = ((uint64_t)(st.st_size - scanOffset) * 8000ULL * quantSum) / (64ULL * (uint64_t)width * (uint64_t)height);
+
+	*score = (value > 0xFFFFFFFFULL ? 0xFFFFFFFFU : (uint32_t)value);
+
+	return true;
+}
+
+struct ReplayFrame
+{
+	uint64_t		time;
+	char			szPath[PATH_MAX];
+};
+
+/*
+** Run the scheduler over a replayed set of frames, one
+** '<seconds> <jpeg path>' line each in time order, with the
+** current downlink and SSDV config, printing its decisions...
+*/
+int replayDownlink(const char * pszReplayFile)
+{
+	vector<ReplayFrame>		frames;
+	ReplayFrame				frame;
+	DownlinkScheduler		scheduler;
+	DownlinkCandidate		candidate;
+	DownlinkCandidate		evicted;
+	DownlinkStats			stats;
+	struct stat				st;
+	char					szLine[PATH_MAX + 32];
+	uint64_t				now = 0;
+	uint64_t				wakeTime;
+	uint64_t				endTime = 0;
+	double					seconds;
+	size_t					i;
+	int						fd;
+	FILE *					fptr;
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	uint64_t budget = (uint64_t)cfg.getValueAsInteger(CFG_DOWNLINK_BUDGET);
+	uint64_t windowLength = (uint64_t)cfg.getValueAsInteger(CFG_DOWNLINK_WINDOW) * 1000000ULL;
+	bool useFEC = cfg.getValueAsBoolean(CFG_SSDV_FEC);
+
+	fptr = fopen(pszReplayFile, "rt");
+
+	if (fptr == NULL) {
+		fprintf(stderr, "Failed to open replay file %s: %s\n", pszReplayFile, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(szLine, sizeof(szLine), fptr) != NULL) {
+		if (szLine[0] == '#' || sscanf(szLine, "%lf %4095s", &seconds, frame.szPath) != 2) {
+			continue;
+		}
+
+		frame.time = (uint64_t)(seconds * 1000000.0);
+		frames.push_back(frame);
+	}
+
+	fclose(fptr);
+
+	scheduler.configure(cfg.getValueAsInteger(CFG_DOWNLINK_QUEUELENGTH), budget, windowLength);
+
+	printf(
+		"Replaying %lu frame(s), budget %lu bytes/s, window %lus, queue %d\n",
+		(unsigned long)frames.size(),
+		(unsigned long)budget,
+		(unsigned long)(windowLength / 1000000ULL),
+		cfg.getValueAsInteger(CFG_DOWNLINK_QUEUELENGTH));
+
+	for (i = 0;i <= frames.size();i++) {
+		/*
+		** Send whatever the budget allows up to this frame,
+		** or after the last one, until the queue is empty...
+		*/
+		while (scheduler.getWakeTime(now, &wakeTime) && (i == frames.size() || wakeTime <= frames[i].time)) {
+			now = wakeTime;
+
+			if (!scheduler.nextFrame(now, &candidate)) {
+				break;
+			}
+
+			if (budget > 0) {
+				endTime = now + ((uint64_t)candidate.cost * 1000000ULL) / budget;
+			}
+
+			printf("%10.3fs  send  %6u  score %-8u %6u bytes\n", (double)now / 1000000.0, candidate.sequence, candidate.score, candidate.cost);
+		}
+
+		if (i == frames.size()) {
+			break;
+		}
+
+		now = frames[i].time;
+
+		memset(&candidate, 0, sizeof(DownlinkCandidate));
+
+		candidate.sequence = (uint32_t)(i + 1);
+		candidate.time = frames[i].time;
+		candidate.fd = -1;
+
+		fd = open(frames[i].szPath, O_RDONLY | O_CLOEXEC);
+
+		if (fd < 0 || fstat(fd, &st) < 0) {
+			fprintf(stderr, "Failed to read %s\n", frames[i].szPath);
+
+			if (fd >= 0) {
+				close(fd);
+			}
+			continue;
+		}
+
+		scoreJpegFile(fd, &candidate.score);
+		close(fd);
+
+		candidate.cost = (uint32_t)(ssdvGetPacketCount((size_t)st.st_size, useFEC) * SSDV_PACKET_LENGTH);
+
+		if (scheduler.addCandidate(candidate, &evicted)) {
+			printf("%10.3fs  evict %6u  score %-8u\n", (double)now / 1000000.0, evicted.sequence, evicted.score);
+		}
+	}
+
+	scheduler.getStats(&stats);
+
+	printf(
+		"Offered %u, sent %u, evicted %u, %u owed, %u of %u window(s) covered, %.1f KB sent",
+		stats.offeredCount,
+		stats.sentCount,
+		stats.evictedCount,
+		stats.owedCount,
+		stats.coveredCount,
+		stats.windowCount,
+		(double)stats.bytesSent / 1000.0);
+
+	/*
+	** Up to the end of the last transmission...
+	*/
+	if (endTime < now) {
+		endTime = now;
+	}
+
+	if (budget > 0 && endTime > 0) {
+		printf(", %.1f%% of the budget", ((double)stats.bytesSent * 100000000.0) / ((double)budget * (double)endTime));
+	}
+
+	printf("\n");
+
+	return 0;
+}
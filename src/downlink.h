@@ -0,0 +1,108 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef _INCL_DOWNLINK
+#define _INCL_DOWNLINK
+
+#define DOWNLINK_MAX_QUEUE_LENGTH           1024
+#define DOWNLINK_MAX_OWED                   16
+
+/*
+** A frame waiting to go down the radio link. The score says how
+** much we want it, the cost is what it takes on the link in bytes.
+** The fd is the caller's, the scheduler just carries it...
+*/
+struct DownlinkCandidate
+{
+    uint32_t            sequence;
+    uint64_t            time;
+    uint32_t            score;
+    uint32_t            cost;
+    int                 fd;
+};
+
+struct DownlinkStats
+{
+    uint32_t            offeredCount;
+    uint32_t            sentCount;
+    uint32_t            evictedCount;
+    uint32_t            owedCount;
+    uint32_t            windowCount;
+    uint32_t            coveredCount;
+    uint64_t            bytesSent;
+};
+
+/*
+** Picks which frame to send next within a bytes/second budget.
+**
+** Candidates sit in two indexed binary heaps over the same slots,
+** one giving the best and the other the worst in O(log n), so a
+** full queue can evict its worst. Time is split into windows of
+** windowLength. If a window closes without a frame being sent
+** from it, its best frame is moved to an 'owed' list, which is
+** sent ahead of everything else, unless that list is full. The
+** best frame of a window not yet covered is never evicted. A
+** budget of 0 is unlimited.
+**
+** All times are passed in, in us, so a replay can drive it...
+*/
+class DownlinkScheduler
+{
+private:
+    DownlinkCandidate   slots[DOWNLINK_MAX_QUEUE_LENGTH];
+    int                 freeSlots[DOWNLINK_MAX_QUEUE_LENGTH];
+    int                 numFree = 0;
+
+    int                 bestHeap[DOWNLINK_MAX_QUEUE_LENGTH];
+    int                 worstHeap[DOWNLINK_MAX_QUEUE_LENGTH];
+    int                 bestPosition[DOWNLINK_MAX_QUEUE_LENGTH];
+    int                 worstPosition[DOWNLINK_MAX_QUEUE_LENGTH];
+    int                 count = 0;
+    int                 capacity = 0;
+
+    DownlinkCandidate   owed[DOWNLINK_MAX_OWED];
+    int                 owedHead = 0;
+    int                 owedCount = 0;
+
+    uint64_t            budget = 0;
+    uint64_t            windowLength = 0;
+    uint64_t            window = 0;
+    bool                isWindowStarted = false;
+    bool                isWindowCovered = false;
+    int                 windowBest = -1;
+
+    uint64_t            availableTime = 0;
+
+    DownlinkStats       stats;
+
+    void                swap(int * heap, int * position, int i, int j);
+    bool                isBefore(int a, int b, bool isBestHeap);
+    void                siftUp(int * heap, int * position, int i, bool isBestHeap);
+    void                siftDown(int * heap, int * position, int i, int n, bool isBestHeap);
+    void                removeFromHeap(int * heap, int * position, int i, bool isBestHeap);
+    int                 findVictim();
+    void                removeSlot(int slot);
+    void                rollWindow(uint64_t now);
+
+public:
+    DownlinkScheduler();
+
+    void                configure(int capacity, uint64_t budget, uint64_t windowLength);
+
+    bool                addCandidate(const DownlinkCandidate & candidate, DownlinkCandidate * evicted);
+    bool                nextFrame(uint64_t now, DownlinkCandidate * candidate);
+    bool                takeAny(DownlinkCandidate * candidate);
+
+    bool                getWakeTime(uint64_t now, uint64_t * wakeTime);
+
+    int                 getQueueLength() {
+        return this->count + this->owedCount;
+    }
+
+    void                getStats(DownlinkStats * stats);
+};
+
+bool    scoreJpegFile(int fd, uint32_t * score);
+int     replayDownlink(const char * pszReplayFile);
+
+#endif
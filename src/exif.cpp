@@ -0,0 +1,619 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "configmgr.h"
+#include "logger.h"
+#include "bctl_error.h"
+#include "currenttime.h"
+#include "clock.h"
+#include "threads.h"
+#include "exif.h"
+#include "bctl.h"
+
+using namespace std;
+
+#define TIFF_BYTE							1
+#define TIFF_ASCII							2
+#define TIFF_SHORT							3
+#define TIFF_LONG							4
+#define TIFF_RATIONAL						5
+#define TIFF_UNDEFINED						7
+#define TIFF_SRATIONAL						10
+
+#define EXIF_HEADER_LENGTH					10
+
+static void putLittleEndian16(uint8_t * p, uint16_t value)
+{
+	p[0] = (uint8_t)value;
+	p[1] = (uint8_t)(value >> 8);
+}
+
+static void putLittleEndian32(uint8_t * p, uint32_t value)
+{
+	p[0] = (uint8_t)value;
+	p[1] = (uint8_t)(value >> 8);
+	p[2] = (uint8_t)(value >> 16);
+	p[3] = (uint8_t)(value >> 24);
+}
+
+/*
+** Builds one IFD at a time, each followed by the values too big
+** to fit in their entry. Offsets are from the TIFF header...
+*/
+struct TiffIFD
+{
+	uint8_t *		tiff;
+	size_t			capacity;
+	size_t			entryOffset;
+	size_t			dataOffset;
+	bool			isOverflow;
+};
+
+static void beginIFD(TiffIFD * ifd, uint8_t * tiff, size_t capacity, size_t offset, int numEntries)
+{
+	ifd->tiff = tiff;
+	ifd->capacity = capacity;
+	ifd->entryOffset = offset + 2;
+	ifd->dataOffset = offset + 2 + numEntries * 12 + 4;
+	ifd->isOverflow = (ifd->dataOffset > capacity);
+
+	if (!ifd->isOverflow) {
+		putLittleEndian16(&tiff[offset], (uint16_t)numEntries);
+		putLittleEndian32(&tiff[ifd->dataOffset - 4], 0);
+	}
+}
+
+/*
+** Returns the offset of the entry's value, so an
+** IFD pointer can be filled in later...
+*/
+static size_t addEntry(TiffIFD * ifd, uint16_t tag, uint16_t type, uint32_t count, const void * value, size_t length)
+{
+	uint8_t *		entry = &ifd->tiff[ifd->entryOffset];
+
+	if (ifd->isOverflow || (length > 4 && ifd->dataOffset + length > ifd->capacity)) {
+		ifd->isOverflow = true;
+		return 0;
+	}
+
+	putLittleEndian16(&entry[0], tag);
+	putLittleEndian16(&entry[2], type);
+	putLittleEndian32(&entry[4], count);
+
+	if (length <= 4) {
+		memset(&entry[8], 0, 4);
+		memcpy(&entry[8], value, length);
+	}
+	else {
+		memcpy(&ifd->tiff[ifd->dataOffset], value, length);
+		putLittleEndian32(&entry[8], (uint32_t)ifd->dataOffset);
+
+		ifd->dataOffset += length + (length & 1);
+	}
+
+	ifd->entryOffset += 12;
+
+	return ifd->entryOffset - 4;
+}
+
+static size_t addLong(TiffIFD * ifd, uint16_t tag, uint32_t value)
+{
+	uint8_t		v[4];
+
+	putLittleEndian32(v, value);
+
+	return addEntry(ifd, tag, TIFF_LONG, 1, v, 4);
+}
+
+static void addAscii(TiffIFD * ifd, uint16_t tag, const char * pszValue)
+{
+	size_t		length = strlen(pszValue) + 1;
+
+	addEntry(ifd, tag, TIFF_ASCII, (uint32_t)length, pszValue, length);
+}
+
+/*
+** Up to 3 numerator/denominator pairs...
+*/
+static void addRationals(TiffIFD * ifd, uint16_t tag, uint16_t type, const uint32_t * values, int count)
+{
+	uint8_t		v[24];
+	int			i;
+
+	for (i = 0;i < count * 2;i++) {
+		putLittleEndian32(&v[i * 4], values[i]);
+	}
+
+	addEntry(ifd, tag, type, (uint32_t)count, v, count * 8);
+}
+
+/*
+** 1e-7 degrees to degrees, minutes and thousandths of
+** a second...
+*/
+static void toDegreesMinutesSeconds(int32_t value, uint32_t * rationals)
+{
+	uint64_t	v = (uint64_t)(value < 0 ? -(int64_t)value : value);
+	uint64_t	minutes = (v % 10000000ULL) * 60ULL;
+
+	rationals[0] = (uint32_t)(v / 10000000ULL);
+	rationals[1] = 1;
+	rationals[2] = (uint32_t)(minutes / 10000000ULL);
+	rationals[3] = 1;
+	rationals[4] = (uint32_t)(((minutes % 10000000ULL) * 60000ULL) / 10000000ULL);
+	rationals[5] = 1000;
+}
+
+/*
+** An APP1 segment of exactly segmentLength bytes, marker and all,
+** padded with zeros. Returns 0 if it doesn't fit...
+*/
+size_t buildExifSegment(uint8_t * buffer, size_t segmentLength, const ExifTelemetry & telemetry)
+{
+	TiffIFD			ifd;
+	struct tm		tm;
+	time_t			t;
+	uint32_t		rationals[6];
+	uint8_t			version[4] = {2, 3, 0, 0};
+	uint8_t			altitudeRef;
+	char			szDateTime[64];
+	char			szSubSec[8];
+	char			szText[96];
+	size_t			exifPointer;
+	size_t			gpsPointer = 0;
+	bool			hasTemperature = (telemetry.cpuTemp > -273.0f);
+	bool			hasPosition = (telemetry.hasFix && (telemetry.fix.isValid || telemetry.fix.quality != GPS_FIX_NONE));
+	int				length;
+
+	if (segmentLength < EXIF_HEADER_LENGTH + 8 || segmentLength > 65537) {
+		return 0;
+	}
+
+	memset(buffer, 0, segmentLength);
+
+	buffer[0] = 0xFF;
+	buffer[1] = 0xE1;
+	buffer[2] = (uint8_t)((segmentLength - 2) >> 8);
+	buffer[3] = (uint8_t)(segmentLength - 2);
+
+	memcpy(&buffer[4], "Exif\0\0", 6);
+
+	uint8_t * tiff = &buffer[EXIF_HEADER_LENGTH];
+	size_t capacity = segmentLength - EXIF_HEADER_LENGTH;
+
+	/*
+	** Little endian TIFF header, IFD0 straight after it...
+	*/
+	tiff[0] = 'I';
+	tiff[1] = 'I';
+	putLittleEndian16(&tiff[2], 42);
+	putLittleEndian32(&tiff[4], 8);
+
+	t = (time_t)(telemetry.wallTime / 1000000ULL);
+	gmtime_r(&t, &tm);
+
+	snprintf(szDateTime, sizeof(szDateTime), "%04d:%02d:%02d %02d:%02d:%02d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+	snprintf(szSubSec, sizeof(szSubSec), "%03u", (unsigned int)((telemetry.wallTime / 1000ULL) % 1000ULL));
+
+	/*
+	** IFD0: description, date/time and the sub-IFD pointers...
+	*/
+	beginIFD(&ifd, tiff, capacity, 8, (hasPosition ? 4 : 3));
+
+	snprintf(szText, sizeof(szText), "bctl frame %u", telemetry.sequence);
+
+	addAscii(&ifd, 0x010E, szText);
+	addAscii(&ifd, 0x0132, szDateTime);
+	exifPointer = addLong(&ifd, 0x8769, 0);
+
+	if (hasPosition) {
+		gpsPointer = addLong(&ifd, 0x8825, 0);
+	}
+
+	if (ifd.isOverflow) {
+		return 0;
+	}
+
+	/*
+	** Exif IFD: when the trigger fired, and the rest of the
+	** telemetry in the user comment...
+	*/
+	putLittleEndian32(&tiff[exifPointer], (uint32_t)ifd.dataOffset);
+
+	beginIFD(&ifd, tiff, capacity, ifd.dataOffset, (hasTemperature ? 4 : 3));
+
+	addAscii(&ifd, 0x9003, szDateTime);
+
+	memcpy(szText, "ASCII\0\0\0", 8);
+
+	if (hasTemperature) {
+		length = snprintf(&szText[8], sizeof(szText) - 8, "bctl seq=%u cputemp=%.1fC", telemetry.sequence, telemetry.cpuTemp);
+	}
+	else {
+		length = snprintf(&szText[8], sizeof(szText) - 8, "bctl seq=%u", telemetry.sequence);
+	}
+
+	addEntry(&ifd, 0x9286, TIFF_UNDEFINED, (uint32_t)(length + 8), szText, length + 8);
+	addAscii(&ifd, 0x9291, szSubSec);
+
+	if (hasTemperature) {
+		rationals[0] = (uint32_t)(int32_t)(telemetry.cpuTemp * 10.0f);
+		rationals[1] = 10;
+
+		addRationals(&ifd, 0x9400, TIFF_SRATIONAL, rationals, 1);
+	}
+
+	if (hasPosition && !ifd.isOverflow) {
+		const GPSFix & f = telemetry.fix;
+
+		putLittleEndian32(&tiff[gpsPointer], (uint32_t)ifd.dataOffset);
+
+		beginIFD(&ifd, tiff, capacity, ifd.dataOffset, (f.date != 0 ? 9 : 8));
+
+		addEntry(&ifd, 0x0000, TIFF_BYTE, 4, version, 4);
+		addAscii(&ifd, 0x0001, (f.latitude < 0 ? "S" : "N"));
+
+		toDegreesMinutesSeconds(f.latitude, rationals);
+		addRationals(&ifd, 0x0002, TIFF_RATIONAL, rationals, 3);
+
+		addAscii(&ifd, 0x0003, (f.longitude < 0 ? "W" : "E"));
+
+		toDegreesMinutesSeconds(f.longitude, rationals);
+		addRationals(&ifd, 0x0004, TIFF_RATIONAL, rationals, 3);
+
+		altitudeRef = (f.altitude < 0 ? 1 : 0);
+		addEntry(&ifd, 0x0005, TIFF_BYTE, 1, &altitudeRef, 1);
+
+		rationals[0] = (uint32_t)(f.altitude < 0 ? -f.altitude : f.altitude);
+		rationals[1] = 1000;
+		addRationals(&ifd, 0x0006, TIFF_RATIONAL, rationals, 1);
+
+		rationals[0] = f.timeOfDay / 3600000;
+		rationals[1] = 1;
+		rationals[2] = (f.timeOfDay / 60000) % 60;
+		rationals[3] = 1;
+		rationals[4] = f.timeOfDay % 60000;
+		rationals[5] = 1000;
+		addRationals(&ifd, 0x0007, TIFF_RATIONAL, rationals, 3);
+
+		/*
+		** ddmmyy, assumed to be this century...
+		*/
+		if (f.date != 0) {
+			snprintf(szText, sizeof(szText), "20%02u:%02u:%02u", f.date % 100, (f.date / 100) % 100, (f.date / 10000) % 100);
+			addAscii(&ifd, 0x001D, szText);
+		}
+	}
+
+	if (ifd.isOverflow) {
+		return 0;
+	}
+
+	return segmentLength;
+}
+
+ExifTagger::ExifTagger()
+{
+	if (pipe2(this->pipeFds, O_CLOEXEC) < 0) {
+		throw bctl_error(bctl_error::buildMsg("Failed to create the Exif splice pipe: %s", strerror(errno)), __FILE__, __LINE__);
+	}
+
+	pthread_mutex_init(&this->mutex, NULL);
+
+	memset(&this->stats, 0, sizeof(ExifStats));
+}
+
+ExifTagger::~ExifTagger()
+{
+	if (this->pipeFds[0] >= 0) {
+		close(this->pipeFds[0]);
+		close(this->pipeFds[1]);
+	}
+
+	pthread_mutex_destroy(&this->mutex);
+}
+
+/*
+** A splice that failed part way leaves bytes in the pipe that
+** would otherwise turn up at the front of the next frame, so
+** start again with an empty one...
+*/
+void ExifTagger::resetPipe()
+{
+	if (this->pipeFds[0] >= 0) {
+		close(this->pipeFds[0]);
+		close(this->pipeFds[1]);
+	}
+
+	if (pipe2(this->pipeFds, O_CLOEXEC) < 0) {
+		this->pipeFds[0] = -1;
+		this->pipeFds[1] = -1;
+	}
+}
+
+/*
+** File to file through our pipe, the data never leaves
+** the kernel...
+*/
+bool ExifTagger::spliceRange(int inFd, off_t offset, size_t length, int outFd)
+{
+	ssize_t		bytesIn;
+	ssize_t		bytesOut;
+
+	if (this->pipeFds[0] < 0) {
+		resetPipe();
+
+		if (this->pipeFds[0] < 0) {
+			return false;
+		}
+	}
+
+	while (length > 0) {
+		bytesIn = splice(inFd, &offset, this->pipeFds[1], NULL, length, SPLICE_F_MOVE);
+
+		if (bytesIn <= 0) {
+			return false;
+		}
+
+		length -= bytesIn;
+
+		while (bytesIn > 0) {
+			bytesOut = splice(this->pipeFds[0], NULL, outFd, NULL, bytesIn, SPLICE_F_MOVE);
+
+			if (bytesOut <= 0) {
+				resetPipe();
+				return false;
+			}
+
+			bytesIn -= bytesOut;
+		}
+	}
+
+	return true;
+}
+
+/*
+** Write a new file with our segment at insertOffset, without the
+** old Exif segment if there is one, and rename it over the old...
+*/
+bool ExifTagger::rewriteFrame(const char * pszPath, int fd, const uint8_t * segment, size_t insertOffset, size_t skipOffset, size_t skipLength, off_t size)
+{
+	char			szTemp[PATH_MAX];
+	uint8_t			header[EXIF_MAX_INPLACE_SLACK];
+	struct stat		st;
+	size_t			skipEnd = skipOffset + skipLength;
+	int				outFd;
+	bool			isOK;
+
+	if (snprintf(szTemp, PATH_MAX, "%s.exif", pszPath) >= PATH_MAX || fstat(fd, &st) < 0) {
+		return false;
+	}
+
+	if (insertOffset > sizeof(header) || pread(fd, header, insertOffset, 0) != (ssize_t)insertOffset) {
+		return false;
+	}
+
+	outFd = open(szTemp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777);
+
+	if (outFd < 0) {
+		return false;
+	}
+
+	isOK =
+		write(outFd, header, insertOffset) == (ssize_t)insertOffset &&
+		write(outFd, segment, EXIF_SEGMENT_LENGTH) == EXIF_SEGMENT_LENGTH &&
+		spliceRange(fd, (off_t)insertOffset, skipOffset - insertOffset, outFd) &&
+		spliceRange(fd, (off_t)skipEnd, (size_t)size - skipEnd, outFd);
+
+	if (close(outFd) < 0) {
+		isOK = false;
+	}
+
+	if (!isOK || rename(szTemp, pszPath) < 0) {
+		unlink(szTemp);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+** Returns false, with errno set, if the frame couldn't be tagged.
+** newSize is the size of the frame afterwards...
+*/
+bool ExifTagger::tagFile(const char * pszPath, const ExifTelemetry & telemetry, off_t * newSize)
+{
+	uint8_t			segment[EXIF_SEGMENT_LENGTH + EXIF_MAX_INPLACE_SLACK];
+	struct stat		st;
+	uint8_t *		p;
+	size_t			offset = 2;
+	size_t			segmentLength;
+	size_t			insertOffset = 2;
+	size_t			exifOffset = 0;
+	size_t			exifLength = 0;
+	size_t			size;
+	uint8_t			marker;
+	bool			isOK;
+	int				fd;
+
+	fd = open(pszPath, O_RDWR | O_CLOEXEC);
+
+	if (fd < 0) {
+		return false;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size < 4) {
+		close(fd);
+		errno = EINVAL;
+		return false;
+	}
+
+	size = (size_t)st.st_size;
+
+	/*
+	** Only the header pages are ever touched...
+	*/
+	p = (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	if (p == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+
+	if (p[0] != 0xFF || p[1] != 0xD8) {
+		munmap(p, size);
+		close(fd);
+		errno = EINVAL;
+		return false;
+	}
+
+	/*
+	** Find any Exif segment, and whether there is a JFIF
+	** APP0 first that we should go after...
+	*/
+	while (offset + 4 <= size && p[offset] == 0xFF) {
+		marker = p[offset + 1];
+
+		if (marker == 0xDA || marker == 0xD9) {
+			break;
+		}
+
+		segmentLength = 2 + (((size_t)p[offset + 2] << 8) | p[offset + 3]);
+
+		if (offset + segmentLength > size) {
+			break;
+		}
+
+		if (marker == 0xE0 && offset == 2) {
+			insertOffset = offset + segmentLength;
+		}
+		else if (marker == 0xE1 && segmentLength >= EXIF_HEADER_LENGTH && memcmp(&p[offset + 4], "Exif\0\0", 6) == 0) {
+			exifOffset = offset;
+			exifLength = segmentLength;
+			break;
+		}
+
+		offset += segmentLength;
+	}
+
+	if (exifLength >= EXIF_SEGMENT_LENGTH && exifLength <= EXIF_SEGMENT_LENGTH + EXIF_MAX_INPLACE_SLACK) {
+		/*
+		** Overwrite it where it is, padded to the same length...
+		*/
+		isOK = (buildExifSegment(segment, exifLength, telemetry) == exifLength);
+
+		if (isOK) {
+			memcpy(&p[exifOffset], segment, exifLength);
+			*newSize = st.st_size;
+
+			pthread_mutex_lock(&this->mutex);
+			this->stats.inPlaceCount++;
+			pthread_mutex_unlock(&this->mutex);
+		}
+		else {
+			errno = EOVERFLOW;
+		}
+
+		munmap(p, size);
+		close(fd);
+
+		return isOK;
+	}
+
+	munmap(p, size);
+
+	if (exifLength == 0) {
+		exifOffset = insertOffset;
+	}
+
+	isOK = (buildExifSegment(segment, EXIF_SEGMENT_LENGTH, telemetry) == EXIF_SEGMENT_LENGTH);
+
+	if (!isOK) {
+		errno = EOVERFLOW;
+	}
+	else {
+		isOK = rewriteFrame(pszPath, fd, segment, insertOffset, exifOffset, exifLength, st.st_size);
+	}
+
+	close(fd);
+
+	if (isOK) {
+		*newSize = st.st_size + EXIF_SEGMENT_LENGTH - (off_t)exifLength;
+
+		pthread_mutex_lock(&this->mutex);
+		this->stats.rewriteCount++;
+		pthread_mutex_unlock(&this->mutex);
+	}
+
+	return isOK;
+}
+
+void ExifTagger::processFrame(CaptureFrame * frame)
+{
+	ExifTelemetry		telemetry;
+	uint64_t			startTime;
+	uint64_t			elapsed;
+	uint64_t			eventTime;
+	off_t				newSize;
+
+	startTime = CurrentTime::getStopwatchTime();
+
+	memset(&telemetry, 0, sizeof(ExifTelemetry));
+
+	telemetry.sequence = frame->sequence;
+
+	/*
+	** The trigger time is monotonic, work back from
+	** the wall clock now...
+	*/
+	eventTime = (frame->triggerTime != 0 ? frame->triggerTime : frame->completedTime);
+
+	Clock & clock = Clock::getInstance();
+
+	telemetry.wallTime = clock.getWallTime() - (clock.getMonotonicTime() - eventTime);
+	telemetry.cpuTemp = getCPUTemp();
+
+	GPSThread * pGPSThread = ThreadManager::getInstance().getGPSThread();
+
+	if (pGPSThread != NULL) {
+		telemetry.hasFix = (pGPSThread->getFix(&telemetry.fix) != 0);
+	}
+
+	if (!tagFile(frame->szPath, telemetry, &newSize)) {
+		Logger::getInstance().logError("Failed to write Exif to %s: %s", frame->szPath, strerror(errno));
+
+		pthread_mutex_lock(&this->mutex);
+		this->stats.errorCount++;
+		pthread_mutex_unlock(&this->mutex);
+		return;
+	}
+
+	frame->size = newSize;
+
+	elapsed = CurrentTime::getStopwatchTime() - startTime;
+
+	pthread_mutex_lock(&this->mutex);
+
+	this->stats.frameCount++;
+	this->stats.totalTime += elapsed;
+
+	if (elapsed > this->stats.maxTime) {
+		this->stats.maxTime = elapsed;
+	}
+
+	pthread_mutex_unlock(&this->mutex);
+}
+
+void ExifTagger::getStats(ExifStats * stats)
+{
+	pthread_mutex_lock(&this->mutex);
+	memcpy(stats, &this->stats, sizeof(ExifStats));
+	pthread_mutex_unlock(&this->mutex);
+}
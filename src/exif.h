@@ -0,0 +1,76 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "capturebackend.h"
+#include "gps.h"
+
+#ifndef _INCL_EXIF
+#define _INCL_EXIF
+
+/*
+** Our APP1 segment is always this long, marker included, so once
+** a frame has one it can be updated in place...
+*/
+#define EXIF_SEGMENT_LENGTH                 640
+
+/*
+** An existing Exif segment up to this much longer than ours is
+** overwritten in place and padded, rather than the file shrunk...
+*/
+#define EXIF_MAX_INPLACE_SLACK              EXIF_SEGMENT_LENGTH
+
+struct ExifTelemetry
+{
+    uint32_t            sequence;
+    uint64_t            wallTime;
+    float               cpuTemp;
+    bool                hasFix;
+    GPSFix              fix;
+};
+
+struct ExifStats
+{
+    uint32_t            frameCount;
+    uint32_t            inPlaceCount;
+    uint32_t            rewriteCount;
+    uint32_t            errorCount;
+    uint64_t            totalTime;
+    uint64_t            maxTime;
+};
+
+/*
+** Inserts or replaces the Exif APP1 segment of each completed
+** frame with the bctl sequence, trigger time, CPU temperature and
+** the latest GPS fix. If the frame already has an Exif segment of
+** about the right size, only that is rewritten, through a shared
+** mapping of the header. Otherwise a new file is built from the
+** new header and the rest of the old one, spliced across in the
+** kernel, and renamed over it...
+*/
+class ExifTagger : public FrameProcessor
+{
+private:
+    int                 pipeFds[2];
+    pthread_mutex_t     mutex;
+    ExifStats           stats;
+
+    bool                rewriteFrame(const char * pszPath, int fd, const uint8_t * segment, size_t insertOffset, size_t skipOffset, size_t skipLength, off_t size);
+    bool                spliceRange(int inFd, off_t offset, size_t length, int outFd);
+    void                resetPipe();
+
+public:
+    ExifTagger();
+    ~ExifTagger();
+
+    bool                tagFile(const char * pszPath, const ExifTelemetry & telemetry, off_t * newSize);
+
+    void                processFrame(CaptureFrame * frame);
+
+    void                getStats(ExifStats * stats);
+};
+
+size_t  buildExifSegment(uint8_t * buffer, size_t segmentLength, const ExifTelemetry & telemetry);
+
+#endif
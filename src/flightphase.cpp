@@ -0,0 +1,480 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "configmgr.h"
+#include "logger.h"
+#include "bctl_error.h"
+#include "currenttime.h"
+#include "clock.h"
+#include "threads.h"
+#include "gps.h"
+#include "trace.h"
+#include "flightphase.h"
+
+using namespace std;
+
+#define FLIGHTPHASE_NO_CONDITION			0xFFFFFFFFFFFFFFFFULL
+
+/*
+** The filter gains, as shifts. Alpha of 1/4 on the altitude
+** and beta of 1/16 on the rate settle within a few tens of
+** samples without chasing every bit of GPS noise...
+*/
+#define FLIGHTPHASE_ALPHA_SHIFT				2
+#define FLIGHTPHASE_BETA_SHIFT				4
+
+struct FlightPhaseProfile
+{
+	const char *	pszName;
+	ConfigKey		frequencyKey;
+	ConfigKey		resolutionKey;
+};
+
+static const FlightPhaseProfile profiles[phase_count] = {
+	{"prelaunch",	CFG_PHASE_PRELAUNCH_FREQUENCY,	CFG_PHASE_PRELAUNCH_RESOLUTION},
+	{"ascent",		CFG_PHASE_ASCENT_FREQUENCY,		CFG_PHASE_ASCENT_RESOLUTION},
+	{"float",		CFG_PHASE_FLOAT_FREQUENCY,		CFG_PHASE_FLOAT_RESOLUTION},
+	{"burst",		CFG_PHASE_BURST_FREQUENCY,		CFG_PHASE_BURST_RESOLUTION},
+	{"descent",		CFG_PHASE_DESCENT_FREQUENCY,	CFG_PHASE_DESCENT_RESOLUTION},
+	{"landed",		CFG_PHASE_LANDED_FREQUENCY,		CFG_PHASE_LANDED_RESOLUTION}
+};
+
+const char * getFlightPhaseName(FlightPhase phase)
+{
+	return (phase >= 0 && phase < phase_count ? profiles[phase].pszName : "unknown");
+}
+
+/*
+** Arithmetic right shift, rounding towards zero, so the
+** filter treats climbing and sinking alike...
+*/
+static inline int64_t scaleDown(int64_t value, int shift)
+{
+	return (value < 0 ? -((-value) >> shift) : (value >> shift));
+}
+
+static inline int64_t absolute(int64_t value)
+{
+	return (value < 0 ? -value : value);
+}
+
+FlightPhaseDetector::FlightPhaseDetector()
+{
+	reset();
+}
+
+void FlightPhaseDetector::reset()
+{
+	memset(&this->status, 0, sizeof(FlightPhaseStatus));
+
+	this->status.phase = phase_prelaunch;
+	this->lastTime = 0;
+
+	for (int i = 0;i < FLIGHTPHASE_NUM_CONDITIONS;i++) {
+		this->conditionStart[i] = FLIGHTPHASE_NO_CONDITION;
+	}
+}
+
+/*
+** True once the condition has been met for hold us
+** without a break...
+*/
+bool FlightPhaseDetector::isHeld(int condition, bool isMet, uint64_t time, uint64_t hold)
+{
+	if (!isMet) {
+		this->conditionStart[condition] = FLIGHTPHASE_NO_CONDITION;
+		return false;
+	}
+
+	if (this->conditionStart[condition] == FLIGHTPHASE_NO_CONDITION) {
+		this->conditionStart[condition] = time;
+	}
+
+	return (time - this->conditionStart[condition] >= hold);
+}
+
+void FlightPhaseDetector::changePhase(FlightPhase phase, uint64_t time)
+{
+	this->status.phase = phase;
+	this->status.phaseStartTime = time;
+	this->status.transitionCount++;
+
+	for (int i = 0;i < FLIGHTPHASE_NUM_CONDITIONS;i++) {
+		this->conditionStart[i] = FLIGHTPHASE_NO_CONDITION;
+	}
+}
+
+bool FlightPhaseDetector::update(uint64_t time, int32_t altitude)
+{
+	FlightPhase		phase = this->status.phase;
+	int64_t			predicted;
+	int64_t			residual;
+	int64_t			dt;
+
+	/*
+	** GGA and RMC for the same second both update the fix,
+	** only the first of them is a new altitude...
+	*/
+	if (this->status.sampleCount > 0 && time >= this->lastTime && time - this->lastTime < FLIGHTPHASE_MIN_INTERVAL) {
+		return false;
+	}
+
+	if (this->status.sampleCount == 0 || time < this->lastTime || time - this->lastTime > FLIGHTPHASE_MAX_GAP) {
+		/*
+		** Start the filter again from this sample...
+		*/
+		if (this->status.sampleCount == 0) {
+			this->status.phaseStartTime = time;
+			this->status.launchAltitude = altitude;
+			this->status.maxAltitude = altitude;
+		}
+
+		this->status.altitude = altitude;
+		this->status.rate = 0;
+		this->status.sampleCount++;
+		this->lastTime = time;
+
+		return false;
+	}
+
+	dt = (int64_t)(time - this->lastTime);
+
+	predicted = this->status.altitude + (this->status.rate * dt) / 1000000LL;
+	residual = (int64_t)altitude - predicted;
+
+	this->status.altitude = predicted + scaleDown(residual, FLIGHTPHASE_ALPHA_SHIFT);
+	this->status.rate += scaleDown((residual * 1000000LL) / dt, FLIGHTPHASE_BETA_SHIFT);
+
+	this->status.sampleCount++;
+	this->lastTime = time;
+
+	if (this->status.altitude > this->status.maxAltitude) {
+		this->status.maxAltitude = this->status.altitude;
+	}
+
+	int64_t altitudeNow = this->status.altitude;
+	int64_t rate = this->status.rate;
+
+	switch (this->status.phase) {
+		case phase_prelaunch:
+			/*
+			** Follow the ground level while sat still, it
+			** drifts with the GPS solution...
+			*/
+			if (absolute(rate) < FLIGHTPHASE_FLOAT_RATE) {
+				this->status.launchAltitude = altitudeNow;
+				this->status.maxAltitude = altitudeNow;
+			}
+
+			if (isHeld(0, rate > FLIGHTPHASE_ASCENT_RATE, time, FLIGHTPHASE_ASCENT_HOLD) ||
+				altitudeNow - this->status.launchAltitude > FLIGHTPHASE_ASCENT_HEIGHT)
+			{
+				changePhase(phase_ascent, time);
+			}
+			break;
+
+		case phase_ascent:
+			if (isHeld(0, rate < FLIGHTPHASE_BURST_RATE, time, FLIGHTPHASE_BURST_HOLD)) {
+				changePhase(phase_burst, time);
+			}
+			else if (isHeld(1, absolute(rate) < FLIGHTPHASE_FLOAT_RATE, time, FLIGHTPHASE_FLOAT_HOLD)) {
+				changePhase(phase_float, time);
+			}
+			break;
+
+		case phase_float:
+			/*
+			** A balloon that is slowly leaking never bursts,
+			** it just sinks...
+			*/
+			if (isHeld(0, rate < FLIGHTPHASE_BURST_RATE, time, FLIGHTPHASE_BURST_HOLD)) {
+				changePhase(phase_burst, time);
+			}
+			else if (isHeld(1, rate < FLIGHTPHASE_SINK_RATE, time, FLIGHTPHASE_SINK_HOLD)) {
+				changePhase(phase_descent, time);
+			}
+			break;
+
+		case phase_burst:
+			if (time - this->status.phaseStartTime >= FLIGHTPHASE_BURST_LENGTH) {
+				changePhase(phase_descent, time);
+			}
+			break;
+
+		case phase_descent:
+			if (isHeld(0, absolute(rate) < FLIGHTPHASE_LANDED_RATE, time, FLIGHTPHASE_LANDED_HOLD)) {
+				changePhase(phase_landed, time);
+			}
+			break;
+
+		default:
+			break;
+	}
+
+	return (this->status.phase != phase);
+}
+
+void FlightPhaseDetector::getStatus(FlightPhaseStatus * status)
+{
+	memcpy(status, &this->status, sizeof(FlightPhaseStatus));
+}
+
+FlightPhaseThread::FlightPhaseThread() : PosixThread(true)
+{
+	pthread_mutex_init(&this->mutex, NULL);
+
+	/*
+	** Any change to the profile of the current phase, or to
+	** the capture frequency it may fall back on, is applied
+	** straight away...
+	*/
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	cfg.subscribe(CFG_CAPTURE_FREQUENCY, this);
+	cfg.subscribe(CFG_CAPTURE_HRES, this);
+	cfg.subscribe(CFG_CAPTURE_VRES, this);
+
+	for (int i = 0;i < phase_count;i++) {
+		cfg.subscribe(profiles[i].frequencyKey, this);
+		cfg.subscribe(profiles[i].resolutionKey, this);
+	}
+}
+
+FlightPhaseThread::~FlightPhaseThread()
+{
+	pthread_mutex_destroy(&this->mutex);
+}
+
+/*
+** Switch the capture schedule and resolution to those of the
+** phase. A frequency of 0 or an empty resolution fall back on
+** the capture.* settings...
+*/
+void FlightPhaseThread::applyProfile(FlightPhase phase)
+{
+	unsigned long	frequency;
+	const char *	pszResolution;
+	int				width = 0;
+	int				height = 0;
+	char			trailing;
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+	Logger & log = Logger::getInstance();
+
+	CaptureThread * pCaptureThread = ThreadManager::getInstance().getCaptureThread();
+
+	if (pCaptureThread == NULL) {
+		return;
+	}
+
+	frequency = (unsigned long)cfg.getValueAsInteger(profiles[phase].frequencyKey);
+
+	if (frequency == 0) {
+		frequency = (unsigned long)cfg.getValueAsInteger(CFG_CAPTURE_FREQUENCY);
+	}
+
+	pszResolution = cfg.getValue(profiles[phase].resolutionKey);
+
+	if (pszResolution[0] != 0) {
+		if (sscanf(pszResolution, "%dx%d%c", &width, &height, &trailing) != 2 ||
+			width < 64 || width > 4056 || height < 64 || height > 3040)
+		{
+			log.logError("Invalid %s '%s', expected WxH, using capture.hres x capture.vres", cfg.getKeyName(profiles[phase].resolutionKey), pszResolution);
+			width = 0;
+			height = 0;
+		}
+	}
+
+	pCaptureThread->setInterval(frequency * 1000UL);
+	pCaptureThread->setResolution(width, height);
+
+	getCaptureResolution(&width, &height);
+
+	log.logStatus("Flight phase %s, capturing every %lus at %dx%d", profiles[phase].pszName, frequency, width, height);
+}
+
+void FlightPhaseThread::configChanged(ConfigKey key, const char * value)
+{
+	FlightPhase		phase;
+
+	pthread_mutex_lock(&this->mutex);
+	phase = this->detector.getPhase();
+	pthread_mutex_unlock(&this->mutex);
+
+	if (key == CFG_CAPTURE_FREQUENCY || key == CFG_CAPTURE_HRES || key == CFG_CAPTURE_VRES ||
+		key == profiles[phase].frequencyKey || key == profiles[phase].resolutionKey)
+	{
+		applyProfile(phase);
+	}
+}
+
+void FlightPhaseThread::getStatus(FlightPhaseStatus * status)
+{
+	pthread_mutex_lock(&this->mutex);
+	this->detector.getStatus(status);
+	pthread_mutex_unlock(&this->mutex);
+}
+
+void * FlightPhaseThread::run()
+{
+	GPSFix					f;
+	FlightPhaseStatus		s;
+	uint32_t				version;
+	bool					isChanged;
+
+	ClockAttachment			attachment;
+
+	Logger & log = Logger::getInstance();
+
+	traceSetThreadName("phase");
+
+	GPSThread * pGPSThread = ThreadManager::getInstance().getGPSThread();
+
+	/*
+	** Only this thread changes the phase...
+	*/
+	applyProfile(this->detector.getPhase());
+
+	while (1) {
+		PosixThread::sleep(PosixThread::milliseconds, FLIGHTPHASE_POLL_MS);
+
+		version = pGPSThread->getFix(&f);
+
+		if (version == this->fixVersion || f.quality == GPS_FIX_NONE) {
+			continue;
+		}
+
+		this->fixVersion = version;
+
+		pthread_mutex_lock(&this->mutex);
+		isChanged = this->detector.update(f.updateTime, f.altitude);
+		this->detector.getStatus(&s);
+		pthread_mutex_unlock(&this->mutex);
+
+		if (isChanged) {
+			log.logStatus(
+				"Flight phase changed to %s at %02u:%02u:%02u UTC, uptime %s, altitude %.1fm, rate %.1fm/s",
+				getFlightPhaseName(s.phase),
+				f.timeOfDay / 3600000,
+				(f.timeOfDay / 60000) % 60,
+				(f.timeOfDay / 1000) % 60,
+				CurrentTime::getUptime(),
+				(double)s.altitude / 1000.0,
+				(double)s.rate / 1000.0);
+
+			applyProfile(s.phase);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+** Runs the detector over recorded telemetry, either an NMEA
+** log (times from the GGA sentences) or lines of
+** '<seconds> <altitude in m>', and prints each transition...
+*/
+int replayFlightPhases(const char * pszReplayFile)
+{
+	FlightPhaseDetector		detector;
+	FlightPhaseStatus		s;
+	GPSFix					f;
+	uint64_t				phaseTime[phase_count];
+	uint64_t				time = 0;
+	uint64_t				firstTime = 0;
+	uint64_t				startTime = 0;
+	uint64_t				dayOffset = 0;
+	uint32_t				lastTimeOfDay = 0;
+	FlightPhase				phase = phase_prelaunch;
+	char					szLine[GPS_BUFFER_LENGTH];
+	double					seconds;
+	double					altitude;
+	size_t					length;
+	bool					isFirst = true;
+	int						i;
+	FILE *					fptr;
+
+	fptr = fopen(pszReplayFile, "rt");
+
+	if (fptr == NULL) {
+		fprintf(stderr, "Failed to open replay file %s: %s\n", pszReplayFile, strerror(errno));
+		return -1;
+	}
+
+	memset(phaseTime, 0, sizeof(phaseTime));
+	memset(&f, 0, sizeof(GPSFix));
+
+	printf("Replaying %s through the flight phase detector\n", pszReplayFile);
+
+	while (fgets(szLine, sizeof(szLine), fptr) != NULL) {
+		if (szLine[0] == '$') {
+			length = strcspn(szLine, "\r\n");
+
+			if (parseNMEASentence(szLine, length, &f) != nmea_gga || f.quality == GPS_FIX_NONE) {
+				continue;
+			}
+
+			/*
+			** Time of day wraps at midnight...
+			*/
+			if (!isFirst && f.timeOfDay < lastTimeOfDay) {
+				dayOffset += (uint64_t)SECONDS_PER_DAY * 1000000ULL;
+			}
+
+			lastTimeOfDay = f.timeOfDay;
+
+			time = dayOffset + (uint64_t)f.timeOfDay * 1000ULL;
+			altitude = (double)f.altitude / 1000.0;
+		}
+		else if (sscanf(szLine, "%lf %lf", &seconds, &altitude) == 2 && seconds >= 0.0) {
+			time = (uint64_t)(seconds * 1000000.0);
+		}
+		else {
+			continue;
+		}
+
+		if (isFirst) {
+			firstTime = time;
+			startTime = time;
+			isFirst = false;
+		}
+		else if (time > startTime) {
+			phaseTime[phase] += time - startTime;
+			startTime = time;
+		}
+
+		if (detector.update(time, (int32_t)(altitude * 1000.0))) {
+			detector.getStatus(&s);
+
+			printf(
+				"%+10.1fs  %-9s -> %-9s  altitude %9.1fm  rate %7.1fm/s\n",
+				(double)(time - firstTime) / 1000000.0,
+				getFlightPhaseName(phase),
+				getFlightPhaseName(s.phase),
+				(double)s.altitude / 1000.0,
+				(double)s.rate / 1000.0);
+
+			phase = s.phase;
+		}
+	}
+
+	fclose(fptr);
+
+	detector.getStatus(&s);
+
+	printf(
+		"%u sample(s), %u transition(s), launch %.1fm, max %.1fm, final phase %s\n",
+		s.sampleCount,
+		s.transitionCount,
+		(double)s.launchAltitude / 1000.0,
+		(double)s.maxAltitude / 1000.0,
+		getFlightPhaseName(s.phase));
+
+	for (i = 0;i < phase_count;i++) {
+		printf("  %-9s %10.1fs\n", getFlightPhaseName((FlightPhase)i), (double)phaseTime[i] / 1000000.0);
+	}
+
+	return 0;
+}
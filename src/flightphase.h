@@ -0,0 +1,126 @@
+#include <stdint.h>
+#include <pthread.h>
+
+#include "posixthread.h"
+#include "configmgr.h"
+
+#ifndef _INCL_FLIGHTPHASE
+#define _INCL_FLIGHTPHASE
+
+#define FLIGHTPHASE_POLL_MS                 500
+
+/*
+** Thresholds for each transition, rates are in mm/s and
+** altitudes in mm. A condition must hold for its time (us)
+** before the phase changes, so one bad fix can't trip it...
+*/
+#define FLIGHTPHASE_ASCENT_RATE             2000
+#define FLIGHTPHASE_ASCENT_HEIGHT           50000
+#define FLIGHTPHASE_ASCENT_HOLD             10000000ULL
+#define FLIGHTPHASE_FLOAT_RATE              1000
+#define FLIGHTPHASE_FLOAT_HOLD              60000000ULL
+#define FLIGHTPHASE_BURST_RATE              -5000
+#define FLIGHTPHASE_BURST_HOLD              3000000ULL
+#define FLIGHTPHASE_BURST_LENGTH            60000000ULL
+#define FLIGHTPHASE_SINK_RATE               -2000
+#define FLIGHTPHASE_SINK_HOLD               30000000ULL
+#define FLIGHTPHASE_LANDED_RATE             500
+#define FLIGHTPHASE_LANDED_HOLD             60000000ULL
+
+/*
+** Samples further apart than this restart the filter, the
+** rate from before a long gap in the fixes means nothing.
+** Samples closer together than the minimum are ignored...
+*/
+#define FLIGHTPHASE_MAX_GAP                 120000000ULL
+#define FLIGHTPHASE_MIN_INTERVAL            100000ULL
+
+#define FLIGHTPHASE_NUM_CONDITIONS          2
+
+enum FlightPhase {
+    phase_prelaunch,
+    phase_ascent,
+    phase_float,
+    phase_burst,
+    phase_descent,
+    phase_landed,
+    phase_count
+};
+
+struct FlightPhaseStatus
+{
+    FlightPhase         phase;
+    uint64_t            phaseStartTime;
+    int64_t             altitude;
+    int64_t             rate;
+    int64_t             launchAltitude;
+    int64_t             maxAltitude;
+    uint32_t            sampleCount;
+    uint32_t            transitionCount;
+};
+
+/*
+** Works out the phase of flight from a series of altitudes. An
+** alpha-beta filter in fixed point smooths the altitude and
+** estimates the vertical rate. Times are passed in, so the same
+** code runs live and against recorded telemetry...
+*/
+class FlightPhaseDetector
+{
+private:
+    FlightPhaseStatus   status;
+
+    uint64_t            lastTime = 0;
+    uint64_t            conditionStart[FLIGHTPHASE_NUM_CONDITIONS];
+
+    bool                isHeld(int condition, bool isMet, uint64_t time, uint64_t hold);
+    void                changePhase(FlightPhase phase, uint64_t time);
+
+public:
+    FlightPhaseDetector();
+
+    void                reset();
+
+    /*
+    ** Feed in an altitude (mm) at time (us), returns true
+    ** if the phase changed...
+    */
+    bool                update(uint64_t time, int32_t altitude);
+
+    FlightPhase         getPhase() {
+        return this->status.phase;
+    }
+
+    void                getStatus(FlightPhaseStatus * status);
+};
+
+const char *    getFlightPhaseName(FlightPhase phase);
+
+/*
+** Feeds each new GPS fix to the detector and, on a change of
+** phase, switches the capture schedule and resolution to the
+** ones configured for the new phase...
+*/
+class FlightPhaseThread : public PosixThread, public ConfigListener
+{
+private:
+    pthread_mutex_t     mutex;
+    FlightPhaseDetector detector;
+    uint32_t            fixVersion = 0;
+
+    void                applyProfile(FlightPhase phase);
+
+public:
+    FlightPhaseThread();
+    ~FlightPhaseThread();
+
+    void *              run();
+
+    void                configChanged(ConfigKey key, const char * value);
+
+    void                getStatus(FlightPhaseStatus * status);
+};
+
+int     replayFlightPhases(const char * pszReplayFile);
+
+#endif
@@ -0,0 +1,646 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <termios.h>
+
+#include "configmgr.h"
+#include "logger.h"
+#include "bctl_error.h"
+#include "currenttime.h"
+#include "trace.h"
+#include "heartbeat.h"
+#include "gps.h"
+
+using namespace std;
+
+#define NMEA_MAX_FIELDS						24
+
+/*
+** A field is a pointer into the sentence and a length,
+** it is never copied or terminated...
+*/
+struct NMEAField
+{
+	const char *	p;
+	size_t			length;
+};
+
+static int hexDigit(char c)
+{
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+
+	return -1;
+}
+
+/*
+** An unsigned decimal, scaled up by 10^decimals with any
+** further digits dropped, so 545.47 with 1 decimal is 5454...
+*/
+static bool parseDecimal(const NMEAField & field, int decimals, int64_t * value)
+{
+	const char *	p = field.p;
+	const char *	end = field.p + field.length;
+	int64_t			v = 0;
+	int				numDigits = 0;
+	int				numDecimals = -1;
+
+	for (;p < end;p++) {
+		if (*p >= '0' && *p <= '9') {
+			if (numDecimals < 0) {
+				v = v * 10 + (*p - '0');
+			}
+			else if (numDecimals < decimals) {
+				v = v * 10 + (*p - '0');
+				numDecimals++;
+			}
+
+			numDigits++;
+		}
+		else if (*p == '.' && numDecimals < 0) {
+			numDecimals = 0;
+		}
+		else {
+			return false;
+		}
+	}
+
+	if (numDigits == 0) {
+		return false;
+	}
+
+	if (numDecimals < 0) {
+		numDecimals = 0;
+	}
+
+	for (;numDecimals < decimals;numDecimals++) {
+		v *= 10;
+	}
+
+	*value = v;
+
+	return true;
+}
+
+static bool parseSignedDecimal(const NMEAField & field, int decimals, int64_t * value)
+{
+	NMEAField		f = field;
+
+	if (f.length > 0 && f.p[0] == '-') {
+		f.p++;
+		f.length--;
+
+		if (!parseDecimal(f, decimals, value)) {
+			return false;
+		}
+
+		*value = -*value;
+		return true;
+	}
+
+	return parseDecimal(f, decimals, value);
+}
+
+/*
+** (d)ddmm.mmmm and a hemisphere to 1e-7 degrees...
+*/
+static bool parseCoordinate(const NMEAField & field, const NMEAField & hemisphere, int32_t * value)
+{
+	int64_t			v;
+	int64_t			degrees;
+	int64_t			minutes;
+
+	if (hemisphere.length != 1 || !parseDecimal(field, 7, &v)) {
+		return false;
+	}
+
+	degrees = v / 1000000000LL;
+	minutes = v % 1000000000LL;
+
+	v = degrees * 10000000LL + minutes / 60;
+
+	switch (hemisphere.p[0]) {
+		case 'N':
+		case 'E':
+			break;
+
+		case 'S':
+		case 'W':
+			v = -v;
+			break;
+
+		default:
+			return false;
+	}
+
+	*value = (int32_t)v;
+
+	return true;
+}
+
+/*
+** hhmmss.sss to ms since midnight...
+*/
+static bool parseTime(const NMEAField & field, uint32_t * value)
+{
+	int64_t			v;
+
+	if (!parseDecimal(field, 3, &v)) {
+		return false;
+	}
+
+	*value = (uint32_t)(((v / 10000000LL) * 3600 + ((v / 100000LL) % 100) * 60) * 1000 + v % 100000LL);
+
+	return true;
+}
+
+NMEAResult parseNMEASentence(const char * pszSentence, size_t length, GPSFix * fix)
+{
+	NMEAField		fields[NMEA_MAX_FIELDS];
+	const char *	p;
+	const char *	end;
+	int64_t			v;
+	int				numFields = 0;
+	int				hi;
+	int				lo;
+	uint64_t		wide = 0;
+	uint64_t		word;
+	uint8_t			checksum;
+
+	/*
+	** $<body>*HH, the checksum is the XOR of the body...
+	*/
+	if (length < 10 || pszSentence[0] != '$' || pszSentence[length - 3] != '*') {
+		return nmea_format_error;
+	}
+
+	end = &pszSentence[length - 3];
+
+	/*
+	** XOR 8 bytes at a time then fold, the order
+	** doesn't matter...
+	*/
+	for (p = &pszSentence[1];p + 8 <= end;p += 8) {
+		memcpy(&word, p, 8);
+		wide ^= word;
+	}
+
+	wide ^= wide >> 32;
+	wide ^= wide >> 16;
+	wide ^= wide >> 8;
+
+	checksum = (uint8_t)wide;
+
+	for (;p < end;p++) {
+		checksum ^= (uint8_t)*p;
+	}
+
+	hi = hexDigit(pszSentence[length - 2]);
+	lo = hexDigit(pszSentence[length - 1]);
+
+	if (hi < 0 || lo < 0) {
+		return nmea_format_error;
+	}
+
+	if (checksum != (uint8_t)((hi << 4) | lo)) {
+		return nmea_checksum_error;
+	}
+
+	/*
+	** Any talker, GP, GN, GL...
+	*/
+	if (memcmp(&pszSentence[3], "GGA,", 4) != 0 && memcmp(&pszSentence[3], "RMC,", 4) != 0) {
+		return nmea_ignored;
+	}
+
+	p = &pszSentence[1];
+
+	while (numFields < NMEA_MAX_FIELDS) {
+		const char * comma = (const char *)memchr(p, ',', end - p);
+
+		fields[numFields].p = p;
+		fields[numFields].length = (comma != NULL ? comma : end) - p;
+		numFields++;
+
+		if (comma == NULL) {
+			break;
+		}
+
+		p = comma + 1;
+	}
+
+	if (pszSentence[3] == 'G') {
+		/*
+		** GGA,time,lat,N,lon,E,quality,sats,hdop,alt,M,...
+		*/
+		if (numFields < 11 || !parseDecimal(fields[6], 0, &v)) {
+			return nmea_format_error;
+		}
+
+		fix->quality = (uint8_t)v;
+		fix->satellites = (uint8_t)(parseDecimal(fields[7], 0, &v) ? v : 0);
+
+		parseTime(fields[1], &fix->timeOfDay);
+
+		if (fix->quality != GPS_FIX_NONE) {
+			if (!parseCoordinate(fields[2], fields[3], &fix->latitude) ||
+				!parseCoordinate(fields[4], fields[5], &fix->longitude) ||
+				!parseSignedDecimal(fields[9], 3, &v))
+			{
+				return nmea_format_error;
+			}
+
+			fix->altitude = (int32_t)v;
+		}
+
+		return nmea_gga;
+	}
+
+	/*
+	** RMC,time,status,lat,N,lon,E,knots,course,date,...
+	*/
+	if (numFields < 10 || fields[2].length != 1) {
+		return nmea_format_error;
+	}
+
+	fix->isValid = (fields[2].p[0] == 'A');
+
+	parseTime(fields[1], &fix->timeOfDay);
+
+	if (fix->isValid) {
+		if (!parseCoordinate(fields[3], fields[4], &fix->latitude) ||
+			!parseCoordinate(fields[5], fields[6], &fix->longitude))
+		{
+			return nmea_format_error;
+		}
+
+		/*
+		** Knots to mm/s...
+		*/
+		if (parseDecimal(fields[7], 3, &v)) {
+			fix->speed = (uint32_t)((v * 1852) / 3600);
+		}
+
+		if (parseDecimal(fields[8], 2, &v)) {
+			fix->course = (uint16_t)v;
+		}
+	}
+
+	if (parseDecimal(fields[9], 0, &v)) {
+		fix->date = (uint32_t)v;
+	}
+
+	return nmea_rmc;
+}
+
+GPSThread::GPSThread(const char * pszDevice, int baudRate) : PosixThread(true)
+{
+	if (strlen(pszDevice) >= PATH_MAX) {
+		throw bctl_error("GPS device name is too long", __FILE__, __LINE__);
+	}
+
+	strcpy(this->szDevice, pszDevice);
+	this->baudRate = baudRate;
+
+	pthread_mutex_init(&this->mutex, NULL);
+
+	memset(&this->fix, 0, sizeof(GPSFix));
+	memset(&this->stats, 0, sizeof(NMEAStats));
+}
+
+GPSThread::~GPSThread()
+{
+	closeDevice();
+
+	pthread_mutex_destroy(&this->mutex);
+}
+
+bool GPSThread::openDevice()
+{
+	struct termios		tios;
+	speed_t				speed;
+
+	switch (this->baudRate) {
+		case 4800:		speed = B4800;		break;
+		case 19200:		speed = B19200;		break;
+		case 38400:		speed = B38400;		break;
+		case 57600:		speed = B57600;		break;
+		case 115200:	speed = B115200;	break;
+		default:		speed = B9600;		break;
+	}
+
+	this->fd = open(this->szDevice, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+
+	if (this->fd < 0) {
+		return false;
+	}
+
+	/*
+	** Raw 8N1, reads return whatever has arrived...
+	*/
+	if (tcgetattr(this->fd, &tios) == 0) {
+		cfmakeraw(&tios);
+		cfsetispeed(&tios, speed);
+		cfsetospeed(&tios, speed);
+
+		tios.c_cflag |= (CLOCAL | CREAD);
+		tios.c_cc[VMIN] = 0;
+		tios.c_cc[VTIME] = 0;
+
+		tcsetattr(this->fd, TCSANOW, &tios);
+	}
+
+	this->bufferLength = 0;
+	this->isDiscarding = false;
+
+	return true;
+}
+
+void GPSThread::closeDevice()
+{
+	if (this->fd >= 0) {
+		close(this->fd);
+		this->fd = -1;
+	}
+}
+
+void GPSThread::getStats(NMEAStats * stats)
+{
+	pthread_mutex_lock(&this->mutex);
+	memcpy(stats, &this->stats, sizeof(NMEAStats));
+	pthread_mutex_unlock(&this->mutex);
+}
+
+void GPSThread::processSentence(const char * pszSentence, size_t length)
+{
+	NMEAResult		result;
+
+	result = parseNMEASentence(pszSentence, length, &this->fix);
+
+	if (result == nmea_gga || result == nmea_rmc) {
+		this->fix.updateTime = CurrentTime::getMonotonicTime();
+		this->publishedFix.write(this->fix);
+	}
+
+	pthread_mutex_lock(&this->mutex);
+
+	this->stats.sentenceCount++;
+
+	switch (result) {
+		case nmea_gga:
+			this->stats.ggaCount++;
+			break;
+
+		case nmea_rmc:
+			this->stats.rmcCount++;
+			break;
+
+		case nmea_ignored:
+			this->stats.ignoredCount++;
+			break;
+
+		case nmea_checksum_error:
+			this->stats.checksumErrors++;
+			break;
+
+		case nmea_format_error:
+			this->stats.formatErrors++;
+			break;
+	}
+
+	pthread_mutex_unlock(&this->mutex);
+}
+
+/*
+** Hand each complete line in the buffer to the parser where it
+** lies, then move any partial line down to the start...
+*/
+void GPSThread::processBuffer()
+{
+	char *			start = this->buffer;
+	char *			end = &this->buffer[this->bufferLength];
+	char *			eol;
+	size_t			length;
+
+	while ((eol = (char *)memchr(start, '\n', end - start)) != NULL) {
+		length = eol - start;
+
+		if (length > 0 && start[length - 1] == '\r') {
+			length--;
+		}
+
+		if (this->isDiscarding) {
+			this->isDiscarding = false;
+		}
+		else if (length > 0) {
+			processSentence(start, length);
+		}
+
+		start = eol + 1;
+	}
+
+	this->bufferLength = end - start;
+
+	/*
+	** A line too long to be NMEA, drop it up to the next
+	** line end...
+	*/
+	if (this->bufferLength > NMEA_MAX_SENTENCE_LENGTH) {
+		pthread_mutex_lock(&this->mutex);
+		this->stats.overflowCount++;
+		pthread_mutex_unlock(&this->mutex);
+
+		this->bufferLength = 0;
+		this->isDiscarding = true;
+	}
+	else if (this->bufferLength > 0 && start != this->buffer) {
+		memmove(this->buffer, start, this->bufferLength);
+	}
+}
+
+void * GPSThread::run()
+{
+	struct pollfd		pfd;
+	ssize_t				bytesRead;
+	bool				isErrorLogged = false;
+
+	Logger & log = Logger::getInstance();
+
+	traceSetThreadName("gps");
+
+	while (1) {
+		if (this->fd < 0) {
+			if (!openDevice()) {
+				if (!isErrorLogged) {
+					log.logError("Failed to open GPS device %s: %s", this->szDevice, strerror(errno));
+					isErrorLogged = true;
+				}
+
+				PosixThread::sleep(PosixThread::milliseconds, GPS_REOPEN_DELAY_MS);
+				continue;
+			}
+
+			log.logStatus("Reading NMEA from %s at %d baud", this->szDevice, this->baudRate);
+			isErrorLogged = false;
+		}
+
+		pfd.fd = this->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		watchdogWait();
+
+		if (poll(&pfd, 1, GPS_POLL_TIMEOUT_MS) <= 0) {
+			continue;
+		}
+
+		watchdogBeat();
+
+		bytesRead = read(this->fd, &this->buffer[this->bufferLength], GPS_BUFFER_LENGTH - this->bufferLength);
+
+		if (bytesRead > 0) {
+			this->bufferLength += bytesRead;
+			processBuffer();
+		}
+		else if (bytesRead == 0 || (errno != EAGAIN && errno != EINTR)) {
+			/*
+			** Unplugged, or the other end of a pty closed...
+			*/
+			log.logError("GPS device %s closed: %s", this->szDevice, (bytesRead == 0 ? "end of file" : strerror(errno)));
+
+			closeDevice();
+			PosixThread::sleep(PosixThread::milliseconds, GPS_REOPEN_DELAY_MS);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+** Feed an NMEA log through a pseudo-terminal to a GPSThread
+** reading the other end, as if it were the serial device, and
+** print each fix it publishes...
+*/
+int replayNMEA(const char * pszReplayFile)
+{
+	GPSThread *			pThread;
+	GPSFix				f;
+	NMEAStats			stats;
+	struct termios		tios;
+	char				szLine[GPS_BUFFER_LENGTH];
+	char *				pszSlave;
+	uint32_t			version = 0;
+	uint32_t			latest;
+	size_t				length;
+	int					master;
+	int					slave;
+	FILE *				fptr;
+
+	fptr = fopen(pszReplayFile, "rt");
+
+	if (fptr == NULL) {
+		fprintf(stderr, "Failed to open replay file %s: %s\n", pszReplayFile, strerror(errno));
+		return -1;
+	}
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+
+	if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0 || (pszSlave = ptsname(master)) == NULL) {
+		fprintf(stderr, "Failed to create a pseudo-terminal: %s\n", strerror(errno));
+		fclose(fptr);
+		return -1;
+	}
+
+	/*
+	** Hold the slave open and raw, so nothing is echoed
+	** back and the reader never sees a hangup...
+	*/
+	slave = open(pszSlave, O_RDWR | O_NOCTTY | O_CLOEXEC);
+
+	if (slave < 0 || tcgetattr(slave, &tios) < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", pszSlave, strerror(errno));
+		fclose(fptr);
+		close(master);
+		return -1;
+	}
+
+	cfmakeraw(&tios);
+	tcsetattr(slave, TCSANOW, &tios);
+
+	printf("Replaying %s through %s\n", pszReplayFile, pszSlave);
+
+	pThread = new GPSThread(pszSlave, 9600);
+
+	if (!pThread->start()) {
+		fclose(fptr);
+		close(slave);
+		close(master);
+		return -1;
+	}
+
+	while (fgets(szLine, sizeof(szLine), fptr) != NULL) {
+		length = strcspn(szLine, "\r\n");
+
+		szLine[length++] = '\r';
+		szLine[length++] = '\n';
+
+		if (write(master, szLine, length) != (ssize_t)length) {
+			fprintf(stderr, "Failed to write to %s: %s\n", pszSlave, strerror(errno));
+			break;
+		}
+
+		PosixThread::sleep(PosixThread::milliseconds, 5);
+
+		latest = pThread->getFix(&f);
+
+		if (latest != version) {
+			version = latest;
+
+			printf(
+				"%02u:%02u:%02u.%03u  %c  %11.7f %12.7f %9.1fm  q%u %2u sats %6.1fm/s\n",
+				f.timeOfDay / 3600000,
+				(f.timeOfDay / 60000) % 60,
+				(f.timeOfDay / 1000) % 60,
+				f.timeOfDay % 1000,
+				(f.isValid ? 'A' : 'V'),
+				(double)f.latitude / 10000000.0,
+				(double)f.longitude / 10000000.0,
+				(double)f.altitude / 1000.0,
+				f.quality,
+				f.satellites,
+				(double)f.speed / 1000.0);
+		}
+	}
+
+	fclose(fptr);
+
+	PosixThread::sleep(PosixThread::milliseconds, 100);
+
+	pThread->getStats(&stats);
+
+	printf(
+		"%u sentence(s): %u GGA, %u RMC, %u ignored, %u checksum error(s), %u format error(s), %u overlong\n",
+		stats.sentenceCount,
+		stats.ggaCount,
+		stats.rmcCount,
+		stats.ignoredCount,
+		stats.checksumErrors,
+		stats.formatErrors,
+		stats.overflowCount);
+
+	close(slave);
+	close(master);
+
+	return ((stats.checksumErrors + stats.formatErrors) > 0 ? 1 : 0);
+}
@@ -0,0 +1,119 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "posixthread.h"
+#include "seqlock.h"
+
+#ifndef _INCL_GPS
+#define _INCL_GPS
+
+/*
+** NMEA 0183 limits a sentence to 82 characters, allow
+** some slack for receivers that don't...
+*/
+#define NMEA_MAX_SENTENCE_LENGTH            128
+#define GPS_BUFFER_LENGTH                   1024
+#define GPS_POLL_TIMEOUT_MS                 1000
+#define GPS_REOPEN_DELAY_MS                 2000
+
+#define GPS_FIX_NONE                        0
+#define GPS_FIX_GPS                         1
+#define GPS_FIX_DGPS                        2
+
+/*
+** The latest position, all fixed point. Latitude and longitude
+** are in 1e-7 degrees, altitude in mm above mean sea level...
+*/
+struct GPSFix
+{
+    int32_t             latitude;
+    int32_t             longitude;
+    int32_t             altitude;
+    uint32_t            timeOfDay;
+    uint32_t            date;
+    uint32_t            speed;
+    uint16_t            course;
+    uint8_t             quality;
+    uint8_t             satellites;
+    uint8_t             isValid;
+    uint8_t             reserved[3];
+    uint64_t            updateTime;
+};
+
+struct NMEAStats
+{
+    uint32_t            sentenceCount;
+    uint32_t            ggaCount;
+    uint32_t            rmcCount;
+    uint32_t            ignoredCount;
+    uint32_t            checksumErrors;
+    uint32_t            formatErrors;
+    uint32_t            overflowCount;
+};
+
+enum NMEAResult {
+    nmea_gga,
+    nmea_rmc,
+    nmea_ignored,
+    nmea_checksum_error,
+    nmea_format_error
+};
+
+/*
+** Parses a sentence where it lies, from the '$' up to but not
+** including the line end, into the fields of fix it carries.
+** Nothing is copied or allocated, fields are walked in place...
+*/
+NMEAResult  parseNMEASentence(const char * pszSentence, size_t length, GPSFix * fix);
+
+/*
+** Reads NMEA from a serial device with non-blocking reads, and
+** publishes each new fix through a seqlock, so anything can read
+** the latest position without taking a lock...
+*/
+class GPSThread : public PosixThread
+{
+private:
+    int                 fd = -1;
+    char                szDevice[PATH_MAX];
+    int                 baudRate = 9600;
+
+    char                buffer[GPS_BUFFER_LENGTH];
+    size_t              bufferLength = 0;
+    bool                isDiscarding = false;
+
+    GPSFix              fix;
+    Seqlock<GPSFix>     publishedFix;
+
+    pthread_mutex_t     mutex;
+    NMEAStats           stats;
+
+    bool                openDevice();
+    void                closeDevice();
+    void                processBuffer();
+
+public:
+    GPSThread(const char * pszDevice, int baudRate);
+    ~GPSThread();
+
+    void *              run();
+
+    /*
+    ** Parse and publish a single sentence, the serial reader
+    ** calls this for every line. A simulation calls it instead
+    ** of starting the thread...
+    */
+    void                processSentence(const char * pszSentence, size_t length);
+
+    uint32_t            getFix(GPSFix * fix) {
+        return this->publishedFix.read(fix);
+    }
+
+    void                getStats(NMEAStats * stats);
+};
+
+int     replayNMEA(const char * pszReplayFile);
+
+#endif
@@ -0,0 +1,77 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <atomic>
+
+#ifndef _INCL_HEARTBEAT
+#define _INCL_HEARTBEAT
+
+class PosixThread;
+
+/*
+** One per watched thread. The owner counts up in steps of 2 at
+** each beat and sets the low bit while it waits for work, which
+** can take as long as it likes. Only the owner writes beat and
+** pszPoint, everything after them is under the watchdog's
+** mutex...
+*/
+struct Heartbeat
+{
+    std::atomic<uint64_t>       beat;
+    std::atomic<const char *>   pszPoint;
+    uint64_t                    count;
+
+    bool                        isAttached;
+    pid_t                       tid;
+    pthread_t                   thread;
+    PosixThread *               pThread;
+    uint64_t                    deadline;
+
+    uint64_t                    lastBeat;
+    uint64_t                    lastChangeTime;
+    uint64_t                    stepTime;
+    int                         level;
+    bool                        isStalled;
+    uint32_t                    stallCount;
+};
+
+extern thread_local Heartbeat *     pThreadHeartbeat;
+
+/*
+** Called by the watched thread, each one a relaxed store...
+*/
+static inline void watchdogBeat()
+{
+    Heartbeat * h = pThreadHeartbeat;
+
+    if (h != NULL) {
+        h->count += 2;
+        h->beat.store(h->count, std::memory_order_relaxed);
+    }
+}
+
+static inline void watchdogWait()
+{
+    Heartbeat * h = pThreadHeartbeat;
+
+    if (h != NULL) {
+        h->beat.store(h->count | 1, std::memory_order_relaxed);
+    }
+}
+
+/*
+** Where the thread is, before anything that might block. Must
+** be a string literal...
+*/
+static inline void watchdogPoint(const char * pszPoint)
+{
+    Heartbeat * h = pThreadHeartbeat;
+
+    if (h != NULL) {
+        h->pszPoint.store(pszPoint, std::memory_order_relaxed);
+    }
+}
+
+#endif
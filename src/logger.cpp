@@ -9,6 +9,7 @@
 
 #include "currenttime.h"
 #include "logger.h"
+#include "trace.h"
 
 extern "C" {
 #include "strutils.h"
@@ -49,8 +50,13 @@ void Logger::initLogger(int logLevel)
 
 void Logger::closeLogger()
 {
-    if (lfp != stdout) {
+    /*
+    ** Called from cleanup() and again on destruction, and the
+    ** logger may never have been initialised at all...
+    */
+    if (lfp != NULL && lfp != stdout) {
         fclose(lfp);
+        lfp = stdout;
     }
 }
 
@@ -118,10 +124,16 @@ int Logger::logMessage(int logLevel, bool addCR, const char * fmt, va_list args)
 {
     int         bytesWritten = 0;
 
-	pthread_mutex_lock(&mutex);
+    TRACE_SPAN("logMessage");
+
+    {
+        TRACE_SPAN("log.lock");
+        pthread_mutex_lock(&mutex);
+    }
 
     if (this->loggingLevel & logLevel) {
         if (strlen(fmt) > MAX_LOG_LENGTH) {
+            pthread_mutex_unlock(&mutex);
             syslog(LOG_ERR, "Log line too long");
             return -1;
         }
@@ -23,6 +23,20 @@
 #include "logger.h"
 #include "configmgr.h"
 #include "threads.h"
+#include "controlthread.h"
+#include "benchmark.h"
+#include "startup.h"
+#include "container.h"
+#include "checksum.h"
+#include "publisher.h"
+#include "avi.h"
+#include "downlink.h"
+#include "gps.h"
+#include "flightphase.h"
+#include "clock.h"
+#include "simulation.h"
+#include "timerwheel.h"
+#include "trace.h"
 
 extern "C" {
 #include "strutils.h"
@@ -31,10 +45,32 @@ extern "C" {
 
 using namespace std;
 
-int pipeFd;
+/*
+** Set by the handler, the shutdown itself happens on the
+** main thread once the timer wheel has stopped...
+*/
+static volatile sig_atomic_t	stopSignal = 0;
 
+/*
+** On the main thread, once the timer wheel has stopped...
+*/
 void cleanup(void)
 {
+	char		szSocketName[PATH_MAX];
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	/*
+	** Write out the trace and remove the control socket while
+	** the threads are still here, killing them takes the whole
+	** process down...
+	*/
+	saveTraceOnExit();
+
+	if (strlen(cfg.getValue(CFG_CONTROL_SOCKETNAME, szSocketName, PATH_MAX)) > 0) {
+		unlink(szSocketName);
+	}
+
 	/*
 	** Kill the threads...
 	*/
@@ -51,11 +87,7 @@ void cleanup(void)
 
 	closelog();
 
-	close(pipeFd);
-
-	ConfigManager & cfg = ConfigManager::getInstance();
-
-	int status = unlink(cfg.getValue("capture.pipename"));
+	int status = unlink(cfg.getValue(CFG_CAPTURE_PIPENAME));
 
 	if (status) {
 		fprintf(stderr, "Failed to remove pipe: %s\n", strerror(errno));
@@ -78,12 +110,15 @@ void handleSignal(int sigNum)
 			return;
 
 		case SIGINT:
-			log.logStatus("Detected SIGINT, cleaning up...");
-			break;
-
 		case SIGTERM:
-			log.logStatus("Detected SIGTERM, cleaning up...");
-			break;
+			/*
+			** The handler may be running on any thread, in the
+			** middle of anything, so all it does is wake the
+			** main thread...
+			*/
+			stopSignal = sigNum;
+			TimerWheel::getInstance().requestStop();
+			return;
 
 		case SIGUSR1:
 			/*
@@ -116,25 +151,19 @@ void handleSignal(int sigNum)
 
 		case SIGUSR2:
 			/*
-			** We're interpreting this as a request to reload config...
+			** We're interpreting this as a request to reload config,
+			** which is deferred to the event thread...
 			*/
 			log.logStatus("Detected SIGUSR2, reloading config...");
 
-			ConfigManager & cfg = ConfigManager::getInstance();
-			cfg.readConfig();
+			ControlThread * pControlThread = ThreadManager::getInstance().getControlThread();
 
-			/*
-			** The only thing we can change dynamically (at present)
-			** is the logging level...
-			*/
-			log.setLogLevel(cfg.getValue("log.level"));
+			if (pControlThread != NULL) {
+				pControlThread->requestReload();
+			}
 			
 			return;
 	}
-
-	cleanup();
-
-    exit(0);
 }
 
 void printUsage(char * pszAppName)
@@ -146,6 +175,18 @@ void printUsage(char * pszAppName)
 	printf("   -cfg configfile  Specify the cfg file, default is ./webconfig.cfg\n");
 	printf("   -d               Daemonise this application\n");
 	printf("   -log  filename   Write logs to the file\n");
+	printf("   -ctl  command    Send a command to the running daemon's control socket\n");
+	printf("   -bench name      Run a built-in benchmark ('all' runs them all)\n");
+	printf("   -extract segment Extract the frames in a segment file\n");
+	printf("   -frame sequence  With -extract, extract just this frame\n");
+	printf("   -verify          Check every frame against the checksum manifest\n");
+	printf("   -shm             Print the latest frame and telemetry from shared memory\n");
+	printf("   -timelapse file  Mux every frame into an MJPEG AVI timelapse\n");
+	printf("   -schedule file   Replay frames through the downlink scheduler\n");
+	printf("   -nmea file       Replay an NMEA log through a pseudo-terminal\n");
+	printf("   -phases file     Replay telemetry through the flight phase detector\n");
+	printf("   -simulate file   Run the daemon on a virtual clock, driven by a replay file\n");
+	printf("   -noalloc         With -simulate, fail on any heap allocation after the warm up\n");
 	printf("\n");
 }
 
@@ -155,15 +196,30 @@ int main(int argc, char *argv[])
 	char *			pszAppName;
 	char *			pszLogFileName = NULL;
 	char *			pszConfigFileName = NULL;
+	char *			pszControlCommand = NULL;
+	char *			pszBenchmark = NULL;
+	char *			pszSegment = NULL;
+	char *			pszReplayFile = NULL;
+	char *			pszNMEAFile = NULL;
+	char *			pszPhaseFile = NULL;
+	char *			pszSimulationFile = NULL;
+	char *			pszTimelapseFile = NULL;
+	int64_t			frameSequence = -1;
+	bool			isVerify = false;
+	bool			isPrintShm = false;
+	bool			isAllocationFree = false;
 	char			szPidFileName[PATH_MAX];
 	int				i;
 	bool			isDaemonised = false;
 	bool			isDumpConfig = false;
 	char			cwd[PATH_MAX];
 	int				defaultLoggingLevel = LOG_LEVEL_INFO | LOG_LEVEL_ERROR | LOG_LEVEL_FATAL;
-	pid_t			pid;
 
 	CurrentTime::initialiseUptimeClock();
+
+	StartupTimeline & timeline = StartupTimeline::getInstance();
+
+	timeline.begin();
 	
 	pszAppName = strdup(argv[0]);
 	getcwd(cwd, sizeof(cwd));
@@ -185,6 +241,42 @@ int main(int argc, char *argv[])
 				else if (strcmp(&argv[i][1], "cfg") == 0) {
 					pszConfigFileName = strdup(&argv[++i][0]);
 				}
+				else if (strcmp(&argv[i][1], "ctl") == 0) {
+					pszControlCommand = strdup(&argv[++i][0]);
+				}
+				else if (strcmp(&argv[i][1], "bench") == 0) {
+					pszBenchmark = strdup(&argv[++i][0]);
+				}
+				else if (strcmp(&argv[i][1], "extract") == 0) {
+					pszSegment = strdup(&argv[++i][0]);
+				}
+				else if (strcmp(&argv[i][1], "schedule") == 0) {
+					pszReplayFile = strdup(&argv[++i][0]);
+				}
+				else if (strcmp(&argv[i][1], "nmea") == 0) {
+					pszNMEAFile = strdup(&argv[++i][0]);
+				}
+				else if (strcmp(&argv[i][1], "simulate") == 0) {
+					pszSimulationFile = strdup(&argv[++i][0]);
+				}
+				else if (strcmp(&argv[i][1], "noalloc") == 0) {
+					isAllocationFree = true;
+				}
+				else if (strcmp(&argv[i][1], "phases") == 0) {
+					pszPhaseFile = strdup(&argv[++i][0]);
+				}
+				else if (strcmp(&argv[i][1], "verify") == 0) {
+					isVerify = true;
+				}
+				else if (strcmp(&argv[i][1], "shm") == 0) {
+					isPrintShm = true;
+				}
+				else if (strcmp(&argv[i][1], "timelapse") == 0) {
+					pszTimelapseFile = strdup(&argv[++i][0]);
+				}
+				else if (strcmp(&argv[i][1], "frame") == 0) {
+					frameSequence = strtoll(&argv[++i][0], NULL, 10);
+				}
 				else if (strcmp(&argv[i][1], "-dump-config") == 0) {
 					isDumpConfig = true;
 				}
@@ -209,7 +301,57 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-	if (isDaemonised) {
+	if (pszControlCommand != NULL || pszBenchmark != NULL || pszSegment != NULL || pszReplayFile != NULL || pszNMEAFile != NULL || pszPhaseFile != NULL || pszTimelapseFile != NULL || isVerify || isPrintShm) {
+		ConfigManager & cfg = ConfigManager::getInstance();
+		int rtn;
+
+		try {
+			cfg.initialise(pszConfigFileName);
+		}
+		catch (bctl_error & e) {
+			fprintf(stderr, "Could not read config file: %s [%s]\n", pszConfigFileName, e.what());
+			return -1;
+		}
+
+		if (pszControlCommand != NULL) {
+			rtn = sendControlCommand(cfg.getValue(CFG_CONTROL_SOCKETNAME), pszControlCommand);
+			free(pszControlCommand);
+		}
+		else if (pszBenchmark != NULL) {
+			rtn = runBenchmark(pszBenchmark);
+			free(pszBenchmark);
+		}
+		else if (pszSegment != NULL) {
+			rtn = extractContainer(pszSegment, frameSequence);
+			free(pszSegment);
+		}
+		else if (pszReplayFile != NULL) {
+			rtn = replayDownlink(pszReplayFile);
+			free(pszReplayFile);
+		}
+		else if (pszNMEAFile != NULL) {
+			rtn = replayNMEA(pszNMEAFile);
+			free(pszNMEAFile);
+		}
+		else if (pszPhaseFile != NULL) {
+			rtn = replayFlightPhases(pszPhaseFile);
+			free(pszPhaseFile);
+		}
+		else if (pszTimelapseFile != NULL) {
+			rtn = muxTimelapse(pszTimelapseFile);
+			free(pszTimelapseFile);
+		}
+		else if (isPrintShm) {
+			rtn = printSharedMemory();
+		}
+		else {
+			rtn = verifyChecksums();
+		}
+
+		return rtn;
+	}
+
+	if (isDaemonised && pszSimulationFile == NULL) {
 		daemonise();
 	}
 
@@ -243,6 +385,8 @@ int main(int argc, char *argv[])
 		free(pszConfigFileName);
 	}
 
+	timeline.mark(STARTUP_CONFIG_LOADED);
+
 	if (isDumpConfig) {
 		cfg.dumpConfig();
 	}
@@ -254,8 +398,8 @@ int main(int argc, char *argv[])
 		free(pszLogFileName);
 	}
 	else {
-		const char * filename = cfg.getValue("log.filename");
-		const char * level = cfg.getValue("log.level");
+		const char * filename = cfg.getValue(CFG_LOG_FILENAME);
+		const char * level = cfg.getValue(CFG_LOG_LEVEL);
 
 		if (strlen(filename) == 0 && strlen(level) == 0) {
 			log.initLogger(defaultLoggingLevel);
@@ -268,6 +412,10 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	registerConfigListeners();
+
+	timeline.mark(STARTUP_LOGGER_READY);
+
 	/*
 	 * Register signal handler for cleanup...
 	 */
@@ -296,110 +444,74 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-    /*
-    ** Fork and run the capture programe...
-    */
-   	const char * pipename = cfg.getValue("capture.pipename");
-   	
-	int status = mkfifo(pipename, 0644);
+	traceSetThreadName("main");
 
-	if (status) {
-		log.logStatus("Failed to create named pipe %s: %s", pipename, strerror(errno));
-	}
+	/*
+	 * Start threads...
+	 */
+	ThreadManager & threadMgr = ThreadManager::getInstance();
 
-   	const char * args[] = {
-		cfg.getValue("capture.progname"),
-		"-n",
-		"-s",
-		"-e",
-		cfg.getValue("capture.encoding"),
-		"-q",
-		cfg.getValue("capture.jpgquality"),
-		"-fs",
-		"1",
-		"-w",
-		cfg.getValue("capture.hres"),
-		"-h",
-		cfg.getValue("capture.vres"),
-		"-ISO",
-		cfg.getValue("capture.iso"),
-		"-o",
-		cfg.getValue("capture.outputtemplate"),
-		(char *)NULL
-	};
-
-	pid = fork();
-
-	if (pid == -1) {
-		log.logError("Fork failed...");
-		cleanup();
-		exit(-1);
-	}
-	else if (pid == 0) {
+	if (pszSimulationFile != NULL) {
 		/*
-		** Child process...
+		** A camera won't keep up with virtual time...
 		*/
-		pid = getpid();
+		if (strcmp(cfg.getValue(CFG_CAPTURE_BACKEND), "synthetic") != 0) {
+			fprintf(stderr, "A simulation needs capture.backend=synthetic\n");
+			return -1;
+		}
 
-		pipeFd = open(pipename, O_WRONLY);
+		/*
+		** Nothing waits on the wheel to shut down cleanly,
+		** and there's nothing worth keeping...
+		*/
+		signal(SIGINT, SIG_DFL);
+		signal(SIGTERM, SIG_DFL);
+
+		Clock::useVirtualClock();
+		CurrentTime::initialiseUptimeClock();
+
+		/*
+		** Hold virtual time still until the replay starts...
+		*/
+		Clock::getInstance().attach();
 
-		if (pipeFd < 0) {
-			fprintf(stderr, "Failed to open named pipe %s", pipename);
-			cleanup();
-			exit(-1);
+		/*
+		** This thread is busy with the replay, so the timer
+		** wheel gets its own...
+		*/
+		Clock::getInstance().reserve();
+
+		if (!TimerWheel::getInstance().start()) {
+			fprintf(stderr, "Failed to start the timer wheel\n");
+			return -1;
 		}
+	}
 
-		write(pipeFd, &pid, sizeof(pid_t));
+	threadMgr.startThreads();
 
-		fprintf(stdout, "Child process forked with pid %d\n", pid);
+	if (pszSimulationFile != NULL) {
+		int rtn = runSimulation(pszSimulationFile, isAllocationFree);
 
-		fprintf(stdout, "Running process: "); 
+		free(pszSimulationFile);
 
-		for (int i = 0;i < 17;i++) {
-			fprintf(stdout, "%s ", args[i]);
-		}
+		saveTraceOnExit();
 
 		/*
-		** Execute the capture program...
+		** Everything else is still running, so don't hang
+		** around for destructors. The log is flushed by line...
 		*/
-		int rtn = execlp(
-			args[0], 
-			args[0], 
-			args[1], 
-			args[2], 
-			args[3], 
-			args[4], 
-			args[5], 
-			args[6], 
-			args[7], 
-			args[8], 
-			args[9], 
-			args[10], 
-			args[11], 
-			args[12], 
-			args[13], 
-			args[14], 
-			args[15], 
-			args[16], 
-			args[17]); 
-
-		if (rtn) {
-			fprintf(stderr, "Failed to execute capture process: [%s]\n", strerror(errno));
-			exit(-1);
-		}
+		fflush(stdout);
+		_exit(rtn);
 	}
 
 	/*
-	 * Start threads...
-	 */
-	ThreadManager & threadMgr = ThreadManager::getInstance();
+	** From here on the main thread runs the timer wheel,
+	** until SIGINT or SIGTERM stops it...
+	*/
+	TimerWheel::getInstance().run();
 
-	threadMgr.startThreads();
+	log.logStatus("Detected %s, cleaning up...", (stopSignal == SIGINT ? "SIGINT" : "SIGTERM"));
 
-	while (1) {
-		PosixThread::sleep(PosixThread::seconds, 5L);
-	}
-	
 	cleanup();
 
 	return 0;
@@ -0,0 +1,487 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <atomic>
+
+#include "configmgr.h"
+#include "logger.h"
+#include "bctl_error.h"
+#include "currenttime.h"
+#include "trace.h"
+#include "heartbeat.h"
+#include "pipeline.h"
+
+using namespace std;
+
+const char * getPipelinePolicyName(PipelinePolicy policy)
+{
+	switch (policy) {
+		case pipeline_block:
+			return "block";
+
+		case pipeline_drop:
+			return "drop";
+
+		case pipeline_sample:
+			return "sample";
+	}
+
+	return "unknown";
+}
+
+static void updateMax(atomic<uint64_t> * max, uint64_t value)
+{
+	uint64_t		current = max->load(memory_order_relaxed);
+
+	while (value > current && !max->compare_exchange_weak(current, value, memory_order_relaxed)) {
+	}
+}
+
+PipelineWorker::PipelineWorker(PipelineStage * pStage, int index) : PosixThread(true)
+{
+	this->pStage = pStage;
+
+	snprintf(this->szName, sizeof(this->szName), "%s.%d", pStage->pszName, index);
+}
+
+void * PipelineWorker::run()
+{
+	CaptureFrame	frame;
+
+	traceSetThreadName(this->szName);
+
+	while (1) {
+		this->pStage->take(&frame);
+
+		watchdogBeat();
+
+		this->pStage->process(&frame);
+
+		/*
+		** A skipped frame is complete as it is...
+		*/
+		this->pStage->pPipeline->pass((frame.isSkipped ? NULL : this->pStage->pNext), frame);
+	}
+
+	return NULL;
+}
+
+PipelineStage::PipelineStage(FramePipeline * pPipeline, const char * pszName, FrameProcessor * pProcessor, FrameListener * pListener, int maxWorkers)
+{
+	this->pPipeline = pPipeline;
+	this->pszName = pszName;
+	this->pProcessor = pProcessor;
+	this->pListener = pListener;
+	this->maxWorkers = maxWorkers;
+
+	memset(this->workers, 0, sizeof(this->workers));
+
+	pthread_mutex_init(&this->mutex, NULL);
+	pthread_cond_init(&this->notEmpty, NULL);
+	pthread_cond_init(&this->notFull, NULL);
+
+	this->numWaiting.store(0);
+	this->numBlocked.store(0);
+
+	this->sampleCounter.store(0);
+	this->maxDepth.store(0);
+	this->frameCount.store(0);
+	this->droppedCount.store(0);
+	this->sampledCount.store(0);
+	this->blockedCount.store(0);
+	this->blockedTime.store(0);
+	this->totalBytes.store(0);
+	this->totalTime.store(0);
+	this->maxTime.store(0);
+}
+
+PipelineStage::~PipelineStage()
+{
+	for (int i = 0;i < PIPELINE_MAX_WORKERS;i++) {
+		if (this->workers[i] != NULL) {
+			delete this->workers[i];
+		}
+	}
+
+	if (this->pQueue != NULL) {
+		delete this->pQueue;
+	}
+
+	pthread_cond_destroy(&this->notFull);
+	pthread_cond_destroy(&this->notEmpty);
+	pthread_mutex_destroy(&this->mutex);
+}
+
+void PipelineStage::configure(const char * pszSpec)
+{
+	char			szSpec[64];
+	char *			pszPolicy;
+	char *			pszLength;
+	char *			pszWorkers;
+	char *			pszEnd;
+	char *			reference;
+	long			length = 16;
+	long			workers = 1;
+
+	if (strlen(pszSpec) >= sizeof(szSpec)) {
+		throw bctl_error(bctl_error::buildMsg("Pipeline spec '%s' for stage %s is too long", pszSpec, this->pszName), __FILE__, __LINE__);
+	}
+
+	strcpy(szSpec, pszSpec);
+
+	pszPolicy = strtok_r(szSpec, ":", &reference);
+	pszLength = strtok_r(NULL, ":", &reference);
+	pszWorkers = strtok_r(NULL, ":", &reference);
+
+	if (pszPolicy == NULL) {
+		throw bctl_error(bctl_error::buildMsg("Pipeline stage %s has no policy", this->pszName), __FILE__, __LINE__);
+	}
+
+	if (strcmp(pszPolicy, "block") == 0) {
+		this->policy = pipeline_block;
+	}
+	else if (strcmp(pszPolicy, "drop") == 0) {
+		this->policy = pipeline_drop;
+	}
+	else if (strcmp(pszPolicy, "sample") == 0) {
+		this->policy = pipeline_sample;
+	}
+	else {
+		throw bctl_error(bctl_error::buildMsg("Invalid policy '%s' for pipeline stage %s, expected block, drop or sample", pszPolicy, this->pszName), __FILE__, __LINE__);
+	}
+
+	if (pszLength != NULL) {
+		length = strtol(pszLength, &pszEnd, 10);
+
+		if (*pszEnd != 0 || length < 1 || length > PIPELINE_MAX_QUEUE_LENGTH) {
+			throw bctl_error(bctl_error::buildMsg("Invalid queue length '%s' for pipeline stage %s, expected 1 - %d", pszLength, this->pszName, PIPELINE_MAX_QUEUE_LENGTH), __FILE__, __LINE__);
+		}
+	}
+
+	if (pszWorkers != NULL) {
+		workers = strtol(pszWorkers, &pszEnd, 10);
+
+		if (*pszEnd != 0 || workers < 1 || workers > this->maxWorkers) {
+			throw bctl_error(bctl_error::buildMsg("Invalid worker count '%s' for pipeline stage %s, expected 1 - %d", pszWorkers, this->pszName, this->maxWorkers), __FILE__, __LINE__);
+		}
+	}
+
+	this->queueLength = (uint32_t)length;
+	this->numWorkers = (int)workers;
+}
+
+/*
+** Called by whichever threads feed this stage. Returns false
+** if the stage won't take the frame...
+*/
+bool PipelineStage::offer(const CaptureFrame & frame)
+{
+	uint64_t		startTime;
+	uint32_t		depth;
+	uint32_t		max;
+
+	if (this->policy == pipeline_sample && this->pQueue->size() >= this->pQueue->getCapacity() / 2) {
+		if (this->sampleCounter.fetch_add(1, memory_order_relaxed) % PIPELINE_SAMPLE_RATE != 0) {
+			this->sampledCount.fetch_add(1, memory_order_relaxed);
+			return false;
+		}
+	}
+
+	if (!this->pQueue->push(frame)) {
+		if (this->policy != pipeline_block) {
+			this->droppedCount.fetch_add(1, memory_order_relaxed);
+
+			Logger::getInstance().logError("Pipeline stage %s is full, frame %s skips it", this->pszName, frame.szPath);
+			return false;
+		}
+
+		TRACE_SPAN("pipeline.blocked");
+
+		this->blockedCount.fetch_add(1, memory_order_relaxed);
+
+		startTime = CurrentTime::getStopwatchTime();
+
+		while (!this->pQueue->push(frame)) {
+			pthread_mutex_lock(&this->mutex);
+
+			this->numBlocked.fetch_add(1);
+			atomic_thread_fence(memory_order_seq_cst);
+
+			/*
+			** Held up by the stage after us, it's the one the
+			** watchdog wants...
+			*/
+			watchdogWait();
+
+			while (this->pQueue->size() >= this->pQueue->getCapacity()) {
+				pthread_cond_wait(&this->notFull, &this->mutex);
+			}
+
+			watchdogBeat();
+
+			this->numBlocked.fetch_sub(1);
+
+			pthread_mutex_unlock(&this->mutex);
+		}
+
+		this->blockedTime.fetch_add(CurrentTime::getStopwatchTime() - startTime, memory_order_relaxed);
+	}
+
+	depth = (uint32_t)this->pQueue->size();
+	max = this->maxDepth.load(memory_order_relaxed);
+
+	while (depth > max && !this->maxDepth.compare_exchange_weak(max, depth, memory_order_relaxed)) {
+	}
+
+	/*
+	** A worker counts itself in before it last looks at the
+	** queue, so either it sees this frame or we see it...
+	*/
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (this->numWaiting.load(memory_order_relaxed) > 0) {
+		pthread_mutex_lock(&this->mutex);
+		pthread_cond_signal(&this->notEmpty);
+		pthread_mutex_unlock(&this->mutex);
+	}
+
+	return true;
+}
+
+void PipelineStage::take(CaptureFrame * frame)
+{
+	while (!this->pQueue->pop(frame)) {
+		pthread_mutex_lock(&this->mutex);
+
+		this->numWaiting.fetch_add(1);
+		atomic_thread_fence(memory_order_seq_cst);
+
+		watchdogWait();
+
+		while (this->pQueue->size() == 0) {
+			pthread_cond_wait(&this->notEmpty, &this->mutex);
+		}
+
+		watchdogBeat();
+
+		this->numWaiting.fetch_sub(1);
+
+		pthread_mutex_unlock(&this->mutex);
+	}
+
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (this->numBlocked.load(memory_order_relaxed) > 0) {
+		pthread_mutex_lock(&this->mutex);
+		pthread_cond_signal(&this->notFull);
+		pthread_mutex_unlock(&this->mutex);
+	}
+}
+
+void PipelineStage::process(CaptureFrame * frame)
+{
+	uint64_t		startTime;
+	uint64_t		elapsed;
+
+	startTime = CurrentTime::getStopwatchTime();
+
+	{
+		TRACE_SPAN(this->pszName);
+
+		if (this->pProcessor != NULL) {
+			this->pProcessor->processFrame(frame);
+		}
+
+		if (this->pListener != NULL) {
+			this->pListener->frameAvailable(*frame);
+		}
+	}
+
+	elapsed = CurrentTime::getStopwatchTime() - startTime;
+
+	this->frameCount.fetch_add(1, memory_order_relaxed);
+	this->totalBytes.fetch_add((uint64_t)frame->size, memory_order_relaxed);
+	this->totalTime.fetch_add(elapsed, memory_order_relaxed);
+
+	updateMax(&this->maxTime, elapsed);
+}
+
+void PipelineStage::getStats(PipelineStageStats * stats)
+{
+	stats->pszName = this->pszName;
+	stats->policy = this->policy;
+	stats->numWorkers = this->numWorkers;
+	stats->isSPSC = (this->numProducers == 1 && this->numWorkers == 1);
+	stats->queueLength = (this->pQueue != NULL ? (uint32_t)this->pQueue->getCapacity() : this->queueLength);
+	stats->depth = (this->pQueue != NULL ? (uint32_t)this->pQueue->size() : 0);
+	stats->maxDepth = this->maxDepth.load(memory_order_relaxed);
+	stats->frameCount = this->frameCount.load(memory_order_relaxed);
+	stats->droppedCount = this->droppedCount.load(memory_order_relaxed);
+	stats->sampledCount = this->sampledCount.load(memory_order_relaxed);
+	stats->blockedCount = this->blockedCount.load(memory_order_relaxed);
+	stats->blockedTime = this->blockedTime.load(memory_order_relaxed);
+	stats->totalBytes = this->totalBytes.load(memory_order_relaxed);
+	stats->totalTime = this->totalTime.load(memory_order_relaxed);
+	stats->maxTime = this->maxTime.load(memory_order_relaxed);
+	stats->startTime = this->startTime;
+}
+
+FramePipeline::FramePipeline()
+{
+	this->submittedCount.store(0);
+	this->completedCount.store(0);
+}
+
+FramePipeline::~FramePipeline()
+{
+	for (int i = 0;i < this->numStages;i++) {
+		delete this->stages[i];
+	}
+}
+
+void FramePipeline::addStage(const char * pszName, ConfigKey key, FrameProcessor * pProcessor, FrameListener * pListener, int maxWorkers)
+{
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	PipelineStage *		pStage;
+
+	if (this->numStages == PIPELINE_MAX_STAGES) {
+		throw bctl_error(bctl_error::buildMsg("Too many pipeline stages adding %s", pszName), __FILE__, __LINE__);
+	}
+
+	pStage = new PipelineStage(this, pszName, pProcessor, pListener, maxWorkers);
+
+	try {
+		pStage->configure(cfg.getValue(key));
+	}
+	catch (bctl_error & e) {
+		delete pStage;
+		throw e;
+	}
+
+	if (this->numStages > 0) {
+		this->stages[this->numStages - 1]->pNext = pStage;
+	}
+
+	this->stages[this->numStages++] = pStage;
+
+	cfg.subscribe(key, this);
+}
+
+/*
+** Each queue is SPSC if only one thread can ever push to it
+** and one pop from it. A stage's producers are the workers of
+** the stage before, plus that stage's own producers if it may
+** pass frames straight on...
+*/
+int FramePipeline::start()
+{
+	Logger & log = Logger::getInstance();
+
+	PipelineStage *		pStage;
+	PipelineStage *		pPrevious = NULL;
+	int					numThreads = 0;
+
+	for (int i = 0;i < this->numStages;i++) {
+		pStage = this->stages[i];
+
+		if (pPrevious != NULL) {
+			pStage->numProducers = pPrevious->numWorkers + (pPrevious->policy != pipeline_block ? pPrevious->numProducers : 0);
+		}
+
+		if (pStage->numProducers == 1 && pStage->numWorkers == 1) {
+			pStage->pQueue = new SPSCQueue<CaptureFrame>(pStage->queueLength);
+		}
+		else {
+			pStage->pQueue = new MPMCQueue<CaptureFrame>(pStage->queueLength);
+		}
+
+		pStage->startTime = CurrentTime::getMonotonicTime();
+
+		for (int w = 0;w < pStage->numWorkers;w++) {
+			pStage->workers[w] = new PipelineWorker(pStage, w);
+
+			if (!pStage->workers[w]->start()) {
+				throw bctl_error(bctl_error::buildMsg("Failed to start pipeline stage %s", pStage->pszName), __FILE__, __LINE__);
+			}
+
+			numThreads++;
+		}
+
+		log.logStatus(
+			"Pipeline stage %s: %s, %s queue of %u, %d worker(s)",
+			pStage->pszName,
+			getPipelinePolicyName(pStage->policy),
+			(pStage->numProducers == 1 && pStage->numWorkers == 1 ? "SPSC" : "MPMC"),
+			(unsigned int)pStage->pQueue->getCapacity(),
+			pStage->numWorkers);
+
+		pPrevious = pStage;
+	}
+
+	return numThreads;
+}
+
+void FramePipeline::stop()
+{
+	for (int i = 0;i < this->numStages;i++) {
+		for (int w = 0;w < this->stages[i]->numWorkers;w++) {
+			if (this->stages[i]->workers[w] != NULL) {
+				this->stages[i]->workers[w]->stop();
+			}
+		}
+	}
+}
+
+/*
+** Offer the frame to each stage in turn until one takes it,
+** a stage that's behind passes it straight on. Off the end,
+** the frame is done with...
+*/
+void FramePipeline::pass(PipelineStage * pStage, const CaptureFrame & frame)
+{
+	while (pStage != NULL && !pStage->offer(frame)) {
+		pStage = pStage->pNext;
+	}
+
+	if (pStage == NULL) {
+		this->completedCount.fetch_add(1, memory_order_release);
+	}
+}
+
+void FramePipeline::submit(const CaptureFrame & frame)
+{
+	this->submittedCount.fetch_add(1, memory_order_release);
+
+	pass((this->numStages > 0 ? this->stages[0] : NULL), frame);
+}
+
+void FramePipeline::configChanged(ConfigKey key, const char * value)
+{
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	/*
+	** The queues are sized and chosen for their producers up
+	** front...
+	*/
+	Logger::getInstance().logError("Config %s changed to '%s', bctl must be restarted to change the pipeline", cfg.getKeyName(key), value);
+}
+
+void FramePipeline::getStats(int stage, PipelineStageStats * stats)
+{
+	this->stages[stage]->getStats(stats);
+}
+
+bool FramePipeline::findStats(const char * pszName, PipelineStageStats * stats)
+{
+	for (int i = 0;i < this->numStages;i++) {
+		if (strcmp(this->stages[i]->pszName, pszName) == 0) {
+			this->stages[i]->getStats(stats);
+			return true;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,192 @@
+#include <stdint.h>
+#include <pthread.h>
+
+#include <atomic>
+
+#include "posixthread.h"
+#include "configmgr.h"
+#include "capturebackend.h"
+#include "ringqueue.h"
+
+#ifndef _INCL_PIPELINE
+#define _INCL_PIPELINE
+
+#define PIPELINE_MAX_STAGES                 8
+#define PIPELINE_MAX_WORKERS                4
+#define PIPELINE_MAX_QUEUE_LENGTH           1024
+
+/*
+** Sampling lets every Nth frame in once the queue is half
+** full...
+*/
+#define PIPELINE_SAMPLE_RATE                4
+
+/*
+** What happens to a frame when a stage is behind. Either way
+** a frame the stage doesn't take goes on to the next stage,
+** it only misses this one...
+*/
+enum PipelinePolicy {
+    pipeline_block,
+    pipeline_drop,
+    pipeline_sample
+};
+
+struct PipelineStageStats
+{
+    const char *        pszName;
+    PipelinePolicy      policy;
+    int                 numWorkers;
+    bool                isSPSC;
+    uint32_t            queueLength;
+    uint32_t            depth;
+    uint32_t            maxDepth;
+    uint64_t            frameCount;
+    uint64_t            droppedCount;
+    uint64_t            sampledCount;
+    uint64_t            blockedCount;
+    uint64_t            blockedTime;
+    uint64_t            totalBytes;
+    uint64_t            totalTime;
+    uint64_t            maxTime;
+    uint64_t            startTime;
+};
+
+class PipelineStage;
+class FramePipeline;
+
+class PipelineWorker : public PosixThread
+{
+private:
+    PipelineStage *     pStage;
+    char                szName[16];
+
+public:
+    PipelineWorker(PipelineStage * pStage, int index);
+
+    void *              run();
+};
+
+/*
+** One step of the frame pipeline: a bounded queue in front of
+** one or more workers, each calling the stage's processor or
+** listener for a frame, then offering it to the next stage...
+*/
+class PipelineStage
+{
+    friend class FramePipeline;
+    friend class PipelineWorker;
+
+private:
+    const char *        pszName;
+    FramePipeline *     pPipeline;
+    FrameProcessor *    pProcessor;
+    FrameListener *     pListener;
+    PipelineStage *     pNext = NULL;
+
+    BoundedQueue<CaptureFrame> * pQueue = NULL;
+    PipelinePolicy      policy = pipeline_block;
+    uint32_t            queueLength = 0;
+    int                 numWorkers = 1;
+    int                 maxWorkers;
+    int                 numProducers = 1;
+
+    PipelineWorker *    workers[PIPELINE_MAX_WORKERS];
+
+    /*
+    ** Only for sleeping, the queue itself is lock free...
+    */
+    pthread_mutex_t     mutex;
+    pthread_cond_t      notEmpty;
+    pthread_cond_t      notFull;
+    std::atomic<int>    numWaiting;
+    std::atomic<int>    numBlocked;
+
+    std::atomic<uint32_t> sampleCounter;
+    std::atomic<uint32_t> maxDepth;
+    std::atomic<uint64_t> frameCount;
+    std::atomic<uint64_t> droppedCount;
+    std::atomic<uint64_t> sampledCount;
+    std::atomic<uint64_t> blockedCount;
+    std::atomic<uint64_t> blockedTime;
+    std::atomic<uint64_t> totalBytes;
+    std::atomic<uint64_t> totalTime;
+    std::atomic<uint64_t> maxTime;
+    uint64_t            startTime = 0;
+
+    void                take(CaptureFrame * frame);
+    void                process(CaptureFrame * frame);
+
+public:
+    PipelineStage(FramePipeline * pPipeline, const char * pszName, FrameProcessor * pProcessor, FrameListener * pListener, int maxWorkers);
+    ~PipelineStage();
+
+    void                configure(const char * pszSpec);
+
+    bool                offer(const CaptureFrame & frame);
+
+    void                getStats(PipelineStageStats * stats);
+};
+
+/*
+** Completed frames go through the stages in the order they
+** were added, each stage on its own threads, so however slow
+** one of them gets the frame thread only ever waits for a
+** stage that is set to block...
+*/
+class FramePipeline : public ConfigListener
+{
+    friend class PipelineWorker;
+
+private:
+    PipelineStage *     stages[PIPELINE_MAX_STAGES];
+    int                 numStages = 0;
+
+    std::atomic<uint64_t> submittedCount;
+    std::atomic<uint64_t> completedCount;
+
+    void                pass(PipelineStage * pStage, const CaptureFrame & frame);
+
+public:
+    FramePipeline();
+    ~FramePipeline();
+
+    /*
+    ** The stage is set up from its config key, the spec is
+    ** '<block|drop|sample>[:<queue length>[:<workers>]]'...
+    */
+    void                addStage(const char * pszName, ConfigKey key, FrameProcessor * pProcessor, FrameListener * pListener, int maxWorkers);
+
+    int                 start();
+    void                stop();
+
+    /*
+    ** From the frame thread...
+    */
+    void                submit(const CaptureFrame & frame);
+
+    void                configChanged(ConfigKey key, const char * value);
+
+    int                 getStageCount() {
+        return this->numStages;
+    }
+
+    /*
+    ** Frames in and frames that have been through (or past)
+    ** every stage, equal when the pipeline is idle...
+    */
+    uint64_t            getSubmittedCount() {
+        return this->submittedCount.load(std::memory_order_acquire);
+    }
+
+    uint64_t            getCompletedCount() {
+        return this->completedCount.load(std::memory_order_acquire);
+    }
+
+    void                getStats(int stage, PipelineStageStats * stats);
+    bool                findStats(const char * pszName, PipelineStageStats * stats);
+};
+
+const char *    getPipelinePolicyName(PipelinePolicy policy);
+
+#endif
@@ -6,6 +6,9 @@
 #include "logger.h"
 #include "bctl_error.h"
 #include "posixthread.h"
+#include "clock.h"
+#include "timerwheel.h"
+#include "watchdog.h"
 
 static void * _threadRunner(void * pThreadArgs)
 {
@@ -15,6 +18,9 @@ static void * _threadRunner(void * pThreadArgs)
 	PosixThread * pThread = (PosixThread *)pThreadArgs;
 
 	Logger & log = Logger::getInstance();
+	Watchdog & watchdog = Watchdog::getInstance();
+
+	watchdog.attach(pThread, pThread->getHeartbeatDeadline());
 
 	while (go) {
 		try {
@@ -29,10 +35,16 @@ static void * _threadRunner(void * pThreadArgs)
 		}
 		else {
 			log.logStatus("Restarting thread...");
-			PosixThread::sleep(PosixThread::seconds, 1);
+
+			/*
+			** There's no hurry, let the wheel fit it in...
+			*/
+			TimerWheel::getInstance().sleep(THREAD_RESTART_DELAY_US, THREAD_RESTART_SLACK_US);
 		}
 	}
 
+	watchdog.detach();
+
 	return pThreadRtn;
 }
 
@@ -49,27 +61,33 @@ PosixThread::~PosixThread()
 {
 }
 
+/*
+** Sleeps on the clock, so a sleep takes no real time
+** when simulating...
+*/
 void PosixThread::sleep(TimeUnit u, unsigned long t)
 {
+	Clock & clock = Clock::getInstance();
+
 	switch (u) {
 		case hours:
-			::sleep(t * 3600);
+			clock.sleep((uint64_t)t * 3600000000ULL);
 			break;
 
 		case minutes:
-			::sleep(t * 60);
+			clock.sleep((uint64_t)t * 60000000ULL);
 			break;
 
 		case seconds:
-			::sleep(t);
+			clock.sleep((uint64_t)t * 1000000ULL);
 			break;
 
 		case milliseconds:
-			usleep(t * 1000L);
+			clock.sleep((uint64_t)t * 1000ULL);
 			break;
 
 		case microseconds:
-			usleep(t);
+			clock.sleep((uint64_t)t);
 			break;
 	}
 }
@@ -99,3 +117,8 @@ void PosixThread::stop()
 {
 	pthread_kill(this->_tid, SIGKILL);
 }
+
+void PosixThread::join()
+{
+	pthread_join(this->_tid, NULL);
+}
@@ -5,6 +5,9 @@
 #ifndef _INCL_POSIXTHREAD
 #define _INCL_POSIXTHREAD
 
+#define THREAD_RESTART_DELAY_US             1000000ULL
+#define THREAD_RESTART_SLACK_US             250000ULL
+
 class PosixThread
 {
 private:
@@ -23,7 +26,7 @@ public:
     PosixThread();
     PosixThread(bool isRestartable);
 
-    ~PosixThread();
+    virtual ~PosixThread();
 
     enum TimeUnit {
         hours,
@@ -42,6 +45,7 @@ public:
     virtual bool        start(void * p);
 
     virtual void        stop();
+    virtual void        join();
 
     virtual pthread_t   getID() {
         return this->_tid;
@@ -51,6 +55,14 @@ public:
         return this->_isRestartable;
     }
 
+    /*
+    ** How long the thread may go between heartbeats when it
+    ** isn't waiting, 0 for watchdog.timeout...
+    */
+    virtual uint64_t    getHeartbeatDeadline() {
+        return 0;
+    }
+
     virtual void *      run() = 0;
 };
 
@@ -0,0 +1,818 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "configmgr.h"
+#include "logger.h"
+#include "bctl_error.h"
+#include "currenttime.h"
+#include "trace.h"
+#include "heartbeat.h"
+#include "preview.h"
+
+#define PREVIEW_MAX_EVENTS				16
+#define PREVIEW_POLL_MS					1000
+
+#define PREVIEW_ID_LISTEN				-1
+#define PREVIEW_ID_EVENT				-2
+
+static const char * pszPage =
+	"<!DOCTYPE html>\n" \
+	"<html><head><title>bctl preview</title></head>\n" \
+	"<body style=\"margin:0;background:#000\">\n" \
+	"<img src=\"/stream\" style=\"display:block;max-width:100%;margin:auto\">\n" \
+	"</body></html>\n";
+
+static const char * getStatusText(int status)
+{
+	switch (status) {
+		case 200:
+			return "OK";
+
+		case 400:
+			return "Bad Request";
+
+		case 404:
+			return "Not Found";
+
+		case 405:
+			return "Method Not Allowed";
+
+		case 503:
+			return "Service Unavailable";
+	}
+
+	return "Error";
+}
+
+PreviewServer::PreviewServer() : PosixThread(true), queue(PREVIEW_QUEUE_LENGTH)
+{
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	snprintf(this->szAddress, sizeof(this->szAddress), "%s", cfg.getValue(CFG_PREVIEW_ADDRESS));
+
+	this->maxClients = cfg.getValueAsInteger(CFG_PREVIEW_MAXCLIENTS);
+
+	for (int i = 0;i < PREVIEW_MAX_CLIENTS;i++) {
+		this->clients[i].fd = -1;
+		this->clients[i].fileFd = -1;
+	}
+
+	pthread_mutex_init(&this->mutex, NULL);
+
+	memset(&this->stats, 0, sizeof(PreviewStats));
+
+	snprintf(this->stats.szAddress, sizeof(this->stats.szAddress), "%s:%d", this->szAddress, cfg.getValueAsInteger(CFG_PREVIEW_PORT));
+	this->stats.maxClients = this->maxClients;
+
+	this->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+PreviewServer::~PreviewServer()
+{
+	for (int i = 0;i < PREVIEW_MAX_CLIENTS;i++) {
+		if (this->clients[i].fd >= 0) {
+			closeClient(&this->clients[i]);
+		}
+	}
+
+	for (int i = 0;i < this->historyCount;i++) {
+		close(this->history[(this->historyHead + i) % PREVIEW_HISTORY].fd);
+	}
+
+	if (this->listenFd >= 0) {
+		close(this->listenFd);
+	}
+
+	if (this->epollFd >= 0) {
+		close(this->epollFd);
+	}
+
+	if (this->eventFd >= 0) {
+		close(this->eventFd);
+	}
+
+	pthread_mutex_destroy(&this->mutex);
+}
+
+void PreviewServer::getStats(PreviewStats * stats)
+{
+	pthread_mutex_lock(&this->mutex);
+	memcpy(stats, &this->stats, sizeof(PreviewStats));
+	pthread_mutex_unlock(&this->mutex);
+}
+
+/*
+** Called on the preview stage worker. The frame is opened here,
+** ahead of the packer, and handed over with the descriptor...
+*/
+void PreviewServer::frameAvailable(const CaptureFrame & frame)
+{
+	PreviewFrame		f;
+	struct stat			st;
+	uint64_t			count = 1;
+
+	f.sequence = frame.sequence;
+	f.fd = open(frame.szPath, O_RDONLY | O_CLOEXEC);
+
+	if (f.fd < 0) {
+		Logger::getInstance().logError("Failed to open frame %s for preview: %s", frame.szPath, strerror(errno));
+		return;
+	}
+
+	f.size = (fstat(f.fd, &st) == 0 ? st.st_size : frame.size);
+
+	if (!this->queue.push(f)) {
+		close(f.fd);
+
+		pthread_mutex_lock(&this->mutex);
+		this->stats.droppedCount++;
+		pthread_mutex_unlock(&this->mutex);
+		return;
+	}
+
+	write(this->eventFd, &count, sizeof(count));
+}
+
+void PreviewServer::openSocket()
+{
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	struct sockaddr_in		addr;
+	struct epoll_event		ev;
+	int						on = 1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)cfg.getValueAsInteger(CFG_PREVIEW_PORT));
+
+	if (inet_pton(AF_INET, this->szAddress, &addr.sin_addr) != 1) {
+		throw bctl_error(bctl_error::buildMsg("Invalid preview address '%s'", this->szAddress), __FILE__, __LINE__);
+	}
+
+	this->listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (this->listenFd < 0) {
+		throw bctl_error(bctl_error::buildMsg("Failed to create preview socket: %s", strerror(errno)), __FILE__, __LINE__);
+	}
+
+	setsockopt(this->listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	if (bind(this->listenFd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		throw bctl_error(bctl_error::buildMsg("Failed to bind preview socket %s: %s", this->stats.szAddress, strerror(errno)), __FILE__, __LINE__);
+	}
+
+	if (listen(this->listenFd, PREVIEW_LISTEN_BACKLOG) < 0) {
+		throw bctl_error(bctl_error::buildMsg("Failed to listen on preview socket %s: %s", this->stats.szAddress, strerror(errno)), __FILE__, __LINE__);
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.u64 = 0;
+	ev.data.fd = PREVIEW_ID_LISTEN;
+
+	epoll_ctl(this->epollFd, EPOLL_CTL_ADD, this->listenFd, &ev);
+}
+
+void PreviewServer::acceptClients()
+{
+	struct epoll_event		ev;
+	int						numClients = 0;
+	int						fd;
+	int						i;
+
+	while ((fd = accept4(this->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		for (i = 0, numClients = 0;i < PREVIEW_MAX_CLIENTS;i++) {
+			if (this->clients[i].fd >= 0) {
+				numClients++;
+			}
+		}
+
+		for (i = 0;i < PREVIEW_MAX_CLIENTS;i++) {
+			if (this->clients[i].fd < 0) {
+				break;
+			}
+		}
+
+		if (numClients >= this->maxClients || i == PREVIEW_MAX_CLIENTS) {
+			const char * pszBusy = "HTTP/1.0 503 Service Unavailable\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+
+			send(fd, pszBusy, strlen(pszBusy), MSG_NOSIGNAL);
+			close(fd);
+
+			pthread_mutex_lock(&this->mutex);
+			this->stats.rejectedCount++;
+			pthread_mutex_unlock(&this->mutex);
+			continue;
+		}
+
+		PreviewClient * client = &this->clients[i];
+
+		client->fd = fd;
+		client->state = preview_reading;
+		client->isStream = false;
+		client->acceptTime = CurrentTime::getStopwatchTime();
+		client->inLength = 0;
+		client->headerLength = 0;
+		client->headerPosition = 0;
+		client->fileFd = -1;
+		client->fileOffset = 0;
+		client->fileLength = 0;
+		client->lastSequence = 0;
+
+		ev.events = EPOLLIN;
+		ev.data.u64 = 0;
+		ev.data.fd = i;
+
+		epoll_ctl(this->epollFd, EPOLL_CTL_ADD, fd, &ev);
+
+		pthread_mutex_lock(&this->mutex);
+		this->stats.connectionCount++;
+		this->stats.numClients = numClients + 1;
+		pthread_mutex_unlock(&this->mutex);
+	}
+}
+
+void PreviewServer::closeClient(PreviewClient * client)
+{
+	epoll_ctl(this->epollFd, EPOLL_CTL_DEL, client->fd, NULL);
+	close(client->fd);
+
+	if (client->fileFd >= 0) {
+		close(client->fileFd);
+		client->fileFd = -1;
+	}
+
+	client->fd = -1;
+
+	pthread_mutex_lock(&this->mutex);
+
+	this->stats.numClients--;
+
+	if (client->isStream) {
+		this->stats.numStreams--;
+	}
+
+	pthread_mutex_unlock(&this->mutex);
+}
+
+/*
+** Don't let a client that never sends a request hold
+** a slot...
+*/
+void PreviewServer::expireClients()
+{
+	uint64_t		now = CurrentTime::getStopwatchTime();
+
+	for (int i = 0;i < PREVIEW_MAX_CLIENTS;i++) {
+		PreviewClient * client = &this->clients[i];
+
+		if (client->fd >= 0 && client->state == preview_reading && now - client->acceptTime > PREVIEW_REQUEST_TIMEOUT_US) {
+			closeClient(client);
+		}
+	}
+}
+
+void PreviewServer::setEvents(PreviewClient * client, uint32_t events)
+{
+	struct epoll_event		ev;
+
+	ev.events = events;
+	ev.data.u64 = 0;
+	ev.data.fd = (int)(client - this->clients);
+
+	epoll_ctl(this->epollFd, EPOLL_CTL_MOD, client->fd, &ev);
+}
+
+void PreviewServer::readClient(PreviewClient * client)
+{
+	char		discard[256];
+	char *		pszEnd;
+	int			bytesRead;
+
+	/*
+	** Once the request is in, only look for the client
+	** going away...
+	*/
+	if (client->state != preview_reading) {
+		while ((bytesRead = read(client->fd, discard, sizeof(discard))) > 0) {
+		}
+
+		if (bytesRead == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+			closeClient(client);
+		}
+		return;
+	}
+
+	while (1) {
+		bytesRead = read(
+						client->fd,
+						&client->inBuffer[client->inLength],
+						PREVIEW_MAX_REQUEST_LENGTH - 1 - client->inLength);
+
+		if (bytesRead == 0) {
+			closeClient(client);
+			return;
+		}
+		else if (bytesRead < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				closeClient(client);
+			}
+			return;
+		}
+
+		client->inLength += bytesRead;
+		client->inBuffer[client->inLength] = 0;
+
+		/*
+		** Only the request line matters, but wait for the end
+		** of the headers before answering...
+		*/
+		pszEnd = strstr(client->inBuffer, "\r\n\r\n");
+
+		if (pszEnd == NULL) {
+			pszEnd = strstr(client->inBuffer, "\n\n");
+		}
+
+		if (pszEnd != NULL) {
+			*pszEnd = 0;
+			handleRequest(client, client->inBuffer);
+			return;
+		}
+
+		if (client->inLength == PREVIEW_MAX_REQUEST_LENGTH - 1) {
+			sendResponse(client, 400, "text/plain", "Request too long\n");
+			return;
+		}
+	}
+}
+
+void PreviewServer::handleRequest(PreviewClient * client, char * request)
+{
+	const PreviewFrame *	frame;
+	PreviewFrame			onDisk;
+	struct stat				st;
+	char					szPath[PATH_MAX];
+	char					szTemplate[PATH_MAX];
+	char *					reference;
+	char *					pszMethod;
+	char *					pszPath;
+	char *					pszEnd;
+	unsigned long			sequence;
+
+	TRACE_SPAN("preview.request");
+
+	pthread_mutex_lock(&this->mutex);
+	this->stats.requestCount++;
+	pthread_mutex_unlock(&this->mutex);
+
+	pszMethod = strtok_r(request, " \t\r\n", &reference);
+	pszPath = strtok_r(NULL, " \t\r\n", &reference);
+
+	if (pszMethod == NULL || pszPath == NULL) {
+		sendResponse(client, 400, "text/plain", "Bad request\n");
+		return;
+	}
+
+	if (strcmp(pszMethod, "GET") != 0) {
+		sendResponse(client, 405, "text/plain", "Only GET is supported\n");
+		return;
+	}
+
+	if (strcmp(pszPath, "/") == 0) {
+		sendResponse(client, 200, "text/html", pszPage);
+	}
+	else if (strcmp(pszPath, "/stream") == 0) {
+		client->isStream = true;
+		client->state = preview_waiting;
+
+		client->headerLength = snprintf(
+									client->header,
+									PREVIEW_MAX_HEADER_LENGTH,
+									"HTTP/1.0 200 OK\r\n" \
+									"Content-Type: multipart/x-mixed-replace; boundary=" PREVIEW_BOUNDARY "\r\n" \
+									"Cache-Control: no-cache\r\n" \
+									"Connection: close\r\n" \
+									"\r\n");
+		client->headerPosition = 0;
+
+		pthread_mutex_lock(&this->mutex);
+		this->stats.numStreams++;
+		pthread_mutex_unlock(&this->mutex);
+
+		writeClient(client);
+	}
+	else if (strcmp(pszPath, "/latest") == 0) {
+		frame = getLatestFrame();
+
+		if (frame == NULL) {
+			sendResponse(client, 404, "text/plain", "No frames yet\n");
+			return;
+		}
+
+		startFrame(client, dup(frame->fd), frame->size, frame->sequence);
+		writeClient(client);
+	}
+	else if (strncmp(pszPath, "/frame/", 7) == 0) {
+		sequence = strtoul(&pszPath[7], &pszEnd, 10);
+
+		if (pszPath[7] == 0 || *pszEnd != 0) {
+			sendResponse(client, 400, "text/plain", "usage: /frame/<sequence>\n");
+			return;
+		}
+
+		frame = findFrame((uint32_t)sequence);
+
+		if (frame != NULL) {
+			startFrame(client, dup(frame->fd), frame->size, frame->sequence);
+		}
+		else {
+			/*
+			** Older than the history, it may still be on disk...
+			*/
+			ConfigManager & cfg = ConfigManager::getInstance();
+
+			onDisk.fd = -1;
+
+			if (formatOutputTemplate(cfg.getValue(CFG_CAPTURE_OUTPUTTEMPLATE, szTemplate, PATH_MAX), (uint32_t)sequence, szPath, PATH_MAX)) {
+				onDisk.fd = open(szPath, O_RDONLY | O_CLOEXEC);
+			}
+
+			if (onDisk.fd < 0 || fstat(onDisk.fd, &st) < 0) {
+				if (onDisk.fd >= 0) {
+					close(onDisk.fd);
+				}
+
+				sendResponse(client, 404, "text/plain", "No such frame\n");
+				return;
+			}
+
+			startFrame(client, onDisk.fd, st.st_size, (uint32_t)sequence);
+		}
+
+		writeClient(client);
+	}
+	else {
+		sendResponse(client, 404, "text/plain", "Not found\n");
+	}
+}
+
+/*
+** A small response, headers and body in one buffer...
+*/
+void PreviewServer::sendResponse(PreviewClient * client, int status, const char * pszType, const char * pszBody)
+{
+	int			length;
+
+	if (status == 404) {
+		pthread_mutex_lock(&this->mutex);
+		this->stats.notFoundCount++;
+		pthread_mutex_unlock(&this->mutex);
+	}
+
+	length = snprintf(
+				client->header,
+				PREVIEW_MAX_HEADER_LENGTH,
+				"HTTP/1.0 %d %s\r\n" \
+				"Content-Type: %s\r\n" \
+				"Content-Length: %d\r\n" \
+				"Connection: close\r\n" \
+				"\r\n" \
+				"%s",
+				status,
+				getStatusText(status),
+				pszType,
+				(int)strlen(pszBody),
+				pszBody);
+
+	client->headerLength = (length < PREVIEW_MAX_HEADER_LENGTH ? length : PREVIEW_MAX_HEADER_LENGTH - 1);
+	client->headerPosition = 0;
+	client->state = preview_sending;
+
+	writeClient(client);
+}
+
+/*
+** Queue a frame after whatever header is still to go. The
+** client owns fileFd from here...
+*/
+void PreviewServer::startFrame(PreviewClient * client, int fileFd, off_t size, uint32_t sequence)
+{
+	int			length;
+
+	if (client->headerPosition == client->headerLength) {
+		client->headerPosition = 0;
+		client->headerLength = 0;
+	}
+
+	if (client->isStream) {
+		length = snprintf(
+					&client->header[client->headerLength],
+					PREVIEW_MAX_HEADER_LENGTH - client->headerLength,
+					"\r\n--" PREVIEW_BOUNDARY "\r\n" \
+					"Content-Type: image/jpeg\r\n" \
+					"Content-Length: %lld\r\n" \
+					"X-Frame-Sequence: %u\r\n" \
+					"\r\n",
+					(long long)size,
+					sequence);
+	}
+	else {
+		length = snprintf(
+					&client->header[client->headerLength],
+					PREVIEW_MAX_HEADER_LENGTH - client->headerLength,
+					"HTTP/1.0 200 OK\r\n" \
+					"Content-Type: image/jpeg\r\n" \
+					"Content-Length: %lld\r\n" \
+					"X-Frame-Sequence: %u\r\n" \
+					"Cache-Control: no-cache\r\n" \
+					"Connection: close\r\n" \
+					"\r\n",
+					(long long)size,
+					sequence);
+	}
+
+	client->headerLength += length;
+	client->fileFd = fileFd;
+	client->fileOffset = 0;
+	client->fileLength = size;
+	client->lastSequence = sequence;
+	client->state = preview_sending;
+}
+
+/*
+** Send as much as the socket takes without blocking, then
+** wait for it to drain...
+*/
+void PreviewServer::writeClient(PreviewClient * client)
+{
+	const PreviewFrame *	latest;
+	ssize_t					bytesSent;
+	uint32_t				skipped;
+
+	while (1) {
+		if (client->headerPosition < client->headerLength) {
+			bytesSent = send(
+							client->fd,
+							&client->header[client->headerPosition],
+							client->headerLength - client->headerPosition,
+							MSG_NOSIGNAL | (client->fileFd >= 0 ? MSG_MORE : 0));
+
+			if (bytesSent < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					setEvents(client, EPOLLIN | EPOLLOUT);
+				}
+				else {
+					closeClient(client);
+				}
+				return;
+			}
+
+			client->headerPosition += (int)bytesSent;
+			continue;
+		}
+
+		if (client->fileFd >= 0 && client->fileOffset < client->fileLength) {
+			bytesSent = sendfile(client->fd, client->fileFd, &client->fileOffset, (size_t)(client->fileLength - client->fileOffset));
+
+			if (bytesSent < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					setEvents(client, EPOLLIN | EPOLLOUT);
+				}
+				else {
+					/*
+					** EPIPE / ECONNRESET, the peer has gone...
+					*/
+					closeClient(client);
+				}
+				return;
+			}
+
+			/*
+			** The file shrank under us, the length we sent
+			** can't be met...
+			*/
+			if (bytesSent == 0) {
+				closeClient(client);
+				return;
+			}
+
+			pthread_mutex_lock(&this->mutex);
+			this->stats.bytesSent += (uint64_t)bytesSent;
+			pthread_mutex_unlock(&this->mutex);
+			continue;
+		}
+
+		if (client->fileFd >= 0) {
+			close(client->fileFd);
+			client->fileFd = -1;
+
+			pthread_mutex_lock(&this->mutex);
+			this->stats.frameCount++;
+			pthread_mutex_unlock(&this->mutex);
+		}
+
+		if (!client->isStream) {
+			closeClient(client);
+			return;
+		}
+
+		/*
+		** Straight on to the latest frame, skipping any that came
+		** and went while this client was busy...
+		*/
+		latest = getLatestFrame();
+
+		if (latest != NULL && latest->sequence != client->lastSequence) {
+			skipped = 0;
+
+			for (int i = 0;i < this->historyCount;i++) {
+				uint32_t sequence = this->history[(this->historyHead + i) % PREVIEW_HISTORY].sequence;
+
+				if (client->lastSequence != 0 && sequence > client->lastSequence && sequence < latest->sequence) {
+					skipped++;
+				}
+			}
+
+			if (skipped > 0) {
+				pthread_mutex_lock(&this->mutex);
+				this->stats.skippedCount += skipped;
+				pthread_mutex_unlock(&this->mutex);
+			}
+
+			startFrame(client, dup(latest->fd), latest->size, latest->sequence);
+			continue;
+		}
+
+		client->state = preview_waiting;
+		setEvents(client, EPOLLIN);
+		return;
+	}
+}
+
+/*
+** Move new frames into the history, then start any stream
+** client that was waiting for one...
+*/
+void PreviewServer::takeFrames()
+{
+	PreviewFrame		frame;
+	int					tail;
+
+	while (this->queue.pop(&frame)) {
+		if (this->historyCount == PREVIEW_HISTORY) {
+			close(this->history[this->historyHead].fd);
+
+			this->historyHead = (this->historyHead + 1) % PREVIEW_HISTORY;
+			this->historyCount--;
+		}
+
+		tail = (this->historyHead + this->historyCount) % PREVIEW_HISTORY;
+
+		this->history[tail] = frame;
+		this->historyCount++;
+	}
+
+	for (int i = 0;i < PREVIEW_MAX_CLIENTS;i++) {
+		PreviewClient * client = &this->clients[i];
+
+		if (client->fd >= 0 && client->isStream && client->state == preview_waiting) {
+			writeClient(client);
+		}
+	}
+}
+
+const PreviewFrame * PreviewServer::findFrame(uint32_t sequence)
+{
+	for (int i = 0;i < this->historyCount;i++) {
+		const PreviewFrame * frame = &this->history[(this->historyHead + i) % PREVIEW_HISTORY];
+
+		if (frame->sequence == sequence) {
+			return frame;
+		}
+	}
+
+	return NULL;
+}
+
+const PreviewFrame * PreviewServer::getLatestFrame()
+{
+	if (this->historyCount == 0) {
+		return NULL;
+	}
+
+	return &this->history[(this->historyHead + this->historyCount - 1) % PREVIEW_HISTORY];
+}
+
+void * PreviewServer::run()
+{
+	struct epoll_event		events[PREVIEW_MAX_EVENTS];
+	struct epoll_event		ev;
+	sigset_t				mask;
+	uint64_t				count;
+	int						numEvents;
+	int						i;
+
+	Logger & log = Logger::getInstance();
+
+	/*
+	** sendfile() has no MSG_NOSIGNAL, a viewer closing its
+	** browser tab should fail the write, not kill the daemon...
+	*/
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	traceSetThreadName("preview");
+
+	/*
+	** Below the capture path, a busy preview client should only
+	** ever slow itself down...
+	*/
+	setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), PREVIEW_THREAD_NICE);
+
+	if (this->epollFd < 0) {
+		this->epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+		if (this->epollFd < 0) {
+			throw bctl_error(bctl_error::buildMsg("Failed to create epoll instance: %s", strerror(errno)), __FILE__, __LINE__);
+		}
+
+		ev.events = EPOLLIN;
+		ev.data.u64 = 0;
+		ev.data.fd = PREVIEW_ID_EVENT;
+
+		epoll_ctl(this->epollFd, EPOLL_CTL_ADD, this->eventFd, &ev);
+	}
+
+	if (this->listenFd < 0) {
+		openSocket();
+
+		log.logStatus("Serving the preview on http://%s/, up to %d client(s)", this->stats.szAddress, this->maxClients);
+	}
+
+	while (1) {
+		watchdogWait();
+
+		numEvents = epoll_wait(this->epollFd, events, PREVIEW_MAX_EVENTS, PREVIEW_POLL_MS);
+
+		watchdogBeat();
+
+		if (numEvents < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			throw bctl_error(bctl_error::buildMsg("epoll_wait failed: %s", strerror(errno)), __FILE__, __LINE__);
+		}
+
+		for (i = 0;i < numEvents;i++) {
+			int id = events[i].data.fd;
+
+			if (id == PREVIEW_ID_LISTEN) {
+				acceptClients();
+			}
+			else if (id == PREVIEW_ID_EVENT) {
+				if (read(this->eventFd, &count, sizeof(count)) == sizeof(count)) {
+					takeFrames();
+				}
+			}
+			else {
+				PreviewClient * client = &this->clients[id];
+
+				if (client->fd < 0) {
+					continue;
+				}
+
+				if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+					closeClient(client);
+					continue;
+				}
+
+				if (events[i].events & EPOLLOUT) {
+					writeClient(client);
+				}
+
+				if (client->fd >= 0 && (events[i].events & EPOLLIN)) {
+					readClient(client);
+				}
+			}
+		}
+
+		expireClients();
+	}
+
+	return NULL;
+}
@@ -0,0 +1,153 @@
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "posixthread.h"
+#include "configmgr.h"
+#include "capturebackend.h"
+#include "ringqueue.h"
+
+#ifndef _INCL_PREVIEW
+#define _INCL_PREVIEW
+
+#define PREVIEW_MAX_CLIENTS                 32
+#define PREVIEW_MAX_REQUEST_LENGTH          1024
+#define PREVIEW_MAX_HEADER_LENGTH           1024
+#define PREVIEW_LISTEN_BACKLOG              8
+
+/*
+** The most recent frames are kept open, so they can still be
+** served after the packer removes them...
+*/
+#define PREVIEW_HISTORY                     16
+#define PREVIEW_QUEUE_LENGTH                8
+
+/*
+** A client has this long to send its request...
+*/
+#define PREVIEW_REQUEST_TIMEOUT_US          5000000ULL
+
+#define PREVIEW_THREAD_NICE                 10
+
+#define PREVIEW_BOUNDARY                    "bctlframe"
+
+struct PreviewFrame
+{
+    uint32_t            sequence;
+    int                 fd;
+    off_t               size;
+};
+
+enum PreviewState {
+    preview_reading,
+    preview_sending,
+    preview_waiting
+};
+
+struct PreviewClient
+{
+    int                 fd;
+    PreviewState        state;
+    bool                isStream;
+    uint64_t            acceptTime;
+
+    int                 inLength;
+    char                inBuffer[PREVIEW_MAX_REQUEST_LENGTH];
+
+    int                 headerLength;
+    int                 headerPosition;
+    char                header[PREVIEW_MAX_HEADER_LENGTH];
+
+    /*
+    ** A dup of the frame, so the client keeps it if it drops
+    ** out of the history mid send...
+    */
+    int                 fileFd;
+    off_t               fileOffset;
+    off_t               fileLength;
+    uint32_t            lastSequence;
+};
+
+struct PreviewStats
+{
+    char                szAddress[80];
+    int                 numClients;
+    int                 maxClients;
+    int                 numStreams;
+    uint32_t            connectionCount;
+    uint32_t            rejectedCount;
+    uint32_t            requestCount;
+    uint32_t            notFoundCount;
+    uint32_t            frameCount;
+    uint32_t            skippedCount;
+    uint32_t            droppedCount;
+    uint64_t            bytesSent;
+};
+
+/*
+** A small HTTP server for checking the camera before launch,
+** bound to preview.address:preview.port. It serves
+**
+**   /               a page showing the stream
+**   /stream         the frames as they arrive, multipart MJPEG
+**   /latest         the most recent frame
+**   /frame/<n>      frame n, if it's still on disk
+**
+** All on one epoll loop at a lower priority, frames go out with
+** sendfile() straight from the page cache. A stream client that
+** is slow to read skips to the latest frame rather than queueing,
+** and at most preview.maxclients are served at once...
+*/
+class PreviewServer : public PosixThread, public FrameListener
+{
+private:
+    int                 listenFd = -1;
+    int                 epollFd = -1;
+    int                 eventFd = -1;
+    int                 maxClients;
+    char                szAddress[64];
+
+    PreviewClient       clients[PREVIEW_MAX_CLIENTS];
+
+    /*
+    ** New frames from the preview pipeline stage, and the
+    ** history, which only the server thread touches...
+    */
+    SPSCQueue<PreviewFrame> queue;
+    PreviewFrame        history[PREVIEW_HISTORY];
+    int                 historyHead = 0;
+    int                 historyCount = 0;
+
+    pthread_mutex_t     mutex;
+    PreviewStats        stats;
+
+    void                openSocket();
+    void                acceptClients();
+    void                closeClient(PreviewClient * client);
+    void                expireClients();
+    void                readClient(PreviewClient * client);
+    void                handleRequest(PreviewClient * client, char * request);
+    void                sendResponse(PreviewClient * client, int status, const char * pszType, const char * pszBody);
+    void                startFrame(PreviewClient * client, int fileFd, off_t size, uint32_t sequence);
+    void                writeClient(PreviewClient * client);
+    void                setEvents(PreviewClient * client, uint32_t events);
+    void                takeFrames();
+    const PreviewFrame * findFrame(uint32_t sequence);
+    const PreviewFrame * getLatestFrame();
+
+public:
+    PreviewServer();
+    ~PreviewServer();
+
+    void *              run();
+
+    /*
+    ** From the preview pipeline stage...
+    */
+    void                frameAvailable(const CaptureFrame & frame);
+
+    void                getStats(PreviewStats * stats);
+};
+
+#endif
@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include <atomic>
+
+#include "configmgr.h"
+#include "logger.h"
+#include "bctl_error.h"
+#include "currenttime.h"
+#include "clock.h"
+#include "threads.h"
+#include "gps.h"
+#include "flightphase.h"
+#include "bctl.h"
+#include "publisher.h"
+
+using namespace std;
+
+FramePublisher::FramePublisher() : telemetryJob(this)
+{
+	ConfigManager & cfg = ConfigManager::getInstance();
+	Clock & clock = Clock::getInstance();
+
+	this->frameCount.store(0);
+	this->truncatedCount.store(0);
+	this->telemetryCount.store(0);
+	this->lastSequence.store(0);
+
+	this->pSegment = bctl_shm_create(cfg.getValue(CFG_SHM_NAME), (uint32_t)getpid(), clock.getWallTime());
+
+	if (this->pSegment == NULL) {
+		throw bctl_error(bctl_error::buildMsg("Failed to create shared memory %s: %s", cfg.getValue(CFG_SHM_NAME), strerror(errno)), __FILE__, __LINE__);
+	}
+
+	this->intervalMs = (unsigned long)cfg.getValueAsInteger(CFG_SHM_INTERVAL);
+
+	cfg.subscribe(CFG_SHM_INTERVAL, this);
+	cfg.subscribe(CFG_SHM_NAME, this);
+
+	scheduleTelemetry();
+
+	Logger::getInstance().logStatus("Publishing frames and telemetry in shared memory %s, %lu bytes", cfg.getValue(CFG_SHM_NAME), (unsigned long)sizeof(struct bctl_shm_segment));
+}
+
+FramePublisher::~FramePublisher()
+{
+	TimerWheel::getInstance().cancel(&this->telemetryJob);
+
+	munmap(this->pSegment, sizeof(struct bctl_shm_segment));
+}
+
+void FramePublisher::scheduleTelemetry()
+{
+	uint64_t		period = (uint64_t)this->intervalMs * 1000ULL;
+
+	TimerWheel::getInstance().scheduleIn(&this->telemetryJob, 0, period, period / SHM_TELEMETRY_SLACK_DIVISOR);
+}
+
+void FramePublisher::configChanged(ConfigKey key, const char * value)
+{
+	ConfigManager & cfg = ConfigManager::getInstance();
+	Logger & log = Logger::getInstance();
+
+	switch (key) {
+		case CFG_SHM_INTERVAL:
+			log.logStatus("Shared memory telemetry interval changed to %sms", value);
+			this->intervalMs = (unsigned long)cfg.getValueAsInteger(key);
+			scheduleTelemetry();
+			break;
+
+		default:
+			log.logError("Config %s changed to '%s', bctl must be restarted to change it", cfg.getKeyName(key), value);
+			break;
+	}
+}
+
+/*
+** Called on the publish pipeline stage's one worker, the only
+** writer of the frame block...
+*/
+void FramePublisher::frameAvailable(const CaptureFrame & frame)
+{
+	struct bctl_shm_frame	f;
+	uint64_t				eventTime;
+	size_t					length;
+
+	Clock & clock = Clock::getInstance();
+
+	memset(&f, 0, sizeof(struct bctl_shm_frame));
+
+	eventTime = (frame.triggerTime != 0 ? frame.triggerTime : frame.completedTime);
+
+	f.sequence = frame.sequence;
+	f.triggerTime = frame.triggerTime;
+	f.completedTime = frame.completedTime;
+	f.publishedTime = clock.getMonotonicTime();
+	f.wallTime = clock.getWallTime() - (f.publishedTime - eventTime);
+	f.size = (uint64_t)frame.size;
+
+	if (frame.hasCRC) {
+		f.crc32c = frame.crc;
+		f.flags |= BCTL_SHM_FRAME_HAS_CRC;
+	}
+
+	if (frame.hasSimilarity) {
+		f.similarity = frame.similarity;
+		f.flags |= BCTL_SHM_FRAME_HAS_SIMILARITY;
+	}
+
+	if (frame.isSimilar) {
+		f.flags |= BCTL_SHM_FRAME_SIMILAR;
+	}
+
+	length = strlen(frame.szPath);
+
+	if (length >= BCTL_SHM_PATH_MAX) {
+		length = BCTL_SHM_PATH_MAX - 1;
+		f.flags |= BCTL_SHM_FRAME_PATH_TRUNCATED;
+
+		this->truncatedCount.fetch_add(1, memory_order_relaxed);
+	}
+
+	memcpy(f.path, frame.szPath, length);
+
+	bctl_shm_write_frame(this->pSegment, &f);
+
+	this->frameCount.fetch_add(1, memory_order_relaxed);
+	this->lastSequence.store(frame.sequence, memory_order_relaxed);
+}
+
+/*
+** On the timer wheel, the only writer of the telemetry block...
+*/
+void FramePublisher::timerExpired(TimerJob * job)
+{
+	struct bctl_shm_telemetry	t;
+	GPSFix						fix;
+	FlightPhaseStatus			ps;
+	CaptureStats				cs;
+	FrameStats					fs;
+	float						cpuTemp;
+
+	ThreadManager & threadMgr = ThreadManager::getInstance();
+	Clock & clock = Clock::getInstance();
+
+	memset(&t, 0, sizeof(struct bctl_shm_telemetry));
+
+	t.updateTime = clock.getMonotonicTime();
+	t.wallTime = clock.getWallTime();
+
+	cpuTemp = getCPUTemp();
+
+	if (cpuTemp > -273.0f) {
+		t.cpuTemp = (int32_t)(cpuTemp * 1000.0f);
+		t.flags |= BCTL_SHM_TELEMETRY_HAS_TEMP;
+	}
+
+	if (threadMgr.getGPSThread() != NULL && threadMgr.getGPSThread()->getFix(&fix) != 0) {
+		t.fixTime = fix.updateTime;
+		t.latitude = fix.latitude;
+		t.longitude = fix.longitude;
+		t.altitude = fix.altitude;
+		t.speed = fix.speed;
+		t.course = fix.course;
+		t.quality = fix.quality;
+		t.satellites = fix.satellites;
+		t.flags |= BCTL_SHM_TELEMETRY_HAS_FIX;
+	}
+
+	if (threadMgr.getFlightPhaseThread() != NULL) {
+		threadMgr.getFlightPhaseThread()->getStatus(&ps);
+
+		t.phase = (uint32_t)ps.phase;
+		t.verticalRate = (int32_t)ps.rate;
+		t.maxAltitude = (int32_t)ps.maxAltitude;
+		t.flags |= BCTL_SHM_TELEMETRY_HAS_PHASE;
+	}
+
+	if (threadMgr.getCaptureThread() != NULL) {
+		threadMgr.getCaptureThread()->getStats(&cs);
+		t.captureCount = cs.captureCount;
+	}
+
+	if (threadMgr.getFrameThread() != NULL) {
+		threadMgr.getFrameThread()->getStats(&fs);
+		t.frameCount = fs.frameCount;
+		t.lastSequence = fs.lastSequence;
+	}
+
+	bctl_shm_write_telemetry(this->pSegment, &t);
+
+	this->telemetryCount.fetch_add(1, memory_order_relaxed);
+}
+
+void FramePublisher::getStats(PublisherStats * stats)
+{
+	stats->pszName = ConfigManager::getInstance().getValue(CFG_SHM_NAME);
+	stats->intervalMs = this->intervalMs;
+	stats->frameCount = this->frameCount.load(memory_order_relaxed);
+	stats->truncatedCount = this->truncatedCount.load(memory_order_relaxed);
+	stats->telemetryCount = this->telemetryCount.load(memory_order_relaxed);
+	stats->lastSequence = this->lastSequence.load(memory_order_relaxed);
+}
+
+/*
+** bctl -shm, read the segment the way any other process would...
+*/
+int printSharedMemory()
+{
+	bctl_shm_reader				reader;
+	struct bctl_shm_frame		f;
+	struct bctl_shm_telemetry	t;
+	int64_t						frameVersion;
+	int64_t						telemetryVersion;
+	const char *				pszName = ConfigManager::getInstance().getValue(CFG_SHM_NAME);
+
+	if (bctl_shm_open(pszName, &reader) < 0) {
+		fprintf(stderr, "Failed to open shared memory %s: %s\n", pszName, strerror(errno));
+		return -1;
+	}
+
+	frameVersion = bctl_shm_read_frame(&reader, &f);
+	telemetryVersion = bctl_shm_read_telemetry(&reader, &t);
+
+	printf("shm.name=%s\n", pszName);
+	printf("shm.pid=%u\n", reader.segment->header.pid);
+
+	if (frameVersion > 0) {
+		printf("frame.version=%lld\n", (long long)frameVersion);
+		printf("frame.sequence=%u\n", f.sequence);
+		printf("frame.path=%s%s\n", f.path, (f.flags & BCTL_SHM_FRAME_PATH_TRUNCATED ? " (truncated)" : ""));
+		printf("frame.size=%llu\n", (unsigned long long)f.size);
+
+		if (f.flags & BCTL_SHM_FRAME_HAS_CRC) {
+			printf("frame.crc32c=%08x\n", f.crc32c);
+		}
+
+		if (f.flags & BCTL_SHM_FRAME_HAS_SIMILARITY) {
+			printf("frame.similarity=%u.%02u%s\n", f.similarity / 100, f.similarity % 100, (f.flags & BCTL_SHM_FRAME_SIMILAR ? " (similar)" : ""));
+		}
+
+		printf("frame.walltime=%llu\n", (unsigned long long)f.wallTime);
+		printf("frame.latency=%lluus\n", (unsigned long long)(f.publishedTime - (f.triggerTime != 0 ? f.triggerTime : f.completedTime)));
+	}
+	else {
+		printf("frame=%s\n", (frameVersion < 0 ? strerror(errno) : "none"));
+	}
+
+	if (telemetryVersion > 0) {
+		printf("telemetry.version=%lld\n", (long long)telemetryVersion);
+		printf("telemetry.walltime=%llu\n", (unsigned long long)t.wallTime);
+
+		if (t.flags & BCTL_SHM_TELEMETRY_HAS_TEMP) {
+			printf("telemetry.cputemp=%.1fC\n", (double)t.cpuTemp / 1000.0);
+		}
+
+		if (t.flags & BCTL_SHM_TELEMETRY_HAS_FIX) {
+			printf("telemetry.position=%.7f,%.7f\n", (double)t.latitude / 1e7, (double)t.longitude / 1e7);
+			printf("telemetry.altitude=%.1fm\n", (double)t.altitude / 1000.0);
+			printf("telemetry.satellites=%u\n", t.satellites);
+		}
+
+		if (t.flags & BCTL_SHM_TELEMETRY_HAS_PHASE) {
+			printf("telemetry.phase=%s\n", getFlightPhaseName((FlightPhase)t.phase));
+			printf("telemetry.rate=%.1fm/s\n", (double)t.verticalRate / 1000.0);
+		}
+
+		printf("telemetry.captures=%u\n", t.captureCount);
+		printf("telemetry.frames=%u\n", t.frameCount);
+	}
+	else {
+		printf("telemetry=%s\n", (telemetryVersion < 0 ? strerror(errno) : "none"));
+	}
+
+	bctl_shm_close(&reader);
+
+	return 0;
+}
@@ -0,0 +1,63 @@
+#include <stdint.h>
+#include <pthread.h>
+
+#include <atomic>
+
+#include "configmgr.h"
+#include "capturebackend.h"
+#include "timerwheel.h"
+
+extern "C" {
+#include "bctlshm.h"
+}
+
+#ifndef _INCL_PUBLISHER
+#define _INCL_PUBLISHER
+
+#define SHM_TELEMETRY_SLACK_DIVISOR         10
+
+struct PublisherStats
+{
+    const char *        pszName;
+    unsigned long       intervalMs;
+    uint32_t            frameCount;
+    uint32_t            truncatedCount;
+    uint32_t            telemetryCount;
+    uint32_t            lastSequence;
+};
+
+/*
+** Publishes the latest frame and the current telemetry in shared
+** memory for other processes on the payload, see bctlshm.h. The
+** frame comes from the publish pipeline stage, after the checksum
+** so it can carry the CRC, and the telemetry from a job on the
+** timer wheel every shm.interval...
+*/
+class FramePublisher : public FrameListener, public TimerListener, public ConfigListener
+{
+private:
+    struct bctl_shm_segment *   pSegment;
+    TimerJob            telemetryJob;
+    unsigned long       intervalMs;
+
+    std::atomic<uint32_t> frameCount;
+    std::atomic<uint32_t> truncatedCount;
+    std::atomic<uint32_t> telemetryCount;
+    std::atomic<uint32_t> lastSequence;
+
+    void                scheduleTelemetry();
+
+public:
+    FramePublisher();
+    ~FramePublisher();
+
+    void                frameAvailable(const CaptureFrame & frame);
+    void                timerExpired(TimerJob * job);
+    void                configChanged(ConfigKey key, const char * value);
+
+    void                getStats(PublisherStats * stats);
+};
+
+int     printSharedMemory();
+
+#endif
@@ -0,0 +1,250 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "reedsolomon.h"
+
+#define RS_FIELD_POLYNOMIAL					0x187
+#define RS_FIRST_ROOT						112
+#define RS_PRIMITIVE						11
+
+/*
+** The encoder is a 32 byte shift register. For each data byte the
+** register shifts down one byte and the product of the feedback
+** byte with each generator coefficient is XORed in. Those products
+** only depend on the feedback byte, so they're precomputed as one
+** 32 byte row per possible feedback value, leaving a shift and an
+** XOR per data byte, which is two SIMD registers wide...
+*/
+struct RSTables
+{
+	uint8_t		alphaTo[256];
+	uint8_t		indexOf[256];
+	uint8_t		roots[RS_PARITY_LENGTH];
+	uint8_t		feedback[256][RS_PARITY_LENGTH] __attribute__((aligned(16)));
+
+	RSTables() {
+		uint8_t		generator[RS_PARITY_LENGTH + 1];
+		int			root;
+		int			sr;
+		int			i;
+		int			j;
+
+		/*
+		** Log and antilog tables, indexOf[0] is never used...
+		*/
+		for (i = 0, sr = 1;i < RS_SYMBOLS;i++) {
+			alphaTo[i] = (uint8_t)sr;
+			indexOf[sr] = (uint8_t)i;
+
+			sr <<= 1;
+
+			if (sr & 0x100) {
+				sr ^= RS_FIELD_POLYNOMIAL;
+			}
+		}
+
+		alphaTo[RS_SYMBOLS] = 0;
+		indexOf[0] = 0;
+
+		/*
+		** Multiply out (x - a^root) for the 32 consecutive
+		** roots, the coefficients are kept as values...
+		*/
+		memset(generator, 0, sizeof(generator));
+		generator[0] = 1;
+
+		for (i = 0, root = RS_FIRST_ROOT * RS_PRIMITIVE;i < RS_PARITY_LENGTH;i++, root += RS_PRIMITIVE) {
+			roots[i] = alphaTo[root % RS_SYMBOLS];
+
+			generator[i + 1] = 1;
+
+			for (j = i;j > 0;j--) {
+				generator[j] = generator[j - 1] ^ multiply(generator[j], roots[i]);
+			}
+
+			generator[0] = multiply(generator[0], roots[i]);
+		}
+
+		for (i = 0;i < 256;i++) {
+			for (j = 0;j < RS_PARITY_LENGTH;j++) {
+				feedback[i][j] = multiply((uint8_t)i, generator[RS_PARITY_LENGTH - 1 - j]);
+			}
+		}
+	}
+
+	uint8_t multiply(uint8_t a, uint8_t b) const {
+		if (a == 0 || b == 0) {
+			return 0;
+		}
+
+		return alphaTo[(indexOf[a] + indexOf[b]) % RS_SYMBOLS];
+	}
+};
+
+static const RSTables & getTables()
+{
+	static const RSTables	tables;
+
+	return tables;
+}
+
+uint8_t gfMultiply(uint8_t a, uint8_t b)
+{
+	return getTables().multiply(a, b);
+}
+
+void rsEncodeScalar(const uint8_t * data, uint8_t * parity)
+{
+	const RSTables & t = getTables();
+
+	uint8_t		sr[RS_PARITY_LENGTH];
+	uint8_t		fb;
+	int			i;
+	int			j;
+
+	memset(sr, 0, sizeof(sr));
+
+	for (i = 0;i < RS_DATA_LENGTH;i++) {
+		fb = data[i] ^ sr[0];
+
+		const uint8_t * row = t.feedback[fb];
+
+		for (j = 0;j < RS_PARITY_LENGTH - 1;j++) {
+			sr[j] = sr[j + 1] ^ row[j];
+		}
+
+		sr[RS_PARITY_LENGTH - 1] = row[RS_PARITY_LENGTH - 1];
+	}
+
+	memcpy(parity, sr, RS_PARITY_LENGTH);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("ssse3")))
+static void rsEncodeSSSE3(const uint8_t * data, uint8_t * parity)
+{
+	const RSTables & t = getTables();
+
+	__m128i		low = _mm_setzero_si128();
+	__m128i		high = _mm_setzero_si128();
+	uint8_t		fb;
+	int			i;
+
+	for (i = 0;i < RS_DATA_LENGTH;i++) {
+		fb = data[i] ^ (uint8_t)_mm_cvtsi128_si32(low);
+
+		const __m128i * row = (const __m128i *)t.feedback[fb];
+
+		low = _mm_xor_si128(_mm_alignr_epi8(high, low, 1), _mm_load_si128(&row[0]));
+		high = _mm_xor_si128(_mm_srli_si128(high, 1), _mm_load_si128(&row[1]));
+	}
+
+	_mm_storeu_si128((__m128i *)&parity[0], low);
+	_mm_storeu_si128((__m128i *)&parity[16], high);
+}
+
+RSEncodeFunction rsGetSIMDEncoder()
+{
+	return (__builtin_cpu_supports("ssse3") ? rsEncodeSSSE3 : NULL);
+}
+
+const char * rsImplementation()
+{
+	return (__builtin_cpu_supports("ssse3") ? "SSSE3" : "scalar");
+}
+
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+
+static void rsEncodeNEON(const uint8_t * data, uint8_t * parity)
+{
+	const RSTables & t = getTables();
+
+	uint8x16_t	zero = vdupq_n_u8(0);
+	uint8x16_t	low = zero;
+	uint8x16_t	high = zero;
+	uint8_t		fb;
+	int			i;
+
+	for (i = 0;i < RS_DATA_LENGTH;i++) {
+		fb = data[i] ^ vgetq_lane_u8(low, 0);
+
+		const uint8_t * row = t.feedback[fb];
+
+		low = veorq_u8(vextq_u8(low, high, 1), vld1q_u8(&row[0]));
+		high = veorq_u8(vextq_u8(high, zero, 1), vld1q_u8(&row[16]));
+	}
+
+	vst1q_u8(&parity[0], low);
+	vst1q_u8(&parity[16], high);
+}
+
+RSEncodeFunction rsGetSIMDEncoder()
+{
+	return rsEncodeNEON;
+}
+
+const char * rsImplementation()
+{
+	return "NEON";
+}
+
+#else
+
+RSEncodeFunction rsGetSIMDEncoder()
+{
+	return NULL;
+}
+
+const char * rsImplementation()
+{
+	return "scalar";
+}
+
+#endif
+
+static RSEncodeFunction selectEncoder()
+{
+	RSEncodeFunction	simd = rsGetSIMDEncoder();
+
+	return (simd != NULL ? simd : rsEncodeScalar);
+}
+
+void rsEncode(const uint8_t * data, uint8_t * parity)
+{
+	static const RSEncodeFunction	encode = selectEncoder();
+
+	encode(data, parity);
+}
+
+bool rsCheck(const uint8_t * codeword)
+{
+	const RSTables & t = getTables();
+
+	uint8_t		syndromes[RS_PARITY_LENGTH];
+	int			i;
+	int			j;
+
+	memset(syndromes, 0, sizeof(syndromes));
+
+	for (i = 0;i < RS_SYMBOLS;i++) {
+		for (j = 0;j < RS_PARITY_LENGTH;j++) {
+			syndromes[j] = t.multiply(syndromes[j], t.roots[j]) ^ codeword[i];
+		}
+	}
+
+	for (j = 0;j < RS_PARITY_LENGTH;j++) {
+		if (syndromes[j] != 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,36 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef _INCL_REEDSOLOMON
+#define _INCL_REEDSOLOMON
+
+/*
+** RS(255,223) over GF(256) with the CCSDS field and generator
+** (x^8 + x^7 + x^2 + x + 1, first root 112, primitive element 11),
+** as used by SSDV, without the CCSDS dual basis conversion...
+*/
+#define RS_SYMBOLS                          255
+#define RS_DATA_LENGTH                      223
+#define RS_PARITY_LENGTH                    32
+
+typedef void (* RSEncodeFunction)(const uint8_t * data, uint8_t * parity);
+
+/*
+** Write the 32 parity bytes for 223 data bytes. Uses SSSE3 or
+** NEON for the shift register if the CPU has it...
+*/
+void            rsEncode(const uint8_t * data, uint8_t * parity);
+
+void            rsEncodeScalar(const uint8_t * data, uint8_t * parity);
+RSEncodeFunction    rsGetSIMDEncoder();
+const char *    rsImplementation();
+
+/*
+** True if the 255 byte codeword (data then parity) has
+** all zero syndromes, i.e. no detectable errors...
+*/
+bool            rsCheck(const uint8_t * codeword);
+
+uint8_t         gfMultiply(uint8_t a, uint8_t b);
+
+#endif
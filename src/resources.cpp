@@ -0,0 +1,438 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/statvfs.h>
+#include <sys/syscall.h>
+
+#include "configmgr.h"
+#include "logger.h"
+#include "bctl_error.h"
+#include "currenttime.h"
+#include "capturebackend.h"
+#include "trace.h"
+#include "heartbeat.h"
+#include "resources.h"
+
+using namespace std;
+
+/*
+** Everything here reads /proc with fixed buffers, no stdio
+** and no opendir(), so sampling doesn't allocate...
+*/
+int readProcFile(const char * pszPath, char * buffer, size_t bufferLength)
+{
+	ssize_t			bytesRead;
+	int				fd;
+
+	fd = open(pszPath, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	bytesRead = read(fd, buffer, bufferLength - 1);
+
+	close(fd);
+
+	if (bytesRead < 0) {
+		return -1;
+	}
+
+	buffer[bytesRead] = 0;
+
+	return (int)bytesRead;
+}
+
+/*
+** Calls back for each entry in a directory, apart from . and
+** .., returns the number of entries or -1. Straight from
+** getdents64(), glibc only has a wrapper for it from 2.30...
+*/
+template <typename F>
+static int forEachEntry(const char * pszPath, F callback)
+{
+	char				buffer[RESOURCE_BUFFER_LENGTH];
+	struct dirent64 *	d;
+	long				bytesRead;
+	long				offset;
+	int					count = 0;
+	int					fd;
+
+	fd = open(pszPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	while ((bytesRead = syscall(SYS_getdents64, fd, buffer, sizeof(buffer))) > 0) {
+		for (offset = 0;offset < bytesRead;offset += d->d_reclen) {
+			d = (struct dirent64 *)&buffer[offset];
+
+			if (d->d_name[0] == '.') {
+				continue;
+			}
+
+			callback(d->d_name);
+			count++;
+		}
+	}
+
+	close(fd);
+
+	return (bytesRead < 0 ? -1 : count);
+}
+
+static uint64_t getCPUClockTime(clockid_t clock)
+{
+	struct timespec		ts;
+
+	clock_gettime(clock, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000000ULL) + ((uint64_t)ts.tv_nsec / 1000ULL);
+}
+
+static bool getStatusCount(const char * pszStatus, const char * pszName, uint64_t * count)
+{
+	const char *	p = strstr(pszStatus, pszName);
+
+	if (p == NULL) {
+		return false;
+	}
+
+	*count = strtoull(p + strlen(pszName), NULL, 10);
+
+	return true;
+}
+
+/*
+** Reads one thread's name and CPU time from its stat and its
+** context switches from its status...
+*/
+static bool sampleThread(pid_t tid, long ticksPerSecond, ThreadResources * t)
+{
+	char			szPath[64];
+	char			buffer[RESOURCE_BUFFER_LENGTH];
+	char *			pszStart;
+	char *			pszEnd;
+	unsigned long	userTicks;
+	unsigned long	systemTicks;
+	size_t			length;
+
+	t->tid = tid;
+
+	snprintf(szPath, sizeof(szPath), "/proc/self/task/%d/stat", (int)tid);
+
+	if (readProcFile(szPath, buffer, sizeof(buffer)) < 0) {
+		return false;
+	}
+
+	/*
+	** The name may itself contain brackets and spaces...
+	*/
+	pszStart = strchr(buffer, '(');
+	pszEnd = strrchr(buffer, ')');
+
+	if (pszStart == NULL || pszEnd == NULL || pszEnd < pszStart) {
+		return false;
+	}
+
+	length = (size_t)(pszEnd - pszStart - 1);
+
+	if (length >= RESOURCE_NAME_LENGTH) {
+		length = RESOURCE_NAME_LENGTH - 1;
+	}
+
+	memcpy(t->szName, pszStart + 1, length);
+	t->szName[length] = 0;
+
+	/*
+	** utime and stime are fields 14 and 15, 11 and 12 after
+	** the name...
+	*/
+	if (sscanf(pszEnd + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &userTicks, &systemTicks) != 2) {
+		return false;
+	}
+
+	t->cpuTime = ((uint64_t)(userTicks + systemTicks) * 1000000ULL) / (uint64_t)ticksPerSecond;
+
+	/*
+	** Clock ticks are too coarse for a thread that's mostly
+	** asleep, the scheduler's own count is in ns if the
+	** kernel keeps it...
+	*/
+	snprintf(szPath, sizeof(szPath), "/proc/self/task/%d/schedstat", (int)tid);
+
+	if (readProcFile(szPath, buffer, sizeof(buffer)) > 0) {
+		t->cpuTime = strtoull(buffer, NULL, 10) / 1000ULL;
+	}
+
+	snprintf(szPath, sizeof(szPath), "/proc/self/task/%d/status", (int)tid);
+
+	if (readProcFile(szPath, buffer, sizeof(buffer)) < 0) {
+		return false;
+	}
+
+	if (!getStatusCount(buffer, "\nvoluntary_ctxt_switches:", &t->voluntaryCount) ||
+		!getStatusCount(buffer, "\nnonvoluntary_ctxt_switches:", &t->involuntaryCount))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+double getCPUShare(uint64_t cpuBefore, uint64_t cpuAfter, uint64_t timeBefore, uint64_t timeAfter)
+{
+	if (timeAfter <= timeBefore || cpuAfter < cpuBefore) {
+		return 0.0;
+	}
+
+	return ((double)(cpuAfter - cpuBefore) * 100.0) / (double)(timeAfter - timeBefore);
+}
+
+ResourceThread::ResourceThread() : PosixThread(true)
+{
+	char			szName[PATH_MAX];
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	pthread_mutex_init(&this->mutex, NULL);
+
+	memset(&this->stats, 0, sizeof(ResourceStats));
+
+	this->stats.historyLength = (uint32_t)cfg.getValueAsInteger(CFG_RESOURCES_HISTORY);
+	this->stats.intervalMs = (unsigned long)cfg.getValueAsInteger(CFG_RESOURCES_INTERVAL) * 1000UL;
+	this->stats.backoff = 1;
+
+	/*
+	** The whole history up front, it's never resized...
+	*/
+	this->history = new ResourceSample[this->stats.historyLength];
+
+	splitOutputPath(cfg.getValue(CFG_CAPTURE_OUTPUTTEMPLATE), this->szOutputDir, szName);
+
+	cfg.subscribe(CFG_RESOURCES_INTERVAL, this);
+	cfg.subscribe(CFG_CAPTURE_OUTPUTTEMPLATE, this);
+}
+
+ResourceThread::~ResourceThread()
+{
+	delete[] this->history;
+
+	pthread_mutex_destroy(&this->mutex);
+}
+
+void ResourceThread::configChanged(ConfigKey key, const char * value)
+{
+	char			szName[PATH_MAX];
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	pthread_mutex_lock(&this->mutex);
+
+	if (key == CFG_RESOURCES_INTERVAL) {
+		this->stats.intervalMs = (unsigned long)cfg.getValueAsInteger(key) * 1000UL;
+		this->stats.backoff = 1;
+	}
+	else if (key == CFG_CAPTURE_OUTPUTTEMPLATE) {
+		splitOutputPath(value, this->szOutputDir, szName);
+	}
+
+	pthread_mutex_unlock(&this->mutex);
+}
+
+bool ResourceThread::sample(ResourceSample * s)
+{
+	char				buffer[RESOURCE_BUFFER_LENGTH];
+	char				szOutputDir[PATH_MAX];
+	struct statvfs		fs;
+	unsigned long		residentPages;
+	long				ticksPerSecond = sysconf(_SC_CLK_TCK);
+	long				pageSize = sysconf(_SC_PAGESIZE);
+	int					count;
+	bool				isOK = true;
+
+	memset(s, 0, sizeof(ResourceSample) - sizeof(s->threads));
+
+	s->time = CurrentTime::getStopwatchTime();
+	s->cpuTime = getCPUClockTime(CLOCK_PROCESS_CPUTIME_ID);
+
+	if (readProcFile("/proc/self/statm", buffer, sizeof(buffer)) < 0 ||
+		sscanf(buffer, "%*u %lu", &residentPages) != 1)
+	{
+		isOK = false;
+	}
+	else {
+		s->rss = (uint64_t)residentPages * (uint64_t)pageSize;
+	}
+
+	/*
+	** Not counting the one we're reading it with...
+	*/
+	count = forEachEntry("/proc/self/fd", [](const char * pszName) {});
+
+	if (count > 0) {
+		s->fdCount = (uint32_t)(count - 1);
+	}
+	else {
+		isOK = false;
+	}
+
+	pthread_mutex_lock(&this->mutex);
+	strcpy(szOutputDir, this->szOutputDir);
+	pthread_mutex_unlock(&this->mutex);
+
+	if (statvfs(szOutputDir, &fs) == 0) {
+		s->freeSpace = (uint64_t)fs.f_bavail * (uint64_t)fs.f_frsize;
+	}
+	else {
+		isOK = false;
+	}
+
+	count = forEachEntry(
+				"/proc/self/task",
+				[s, ticksPerSecond](const char * pszName) {
+					if (s->numThreads < RESOURCE_MAX_THREADS) {
+						/*
+						** A thread may exit between listing and
+						** reading, that's not an error...
+						*/
+						if (sampleThread((pid_t)atoi(pszName), ticksPerSecond, &s->threads[s->numThreads])) {
+							s->numThreads++;
+						}
+					}
+				});
+
+	if (count < 0) {
+		isOK = false;
+	}
+
+	return isOK;
+}
+
+void ResourceThread::getStats(ResourceStats * stats)
+{
+	pthread_mutex_lock(&this->mutex);
+	memcpy(stats, &this->stats, sizeof(ResourceStats));
+	pthread_mutex_unlock(&this->mutex);
+}
+
+bool ResourceThread::getSample(uint32_t age, ResourceSample * s)
+{
+	bool			isAvailable = false;
+
+	pthread_mutex_lock(&this->mutex);
+
+	if (age < this->stats.sampleCount && age < this->stats.historyLength) {
+		memcpy(
+			s,
+			&this->history[(this->stats.sampleCount - 1 - age) % this->stats.historyLength],
+			sizeof(ResourceSample));
+
+		isAvailable = true;
+	}
+
+	pthread_mutex_unlock(&this->mutex);
+
+	return isAvailable;
+}
+
+void * ResourceThread::run()
+{
+	ResourceSample		s;
+	struct timespec		due;
+	uint64_t			cpuStart;
+	uint64_t			cost;
+	uint64_t			interval;
+	uint64_t			nextTime;
+	bool				isOK;
+	bool				isFirstError;
+
+	Logger & log = Logger::getInstance();
+
+	traceSetThreadName("resources");
+
+	pthread_mutex_lock(&this->mutex);
+	this->stats.startTime = CurrentTime::getStopwatchTime();
+	pthread_mutex_unlock(&this->mutex);
+
+	nextTime = this->stats.startTime;
+
+	while (1) {
+		cpuStart = getCPUClockTime(CLOCK_THREAD_CPUTIME_ID);
+
+		{
+			TRACE_SPAN("resources.sample");
+			isOK = sample(&s);
+		}
+
+		cost = getCPUClockTime(CLOCK_THREAD_CPUTIME_ID) - cpuStart;
+
+		pthread_mutex_lock(&this->mutex);
+
+		isFirstError = (!isOK && this->stats.errorCount == 0);
+
+		if (isOK) {
+			memcpy(&this->history[this->stats.sampleCount % this->stats.historyLength], &s, sizeof(ResourceSample));
+			this->stats.sampleCount++;
+		}
+		else {
+			this->stats.errorCount++;
+		}
+
+		this->stats.samplerTime += cost;
+
+		if (cost > this->stats.maxSampleTime) {
+			this->stats.maxSampleTime = cost;
+		}
+
+		/*
+		** Keep our own share of the CPU bounded, with lots of
+		** threads on a slow CPU sample less often...
+		*/
+		interval = (uint64_t)this->stats.intervalMs * 1000ULL * this->stats.backoff;
+
+		if (cost * 1000000ULL > interval * RESOURCE_MAX_OVERHEAD_PPM && this->stats.backoff < RESOURCE_MAX_BACKOFF) {
+			this->stats.backoff <<= 1;
+
+			log.logStatus("Resource sampling took %luus, backing off to every %lums", (unsigned long)cost, this->stats.intervalMs * this->stats.backoff);
+		}
+		else if (this->stats.backoff > 1 && cost * 4000000ULL < (interval / 2) * RESOURCE_MAX_OVERHEAD_PPM) {
+			this->stats.backoff >>= 1;
+		}
+
+		interval = (uint64_t)this->stats.intervalMs * 1000ULL * this->stats.backoff;
+
+		pthread_mutex_unlock(&this->mutex);
+
+		if (isFirstError) {
+			log.logError("Failed to sample resource usage: %s", strerror(errno));
+		}
+
+		/*
+		** On real time, even in a simulation, this is about
+		** what the machine is doing...
+		*/
+		nextTime += interval;
+
+		if (nextTime < CurrentTime::getStopwatchTime()) {
+			nextTime = CurrentTime::getStopwatchTime() + interval;
+		}
+
+		due.tv_sec = (time_t)(nextTime / 1000000ULL);
+		due.tv_nsec = (long)((nextTime % 1000000ULL) * 1000ULL);
+
+		watchdogWait();
+
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR);
+
+		watchdogBeat();
+	}
+
+	return NULL;
+}
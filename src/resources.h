@@ -0,0 +1,106 @@
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "posixthread.h"
+#include "configmgr.h"
+
+#ifndef _INCL_RESOURCES
+#define _INCL_RESOURCES
+
+#define RESOURCE_MAX_THREADS                32
+#define RESOURCE_NAME_LENGTH                16
+#define RESOURCE_BUFFER_LENGTH              4096
+
+/*
+** The sampler may use up to this share of the interval, in
+** parts per million. Over it the interval is doubled, up to
+** the maximum backoff...
+*/
+#define RESOURCE_MAX_OVERHEAD_PPM           10000
+#define RESOURCE_MAX_BACKOFF                16
+
+struct ThreadResources
+{
+    pid_t               tid;
+    char                szName[RESOURCE_NAME_LENGTH];
+    uint64_t            cpuTime;
+    uint64_t            voluntaryCount;
+    uint64_t            involuntaryCount;
+};
+
+/*
+** One sample of the whole process. Times are us, the sample
+** time is on the real monotonic clock so CPU shares make
+** sense in a simulation too...
+*/
+struct ResourceSample
+{
+    uint64_t            time;
+    uint64_t            cpuTime;
+    uint64_t            rss;
+    uint64_t            freeSpace;
+    uint32_t            fdCount;
+    uint32_t            numThreads;
+    ThreadResources     threads[RESOURCE_MAX_THREADS];
+};
+
+struct ResourceStats
+{
+    uint32_t            sampleCount;
+    uint32_t            errorCount;
+    uint32_t            historyLength;
+    uint32_t            backoff;
+    unsigned long       intervalMs;
+    uint64_t            startTime;
+    uint64_t            samplerTime;
+    uint64_t            maxSampleTime;
+};
+
+/*
+** Periodically samples the CPU time and context switches of
+** every thread, from /proc/self/task, with the process RSS,
+** open files and the free space where frames are written. The
+** samples go into a fixed history allocated up front...
+*/
+class ResourceThread : public PosixThread, public ConfigListener
+{
+private:
+    pthread_mutex_t     mutex;
+    ResourceSample *    history;
+    ResourceStats       stats;
+    char                szOutputDir[PATH_MAX];
+
+    bool                sample(ResourceSample * s);
+
+public:
+    ResourceThread();
+    ~ResourceThread();
+
+    void *              run();
+
+    void                configChanged(ConfigKey key, const char * value);
+
+    void                getStats(ResourceStats * stats);
+
+    /*
+    ** Copy out a sample, age 0 is the latest. Returns false
+    ** if the history doesn't go back that far...
+    */
+    bool                getSample(uint32_t age, ResourceSample * s);
+};
+
+/*
+** CPU share of the interval between two samples, in
+** percent...
+*/
+double  getCPUShare(uint64_t cpuBefore, uint64_t cpuAfter, uint64_t timeBefore, uint64_t timeAfter);
+
+/*
+** Reads a whole /proc file into a fixed buffer, without
+** allocating. Returns its length or -1...
+*/
+int     readProcFile(const char * pszPath, char * buffer, size_t bufferLength);
+
+#endif
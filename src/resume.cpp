@@ -0,0 +1,494 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "configmgr.h"
+#include "logger.h"
+#include "bctl_error.h"
+#include "currenttime.h"
+#include "startup.h"
+#include "container.h"
+#include "resume.h"
+#include "heartbeat.h"
+
+/*
+** The kernel's record layout for getdents64(), we call it
+** directly to read the directory in big chunks...
+*/
+struct LinuxDirent64
+{
+	uint64_t		d_ino;
+	int64_t			d_off;
+	uint16_t		d_reclen;
+	uint8_t			d_type;
+	char			d_name[1];
+};
+
+/*
+** The sequence, then F for a frame on disk or R for one the
+** similarity stage or the packer removed...
+*/
+#define CHECKPOINT_RECORD_LENGTH			13
+
+void * ScanThread::run()
+{
+	this->pScan->parse();
+
+	return NULL;
+}
+
+DirectoryScan::DirectoryScan(const char * pszTemplate, int numThreads)
+{
+	int			i;
+
+	this->pszTemplate = pszTemplate;
+	this->numThreads = (numThreads < 1 ? 1 : (numThreads > RESUME_MAX_SCAN_THREADS ? RESUME_MAX_SCAN_THREADS : numThreads));
+
+	/*
+	** Two buffers per thread, so the reader can fill one while
+	** the other is parsed...
+	*/
+	this->numBuffers = (this->numThreads > 1 ? this->numThreads * 2 : 1);
+
+	for (i = 0;i < this->numBuffers;i++) {
+		this->buffers[i].data = (char *)malloc(RESUME_SCAN_BUFFER_SIZE);
+
+		if (this->buffers[i].data == NULL) {
+			while (--i >= 0) {
+				free(this->buffers[i].data);
+			}
+
+			throw bctl_error("Failed to allocate directory scan buffers", __FILE__, __LINE__);
+		}
+
+		this->buffers[i].length = 0;
+		this->freeBuffers[i] = i;
+	}
+
+	this->numFree = this->numBuffers;
+
+	pthread_mutex_init(&this->mutex, NULL);
+	pthread_cond_init(&this->bufferFree, NULL);
+	pthread_cond_init(&this->bufferFull, NULL);
+}
+
+DirectoryScan::~DirectoryScan()
+{
+	for (int i = 0;i < this->numBuffers;i++) {
+		free(this->buffers[i].data);
+	}
+
+	pthread_cond_destroy(&this->bufferFull);
+	pthread_cond_destroy(&this->bufferFree);
+	pthread_mutex_destroy(&this->mutex);
+}
+
+void DirectoryScan::parseBuffer(ScanBuffer * buffer, uint32_t * lastSequence, uint32_t * filesScanned)
+{
+	LinuxDirent64 *		entry;
+	uint32_t			sequence;
+	int					position = 0;
+
+	while (position < buffer->length) {
+		entry = (LinuxDirent64 *)&buffer->data[position];
+		position += entry->d_reclen;
+
+		(*filesScanned)++;
+
+		if (entry->d_type == DT_DIR) {
+			continue;
+		}
+
+		if (matchOutputTemplate(this->pszTemplate, entry->d_name, &sequence) && sequence > *lastSequence) {
+			*lastSequence = sequence;
+		}
+	}
+}
+
+void DirectoryScan::parse()
+{
+	ScanBuffer *	buffer;
+	uint32_t		lastSequence = 0;
+	uint32_t		filesScanned = 0;
+	int				index;
+
+	while (1) {
+		pthread_mutex_lock(&this->mutex);
+
+		watchdogWait();
+
+		while (this->numFull == 0 && !this->isFinished) {
+			pthread_cond_wait(&this->bufferFull, &this->mutex);
+		}
+
+		watchdogBeat();
+
+		if (this->numFull == 0) {
+			break;
+		}
+
+		index = this->fullBuffers[this->fullHead];
+		this->fullHead = (this->fullHead + 1) % this->numBuffers;
+		this->numFull--;
+
+		pthread_mutex_unlock(&this->mutex);
+
+		buffer = &this->buffers[index];
+
+		parseBuffer(buffer, &lastSequence, &filesScanned);
+
+		pthread_mutex_lock(&this->mutex);
+		this->freeBuffers[this->numFree++] = index;
+		pthread_cond_signal(&this->bufferFree);
+		pthread_mutex_unlock(&this->mutex);
+	}
+
+	/*
+	** Still holding the mutex...
+	*/
+	if (lastSequence > this->lastSequence) {
+		this->lastSequence = lastSequence;
+	}
+
+	this->filesScanned += filesScanned;
+
+	pthread_mutex_unlock(&this->mutex);
+}
+
+/*
+** Returns false if the directory can't be read...
+*/
+bool DirectoryScan::scan(const char * pszDir, uint32_t * lastSequence, uint32_t * filesScanned)
+{
+	ScanThread *	threads[RESUME_MAX_SCAN_THREADS];
+	ScanBuffer *	buffer;
+	long			length;
+	int				numStarted = 0;
+	int				index;
+	int				fd;
+	int				i;
+	bool			isOK = true;
+
+	fd = open(pszDir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if (fd < 0) {
+		return false;
+	}
+
+	this->lastSequence = 0;
+	this->filesScanned = 0;
+	this->isFinished = false;
+
+	if (this->numThreads > 1) {
+		for (i = 0;i < this->numThreads;i++) {
+			threads[i] = new ScanThread(this);
+
+			if (!threads[i]->start()) {
+				delete threads[i];
+				break;
+			}
+
+			numStarted++;
+		}
+	}
+
+	while (1) {
+		pthread_mutex_lock(&this->mutex);
+
+		watchdogWait();
+
+		while (this->numFree == 0) {
+			pthread_cond_wait(&this->bufferFree, &this->mutex);
+		}
+
+		watchdogBeat();
+
+		index = this->freeBuffers[--this->numFree];
+
+		pthread_mutex_unlock(&this->mutex);
+
+		buffer = &this->buffers[index];
+
+		length = syscall(SYS_getdents64, fd, buffer->data, RESUME_SCAN_BUFFER_SIZE);
+
+		if (length <= 0) {
+			if (length < 0) {
+				isOK = false;
+			}
+
+			pthread_mutex_lock(&this->mutex);
+			this->freeBuffers[this->numFree++] = index;
+			pthread_mutex_unlock(&this->mutex);
+			break;
+		}
+
+		buffer->length = (int)length;
+
+		if (numStarted == 0) {
+			parseBuffer(buffer, &this->lastSequence, &this->filesScanned);
+
+			pthread_mutex_lock(&this->mutex);
+			this->freeBuffers[this->numFree++] = index;
+			pthread_mutex_unlock(&this->mutex);
+		}
+		else {
+			pthread_mutex_lock(&this->mutex);
+			this->fullBuffers[(this->fullHead + this->numFull) % this->numBuffers] = index;
+			this->numFull++;
+			pthread_cond_signal(&this->bufferFull);
+			pthread_mutex_unlock(&this->mutex);
+		}
+	}
+
+	pthread_mutex_lock(&this->mutex);
+	this->isFinished = true;
+	pthread_cond_broadcast(&this->bufferFull);
+	pthread_mutex_unlock(&this->mutex);
+
+	for (i = 0;i < numStarted;i++) {
+		threads[i]->join();
+		delete threads[i];
+	}
+
+	close(fd);
+
+	*lastSequence = this->lastSequence;
+	*filesScanned = this->filesScanned;
+
+	return isOK;
+}
+
+FrameCheckpoint::FrameCheckpoint()
+{
+	ConfigManager & cfg = ConfigManager::getInstance();
+	Logger & log = Logger::getInstance();
+
+	const char * pszPath = cfg.getValue(CFG_CAPTURE_CHECKPOINTFILE);
+
+	pthread_mutex_init(&this->mutex, NULL);
+
+	if (strlen(pszPath) > 0) {
+		this->fd = open(pszPath, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+
+		if (this->fd < 0) {
+			log.logError("Failed to open checkpoint file %s: %s", pszPath, strerror(errno));
+		}
+	}
+}
+
+FrameCheckpoint::~FrameCheckpoint()
+{
+	if (this->fd >= 0) {
+		close(this->fd);
+	}
+
+	pthread_mutex_destroy(&this->mutex);
+}
+
+/*
+** A fixed length record rewritten in place, so this is a
+** single pwrite() per frame...
+*/
+void FrameCheckpoint::writeRecord(uint32_t sequence, bool isRemoved)
+{
+	char			szRecord[CHECKPOINT_RECORD_LENGTH + 1];
+
+	snprintf(szRecord, sizeof(szRecord), "%010u %c\n", sequence, (isRemoved ? 'R' : 'F'));
+
+	if (pwrite(this->fd, szRecord, CHECKPOINT_RECORD_LENGTH, 0) != CHECKPOINT_RECORD_LENGTH) {
+		Logger::getInstance().logError("Failed to write checkpoint: %s", strerror(errno));
+	}
+}
+
+void FrameCheckpoint::frameAvailable(const CaptureFrame & frame)
+{
+	if (this->fd < 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&this->mutex);
+
+	this->lastSequence = frame.sequence;
+	writeRecord(frame.sequence, false);
+
+	pthread_mutex_unlock(&this->mutex);
+}
+
+/*
+** Called before the frame is removed. Only the latest frame
+** matters, a later one will already have moved the record on...
+*/
+void FrameCheckpoint::frameRemoved(uint32_t sequence)
+{
+	if (this->fd < 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&this->mutex);
+
+	if (sequence == this->lastSequence) {
+		writeRecord(sequence, true);
+	}
+
+	pthread_mutex_unlock(&this->mutex);
+}
+
+/*
+** Also reads the older record, the bare sequence and a
+** newline...
+*/
+bool readCheckpoint(const char * pszPath, uint32_t * sequence, bool * isRemoved)
+{
+	char			szRecord[CHECKPOINT_RECORD_LENGTH + 1];
+	char *			pszEnd;
+	ssize_t			length;
+	int				fd;
+
+	fd = open(pszPath, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		return false;
+	}
+
+	length = read(fd, szRecord, CHECKPOINT_RECORD_LENGTH);
+
+	close(fd);
+
+	if (length <= 0) {
+		return false;
+	}
+
+	szRecord[length] = 0;
+
+	*sequence = (uint32_t)strtoul(szRecord, &pszEnd, 10);
+	*isRemoved = false;
+
+	if (pszEnd == szRecord) {
+		return false;
+	}
+
+	if (*pszEnd == ' ') {
+		pszEnd++;
+
+		if (*pszEnd != 'F' && *pszEnd != 'R') {
+			return false;
+		}
+
+		*isRemoved = (*pszEnd++ == 'R');
+	}
+
+	return (*pszEnd == '\n' || *pszEnd == 0);
+}
+
+static bool frameExists(const char * pszTemplate, uint32_t sequence)
+{
+	struct stat		st;
+	char			szPath[PATH_MAX];
+
+	if (!formatOutputTemplate(pszTemplate, sequence, szPath, PATH_MAX)) {
+		return false;
+	}
+
+	return (stat(szPath, &st) == 0);
+}
+
+/*
+** The checkpoint is trusted if its frame is still on disk, or
+** was removed as a near duplicate or once packed. It may lag
+** behind if we died between a frame and its checkpoint, so look
+** a little way past it for newer frames...
+*/
+bool resumeFromCheckpoint(const char * pszCheckpoint, const char * pszTemplate, uint32_t * lastSequence)
+{
+	uint32_t		checkpoint;
+	bool			isRemoved;
+	int				i;
+
+	if (!readCheckpoint(pszCheckpoint, &checkpoint, &isRemoved)) {
+		return false;
+	}
+
+	if (checkpoint == 0 || (!isRemoved && !frameExists(pszTemplate, checkpoint))) {
+		return false;
+	}
+
+	for (i = 0;i < RESUME_MAX_PROBES;i++) {
+		if (!frameExists(pszTemplate, checkpoint + 1)) {
+			*lastSequence = checkpoint;
+			return true;
+		}
+
+		checkpoint++;
+	}
+
+	return false;
+}
+
+/*
+** Returns the sequence the next frame should take, so a restart
+** carries on from the highest frame already in the output
+** directory rather than overwriting from 1...
+*/
+uint32_t findResumeSequence(ResumeResult * result)
+{
+	char			szTemplate[PATH_MAX];
+	char			szCheckpoint[PATH_MAX];
+	char			szDir[PATH_MAX];
+	char			szName[PATH_MAX];
+	uint64_t		startTime;
+	uint32_t		lastPacked;
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+	Logger & log = Logger::getInstance();
+
+	startTime = CurrentTime::getStopwatchTime();
+
+	const char * pszTemplate = cfg.getValue(CFG_CAPTURE_OUTPUTTEMPLATE, szTemplate, PATH_MAX);
+	const char * pszCheckpoint = cfg.getValue(CFG_CAPTURE_CHECKPOINTFILE, szCheckpoint, PATH_MAX);
+
+	memset(result, 0, sizeof(ResumeResult));
+
+	if (strlen(pszCheckpoint) > 0 && resumeFromCheckpoint(pszCheckpoint, pszTemplate, &result->lastSequence)) {
+		result->isFromCheckpoint = true;
+	}
+	else {
+		splitOutputPath(pszTemplate, szDir, szName);
+
+		DirectoryScan scan(szName, cfg.getValueAsInteger(CFG_CAPTURE_SCANTHREADS));
+
+		if (!scan.scan(szDir, &result->lastSequence, &result->filesScanned)) {
+			log.logError("Failed to scan output directory %s: %s", szDir, strerror(errno));
+		}
+	}
+
+	/*
+	** The loose frames may have been packed and removed...
+	*/
+	if (cfg.getValueAsBoolean(CFG_CONTAINER_ENABLE) && findLastPackedFrame(&lastPacked) && lastPacked > result->lastSequence) {
+		result->lastSequence = lastPacked;
+		result->isFromCheckpoint = false;
+		result->isFromContainer = true;
+	}
+
+	result->elapsed = CurrentTime::getStopwatchTime() - startTime;
+
+	log.logStatus(
+			"Resuming capture at frame %u, found by %s in %luus",
+			result->lastSequence + 1,
+			(result->isFromCheckpoint ? "checkpoint" : (result->isFromContainer ? "segment index" : "directory scan")),
+			(unsigned long)result->elapsed);
+
+	if (result->filesScanned > 0) {
+		log.logDebug("Scanned %u directory entries", result->filesScanned);
+	}
+
+	StartupTimeline::getInstance().mark(STARTUP_RESUME_FOUND);
+
+	return result->lastSequence + 1;
+}
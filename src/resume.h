@@ -0,0 +1,116 @@
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "posixthread.h"
+#include "capturebackend.h"
+
+#ifndef _INCL_RESUME
+#define _INCL_RESUME
+
+/*
+** How far past the checkpoint we'll look for newer frames
+** before giving up on it and scanning the directory...
+*/
+#define RESUME_MAX_PROBES                   64
+
+#define RESUME_SCAN_BUFFER_SIZE             (256 * 1024)
+#define RESUME_MAX_SCAN_THREADS             16
+
+struct ResumeResult
+{
+    uint32_t            lastSequence;
+    uint32_t            filesScanned;
+    uint64_t            elapsed;
+    bool                isFromCheckpoint;
+    bool                isFromContainer;
+};
+
+struct ScanBuffer
+{
+    char *              data;
+    int                 length;
+};
+
+class DirectoryScan;
+
+class ScanThread : public PosixThread
+{
+private:
+    DirectoryScan *     pScan;
+
+public:
+    ScanThread(DirectoryScan * pScan) : PosixThread(false) {
+        this->pScan = pScan;
+    }
+
+    void *              run();
+};
+
+/*
+** Finds the highest frame sequence in a directory. The calling
+** thread reads the directory with getdents64() into a pool of
+** buffers, while the scan threads match the names against the
+** output template...
+*/
+class DirectoryScan
+{
+private:
+    pthread_mutex_t     mutex;
+    pthread_cond_t      bufferFree;
+    pthread_cond_t      bufferFull;
+
+    const char *        pszTemplate;
+    int                 numThreads;
+
+    ScanBuffer          buffers[RESUME_MAX_SCAN_THREADS * 2];
+    int                 numBuffers;
+    int                 freeBuffers[RESUME_MAX_SCAN_THREADS * 2];
+    int                 numFree;
+    int                 fullBuffers[RESUME_MAX_SCAN_THREADS * 2];
+    int                 fullHead = 0;
+    int                 numFull = 0;
+    bool                isFinished = false;
+
+    uint32_t            lastSequence = 0;
+    uint32_t            filesScanned = 0;
+
+    void                parseBuffer(ScanBuffer * buffer, uint32_t * lastSequence, uint32_t * filesScanned);
+
+public:
+    DirectoryScan(const char * pszTemplate, int numThreads);
+    ~DirectoryScan();
+
+    bool                scan(const char * pszDir, uint32_t * lastSequence, uint32_t * filesScanned);
+
+    void                parse();
+};
+
+/*
+** Records the sequence of each completed frame, so a restart
+** can resume numbering without scanning the output directory.
+** The similarity stage and the packer mark the record when they
+** remove that frame, so a resume doesn't go looking for it...
+*/
+class FrameCheckpoint : public FrameListener
+{
+private:
+    int                 fd = -1;
+    pthread_mutex_t     mutex;
+    uint32_t            lastSequence = 0;
+
+    void                writeRecord(uint32_t sequence, bool isRemoved);
+
+public:
+    FrameCheckpoint();
+    ~FrameCheckpoint();
+
+    void                frameAvailable(const CaptureFrame & frame);
+    void                frameRemoved(uint32_t sequence);
+};
+
+bool        readCheckpoint(const char * pszPath, uint32_t * sequence, bool * isRemoved);
+bool        resumeFromCheckpoint(const char * pszCheckpoint, const char * pszTemplate, uint32_t * lastSequence);
+uint32_t    findResumeSequence(ResumeResult * result);
+
+#endif
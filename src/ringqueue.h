@@ -0,0 +1,227 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+
+#ifndef _INCL_RINGQUEUE
+#define _INCL_RINGQUEUE
+
+/*
+** The indexes are padded out to a cache line each, so the
+** producer and consumer don't keep stealing the line from each
+** other. Padding rather than alignas, new doesn't honour
+** extended alignment before C++17...
+*/
+#define RINGQUEUE_CACHE_LINE                64
+#define RINGQUEUE_PAD                       (RINGQUEUE_CACHE_LINE - sizeof(std::atomic<size_t>))
+
+/*
+** Fixed size queues of T, allocated up front and rounded up
+** to a power of 2. push() fails when full and pop() when
+** empty, neither ever blocks or allocates. Waiting is up to
+** the caller...
+*/
+template <typename T>
+class BoundedQueue
+{
+protected:
+    size_t                          capacity;
+    size_t                          mask;
+
+    static size_t roundUp(size_t length) {
+        size_t      capacity = 2;
+
+        while (capacity < length) {
+            capacity <<= 1;
+        }
+
+        return capacity;
+    }
+
+public:
+    BoundedQueue(size_t length) {
+        this->capacity = roundUp(length);
+        this->mask = this->capacity - 1;
+    }
+
+    virtual ~BoundedQueue() {}
+
+    size_t getCapacity() {
+        return this->capacity;
+    }
+
+    virtual bool        push(const T & item) = 0;
+    virtual bool        pop(T * item) = 0;
+
+    /*
+    ** Only a snapshot, other threads may be busy...
+    */
+    virtual size_t      size() = 0;
+};
+
+/*
+** One producer thread and one consumer thread. Each side only
+** writes its own index, so there are no atomic read-modify-
+** writes at all...
+*/
+template <typename T>
+class SPSCQueue : public BoundedQueue<T>
+{
+private:
+    T *                             items;
+
+    char                            pad0[RINGQUEUE_CACHE_LINE];
+    std::atomic<size_t>             head;
+    char                            pad1[RINGQUEUE_PAD];
+    std::atomic<size_t>             tail;
+    char                            pad2[RINGQUEUE_PAD];
+
+public:
+    SPSCQueue(size_t length) : BoundedQueue<T>(length) {
+        this->items = new T[this->capacity];
+
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+
+    ~SPSCQueue() {
+        delete[] this->items;
+    }
+
+    bool push(const T & item) {
+        size_t      t = tail.load(std::memory_order_relaxed);
+
+        if (t - head.load(std::memory_order_acquire) == this->capacity) {
+            return false;
+        }
+
+        this->items[t & this->mask] = item;
+
+        tail.store(t + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    bool pop(T * item) {
+        size_t      h = head.load(std::memory_order_relaxed);
+
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        *item = this->items[h & this->mask];
+
+        head.store(h + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    size_t size() {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+};
+
+/*
+** Any number of producers and consumers. Each cell carries a
+** sequence number saying whose turn it is, so a thread claims
+** a cell with one compare and swap and then has it to itself
+** (Vyukov's bounded MPMC queue)...
+*/
+template <typename T>
+class MPMCQueue : public BoundedQueue<T>
+{
+private:
+    struct Cell {
+        std::atomic<size_t>         sequence;
+        T                           item;
+    };
+
+    Cell *                          cells;
+
+    char                            pad0[RINGQUEUE_CACHE_LINE];
+    std::atomic<size_t>             head;
+    char                            pad1[RINGQUEUE_PAD];
+    std::atomic<size_t>             tail;
+    char                            pad2[RINGQUEUE_PAD];
+
+public:
+    MPMCQueue(size_t length) : BoundedQueue<T>(length) {
+        this->cells = new Cell[this->capacity];
+
+        for (size_t i = 0;i < this->capacity;i++) {
+            this->cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+
+    ~MPMCQueue() {
+        delete[] this->cells;
+    }
+
+    bool push(const T & item) {
+        Cell *      cell;
+        size_t      t = tail.load(std::memory_order_relaxed);
+        intptr_t    diff;
+
+        while (1) {
+            cell = &this->cells[t & this->mask];
+            diff = (intptr_t)cell->sequence.load(std::memory_order_acquire) - (intptr_t)t;
+
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(t, t + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                t = tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->item = item;
+        cell->sequence.store(t + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    bool pop(T * item) {
+        Cell *      cell;
+        size_t      h = head.load(std::memory_order_relaxed);
+        intptr_t    diff;
+
+        while (1) {
+            cell = &this->cells[h & this->mask];
+            diff = (intptr_t)cell->sequence.load(std::memory_order_acquire) - (intptr_t)(h + 1);
+
+            if (diff == 0) {
+                if (head.compare_exchange_weak(h, h + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                h = head.load(std::memory_order_relaxed);
+            }
+        }
+
+        *item = cell->item;
+        cell->sequence.store(h + this->capacity, std::memory_order_release);
+
+        return true;
+    }
+
+    size_t size() {
+        size_t      t = tail.load(std::memory_order_acquire);
+        size_t      h = head.load(std::memory_order_acquire);
+
+        return (t > h ? t - h : 0);
+    }
+};
+
+#endif
@@ -0,0 +1,93 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <sched.h>
+
+#include <atomic>
+
+#ifndef _INCL_SEQLOCK
+#define _INCL_SEQLOCK
+
+/*
+** Publishes a small struct from one writer to any number of
+** readers without a lock. Readers retry if the writer was busy,
+** the writer never waits. The value is held as relaxed atomic
+** words, so a torn read is detected rather than undefined...
+*/
+template <typename T>
+class Seqlock
+{
+private:
+    static const size_t             numWords = (sizeof(T) + 7) / 8;
+
+    std::atomic<uint32_t>           sequence;
+    std::atomic<uint64_t>           words[numWords];
+
+public:
+    Seqlock() {
+        sequence.store(0, std::memory_order_relaxed);
+
+        for (size_t i = 0;i < numWords;i++) {
+            words[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /*
+    ** Only ever from one thread...
+    */
+    void write(const T & value) {
+        uint64_t    buffer[numWords];
+        uint32_t    s;
+
+        buffer[numWords - 1] = 0;
+        memcpy(buffer, &value, sizeof(T));
+
+        s = sequence.load(std::memory_order_relaxed);
+
+        sequence.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (size_t i = 0;i < numWords;i++) {
+            words[i].store(buffer[i], std::memory_order_relaxed);
+        }
+
+        sequence.store(s + 2, std::memory_order_release);
+    }
+
+    /*
+    ** Returns the version read, 0 if nothing has been
+    ** written yet...
+    */
+    uint32_t read(T * value) {
+        uint64_t    buffer[numWords];
+        uint32_t    s1;
+        uint32_t    s2;
+
+        while (1) {
+            s1 = sequence.load(std::memory_order_acquire);
+
+            if (s1 & 1) {
+                sched_yield();
+                continue;
+            }
+
+            for (size_t i = 0;i < numWords;i++) {
+                buffer[i] = words[i].load(std::memory_order_relaxed);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            s2 = sequence.load(std::memory_order_relaxed);
+
+            if (s1 == s2) {
+                break;
+            }
+        }
+
+        memcpy(value, buffer, sizeof(T));
+
+        return s1 / 2;
+    }
+};
+
+#endif
@@ -0,0 +1,1004 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "configmgr.h"
+#include "logger.h"
+#include "bctl_error.h"
+#include "currenttime.h"
+#include "resume.h"
+#include "similarity.h"
+
+using namespace std;
+
+/*
+** Reads the entropy coded data MSB first, with the 0xFF00 byte
+** stuffing taken out. At a marker it feeds zeros and counts them,
+** so running into one mid block shows up as a truncated scan...
+*/
+struct BitReader
+{
+	const uint8_t *		p;
+	const uint8_t *		end;
+	uint64_t			bits;
+	int					numBits;
+	int					zeroBytes;
+	bool				isAtMarker;
+};
+
+static inline uint16_t readShort(const uint8_t * p)
+{
+	return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline void fillBits(BitReader * r)
+{
+	uint64_t		b;
+
+	while (r->numBits <= 56) {
+		b = 0;
+
+		if (r->isAtMarker || r->p >= r->end) {
+			r->zeroBytes++;
+		}
+		else if (r->p[0] != 0xFF) {
+			b = *r->p++;
+		}
+		else if (r->p + 1 < r->end && r->p[1] == 0x00) {
+			b = 0xFF;
+			r->p += 2;
+		}
+		else {
+			r->isAtMarker = true;
+			r->zeroBytes++;
+		}
+
+		r->bits |= b << (56 - r->numBits);
+		r->numBits += 8;
+	}
+}
+
+static inline int getBits(BitReader * r, int n)
+{
+	int			value;
+
+	if (n == 0) {
+		return 0;
+	}
+
+	if (r->numBits < n) {
+		fillBits(r);
+	}
+
+	value = (int)(r->bits >> (64 - n));
+
+	r->bits <<= n;
+	r->numBits -= n;
+
+	return value;
+}
+
+/*
+** Turn the n bit magnitude of a coefficient into its value, the
+** negative ones have a leading 0...
+*/
+static inline int extend(int value, int n)
+{
+	return (value < (1 << (n - 1)) ? value - (1 << n) + 1 : value);
+}
+
+static inline int decodeSymbol(BitReader * r, const JpegHuffmanTable * t)
+{
+	int32_t		code;
+	int			peek;
+	int			length;
+
+	if (r->numBits < 16) {
+		fillBits(r);
+	}
+
+	peek = (int)(r->bits >> (64 - JPEG_HUFFMAN_LOOKUP_BITS));
+	length = t->lookupLength[peek];
+
+	if (length != 0) {
+		r->bits <<= length;
+		r->numBits -= length;
+
+		return t->lookupValue[peek];
+	}
+
+	for (length = JPEG_HUFFMAN_LOOKUP_BITS + 1;length <= 16;length++) {
+		code = (int32_t)(r->bits >> (64 - length));
+
+		if (code <= t->maxCode[length]) {
+			r->bits <<= length;
+			r->numBits -= length;
+
+			return t->values[code + t->valueOffset[length]];
+		}
+	}
+
+	return -1;
+}
+
+/*
+** Decode one block, keeping its DC coefficient in the component's
+** predictor. The AC coefficients are only decoded far enough to
+** skip them...
+*/
+static bool decodeBlock(BitReader * r, const JpegHuffmanTable * dc, const JpegHuffmanTable * ac, int * predictor)
+{
+	int			symbol;
+	int			size;
+	int			k;
+
+	symbol = decodeSymbol(r, dc);
+
+	if (symbol < 0 || symbol > 11) {
+		return false;
+	}
+
+	*predictor += (symbol > 0 ? extend(getBits(r, symbol), symbol) : 0);
+
+	for (k = 1;k < 64;k++) {
+		symbol = decodeSymbol(r, ac);
+
+		if (symbol < 0) {
+			return false;
+		}
+
+		size = symbol & 0x0F;
+
+		if (size == 0) {
+			/*
+			** EOB, or a run of 16 zeros...
+			*/
+			if (symbol != 0xF0) {
+				return true;
+			}
+
+			k += 15;
+		}
+		else {
+			k += symbol >> 4;
+
+			if (r->numBits < size) {
+				fillBits(r);
+			}
+
+			r->bits <<= size;
+			r->numBits -= size;
+		}
+	}
+
+	return (k == 64);
+}
+
+/*
+** From the 16 code counts and the values of a DHT, assigning the
+** codes in order as the spec does (Annex C)...
+*/
+static bool buildHuffmanTable(JpegHuffmanTable * t, const uint8_t * counts, const uint8_t * values, int numValues)
+{
+	int			code = 0;
+	int			length;
+	int			shift;
+	int			i;
+	int			j;
+	int			k = 0;
+
+	memset(t->lookupLength, 0, sizeof(t->lookupLength));
+	memcpy(t->values, values, numValues);
+
+	for (length = 1;length <= 16;length++) {
+		t->valueOffset[length] = k - code;
+
+		for (i = 0;i < counts[length - 1];i++, code++, k++) {
+			if (code >= (1 << length)) {
+				return false;
+			}
+
+			if (length <= JPEG_HUFFMAN_LOOKUP_BITS) {
+				shift = JPEG_HUFFMAN_LOOKUP_BITS - length;
+
+				for (j = 0;j < (1 << shift);j++) {
+					t->lookupLength[(code << shift) + j] = (uint8_t)length;
+					t->lookupValue[(code << shift) + j] = values[k];
+				}
+			}
+		}
+
+		t->maxCode[length] = (counts[length - 1] > 0 ? code - 1 : -1);
+
+		code <<= 1;
+	}
+
+	t->isDefined = true;
+
+	return true;
+}
+
+static bool parseQuantTables(JpegDCDecoder * d, const uint8_t * p, const uint8_t * end)
+{
+	int			table;
+	int			tableLength;
+
+	while (p < end) {
+		table = p[0] & 0x0F;
+		tableLength = ((p[0] >> 4) != 0 ? 128 : 64);
+
+		if (table > 3 || end - p < 1 + tableLength) {
+			return false;
+		}
+
+		/*
+		** Only the DC quantiser matters, it's first in
+		** zigzag order...
+		*/
+		d->quantDC[table] = (tableLength == 128 ? readShort(&p[1]) : p[1]);
+		d->hasQuant[table] = true;
+
+		p += 1 + tableLength;
+	}
+
+	return true;
+}
+
+static bool parseHuffmanTables(JpegDCDecoder * d, const uint8_t * p, const uint8_t * end)
+{
+	int			tableClass;
+	int			table;
+	int			numValues;
+	int			i;
+
+	while (p < end) {
+		if (end - p < 17) {
+			return false;
+		}
+
+		tableClass = p[0] >> 4;
+		table = p[0] & 0x0F;
+
+		for (i = 0, numValues = 0;i < 16;i++) {
+			numValues += p[1 + i];
+		}
+
+		if (tableClass > 1 || table > 3 || numValues > 256 || end - p < 17 + numValues) {
+			return false;
+		}
+
+		if (!buildHuffmanTable((tableClass == 0 ? &d->dcTables[table] : &d->acTables[table]), &p[1], &p[17], numValues)) {
+			return false;
+		}
+
+		p += 17 + numValues;
+	}
+
+	return true;
+}
+
+static bool parseFrameHeader(JpegDCDecoder * d, const uint8_t * p, const uint8_t * end)
+{
+	JpegComponent *	c;
+	int				i;
+
+	if (end - p < 6 || p[0] != 8) {
+		return false;
+	}
+
+	d->height = readShort(&p[1]);
+	d->width = readShort(&p[3]);
+	d->numComponents = p[5];
+
+	/*
+	** A height of 0 would come later in a DNL marker, which
+	** nothing we capture with uses...
+	*/
+	if (d->width == 0 || d->height == 0 || d->numComponents < 1 || d->numComponents > JPEG_MAX_COMPONENTS || end - p < 6 + 3 * d->numComponents) {
+		return false;
+	}
+
+	d->maxH = 1;
+	d->maxV = 1;
+
+	for (i = 0;i < d->numComponents;i++) {
+		c = &d->components[i];
+
+		c->id = p[6 + i * 3];
+		c->h = p[7 + i * 3] >> 4;
+		c->v = p[7 + i * 3] & 0x0F;
+		c->quantTable = p[8 + i * 3];
+
+		if (c->h < 1 || c->h > 4 || c->v < 1 || c->v > 4 || c->quantTable > 3) {
+			return false;
+		}
+
+		d->maxH = (c->h > d->maxH ? c->h : d->maxH);
+		d->maxV = (c->v > d->maxV ? c->v : d->maxV);
+	}
+
+	return true;
+}
+
+static bool restart(BitReader * r, JpegDCDecoder * d)
+{
+	int			i;
+
+	/*
+	** All that's left of the interval should be padding...
+	*/
+	if (r->zeroBytes * 8 > r->numBits) {
+		return false;
+	}
+
+	if (r->end - r->p < 2 || r->p[0] != 0xFF || (r->p[1] & 0xF8) != 0xD0) {
+		return false;
+	}
+
+	r->p += 2;
+	r->bits = 0;
+	r->numBits = 0;
+	r->zeroBytes = 0;
+	r->isAtMarker = false;
+
+	for (i = 0;i < d->numComponents;i++) {
+		d->components[i].predictor = 0;
+	}
+
+	return true;
+}
+
+/*
+** The DC coefficient is 8x the block's mean level shifted down by
+** 128, once dequantised...
+*/
+static inline uint8_t getBlockLevel(int predictor, int quant)
+{
+	int			level = predictor * quant;
+
+	level = 128 + (level >= 0 ? level + 4 : level - 4) / 8;
+
+	return (uint8_t)(level < 0 ? 0 : (level > 255 ? 255 : level));
+}
+
+static bool decodeScan(JpegDCDecoder * d, const uint8_t * p, const uint8_t * segmentEnd, const uint8_t * end, Thumbnail * thumbnail)
+{
+	JpegComponent *	scan[JPEG_MAX_COMPONENTS];
+	JpegComponent *	y = &d->components[0];
+	JpegComponent *	c;
+	BitReader		r;
+	int				numScan;
+	int				mcuCols;
+	int				mcuRows;
+	int				mcu;
+	int				quant;
+	int				width;
+	int				height;
+	int				row;
+	int				col;
+	int				bx;
+	int				by;
+	int				x;
+	int				i;
+	int				j;
+
+	if (d->numComponents == 0 || !d->hasQuant[y->quantTable]) {
+		return false;
+	}
+
+	numScan = p[0];
+
+	if (numScan < 1 || numScan > d->numComponents || segmentEnd - p < 4 + 2 * numScan) {
+		return false;
+	}
+
+	for (i = 0;i < numScan;i++) {
+		for (j = 0, scan[i] = NULL;j < d->numComponents;j++) {
+			if (d->components[j].id == p[1 + i * 2]) {
+				scan[i] = &d->components[j];
+			}
+		}
+
+		if (scan[i] == NULL) {
+			return false;
+		}
+
+		scan[i]->dcTable = p[2 + i * 2] >> 4;
+		scan[i]->acTable = p[2 + i * 2] & 0x0F;
+		scan[i]->predictor = 0;
+
+		if (scan[i]->dcTable > 3 || scan[i]->acTable > 3 || !d->dcTables[scan[i]->dcTable].isDefined || !d->acTables[scan[i]->acTable].isDefined) {
+			return false;
+		}
+	}
+
+	/*
+	** A sequential scan of all 64 coefficients, and Y must be in
+	** the first one...
+	*/
+	p += 1 + 2 * numScan;
+
+	if (p[0] != 0 || p[1] != 63 || p[2] != 0 || scan[0] != y) {
+		return false;
+	}
+
+	/*
+	** One pixel per Y block, cropped to the image...
+	*/
+	width = (((d->width * y->h + d->maxH - 1) / d->maxH) + 7) / 8;
+	height = (((d->height * y->v + d->maxV - 1) / d->maxV) + 7) / 8;
+
+	if (width > THUMBNAIL_MAX_WIDTH || height > THUMBNAIL_MAX_HEIGHT) {
+		return false;
+	}
+
+	/*
+	** A scan of one component has a block per MCU, interleaved
+	** ones cover maxH x maxV blocks of 8x8...
+	*/
+	if (numScan == 1) {
+		mcuCols = width;
+		mcuRows = height;
+	}
+	else {
+		mcuCols = (d->width + 8 * d->maxH - 1) / (8 * d->maxH);
+		mcuRows = (d->height + 8 * d->maxV - 1) / (8 * d->maxV);
+	}
+
+	quant = d->quantDC[y->quantTable];
+
+	r.p = segmentEnd;
+	r.end = end;
+	r.bits = 0;
+	r.numBits = 0;
+	r.zeroBytes = 0;
+	r.isAtMarker = false;
+
+	for (row = 0, mcu = 0;row < mcuRows;row++) {
+		for (col = 0;col < mcuCols;col++, mcu++) {
+			if (d->restartInterval > 0 && mcu > 0 && (mcu % d->restartInterval) == 0 && !restart(&r, d)) {
+				return false;
+			}
+
+			if (numScan == 1) {
+				if (!decodeBlock(&r, &d->dcTables[y->dcTable], &d->acTables[y->acTable], &y->predictor)) {
+					return false;
+				}
+
+				thumbnail->pixels[row * width + col] = getBlockLevel(y->predictor, quant);
+				continue;
+			}
+
+			for (i = 0;i < numScan;i++) {
+				c = scan[i];
+
+				for (by = 0;by < c->v;by++) {
+					for (bx = 0;bx < c->h;bx++) {
+						if (!decodeBlock(&r, &d->dcTables[c->dcTable], &d->acTables[c->acTable], &c->predictor)) {
+							return false;
+						}
+
+						x = col * c->h + bx;
+
+						if (c == y && x < width && row * c->v + by < height) {
+							thumbnail->pixels[(row * c->v + by) * width + x] = getBlockLevel(c->predictor, quant);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	/*
+	** Anything decoded from the zeros fed in at the end means the
+	** scan was cut short...
+	*/
+	if (r.zeroBytes * 8 > r.numBits) {
+		return false;
+	}
+
+	thumbnail->width = width;
+	thumbnail->height = height;
+
+	return true;
+}
+
+bool extractDCThumbnail(JpegDCDecoder * decoder, const uint8_t * jpeg, size_t length, Thumbnail * thumbnail)
+{
+	const uint8_t *	p = jpeg;
+	const uint8_t *	end = jpeg + length;
+	const uint8_t *	segmentEnd;
+	uint8_t			marker;
+	bool			isValid = true;
+	int				i;
+
+	decoder->numComponents = 0;
+	decoder->restartInterval = 0;
+
+	for (i = 0;i < 4;i++) {
+		decoder->hasQuant[i] = false;
+		decoder->dcTables[i].isDefined = false;
+		decoder->acTables[i].isDefined = false;
+	}
+
+	if (length < 4 || p[0] != 0xFF || p[1] != 0xD8) {
+		return false;
+	}
+
+	p += 2;
+
+	while (isValid) {
+		if (end - p < 4 || p[0] != 0xFF) {
+			return false;
+		}
+
+		marker = p[1];
+
+		/*
+		** Fill bytes before the marker, and those without
+		** a segment...
+		*/
+		if (marker == 0xFF) {
+			p++;
+			continue;
+		}
+
+		if (marker == 0xD9) {
+			return false;
+		}
+
+		if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+			p += 2;
+			continue;
+		}
+
+		segmentEnd = p + 2 + readShort(&p[2]);
+
+		if (segmentEnd - p < 4 || segmentEnd > end) {
+			return false;
+		}
+
+		p += 4;
+
+		switch (marker) {
+			case 0xDB:
+				isValid = parseQuantTables(decoder, p, segmentEnd);
+				break;
+
+			case 0xC4:
+				isValid = parseHuffmanTables(decoder, p, segmentEnd);
+				break;
+
+			case 0xC0:
+			case 0xC1:
+				isValid = parseFrameHeader(decoder, p, segmentEnd);
+				break;
+
+			case 0xDD:
+				isValid = (segmentEnd - p >= 2);
+
+				if (isValid) {
+					decoder->restartInterval = readShort(p);
+				}
+				break;
+
+			case 0xDA:
+				return decodeScan(decoder, p, segmentEnd, end, thumbnail);
+
+			/*
+			** Progressive, lossless, arithmetic coded...
+			*/
+			case 0xC2:
+			case 0xC3:
+			case 0xC5:
+			case 0xC6:
+			case 0xC7:
+			case 0xC9:
+			case 0xCA:
+			case 0xCB:
+			case 0xCD:
+			case 0xCE:
+			case 0xCF:
+				return false;
+
+			default:
+				break;
+		}
+
+		p = segmentEnd;
+	}
+
+	return false;
+}
+
+uint64_t sadScalar(const uint8_t * a, const uint8_t * b, size_t length)
+{
+	uint64_t		sum = 0;
+	size_t			i;
+
+	for (i = 0;i < length;i++) {
+		sum += (uint64_t)(a[i] > b[i] ? a[i] - b[i] : b[i] - a[i]);
+	}
+
+	return sum;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse2")))
+static uint64_t sadSSE2(const uint8_t * a, const uint8_t * b, size_t length)
+{
+	__m128i			sum = _mm_setzero_si128();
+	uint64_t		lanes[2];
+	size_t			i;
+
+	for (i = 0;i + 16 <= length;i += 16) {
+		sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)&a[i]), _mm_loadu_si128((const __m128i *)&b[i])));
+	}
+
+	_mm_storeu_si128((__m128i *)lanes, sum);
+
+	return lanes[0] + lanes[1] + sadScalar(&a[i], &b[i], length - i);
+}
+
+__attribute__((target("avx2")))
+static uint64_t sadAVX2(const uint8_t * a, const uint8_t * b, size_t length)
+{
+	__m256i			sum = _mm256_setzero_si256();
+	uint64_t		lanes[4];
+	size_t			i;
+
+	for (i = 0;i + 32 <= length;i += 32) {
+		sum = _mm256_add_epi64(sum, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)&a[i]), _mm256_loadu_si256((const __m256i *)&b[i])));
+	}
+
+	_mm256_storeu_si256((__m256i *)lanes, sum);
+
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sadScalar(&a[i], &b[i], length - i);
+}
+
+SADFunction sadGetSIMDFunction()
+{
+	if (__builtin_cpu_supports("avx2")) {
+		return sadAVX2;
+	}
+
+	return (__builtin_cpu_supports("sse2") ? sadSSE2 : NULL);
+}
+
+const char * sadImplementation()
+{
+	if (__builtin_cpu_supports("avx2")) {
+		return "AVX2";
+	}
+
+	return (__builtin_cpu_supports("sse2") ? "SSE2" : "scalar");
+}
+
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+
+/*
+** The 32 bit lanes take 1020 a step, so can't overflow on a
+** thumbnail...
+*/
+static uint64_t sadNEON(const uint8_t * a, const uint8_t * b, size_t length)
+{
+	uint32x4_t		sum = vdupq_n_u32(0);
+	size_t			i;
+
+	for (i = 0;i + 16 <= length;i += 16) {
+		sum = vpadalq_u16(sum, vpaddlq_u8(vabdq_u8(vld1q_u8(&a[i]), vld1q_u8(&b[i]))));
+	}
+
+	return
+		(uint64_t)vgetq_lane_u32(sum, 0) +
+		(uint64_t)vgetq_lane_u32(sum, 1) +
+		(uint64_t)vgetq_lane_u32(sum, 2) +
+		(uint64_t)vgetq_lane_u32(sum, 3) +
+		sadScalar(&a[i], &b[i], length - i);
+}
+
+SADFunction sadGetSIMDFunction()
+{
+	return sadNEON;
+}
+
+const char * sadImplementation()
+{
+	return "NEON";
+}
+
+#else
+
+SADFunction sadGetSIMDFunction()
+{
+	return NULL;
+}
+
+const char * sadImplementation()
+{
+	return "scalar";
+}
+
+#endif
+
+static SADFunction selectSAD()
+{
+	SADFunction		simd = sadGetSIMDFunction();
+
+	return (simd != NULL ? simd : sadScalar);
+}
+
+uint64_t thumbnailSAD(const uint8_t * a, const uint8_t * b, size_t length)
+{
+	static const SADFunction	sad = selectSAD();
+
+	return sad(a, b, length);
+}
+
+const char * getSimilarityActionName(SimilarityAction action)
+{
+	return (action == similarity_skip ? "skip" : "tag");
+}
+
+/*
+** The thumbnail of a frame on disk, read through a mapping...
+*/
+static bool readDCThumbnail(JpegDCDecoder * decoder, const char * pszPath, Thumbnail * thumbnail)
+{
+	struct stat		st;
+	void *			p;
+	bool			isExtracted;
+	int				fd;
+
+	fd = open(pszPath, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		return false;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+
+	p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (p == MAP_FAILED) {
+		return false;
+	}
+
+	madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+	isExtracted = extractDCThumbnail(decoder, (const uint8_t *)p, (size_t)st.st_size, thumbnail);
+
+	munmap(p, (size_t)st.st_size);
+
+	if (!isExtracted) {
+		errno = EINVAL;
+	}
+
+	return isExtracted;
+}
+
+FrameSimilarity::FrameSimilarity(FrameCheckpoint * pCheckpoint)
+{
+	int			i;
+
+	this->pCheckpoint = pCheckpoint;
+
+	pthread_mutex_init(&this->mutex, NULL);
+
+	memset(&this->stats, 0, sizeof(SimilarityStats));
+
+	this->pixels = (uint8_t *)malloc(THUMBNAIL_MAX_PIXELS * SIMILARITY_THUMBNAILS);
+
+	if (this->pixels == NULL) {
+		throw bctl_error("Failed to allocate the thumbnails", __FILE__, __LINE__);
+	}
+
+	for (i = 0;i < SIMILARITY_THUMBNAILS;i++) {
+		this->freeList[i] = &this->pixels[i * THUMBNAIL_MAX_PIXELS];
+	}
+
+	this->freeCount = SIMILARITY_THUMBNAILS;
+	this->hasReference = false;
+
+	memset(&this->reference, 0, sizeof(Thumbnail));
+
+	readConfig();
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	cfg.subscribe(CFG_SIMILARITY_THRESHOLD, this);
+	cfg.subscribe(CFG_SIMILARITY_ACTION, this);
+
+	Logger::getInstance().logStatus(
+			"Comparing frames by their DC thumbnails (SAD with %s), %s those within %u.%02u grey levels",
+			sadImplementation(),
+			(this->action == similarity_skip ? "skipping" : "tagging"),
+			this->threshold / 100,
+			this->threshold % 100);
+}
+
+FrameSimilarity::~FrameSimilarity()
+{
+	free(this->pixels);
+
+	pthread_mutex_destroy(&this->mutex);
+}
+
+void FrameSimilarity::readConfig()
+{
+	SimilarityAction	action = similarity_tag;
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	const char * pszAction = cfg.getValue(CFG_SIMILARITY_ACTION);
+
+	if (strcmp(pszAction, "skip") == 0) {
+		action = similarity_skip;
+	}
+	else if (strcmp(pszAction, "tag") != 0) {
+		Logger::getInstance().logError("Invalid similarity.action '%s', tagging similar frames", pszAction);
+	}
+
+	pthread_mutex_lock(&this->mutex);
+	this->threshold = (uint32_t)cfg.getValueAsInteger(CFG_SIMILARITY_THRESHOLD);
+	this->action = action;
+	pthread_mutex_unlock(&this->mutex);
+}
+
+void FrameSimilarity::configChanged(ConfigKey key, const char * value)
+{
+	readConfig();
+}
+
+/*
+** Called with the lock held...
+*/
+uint8_t * FrameSimilarity::takeBuffer()
+{
+	return this->freeList[--this->freeCount];
+}
+
+void FrameSimilarity::releaseBuffer(uint8_t * buffer)
+{
+	this->freeList[this->freeCount++] = buffer;
+}
+
+void FrameSimilarity::getStats(SimilarityStats * stats)
+{
+	pthread_mutex_lock(&this->mutex);
+	memcpy(stats, &this->stats, sizeof(SimilarityStats));
+	pthread_mutex_unlock(&this->mutex);
+}
+
+/*
+** Called on a similarity stage worker. With more than one worker
+** the frames can be compared slightly out of order, which only
+** matters to which frame becomes the reference...
+*/
+void FrameSimilarity::processFrame(CaptureFrame * frame)
+{
+	JpegDCDecoder		decoder;
+	Thumbnail			thumbnail;
+	uint64_t			startTime;
+	uint64_t			elapsed;
+	uint32_t			score = 0;
+	size_t				numPixels;
+	bool				isCompared = false;
+	bool				isSimilar = false;
+	bool				isSkipped = false;
+
+	startTime = CurrentTime::getStopwatchTime();
+
+	pthread_mutex_lock(&this->mutex);
+	thumbnail.pixels = takeBuffer();
+	pthread_mutex_unlock(&this->mutex);
+
+	thumbnail.sequence = frame->sequence;
+
+	if (!readDCThumbnail(&decoder, frame->szPath, &thumbnail)) {
+		Logger::getInstance().logError("Failed to read the DC thumbnail of %s: %s", frame->szPath, strerror(errno));
+
+		pthread_mutex_lock(&this->mutex);
+		releaseBuffer(thumbnail.pixels);
+		this->stats.errorCount++;
+		pthread_mutex_unlock(&this->mutex);
+		return;
+	}
+
+	numPixels = (size_t)thumbnail.width * (size_t)thumbnail.height;
+
+	pthread_mutex_lock(&this->mutex);
+
+	/*
+	** A change of resolution starts again...
+	*/
+	if (this->hasReference && this->reference.width == thumbnail.width && this->reference.height == thumbnail.height) {
+		score = (uint32_t)((thumbnailSAD(this->reference.pixels, thumbnail.pixels, numPixels) * 100ULL) / numPixels);
+
+		isCompared = true;
+		isSimilar = (score < this->threshold);
+		isSkipped = (isSimilar && this->action == similarity_skip);
+	}
+
+	/*
+	** A frame that's different enough becomes what the
+	** next ones are compared with...
+	*/
+	if (isSimilar) {
+		releaseBuffer(thumbnail.pixels);
+	}
+	else {
+		if (this->hasReference) {
+			releaseBuffer(this->reference.pixels);
+		}
+
+		this->reference = thumbnail;
+		this->hasReference = true;
+	}
+
+	elapsed = CurrentTime::getStopwatchTime() - startTime;
+
+	this->stats.frameCount++;
+	this->stats.width = thumbnail.width;
+	this->stats.height = thumbnail.height;
+	this->stats.referenceSequence = this->reference.sequence;
+	this->stats.totalTime += elapsed;
+
+	if (elapsed > this->stats.maxTime) {
+		this->stats.maxTime = elapsed;
+	}
+
+	if (isCompared) {
+		this->stats.comparedCount++;
+		this->stats.lastScore = score;
+		this->stats.totalScore += score;
+	}
+
+	if (isSimilar) {
+		this->stats.similarCount++;
+	}
+
+	if (isSkipped) {
+		this->stats.skippedCount++;
+	}
+
+	pthread_mutex_unlock(&this->mutex);
+
+	frame->similarity = score;
+	frame->hasSimilarity = isCompared;
+	frame->isSimilar = isSimilar;
+
+	/*
+	** A skipped frame goes no further, so nothing
+	** else will remove it. The checkpoint is marked
+	** first, so it never names a missing frame...
+	*/
+	if (isSkipped) {
+		frame->isSkipped = true;
+
+		if (this->pCheckpoint != NULL) {
+			this->pCheckpoint->frameRemoved(frame->sequence);
+		}
+
+		if (unlink(frame->szPath) < 0) {
+			Logger::getInstance().logError("Failed to remove similar frame %s: %s", frame->szPath, strerror(errno));
+		}
+	}
+}
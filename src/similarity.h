@@ -0,0 +1,173 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "configmgr.h"
+#include "capturebackend.h"
+#include "pipeline.h"
+
+#ifndef _INCL_SIMILARITY
+#define _INCL_SIMILARITY
+
+/*
+** One thumbnail pixel per 8x8 luminance block, so this covers
+** frames up to 4096x4096...
+*/
+#define THUMBNAIL_MAX_WIDTH                 512
+#define THUMBNAIL_MAX_HEIGHT                512
+#define THUMBNAIL_MAX_PIXELS                (THUMBNAIL_MAX_WIDTH * THUMBNAIL_MAX_HEIGHT)
+
+/*
+** Enough for every worker to hold one while the reference is
+** kept...
+*/
+#define SIMILARITY_THUMBNAILS               (PIPELINE_MAX_WORKERS + 1)
+
+#define JPEG_MAX_COMPONENTS                 4
+#define JPEG_HUFFMAN_LOOKUP_BITS            9
+
+/*
+** A Huffman table as canonical codes, with a lookup on the
+** first JPEG_HUFFMAN_LOOKUP_BITS bits for the common short ones.
+** A lookupLength of 0 means the code is longer...
+*/
+struct JpegHuffmanTable
+{
+    bool                isDefined;
+    uint8_t             lookupLength[1 << JPEG_HUFFMAN_LOOKUP_BITS];
+    uint8_t             lookupValue[1 << JPEG_HUFFMAN_LOOKUP_BITS];
+    int32_t             maxCode[18];
+    int32_t             valueOffset[18];
+    uint8_t             values[256];
+};
+
+struct JpegComponent
+{
+    int                 id;
+    int                 h;
+    int                 v;
+    int                 quantTable;
+    int                 dcTable;
+    int                 acTable;
+    int                 predictor;
+};
+
+/*
+** What's needed of a baseline JPEG to walk its entropy coded data
+** and pick out the DC coefficients...
+*/
+struct JpegDCDecoder
+{
+    uint16_t            quantDC[4];
+    bool                hasQuant[4];
+    JpegHuffmanTable    dcTables[4];
+    JpegHuffmanTable    acTables[4];
+    JpegComponent       components[JPEG_MAX_COMPONENTS];
+    int                 numComponents;
+    int                 width;
+    int                 height;
+    int                 maxH;
+    int                 maxV;
+    int                 restartInterval;
+};
+
+struct Thumbnail
+{
+    int                 width;
+    int                 height;
+    uint32_t            sequence;
+    uint8_t *           pixels;
+};
+
+/*
+** Builds a 1/8 scale luminance thumbnail from the DC coefficient
+** of each Y block, which is its mean level. Only the Huffman codes
+** are decoded, the AC coefficients are skipped over and there's no
+** IDCT. Baseline JPEGs only, false for progressive or anything
+** corrupt...
+*/
+bool            extractDCThumbnail(JpegDCDecoder * decoder, const uint8_t * jpeg, size_t length, Thumbnail * thumbnail);
+
+typedef uint64_t (* SADFunction)(const uint8_t * a, const uint8_t * b, size_t length);
+
+/*
+** The sum of absolute differences of two thumbnails, SSE2, AVX2
+** or NEON if the CPU has it...
+*/
+uint64_t        thumbnailSAD(const uint8_t * a, const uint8_t * b, size_t length);
+
+uint64_t        sadScalar(const uint8_t * a, const uint8_t * b, size_t length);
+SADFunction     sadGetSIMDFunction();
+const char *    sadImplementation();
+
+enum SimilarityAction {
+    similarity_tag,
+    similarity_skip
+};
+
+struct SimilarityStats
+{
+    uint32_t            frameCount;
+    uint32_t            comparedCount;
+    uint32_t            similarCount;
+    uint32_t            skippedCount;
+    uint32_t            errorCount;
+    uint32_t            lastScore;
+    uint32_t            referenceSequence;
+    int                 width;
+    int                 height;
+    uint64_t            totalScore;
+    uint64_t            totalTime;
+    uint64_t            maxTime;
+};
+
+class FrameCheckpoint;
+
+/*
+** The similarity stage, scores each frame against the last one
+** that was different enough to keep, as the mean absolute
+** difference of their thumbnails in 1/100 grey levels. Frames
+** scoring below similarity.threshold are tagged as similar and,
+** with similarity.action=skip, go no further down the pipeline
+** and are removed...
+*/
+class FrameSimilarity : public FrameProcessor, public ConfigListener
+{
+private:
+    pthread_mutex_t     mutex;
+    SimilarityStats     stats;
+
+    uint32_t            threshold;
+    SimilarityAction    action;
+
+    /*
+    ** The thumbnail buffers, allocated up front and handed out
+    ** from the free list...
+    */
+    uint8_t *           pixels;
+    uint8_t *           freeList[SIMILARITY_THUMBNAILS];
+    int                 freeCount;
+
+    Thumbnail           reference;
+    bool                hasReference;
+
+    FrameCheckpoint *   pCheckpoint;
+
+    void                readConfig();
+    uint8_t *           takeBuffer();
+    void                releaseBuffer(uint8_t * buffer);
+
+public:
+    FrameSimilarity(FrameCheckpoint * pCheckpoint);
+    ~FrameSimilarity();
+
+    void                processFrame(CaptureFrame * frame);
+
+    void                configChanged(ConfigKey key, const char * value);
+
+    void                getStats(SimilarityStats * stats);
+};
+
+const char *    getSimilarityActionName(SimilarityAction action);
+
+#endif
@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "logger.h"
+#include "currenttime.h"
+#include "clock.h"
+#include "threads.h"
+#include "controlthread.h"
+#include "gps.h"
+#include "flightphase.h"
+#include "avi.h"
+#include "bctl.h"
+#include "allocwatch.h"
+#include "timerwheel.h"
+#include "simulation.h"
+
+using namespace std;
+
+struct SimulationStats
+{
+	uint32_t		lineCount;
+	uint32_t		sentenceCount;
+	uint32_t		sensorCount;
+	uint32_t		triggerCount;
+	uint32_t		commandCount;
+	uint32_t		errorCount;
+};
+
+/*
+** Time of day from a GGA or RMC sentence, in us, without
+** touching the published fix...
+*/
+static bool getSentenceTime(const char * pszSentence, size_t length, uint64_t * time)
+{
+	GPSFix			f;
+	NMEAResult		result;
+
+	memset(&f, 0, sizeof(GPSFix));
+
+	result = parseNMEASentence(pszSentence, length, &f);
+
+	if (result != nmea_gga && result != nmea_rmc) {
+		return false;
+	}
+
+	*time = (uint64_t)f.timeOfDay * 1000ULL;
+
+	return true;
+}
+
+int runSimulation(const char * pszReplayFile, bool isAllocationFree)
+{
+	SimulationStats		ss;
+	CaptureStats		cs;
+	FrameStats			fs;
+	FlightPhaseStatus	ps;
+	TimerStats			ts;
+	AllocWatchStats		as;
+	char				szLine[SIMULATION_MAX_LINE_LENGTH];
+	char				szResponse[CONTROL_MAX_RESPONSE_LENGTH];
+	char *				pszRecord;
+	char *				pszEnd;
+	uint64_t			virtualStart;
+	uint64_t			realStart;
+	uint64_t			virtualElapsed;
+	uint64_t			realElapsed;
+	uint64_t			dueTime;
+	uint64_t			sentenceTime;
+	uint64_t			firstSentenceTime = 0;
+	uint64_t			dayOffset = 0;
+	uint64_t			lastSentenceTime = 0;
+	bool				hasSentenceTime = false;
+	bool				isWatching = false;
+	double				seconds;
+	size_t				length;
+	int					i;
+	FILE *				fptr;
+
+	Clock & clock = Clock::getInstance();
+	Logger & log = Logger::getInstance();
+	ThreadManager & threadMgr = ThreadManager::getInstance();
+
+	if (!clock.isVirtual()) {
+		fprintf(stderr, "A simulation needs the virtual clock\n");
+		return -1;
+	}
+
+	fptr = fopen(pszReplayFile, "rt");
+
+	if (fptr == NULL) {
+		fprintf(stderr, "Failed to open replay file %s: %s\n", pszReplayFile, strerror(errno));
+		return -1;
+	}
+
+	memset(&ss, 0, sizeof(SimulationStats));
+
+	GPSThread * pGPSThread = threadMgr.getGPSThread();
+	CaptureThread * pCaptureThread = threadMgr.getCaptureThread();
+
+	printf("Simulating %s\n", pszReplayFile);
+
+	virtualStart = clock.getMonotonicTime();
+	realStart = CurrentTime::getStopwatchTime();
+
+	while (fgets(szLine, sizeof(szLine), fptr) != NULL) {
+		ss.lineCount++;
+
+		length = strcspn(szLine, "\r\n");
+		szLine[length] = 0;
+
+		if (length == 0 || szLine[0] == '#') {
+			continue;
+		}
+
+		if (szLine[0] == '$') {
+			/*
+			** A bare NMEA log, timed by its sentences. Time of
+			** day wraps at midnight...
+			*/
+			pszRecord = szLine;
+
+			if (getSentenceTime(pszRecord, length, &sentenceTime)) {
+				if (!hasSentenceTime) {
+					firstSentenceTime = sentenceTime;
+					hasSentenceTime = true;
+				}
+				else if (sentenceTime + dayOffset < lastSentenceTime) {
+					dayOffset += (uint64_t)SECONDS_PER_DAY * 1000000ULL;
+				}
+
+				lastSentenceTime = sentenceTime + dayOffset;
+			}
+
+			dueTime = virtualStart + (lastSentenceTime - firstSentenceTime);
+		}
+		else {
+			seconds = strtod(szLine, &pszEnd);
+
+			if (pszEnd == szLine || seconds < 0.0) {
+				log.logError("Simulation line %u: expected '<seconds> <record>'", ss.lineCount);
+				ss.errorCount++;
+				continue;
+			}
+
+			pszRecord = pszEnd + strspn(pszEnd, " \t");
+			dueTime = virtualStart + (uint64_t)(seconds * 1000000.0);
+		}
+
+		clock.sleepUntil(dueTime);
+
+		/*
+		** Startup is allowed to allocate, the steady state
+		** after it isn't...
+		*/
+		if (isAllocationFree && !isWatching && dueTime >= virtualStart + SIMULATION_WARMUP) {
+			allocWatchArm();
+			isWatching = true;
+		}
+
+		if (pszRecord[0] == '$') {
+			if (pGPSThread != NULL) {
+				pGPSThread->processSentence(pszRecord, strlen(pszRecord));
+			}
+
+			ss.sentenceCount++;
+		}
+		else if (strncmp(pszRecord, "temp ", 5) == 0) {
+			setSimulatedCPUTemp((float)strtod(&pszRecord[5], NULL));
+			ss.sensorCount++;
+		}
+		else if (strcmp(pszRecord, "trigger") == 0) {
+			pCaptureThread->triggerNow();
+			ss.triggerCount++;
+		}
+		else if (strncmp(pszRecord, "control ", 8) == 0) {
+			if (!threadMgr.getControlThread()->execute(&pszRecord[8], szResponse, sizeof(szResponse))) {
+				log.logError("Simulation line %u: '%s' failed: %s", ss.lineCount, &pszRecord[8], szResponse);
+				ss.errorCount++;
+			}
+
+			ss.commandCount++;
+		}
+		else {
+			log.logError("Simulation line %u: unknown record '%s'", ss.lineCount, pszRecord);
+			ss.errorCount++;
+		}
+	}
+
+	fclose(fptr);
+
+	virtualElapsed = clock.getMonotonicTime() - virtualStart;
+
+	/*
+	** Frames are completed outside the clock, give the last
+	** of them a moment of real time to come through, and the
+	** pipeline to finish with them...
+	*/
+	pCaptureThread->getStats(&cs);
+
+	for (i = 0;i < SIMULATION_DRAIN_TIMEOUT_MS / 10;i++) {
+		threadMgr.getFrameThread()->getStats(&fs);
+
+		if (fs.frameCount >= cs.captureCount && threadMgr.getFrameThread()->getPipeline().getCompletedCount() >= fs.frameCount) {
+			break;
+		}
+
+		usleep(10000);
+	}
+
+	realElapsed = CurrentTime::getStopwatchTime() - realStart;
+
+	/*
+	** The process goes with _exit(), index the timelapse
+	** while we can...
+	*/
+	if (threadMgr.getMuxer() != NULL) {
+		threadMgr.getMuxer()->finish();
+	}
+
+	if (isWatching) {
+		allocWatchDisarm();
+	}
+
+	printf(
+		"Simulated %.1fs in %.3fs real, %.0fx real time\n",
+		(double)virtualElapsed / 1000000.0,
+		(double)realElapsed / 1000000.0,
+		(realElapsed > 0 ? (double)virtualElapsed / (double)realElapsed : 0.0));
+
+	printf(
+		"%u line(s): %u NMEA, %u sensor, %u trigger, %u control, %u error(s)\n",
+		ss.lineCount,
+		ss.sentenceCount,
+		ss.sensorCount,
+		ss.triggerCount,
+		ss.commandCount,
+		ss.errorCount);
+
+	printf(
+		"%u capture(s) (%u manual, %u burst), %u frame(s) completed, %.1f MB\n",
+		cs.captureCount,
+		cs.manualCount,
+		cs.burstCount,
+		fs.frameCount,
+		(double)fs.totalBytes / 1000000.0);
+
+	TimerWheel::getInstance().getStats(&ts);
+
+	printf(
+		"%lu timer(s) expired, delay avg %luus max %luus, %lu late, lateness avg %luus max %luus, %lu wake up(s)\n",
+		(unsigned long)ts.expiredCount,
+		(ts.expiredCount > 0 ? (unsigned long)(ts.totalDelay / ts.expiredCount) : 0UL),
+		(unsigned long)ts.maxDelay,
+		(unsigned long)ts.lateCount,
+		(ts.lateCount > 0 ? (unsigned long)(ts.totalLateness / ts.lateCount) : 0UL),
+		(unsigned long)ts.maxLateness,
+		(unsigned long)ts.wakeupCount);
+
+	if (threadMgr.getFlightPhaseThread() != NULL) {
+		threadMgr.getFlightPhaseThread()->getStatus(&ps);
+
+		printf(
+			"%u phase transition(s), final phase %s, max altitude %.1fm\n",
+			ps.transitionCount,
+			getFlightPhaseName(ps.phase),
+			(double)ps.maxAltitude / 1000.0);
+	}
+
+	log.logStatus("Simulation of %s finished", pszReplayFile);
+
+	if (isAllocationFree) {
+		if (!isWatching) {
+			printf("The replay is shorter than the %us warm up, no allocations checked\n", (unsigned)(SIMULATION_WARMUP / 1000000ULL));
+			return 1;
+		}
+
+		allocWatchGetStats(&as);
+
+		printf(
+			"%lu allocation(s) of %lu bytes, %lu free(s) in %.1fs after the warm up\n",
+			(unsigned long)as.allocationCount,
+			(unsigned long)as.bytes,
+			(unsigned long)as.freeCount,
+			(double)(virtualElapsed - SIMULATION_WARMUP) / 1000000.0);
+
+		if (as.allocationCount > 0) {
+			allocWatchReport(stdout);
+			return 1;
+		}
+	}
+
+	return (ss.errorCount > 0 ? 1 : 0);
+}
@@ -0,0 +1,29 @@
+#ifndef _INCL_SIMULATION
+#define _INCL_SIMULATION
+
+#define SIMULATION_MAX_LINE_LENGTH          1024
+#define SIMULATION_DRAIN_TIMEOUT_MS         5000
+#define SIMULATION_WARMUP                   120000000ULL
+
+/*
+** Runs the started threads against a virtual clock, fed from
+** a replay file, as fast as the CPU allows. Each line of the
+** file is one of:
+**
+**   $GPGGA,...             an NMEA sentence, timed by its own
+**                          time of day
+**   <seconds> $GPGGA,...   an NMEA sentence at a time
+**   <seconds> temp <C>     the CPU temperature
+**   <seconds> trigger      a manual capture
+**   <seconds> control <c>  a control command, as bctl -ctl
+**
+** Times are seconds from the start of the simulation. The
+** calling thread must be attached to the virtual clock, so
+** time can't pass the next line before we wait for it.
+**
+** With isAllocationFree, any heap allocation after the warm
+** up fails the simulation...
+*/
+int     runSimulation(const char * pszReplayFile, bool isAllocationFree);
+
+#endif
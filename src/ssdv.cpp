@@ -0,0 +1,604 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "configmgr.h"
+#include "logger.h"
+#include "bctl_error.h"
+#include "currenttime.h"
+#include "clock.h"
+#include "reedsolomon.h"
+#include "trace.h"
+#include "ssdv.h"
+
+using namespace std;
+
+/*
+** Reflected IEEE 802.3 polynomial, as SSDV uses, not the
+** Castagnoli one in crc32c.cpp...
+*/
+#define SSDV_CRC_POLYNOMIAL					0xEDB88320U
+
+static void putBigEndian16(uint8_t * p, uint16_t value)
+{
+	p[0] = (uint8_t)(value >> 8);
+	p[1] = (uint8_t)value;
+}
+
+static void putBigEndian32(uint8_t * p, uint32_t value)
+{
+	p[0] = (uint8_t)(value >> 24);
+	p[1] = (uint8_t)(value >> 16);
+	p[2] = (uint8_t)(value >> 8);
+	p[3] = (uint8_t)value;
+}
+
+struct SSDVCRCTable
+{
+	uint32_t		table[256];
+
+	SSDVCRCTable() {
+		uint32_t	i;
+		int			j;
+
+		for (i = 0;i < 256;i++) {
+			uint32_t crc = i;
+
+			for (j = 0;j < 8;j++) {
+				crc = (crc >> 1) ^ ((crc & 1) ? SSDV_CRC_POLYNOMIAL : 0);
+			}
+
+			table[i] = crc;
+		}
+	}
+};
+
+uint32_t ssdvCRC32(const uint8_t * data, size_t length)
+{
+	static const SSDVCRCTable	t;
+
+	uint32_t		crc = 0xFFFFFFFFU;
+
+	while (length--) {
+		crc = t.table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+	}
+
+	return ~crc;
+}
+
+/*
+** Up to 6 characters, A-Z, 0-9, packed base 40
+** last character first, as SSDV does...
+*/
+uint32_t ssdvEncodeCallsign(const char * pszCallsign)
+{
+	uint32_t		x = 0;
+	int				length;
+	int				i;
+	char			c;
+
+	length = (int)strnlen(pszCallsign, 6);
+
+	for (i = length - 1;i >= 0;i--) {
+		c = pszCallsign[i];
+
+		x *= 40;
+
+		if (c >= 'A' && c <= 'Z') {
+			x += c - 'A' + 14;
+		}
+		else if (c >= 'a' && c <= 'z') {
+			x += c - 'a' + 14;
+		}
+		else if (c >= '0' && c <= '9') {
+			x += c - '0' + 1;
+		}
+	}
+
+	return x;
+}
+
+/*
+** Walk the marker segments up to the first start of frame,
+** returns false if there isn't one...
+*/
+bool ssdvGetDimensions(const uint8_t * jpeg, size_t length, int * width, int * height)
+{
+	size_t			i = 2;
+	size_t			segmentLength;
+	uint8_t			marker;
+
+	if (length < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8) {
+		return false;
+	}
+
+	while (i + 4 <= length) {
+		if (jpeg[i] != 0xFF) {
+			return false;
+		}
+
+		marker = jpeg[i + 1];
+
+		if (marker == 0xFF) {
+			i++;
+			continue;
+		}
+
+		segmentLength = ((size_t)jpeg[i + 2] << 8) | jpeg[i + 3];
+
+		/*
+		** SOF0 to SOF15, except DHT, JPG and DAC...
+		*/
+		if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+			if (i + 9 > length) {
+				return false;
+			}
+
+			*height = ((int)jpeg[i + 5] << 8) | jpeg[i + 6];
+			*width = ((int)jpeg[i + 7] << 8) | jpeg[i + 8];
+
+			return true;
+		}
+
+		if (marker == 0xDA) {
+			return false;
+		}
+
+		i += 2 + segmentLength;
+	}
+
+	return false;
+}
+
+void SSDVEncoder::setCallsign(const char * pszCallsign)
+{
+	this->callsign = ssdvEncodeCallsign(pszCallsign);
+}
+
+void SSDVEncoder::begin(const uint8_t * jpeg, size_t length, uint8_t imageID)
+{
+	int			w = 0;
+	int			h = 0;
+
+	this->jpeg = jpeg;
+	this->length = length;
+	this->position = 0;
+	this->imageID = imageID;
+	this->packetID = 0;
+
+	ssdvGetDimensions(jpeg, length, &w, &h);
+
+	/*
+	** In 16 pixel units, 0 if unknown or too big to say...
+	*/
+	this->width = (uint8_t)((w + 15) / 16 > 255 ? 0 : (w + 15) / 16);
+	this->height = (uint8_t)((h + 15) / 16 > 255 ? 0 : (h + 15) / 16);
+}
+
+int ssdvGetPacketCount(size_t length, bool useFEC)
+{
+	size_t		payloadLength = (useFEC ? SSDV_PAYLOAD_LENGTH : SSDV_NOFEC_PAYLOAD_LENGTH);
+
+	return (int)((length + payloadLength - 1) / payloadLength);
+}
+
+int SSDVEncoder::getPacketCount()
+{
+	return ssdvGetPacketCount(this->length, this->useFEC);
+}
+
+bool SSDVEncoder::nextPacket(uint8_t * packet)
+{
+	size_t		payloadLength = (this->useFEC ? SSDV_PAYLOAD_LENGTH : SSDV_NOFEC_PAYLOAD_LENGTH);
+	size_t		crcOffset = SSDV_HEADER_LENGTH + payloadLength;
+	size_t		chunkLength;
+
+	if (this->position >= this->length) {
+		return false;
+	}
+
+	chunkLength = this->length - this->position;
+
+	if (chunkLength > payloadLength) {
+		chunkLength = payloadLength;
+	}
+
+	packet[0] = SSDV_SYNC;
+	packet[1] = (this->useFEC ? SSDV_TYPE_FEC : SSDV_TYPE_NOFEC);
+	putBigEndian32(&packet[2], this->callsign);
+	packet[6] = this->imageID;
+	putBigEndian16(&packet[7], this->packetID);
+	packet[9] = this->width;
+	packet[10] = this->height;
+	packet[11] = (this->position + chunkLength == this->length ? SSDV_FLAG_EOI : 0);
+
+	/*
+	** No MCU boundaries in a raw byte stream...
+	*/
+	packet[12] = 0xFF;
+	putBigEndian16(&packet[13], 0xFFFF);
+
+	memcpy(&packet[SSDV_HEADER_LENGTH], &this->jpeg[this->position], chunkLength);
+
+	/*
+	** The last packet is padded out, a decoder can drop
+	** everything after the EOI marker...
+	*/
+	if (chunkLength < payloadLength) {
+		memset(&packet[SSDV_HEADER_LENGTH + chunkLength], 0, payloadLength - chunkLength);
+	}
+
+	putBigEndian32(&packet[crcOffset], ssdvCRC32(&packet[1], crcOffset - 1));
+
+	if (this->useFEC) {
+		rsEncode(&packet[1], &packet[SSDV_FEC_OFFSET]);
+	}
+
+	this->position += chunkLength;
+	this->packetID++;
+
+	return true;
+}
+
+SSDVSink::~SSDVSink()
+{
+	close();
+}
+
+void SSDVSink::configure(const char * pszSpec)
+{
+	if (strncmp(pszSpec, "udp:", 4) != 0 && strncmp(pszSpec, "fifo:", 5) != 0) {
+		throw bctl_error(bctl_error::buildMsg("Invalid SSDV sink '%s', expected udp:<address>:<port> or fifo:<path>", pszSpec), __FILE__, __LINE__);
+	}
+
+	if (strlen(pszSpec) >= PATH_MAX) {
+		throw bctl_error("SSDV sink is too long", __FILE__, __LINE__);
+	}
+
+	strcpy(this->szSpec, pszSpec);
+
+	this->isFifo = (strncmp(pszSpec, "fifo:", 5) == 0);
+}
+
+/*
+** Returns false if the sink isn't there yet, e.g. nothing has
+** the FIFO open for reading, in which case try again later...
+*/
+bool SSDVSink::open()
+{
+	struct sockaddr_in	addr;
+	char				szAddress[64];
+	const char *		pszPort;
+	size_t				addressLength;
+
+	if (this->fd >= 0) {
+		return true;
+	}
+
+	if (this->isFifo) {
+		if (mkfifo(&this->szSpec[5], 0644) < 0 && errno != EEXIST) {
+			return false;
+		}
+
+		/*
+		** Non-blocking, so a stalled reader costs us
+		** packets rather than stopping this thread...
+		*/
+		this->fd = ::open(&this->szSpec[5], O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+
+		return (this->fd >= 0);
+	}
+
+	pszPort = strrchr(&this->szSpec[4], ':');
+
+	if (pszPort == NULL) {
+		errno = EINVAL;
+		return false;
+	}
+
+	addressLength = pszPort - &this->szSpec[4];
+
+	if (addressLength >= sizeof(szAddress)) {
+		errno = EINVAL;
+		return false;
+	}
+
+	memcpy(szAddress, &this->szSpec[4], addressLength);
+	szAddress[addressLength] = 0;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)atoi(pszPort + 1));
+
+	if (inet_pton(AF_INET, szAddress, &addr.sin_addr) != 1) {
+		errno = EINVAL;
+		return false;
+	}
+
+	this->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+	if (this->fd < 0) {
+		return false;
+	}
+
+	if (connect(this->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+bool SSDVSink::send(const uint8_t * packet)
+{
+	ssize_t		bytesWritten;
+
+	if (this->isFifo) {
+		bytesWritten = write(this->fd, packet, SSDV_PACKET_LENGTH);
+	}
+	else {
+		bytesWritten = ::send(this->fd, packet, SSDV_PACKET_LENGTH, MSG_NOSIGNAL);
+	}
+
+	/*
+	** A 256 byte write to a pipe is atomic, so it's all or
+	** nothing. If the reader has gone, reopen next time...
+	*/
+	if (bytesWritten != SSDV_PACKET_LENGTH) {
+		if (this->isFifo && errno == EPIPE) {
+			close();
+		}
+
+		return false;
+	}
+
+	return true;
+}
+
+void SSDVSink::close()
+{
+	if (this->fd >= 0) {
+		::close(this->fd);
+		this->fd = -1;
+	}
+}
+
+SSDVThread::SSDVThread() : PosixThread(true)
+{
+	pthread_condattr_t		attr;
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	pthread_mutex_init(&this->mutex, NULL);
+
+	/*
+	** Wait for the budget against the same clock
+	** the frame times come from...
+	*/
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&this->frameQueued, &attr);
+	pthread_condattr_destroy(&attr);
+
+	memset(&this->stats, 0, sizeof(SSDVStats));
+
+	this->sink.configure(cfg.getValue(CFG_SSDV_SINK));
+
+	this->useFEC = cfg.getValueAsBoolean(CFG_SSDV_FEC);
+
+	this->encoder.setCallsign(cfg.getValue(CFG_SSDV_CALLSIGN));
+	this->encoder.setFEC(this->useFEC);
+
+	this->scheduler.configure(
+		cfg.getValueAsInteger(CFG_DOWNLINK_QUEUELENGTH),
+		(uint64_t)cfg.getValueAsInteger(CFG_DOWNLINK_BUDGET),
+		(uint64_t)cfg.getValueAsInteger(CFG_DOWNLINK_WINDOW) * 1000000ULL);
+
+	Logger::getInstance().logStatus(
+		"Sending SSDV packets as %s to %s, RS(255,223) %s, budget %d bytes/s",
+		cfg.getValue(CFG_SSDV_CALLSIGN),
+		cfg.getValue(CFG_SSDV_SINK),
+		(this->useFEC ? rsImplementation() : "off"),
+		cfg.getValueAsInteger(CFG_DOWNLINK_BUDGET));
+}
+
+SSDVThread::~SSDVThread()
+{
+	DownlinkCandidate		candidate;
+
+	while (this->scheduler.takeAny(&candidate)) {
+		::close(candidate.fd);
+	}
+
+	pthread_cond_destroy(&this->frameQueued);
+	pthread_mutex_destroy(&this->mutex);
+}
+
+/*
+** Called on an ssdv pipeline stage worker, so just open, score
+** and queue it...
+*/
+void SSDVThread::frameAvailable(const CaptureFrame & frame)
+{
+	DownlinkCandidate		candidate;
+	DownlinkCandidate		evicted;
+	struct stat				st;
+	off_t					size = frame.size;
+	bool					isEvicted;
+	int						fd;
+
+	Logger & log = Logger::getInstance();
+
+	fd = open(frame.szPath, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		log.logError("Failed to open frame %s for SSDV: %s", frame.szPath, strerror(errno));
+
+		pthread_mutex_lock(&this->mutex);
+		this->stats.errorCount++;
+		pthread_mutex_unlock(&this->mutex);
+		return;
+	}
+
+	if (size == 0 && fstat(fd, &st) == 0) {
+		size = st.st_size;
+	}
+
+	candidate.sequence = frame.sequence;
+	candidate.time = (frame.triggerTime != 0 ? frame.triggerTime : frame.completedTime);
+	candidate.cost = (uint32_t)(ssdvGetPacketCount((size_t)size, this->useFEC) * SSDV_PACKET_LENGTH);
+	candidate.fd = fd;
+
+	if (!scoreJpegFile(fd, &candidate.score)) {
+		candidate.score = 0;
+	}
+
+	pthread_mutex_lock(&this->mutex);
+
+	isEvicted = this->scheduler.addCandidate(candidate, &evicted);
+
+	Clock::getInstance().signal(&this->frameQueued);
+	pthread_mutex_unlock(&this->mutex);
+
+	if (isEvicted) {
+		close(evicted.fd);
+
+		log.logDebug("Frame %u (score %u) dropped from the downlink queue", evicted.sequence, evicted.score);
+	}
+
+	log.logDebug("Frame %u queued for downlink, score %u, %u bytes", candidate.sequence, candidate.score, candidate.cost);
+}
+
+void SSDVThread::getStats(SSDVStats * stats, DownlinkStats * downlinkStats)
+{
+	pthread_mutex_lock(&this->mutex);
+	memcpy(stats, &this->stats, sizeof(SSDVStats));
+	this->scheduler.getStats(downlinkStats);
+	pthread_mutex_unlock(&this->mutex);
+}
+
+void SSDVThread::sendFrame(const DownlinkCandidate & candidate)
+{
+	uint8_t			packet[SSDV_PACKET_LENGTH];
+	struct stat		st;
+	uint64_t		startTime;
+	uint32_t		numPackets = 0;
+	size_t			length;
+	void *			p;
+
+	Logger & log = Logger::getInstance();
+
+	if (fstat(candidate.fd, &st) < 0 || st.st_size == 0) {
+		log.logError("Failed to read frame %u for SSDV", candidate.sequence);
+
+		pthread_mutex_lock(&this->mutex);
+		this->stats.errorCount++;
+		pthread_mutex_unlock(&this->mutex);
+		return;
+	}
+
+	if (!this->sink.open()) {
+		log.logInfo("SSDV sink is not available (%s), frame %u not sent", strerror(errno), candidate.sequence);
+
+		pthread_mutex_lock(&this->mutex);
+		this->stats.droppedCount++;
+		pthread_mutex_unlock(&this->mutex);
+		return;
+	}
+
+	length = (size_t)st.st_size;
+
+	p = mmap(NULL, length, PROT_READ, MAP_PRIVATE, candidate.fd, 0);
+
+	if (p == MAP_FAILED) {
+		log.logError("Failed to map frame %u for SSDV: %s", candidate.sequence, strerror(errno));
+
+		pthread_mutex_lock(&this->mutex);
+		this->stats.errorCount++;
+		pthread_mutex_unlock(&this->mutex);
+		return;
+	}
+
+	startTime = CurrentTime::getStopwatchTime();
+
+	this->encoder.begin((const uint8_t *)p, length, (uint8_t)candidate.sequence);
+
+	while (this->encoder.nextPacket(packet)) {
+		if (!this->sink.send(packet)) {
+			break;
+		}
+
+		numPackets++;
+	}
+
+	munmap(p, length);
+
+	log.logDebug("Frame %u sent as %u of %d SSDV packet(s)", candidate.sequence, numPackets, this->encoder.getPacketCount());
+
+	pthread_mutex_lock(&this->mutex);
+
+	this->stats.packetCount += numPackets;
+	this->stats.totalTime += CurrentTime::getStopwatchTime() - startTime;
+
+	if ((int)numPackets == this->encoder.getPacketCount()) {
+		this->stats.imageCount++;
+	}
+	else {
+		this->stats.droppedCount++;
+	}
+
+	pthread_mutex_unlock(&this->mutex);
+}
+
+void * SSDVThread::run()
+{
+	DownlinkCandidate	candidate;
+	sigset_t			mask;
+	uint64_t			now;
+	uint64_t			wakeTime;
+
+	/*
+	** A FIFO reader going away should fail the write,
+	** not kill the daemon...
+	*/
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	traceSetThreadName("ssdv");
+
+	while (1) {
+		pthread_mutex_lock(&this->mutex);
+
+		while (1) {
+			now = CurrentTime::getMonotonicTime();
+
+			if (this->scheduler.nextFrame(now, &candidate)) {
+				break;
+			}
+
+			if (!this->scheduler.getWakeTime(now, &wakeTime)) {
+				wakeTime = CLOCK_FOREVER;
+			}
+
+			Clock::getInstance().waitUntil(&this->frameQueued, &this->mutex, wakeTime);
+		}
+
+		pthread_mutex_unlock(&this->mutex);
+
+		sendFrame(candidate);
+
+		close(candidate.fd);
+	}
+
+	return NULL;
+}
@@ -0,0 +1,146 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "posixthread.h"
+#include "capturebackend.h"
+#include "downlink.h"
+
+#ifndef _INCL_SSDV
+#define _INCL_SSDV
+
+/*
+** SSDV style 256 byte packets:
+**
+**   0      sync byte
+**   1      packet type, with or without FEC
+**   2-5    callsign, base 40
+**   6      image ID
+**   7-8    packet ID
+**   9      width / 16
+**   10     height / 16
+**   11     flags
+**   12     MCU offset
+**   13-14  MCU index
+**   15-219 payload
+**   220-3  CRC32 of bytes 1-219
+**   224    RS(255,223) parity of bytes 1-223
+**
+** Multi-byte fields are big endian...
+*/
+#define SSDV_PACKET_LENGTH                  256
+#define SSDV_HEADER_LENGTH                  15
+#define SSDV_PAYLOAD_LENGTH                 205
+#define SSDV_CRC_OFFSET                     220
+#define SSDV_FEC_OFFSET                     224
+#define SSDV_NOFEC_PAYLOAD_LENGTH           237
+
+#define SSDV_SYNC                           0x55
+#define SSDV_TYPE_FEC                       0x66
+#define SSDV_TYPE_NOFEC                     0x67
+
+#define SSDV_FLAG_EOI                       0x04
+
+/*
+** Cuts a JPEG into packets, one at a time into the caller's
+** buffer. Unlike SSDV proper the payload is the JPEG byte
+** stream as is, rather than re-coded MCUs, so a lost packet
+** costs the rest of the image...
+*/
+class SSDVEncoder
+{
+private:
+    const uint8_t *     jpeg = NULL;
+    size_t              length = 0;
+    size_t              position = 0;
+
+    uint32_t            callsign = 0;
+    uint8_t             imageID = 0;
+    uint16_t            packetID = 0;
+    uint8_t             width = 0;
+    uint8_t             height = 0;
+    bool                useFEC = true;
+
+public:
+    void                setCallsign(const char * pszCallsign);
+    void                setFEC(bool useFEC) {
+        this->useFEC = useFEC;
+    }
+
+    void                begin(const uint8_t * jpeg, size_t length, uint8_t imageID);
+    bool                nextPacket(uint8_t * packet);
+
+    int                 getPacketCount();
+};
+
+/*
+** Where packets go: 'udp:<address>:<port>' sends each packet as
+** a datagram, 'fifo:<path>' writes them to a named pipe, for a
+** modem or a ground station decoder to pick up...
+*/
+class SSDVSink
+{
+private:
+    int                 fd = -1;
+    bool                isFifo = false;
+    char                szSpec[PATH_MAX];
+
+public:
+    ~SSDVSink();
+
+    void                configure(const char * pszSpec);
+
+    bool                open();
+    bool                send(const uint8_t * packet);
+    void                close();
+};
+
+struct SSDVStats
+{
+    uint32_t            imageCount;
+    uint32_t            packetCount;
+    uint32_t            errorCount;
+    uint32_t            droppedCount;
+    uint64_t            totalTime;
+};
+
+/*
+** Packetises completed frames and streams them to the sink, in
+** the order and at the rate the downlink scheduler picks. Frames
+** are opened by the ssdv pipeline stage, ahead of the packer, so
+** they can still be read if it removes them before they are
+** sent...
+*/
+class SSDVThread : public PosixThread, public FrameListener
+{
+private:
+    pthread_mutex_t     mutex;
+    pthread_cond_t      frameQueued;
+
+    DownlinkScheduler   scheduler;
+    bool                useFEC = true;
+
+    SSDVEncoder         encoder;
+    SSDVSink            sink;
+    SSDVStats           stats;
+
+    void                sendFrame(const DownlinkCandidate & candidate);
+
+public:
+    SSDVThread();
+    ~SSDVThread();
+
+    void *              run();
+
+    void                frameAvailable(const CaptureFrame & frame);
+
+    void                getStats(SSDVStats * stats, DownlinkStats * downlinkStats);
+};
+
+int         ssdvGetPacketCount(size_t length, bool useFEC);
+uint32_t    ssdvEncodeCallsign(const char * pszCallsign);
+uint32_t    ssdvCRC32(const uint8_t * data, size_t length);
+bool        ssdvGetDimensions(const uint8_t * jpeg, size_t length, int * width, int * height);
+
+#endif
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "logger.h"
+#include "currenttime.h"
+#include "startup.h"
+
+static const char * phaseNames[STARTUP_NUM_PHASES] = {
+	"config",
+	"logger",
+	"resume",
+	"spawn",
+	"ready",
+	"trigger",
+	"frame"
+};
+
+StartupTimeline::StartupTimeline()
+{
+	pthread_mutex_init(&this->mutex, NULL);
+
+	memset(this->phaseTimes, 0, sizeof(this->phaseTimes));
+}
+
+StartupTimeline::~StartupTimeline()
+{
+	pthread_mutex_destroy(&this->mutex);
+}
+
+void StartupTimeline::begin()
+{
+	this->startTime = CurrentTime::getMonotonicTime();
+}
+
+/*
+** Only the first time a phase is reached counts, restarting
+** the capture backend later doesn't move the timeline...
+*/
+void StartupTimeline::mark(StartupPhase phase)
+{
+	char			szTimeline[256];
+	bool			isComplete = false;
+
+	pthread_mutex_lock(&this->mutex);
+
+	if (this->phaseTimes[phase] == 0) {
+		this->phaseTimes[phase] = CurrentTime::getMonotonicTime();
+	}
+
+	if (phase == STARTUP_FIRST_FRAME && !this->isReported) {
+		this->isReported = true;
+		isComplete = true;
+	}
+
+	pthread_mutex_unlock(&this->mutex);
+
+	if (isComplete) {
+		format(szTimeline, sizeof(szTimeline));
+		Logger::getInstance().logStatus("Startup timeline: %s", szTimeline);
+	}
+}
+
+/*
+** Each phase as the time since start and, in brackets, since
+** the previous phase. Phases not yet reached are shown as '-'...
+*/
+size_t StartupTimeline::format(char * buffer, size_t length)
+{
+	uint64_t		previous = this->startTime;
+	size_t			used = 0;
+	int				i;
+
+	buffer[0] = 0;
+
+	pthread_mutex_lock(&this->mutex);
+
+	for (i = 0;i < STARTUP_NUM_PHASES && used < length;i++) {
+		if (this->phaseTimes[i] == 0) {
+			used += snprintf(&buffer[used], length - used, "%s%s=-", (i > 0 ? " " : ""), phaseNames[i]);
+			continue;
+		}
+
+		used += snprintf(
+					&buffer[used],
+					length - used,
+					"%s%s=%.1fms(+%.1f)",
+					(i > 0 ? " " : ""),
+					phaseNames[i],
+					(double)(this->phaseTimes[i] - this->startTime) / 1000.0,
+					(double)(this->phaseTimes[i] - previous) / 1000.0);
+
+		previous = this->phaseTimes[i];
+	}
+
+	pthread_mutex_unlock(&this->mutex);
+
+	return (used < length ? used : length - 1);
+}
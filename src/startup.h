@@ -0,0 +1,49 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#ifndef _INCL_STARTUP
+#define _INCL_STARTUP
+
+enum StartupPhase
+{
+    STARTUP_CONFIG_LOADED,
+    STARTUP_LOGGER_READY,
+    STARTUP_RESUME_FOUND,
+    STARTUP_CAPTURE_SPAWNED,
+    STARTUP_CAPTURE_READY,
+    STARTUP_FIRST_TRIGGER,
+    STARTUP_FIRST_FRAME,
+    STARTUP_NUM_PHASES
+};
+
+/*
+** Records when each phase of startup was first reached,
+** relative to the start of main()...
+*/
+class StartupTimeline
+{
+public:
+    static StartupTimeline & getInstance() {
+        static StartupTimeline instance;
+        return instance;
+    }
+
+private:
+    pthread_mutex_t     mutex;
+    uint64_t            startTime = 0;
+    uint64_t            phaseTimes[STARTUP_NUM_PHASES];
+    bool                isReported = false;
+
+    StartupTimeline();
+
+public:
+    ~StartupTimeline();
+
+    void                begin();
+    void                mark(StartupPhase phase);
+
+    size_t              format(char * buffer, size_t length);
+};
+
+#endif
@@ -0,0 +1,644 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/eventfd.h>
+
+#include "configmgr.h"
+#include "logger.h"
+#include "bctl_error.h"
+#include "currenttime.h"
+#include "clock.h"
+#include "trace.h"
+#include "capturebackend.h"
+#include "startup.h"
+#include "resume.h"
+
+/*
+** If free running falls this far behind, skip ahead
+** rather than try to catch up...
+*/
+#define SYNTHETIC_MAX_LAG_US				1000000ULL
+
+/*
+** Standard luminance tables from the JPEG spec (ITU T.81, K.1,
+** K.3 and K.5)...
+*/
+static const uint8_t lumaQuantTable[64] = {
+	16,  11,  10,  16,  24,  40,  51,  61,
+	12,  12,  14,  19,  26,  58,  60,  55,
+	14,  13,  16,  24,  40,  57,  69,  56,
+	14,  17,  22,  29,  51,  87,  80,  62,
+	18,  22,  37,  56,  68, 109, 103,  77,
+	24,  35,  55,  64,  81, 104, 113,  92,
+	49,  64,  78,  87, 103, 121, 120, 101,
+	72,  92,  95,  98, 112, 100, 103,  99
+};
+
+static const uint8_t zigzag[64] = {
+	 0,  1,  8, 16,  9,  2,  3, 10,
+	17, 24, 32, 25, 18, 11,  4,  5,
+	12, 19, 26, 33, 40, 48, 41, 34,
+	27, 20, 13,  6,  7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36,
+	29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46,
+	53, 60, 61, 54, 47, 55, 62, 63
+};
+
+static const uint8_t lumaDCBits[16] = {
+	0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0
+};
+
+static const uint8_t lumaDCValues[12] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11
+};
+
+static const uint8_t lumaACBits[16] = {
+	0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7D
+};
+
+static const uint8_t lumaACValues[162] = {
+	0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12,
+	0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+	0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08,
+	0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0,
+	0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16,
+	0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+	0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+	0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+	0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+	0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+	0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
+	0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+	0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
+	0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+	0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6,
+	0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5,
+	0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4,
+	0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+	0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA,
+	0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+	0xF9, 0xFA
+};
+
+/*
+** Code and length of the end-of-block symbol (0x00)
+** in the standard luminance AC table...
+*/
+#define LUMA_AC_EOB_CODE					0x0A
+#define LUMA_AC_EOB_LENGTH					4
+
+#define JPEG_HEADER_MAX_LENGTH				1024
+#define JPEG_MAX_SEGMENT_LENGTH				65535
+
+struct BitWriter
+{
+	uint8_t *		buffer;
+	size_t			position;
+	uint32_t		bits;
+	int				numBits;
+};
+
+static void writeBits(BitWriter * w, uint32_t code, int length)
+{
+	w->bits = (w->bits << length) | (code & ((1U << length) - 1));
+	w->numBits += length;
+
+	while (w->numBits >= 8) {
+		uint8_t b = (uint8_t)(w->bits >> (w->numBits - 8));
+
+		w->buffer[w->position++] = b;
+
+		/*
+		** Byte stuffing, so 0xFF in the scan isn't read as a marker...
+		*/
+		if (b == 0xFF) {
+			w->buffer[w->position++] = 0x00;
+		}
+
+		w->numBits -= 8;
+	}
+}
+
+static void flushBits(BitWriter * w)
+{
+	if (w->numBits > 0) {
+		writeBits(w, 0x7F, 8 - w->numBits);
+	}
+}
+
+static uint8_t * writeMarker(uint8_t * p, uint8_t marker, int length)
+{
+	*p++ = 0xFF;
+	*p++ = marker;
+
+	if (length > 0) {
+		*p++ = (uint8_t)(length >> 8);
+		*p++ = (uint8_t)(length & 0xFF);
+	}
+
+	return p;
+}
+
+static uint8_t * writeHuffmanTable(uint8_t * p, int tableClass, const uint8_t * bits, const uint8_t * values, int numValues)
+{
+	p = writeMarker(p, 0xC4, 2 + 1 + 16 + numValues);
+
+	*p++ = (uint8_t)(tableClass << 4);
+
+	memcpy(p, bits, 16);
+	p += 16;
+
+	memcpy(p, values, numValues);
+	p += numValues;
+
+	return p;
+}
+
+size_t getSyntheticJpegMaxLength(int width, int height, size_t frameSize)
+{
+	size_t numBlocks = (size_t)((width + 7) / 8) * (size_t)((height + 7) / 8);
+
+	/*
+	** At most 11 + 11 + 4 bits per block, doubled in case
+	** every byte needs stuffing...
+	*/
+	return JPEG_HEADER_MAX_LENGTH + (numBlocks * 7) + frameSize + ((frameSize / (JPEG_MAX_SEGMENT_LENGTH - 2)) + 1) * 4;
+}
+
+/*
+** Encode a baseline greyscale JPEG of a moving test pattern into
+** buffer, which must be getSyntheticJpegMaxLength() bytes. Each
+** block is flat, so only DC coefficients are coded. If frameSize
+** is bigger than the natural size the frame is padded out to it
+** with COM segments. Returns the length of the JPEG...
+*/
+size_t synthesiseJpeg(uint8_t * buffer, size_t bufferLength, int width, int height, int quality, uint32_t frameNumber, size_t frameSize)
+{
+	uint8_t			quant[64];
+	uint16_t		dcCodes[12];
+	uint8_t			dcLengths[12];
+	uint8_t *		p = buffer;
+	uint8_t *		scanStart;
+	BitWriter		w;
+	int				blocksWide = (width + 7) / 8;
+	int				blocksHigh = (height + 7) / 8;
+	int				scale;
+	int				previousDC = 0;
+	int				i;
+	int				j;
+	int				k;
+
+	if (bufferLength < getSyntheticJpegMaxLength(width, height, frameSize)) {
+		return 0;
+	}
+
+	/*
+	** IJG quality scaling of the standard table...
+	*/
+	scale = (quality < 50 ? 5000 / quality : 200 - (quality * 2));
+
+	for (i = 0;i < 64;i++) {
+		int q = ((lumaQuantTable[i] * scale) + 50) / 100;
+		quant[i] = (uint8_t)(q < 1 ? 1 : (q > 255 ? 255 : q));
+	}
+
+	/*
+	** Canonical Huffman codes for the DC table...
+	*/
+	for (i = 0, j = 0, k = 0;i < 16;i++) {
+		for (int n = 0;n < lumaDCBits[i];n++) {
+			dcCodes[lumaDCValues[j]] = (uint16_t)k++;
+			dcLengths[lumaDCValues[j]] = (uint8_t)(i + 1);
+			j++;
+		}
+		k <<= 1;
+	}
+
+	p = writeMarker(p, 0xD8, 0);
+
+	p = writeMarker(p, 0xE0, 16);
+	memcpy(p, "JFIF\0\x01\x01\x00\x00\x01\x00\x01\x00\x00", 14);
+	p += 14;
+
+	p = writeMarker(p, 0xDB, 2 + 1 + 64);
+	*p++ = 0x00;
+
+	for (i = 0;i < 64;i++) {
+		*p++ = quant[zigzag[i]];
+	}
+
+	p = writeMarker(p, 0xC0, 2 + 6 + 3);
+	*p++ = 8;
+	*p++ = (uint8_t)(height >> 8);
+	*p++ = (uint8_t)(height & 0xFF);
+	*p++ = (uint8_t)(width >> 8);
+	*p++ = (uint8_t)(width & 0xFF);
+	*p++ = 1;
+	*p++ = 1;
+	*p++ = 0x11;
+	*p++ = 0;
+
+	p = writeHuffmanTable(p, 0, lumaDCBits, lumaDCValues, sizeof(lumaDCValues));
+	p = writeHuffmanTable(p, 1, lumaACBits, lumaACValues, sizeof(lumaACValues));
+
+	p = writeMarker(p, 0xDA, 2 + 1 + 2 + 3);
+	*p++ = 1;
+	*p++ = 1;
+	*p++ = 0x00;
+	*p++ = 0;
+	*p++ = 63;
+	*p++ = 0;
+
+	scanStart = p;
+
+	w.buffer = p;
+	w.position = 0;
+	w.bits = 0;
+	w.numBits = 0;
+
+	for (i = 0;i < blocksHigh;i++) {
+		/*
+		** A vertical gradient with a wave moving across it, so
+		** consecutive frames differ...
+		*/
+		int base = 60 + ((i * 140) / blocksHigh);
+
+		for (j = 0;j < blocksWide;j++) {
+			int wave = (int)(((uint32_t)j * 8 + frameNumber * 4) % 128);
+			int mean = base + (wave < 64 ? wave : 127 - wave) - 32;
+
+			mean = (mean < 0 ? 0 : (mean > 255 ? 255 : mean));
+
+			int dc = ((mean - 128) * 8) / quant[0];
+			int diff = dc - previousDC;
+			int magnitude = (diff < 0 ? -diff : diff);
+			int category = 0;
+
+			previousDC = dc;
+
+			while (magnitude > 0) {
+				category++;
+				magnitude >>= 1;
+			}
+
+			writeBits(&w, dcCodes[category], dcLengths[category]);
+
+			if (category > 0) {
+				writeBits(&w, (uint32_t)(diff < 0 ? diff - 1 : diff), category);
+			}
+
+			writeBits(&w, LUMA_AC_EOB_CODE, LUMA_AC_EOB_LENGTH);
+		}
+	}
+
+	flushBits(&w);
+
+	size_t scanLength = w.position;
+	size_t naturalLength = (size_t)(scanStart - buffer) + scanLength + 2;
+
+	/*
+	** Pad out to the requested size with COM segments ahead of the
+	** scan, each costs 4 bytes of marker and length on top of its
+	** content...
+	*/
+	if (frameSize > naturalLength + 4) {
+		size_t padding = frameSize - naturalLength;
+		size_t headerLength = (size_t)(scanStart - buffer) - 10;
+		uint8_t * q = buffer + headerLength;
+		uint8_t * scanEnd = scanStart + scanLength;
+
+		/*
+		** Move the SOS header and scan up to make room...
+		*/
+		memmove(scanStart - 10 + padding, scanStart - 10, (size_t)(scanEnd - (scanStart - 10)));
+
+		while (padding > 0) {
+			size_t segment = (padding > JPEG_MAX_SEGMENT_LENGTH + 2 ? JPEG_MAX_SEGMENT_LENGTH + 2 : padding);
+
+			if (padding - segment > 0 && padding - segment < 4) {
+				segment -= 4;
+			}
+
+			q = writeMarker(q, 0xFE, (int)(segment - 2));
+			memset(q, 0x20, segment - 4);
+			q += segment - 4;
+
+			padding -= segment;
+		}
+
+		p = buffer + frameSize - 2;
+	}
+	else {
+		p = scanStart + scanLength;
+	}
+
+	p = writeMarker(p, 0xD9, 0);
+
+	return (size_t)(p - buffer);
+}
+
+void * SyntheticThread::run()
+{
+	ClockAttachment		attachment;
+
+	traceSetThreadName("synthetic");
+
+	this->pBackend->generate();
+
+	return NULL;
+}
+
+SyntheticBackend::SyntheticBackend()
+{
+	pthread_condattr_t		attr;
+
+	pthread_mutex_init(&this->mutex, NULL);
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&this->wakeup, &attr);
+	pthread_condattr_destroy(&attr);
+
+	this->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (this->eventFd < 0) {
+		throw bctl_error(bctl_error::buildMsg("Failed to create eventfd: %s", strerror(errno)), __FILE__, __LINE__);
+	}
+
+	this->szOutputTemplate[0] = 0;
+}
+
+SyntheticBackend::~SyntheticBackend()
+{
+	shutdown();
+
+	if (this->buffer != NULL) {
+		free(this->buffer);
+	}
+
+	close(this->eventFd);
+
+	pthread_cond_destroy(&this->wakeup);
+	pthread_mutex_destroy(&this->mutex);
+}
+
+void SyntheticBackend::start()
+{
+	ResumeResult	resume;
+	size_t			length;
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+	Logger & log = Logger::getInstance();
+
+	if (this->isRunning) {
+		return;
+	}
+
+	getCaptureResolution(&this->width, &this->height);
+	this->quality = cfg.getValueAsInteger(CFG_CAPTURE_JPGQUALITY);
+	this->rate = (unsigned long)cfg.getValueAsInteger(CFG_SYNTHETIC_RATE);
+	this->frameSize = (size_t)cfg.getValueAsInteger(CFG_SYNTHETIC_FRAMESIZE);
+
+	cfg.getValue(CFG_CAPTURE_OUTPUTTEMPLATE, this->szOutputTemplate, PATH_MAX);
+
+	length = getSyntheticJpegMaxLength(this->width, this->height, this->frameSize);
+
+	/*
+	** Sized once up front, generating frames doesn't allocate...
+	*/
+	if (length > this->bufferLength) {
+		uint8_t * newBuffer = (uint8_t *)realloc(this->buffer, length);
+
+		if (newBuffer == NULL) {
+			throw bctl_error(bctl_error::buildMsg("Failed to allocate %lu bytes for synthetic frames", (unsigned long)length), __FILE__, __LINE__);
+		}
+
+		this->buffer = newBuffer;
+		this->bufferLength = length;
+	}
+
+	this->sequence = findResumeSequence(&resume) - 1;
+	this->isStopping = false;
+	this->triggersPending = 0;
+	this->triggers.clear();
+
+	this->pThread = new SyntheticThread(this);
+
+	Clock::getInstance().reserve();
+
+	if (!this->pThread->start()) {
+		delete this->pThread;
+		this->pThread = NULL;
+		throw bctl_error("Failed to start synthetic capture thread", __FILE__, __LINE__);
+	}
+
+	this->isRunning = true;
+
+	StartupTimeline::getInstance().mark(STARTUP_CAPTURE_SPAWNED);
+
+	log.logStatus(
+			"Started synthetic capture, %dx%d at %lu frames/s%s",
+			this->width,
+			this->height,
+			this->rate,
+			(this->rate == 0 ? " (on trigger only)" : ""));
+}
+
+bool SyntheticBackend::isReady()
+{
+	return this->isRunning;
+}
+
+bool SyntheticBackend::trigger()
+{
+	if (!this->isRunning) {
+		return false;
+	}
+
+	this->triggers.push(CurrentTime::getMonotonicTime());
+
+	pthread_mutex_lock(&this->mutex);
+	this->triggersPending++;
+	Clock::getInstance().signal(&this->wakeup);
+	pthread_mutex_unlock(&this->mutex);
+
+	return true;
+}
+
+void SyntheticBackend::shutdown()
+{
+	if (!this->isRunning) {
+		return;
+	}
+
+	pthread_mutex_lock(&this->mutex);
+	this->isStopping = true;
+	Clock::getInstance().signal(&this->wakeup);
+	pthread_mutex_unlock(&this->mutex);
+
+	this->pThread->join();
+
+	delete this->pThread;
+	this->pThread = NULL;
+
+	this->isRunning = false;
+}
+
+bool SyntheticBackend::nextFrame(CaptureFrame * frame)
+{
+	uint64_t		count;
+	bool			isFrame = false;
+
+	pthread_mutex_lock(&this->mutex);
+
+	if (this->frameCount > 0) {
+		memcpy(frame, &this->frames[this->frameHead], sizeof(CaptureFrame));
+
+		this->frameHead = (this->frameHead + 1) % CAPTURE_MAX_PENDING_FRAMES;
+		this->frameCount--;
+
+		isFrame = true;
+	}
+	else {
+		/*
+		** Frames are queued and signalled under the same lock,
+		** so it's safe to reset the eventfd here...
+		*/
+		read(this->eventFd, &count, sizeof(count));
+	}
+
+	pthread_mutex_unlock(&this->mutex);
+
+	return isFrame;
+}
+
+void SyntheticBackend::writeFrame(uint64_t triggerTime)
+{
+	CaptureFrame *	frame;
+	char			szPath[PATH_MAX];
+	uint64_t		count = 1;
+	size_t			length;
+	size_t			bytesWritten = 0;
+	ssize_t			rtn;
+	uint32_t		frameNumber;
+	int				fd;
+
+	Logger & log = Logger::getInstance();
+
+	frameNumber = ++this->sequence;
+
+	length = synthesiseJpeg(this->buffer, this->bufferLength, this->width, this->height, this->quality, frameNumber, this->frameSize);
+
+	if (!formatOutputTemplate(this->szOutputTemplate, frameNumber, szPath, PATH_MAX)) {
+		log.logError("Invalid output template '%s'", this->szOutputTemplate);
+		return;
+	}
+
+	fd = open(szPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (fd < 0) {
+		log.logError("Failed to create synthetic frame %s: %s", szPath, strerror(errno));
+		return;
+	}
+
+	while (bytesWritten < length) {
+		rtn = write(fd, &this->buffer[bytesWritten], length - bytesWritten);
+
+		if (rtn < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			log.logError("Failed to write synthetic frame %s: %s", szPath, strerror(errno));
+			close(fd);
+			return;
+		}
+
+		bytesWritten += (size_t)rtn;
+	}
+
+	close(fd);
+
+	pthread_mutex_lock(&this->mutex);
+
+	/*
+	** Drop the oldest if nobody is collecting frames...
+	*/
+	if (this->frameCount == CAPTURE_MAX_PENDING_FRAMES) {
+		this->frameHead = (this->frameHead + 1) % CAPTURE_MAX_PENDING_FRAMES;
+		this->frameCount--;
+	}
+
+	frame = &this->frames[(this->frameHead + this->frameCount) % CAPTURE_MAX_PENDING_FRAMES];
+
+	strcpy(frame->szPath, szPath);
+	frame->sequence = frameNumber;
+	frame->triggerTime = triggerTime;
+	frame->completedTime = CurrentTime::getMonotonicTime();
+	frame->size = (off_t)length;
+	frame->hasCRC = false;
+	frame->hasSimilarity = false;
+	frame->isSimilar = false;
+	frame->isSkipped = false;
+
+	this->frameCount++;
+
+	write(this->eventFd, &count, sizeof(count));
+
+	pthread_mutex_unlock(&this->mutex);
+}
+
+void SyntheticBackend::generate()
+{
+	uint64_t			nextDue;
+	uint64_t			period;
+	uint64_t			now;
+	uint64_t			triggerTime;
+	bool				isTriggered;
+
+	period = (this->rate > 0 ? 1000000ULL / this->rate : 0);
+	nextDue = CurrentTime::getMonotonicTime() + period;
+
+	while (1) {
+		pthread_mutex_lock(&this->mutex);
+
+		while (1) {
+			now = CurrentTime::getMonotonicTime();
+
+			if (this->isStopping) {
+				pthread_mutex_unlock(&this->mutex);
+				return;
+			}
+
+			if (this->triggersPending > 0) {
+				this->triggersPending--;
+				isTriggered = true;
+				break;
+			}
+
+			if (period > 0 && now >= nextDue) {
+				nextDue += period;
+
+				if (now > nextDue + SYNTHETIC_MAX_LAG_US) {
+					nextDue = now + period;
+				}
+
+				isTriggered = false;
+				break;
+			}
+
+			Clock::getInstance().waitUntil(&this->wakeup, &this->mutex, (period > 0 ? nextDue : CLOCK_FOREVER));
+		}
+
+		pthread_mutex_unlock(&this->mutex);
+
+		triggerTime = (isTriggered ? this->triggers.pop() : now);
+
+		writeFrame(triggerTime);
+	}
+}
@@ -4,11 +4,33 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <errno.h>
+#include <time.h>
+#include <string.h>
+#include <stdlib.h>
+#include <poll.h>
 
 #include "configmgr.h"
 #include "logger.h"
 #include "bctl_error.h"
+#include "currenttime.h"
+#include "clock.h"
 #include "threads.h"
+#include "controlthread.h"
+#include "startup.h"
+#include "resume.h"
+#include "container.h"
+#include "checksum.h"
+#include "publisher.h"
+#include "preview.h"
+#include "avi.h"
+#include "similarity.h"
+#include "ssdv.h"
+#include "gps.h"
+#include "exif.h"
+#include "flightphase.h"
+#include "resources.h"
+#include "trace.h"
+#include "watchdog.h"
 #include "bctl.h"
 
 extern "C" {
@@ -21,59 +43,637 @@ void ThreadManager::startThreads()
 {
 	Logger & log = Logger::getInstance();
 
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	/*
+	** Before anything else, so a thread that never gets going
+	** is noticed...
+	*/
+	if (cfg.getValueAsBoolean(CFG_WATCHDOG_ENABLE)) {
+		if (Clock::getInstance().isVirtual()) {
+			log.logStatus("Simulating, the watchdog is off");
+		}
+		else if (Watchdog::getInstance().start()) {
+			log.logStatus("Started Watchdog successfully");
+		}
+		else {
+			throw bctl_error("Failed to start Watchdog", __FILE__, __LINE__);
+		}
+	}
+
+	/*
+	** First, so there may be a fix by the first frame...
+	*/
+	if (cfg.getValueAsBoolean(CFG_GPS_ENABLE)) {
+		this->pGPSThread = new GPSThread(cfg.getValue(CFG_GPS_DEVICE), cfg.getValueAsInteger(CFG_GPS_BAUD));
+
+		/*
+		** A simulation feeds the GPS from its replay file...
+		*/
+		if (Clock::getInstance().isVirtual()) {
+			log.logStatus("Simulating, GPS sentences come from the replay");
+		}
+		else if (this->pGPSThread->start()) {
+			log.logStatus("Started GPSThread successfully");
+		}
+		else {
+			throw bctl_error("Failed to start GPSThread", __FILE__, __LINE__);
+		}
+	}
+
 	this->pCaptureThread = new CaptureThread();
+
+	Clock::getInstance().reserve();
+
 	if (this->pCaptureThread->start()) {
 		log.logStatus("Started CaptureThread successfully");
 	}
 	else {
 		throw bctl_error("Failed to start CaptureThread", __FILE__, __LINE__);
 	}
+
+	/*
+	** The phase comes from the GPS altitude...
+	*/
+	if (cfg.getValueAsBoolean(CFG_PHASE_ENABLE)) {
+		if (this->pGPSThread == NULL) {
+			log.logError("Flight phase detection needs gps.enable=yes, capturing with the capture.* settings");
+		}
+		else {
+			this->pFlightPhaseThread = new FlightPhaseThread();
+
+			Clock::getInstance().reserve();
+
+			if (this->pFlightPhaseThread->start()) {
+				log.logStatus("Started FlightPhaseThread successfully");
+			}
+			else {
+				throw bctl_error("Failed to start FlightPhaseThread", __FILE__, __LINE__);
+			}
+		}
+	}
+
+	this->pCheckpoint = new FrameCheckpoint();
+
+	this->pFrameThread = new FrameThread(this->pCaptureThread->getBackend());
+	this->pFrameThread->addListener(this->pCheckpoint);
+
+	FramePipeline & pipeline = this->pFrameThread->getPipeline();
+
+	/*
+	** First, so the frames it skips cost the later stages
+	** nothing...
+	*/
+	if (cfg.getValueAsBoolean(CFG_SIMILARITY_ENABLE)) {
+		this->pSimilarity = new FrameSimilarity(this->pCheckpoint);
+		pipeline.addStage("similarity", CFG_PIPELINE_SIMILARITY, this->pSimilarity, NULL, PIPELINE_MAX_WORKERS);
+	}
+
+	/*
+	** Next, so every later stage sees the tagged frame. The
+	** tagger has one pipe to splice through, so one worker...
+	*/
+	if (cfg.getValueAsBoolean(CFG_EXIF_ENABLE)) {
+		this->pExifTagger = new ExifTagger();
+		pipeline.addStage("tag", CFG_PIPELINE_TAG, this->pExifTagger, NULL, 1);
+	}
+
+	bool isPacking = cfg.getValueAsBoolean(CFG_CONTAINER_ENABLE);
+
+	/*
+	** Packed frames carry their own CRC, there's no point
+	** checksumming loose files that are about to go...
+	*/
+	if (cfg.getValueAsBoolean(CFG_CHECKSUM_ENABLE) && !(isPacking && cfg.getValueAsBoolean(CFG_CONTAINER_REMOVEFRAMES))) {
+		this->pChecksummer = new FrameChecksummer();
+		pipeline.addStage("checksum", CFG_PIPELINE_CHECKSUM, this->pChecksummer, NULL, PIPELINE_MAX_WORKERS);
+	}
+
+	/*
+	** After the checksum, so the CRC goes out with the frame...
+	*/
+	if (cfg.getValueAsBoolean(CFG_SHM_ENABLE)) {
+		this->pPublisher = new FramePublisher();
+		pipeline.addStage("publish", CFG_PIPELINE_PUBLISH, NULL, this->pPublisher, 1);
+	}
+
+	/*
+	** The server keeps the recent frames open, so it can
+	** still send them once the packer has removed them...
+	*/
+	if (cfg.getValueAsBoolean(CFG_PREVIEW_ENABLE)) {
+		this->pPreviewServer = new PreviewServer();
+		if (this->pPreviewServer->start()) {
+			log.logStatus("Started PreviewServer successfully");
+		}
+		else {
+			throw bctl_error("Failed to start PreviewServer", __FILE__, __LINE__);
+		}
+
+		pipeline.addStage("preview", CFG_PIPELINE_PREVIEW, NULL, this->pPreviewServer, 1);
+	}
+
+	/*
+	** Ahead of the packer, which may remove the file...
+	*/
+	if (cfg.getValueAsBoolean(CFG_SSDV_ENABLE)) {
+		this->pSSDVThread = new SSDVThread();
+		if (this->pSSDVThread->start()) {
+			log.logStatus("Started SSDVThread successfully");
+		}
+		else {
+			throw bctl_error("Failed to start SSDVThread", __FILE__, __LINE__);
+		}
+
+		pipeline.addStage("ssdv", CFG_PIPELINE_SSDV, NULL, this->pSSDVThread, PIPELINE_MAX_WORKERS);
+	}
+
+	/*
+	** Frames go into the AVI in order, so one worker, and
+	** ahead of the packer...
+	*/
+	if (cfg.getValueAsBoolean(CFG_TIMELAPSE_ENABLE)) {
+		this->pMuxer = new FrameMuxer();
+		pipeline.addStage("timelapse", CFG_PIPELINE_TIMELAPSE, NULL, this->pMuxer, 1);
+	}
+
+	/*
+	** Segments are written in frame order, so one worker...
+	*/
+	if (isPacking) {
+		this->pPacker = new FramePacker(this->pCheckpoint);
+		pipeline.addStage("pack", CFG_PIPELINE_PACK, NULL, this->pPacker, 1);
+	}
+
+	log.logStatus("Started %d pipeline worker(s) in %d stage(s)", pipeline.start(), pipeline.getStageCount());
+
+	if (this->pFrameThread->start()) {
+		log.logStatus("Started FrameThread successfully");
+	}
+	else {
+		throw bctl_error("Failed to start FrameThread", __FILE__, __LINE__);
+	}
+
+	if (cfg.getValueAsBoolean(CFG_RESOURCES_ENABLE)) {
+		this->pResourceThread = new ResourceThread();
+		if (this->pResourceThread->start()) {
+			log.logStatus("Started ResourceThread successfully");
+		}
+		else {
+			throw bctl_error("Failed to start ResourceThread", __FILE__, __LINE__);
+		}
+	}
+
+	this->pControlThread = new ControlThread();
+	if (this->pControlThread->start()) {
+		log.logStatus("Started ControlThread successfully");
+	}
+	else {
+		throw bctl_error("Failed to start ControlThread", __FILE__, __LINE__);
+	}
 }
 
 void ThreadManager::killThreads()
 {
+	/*
+	** Index and close the timelapse before anything goes...
+	*/
+	if (this->pMuxer != NULL) {
+		this->pMuxer->finish();
+	}
+
+	if (this->pControlThread != NULL) {
+		this->pControlThread->stop();
+	}
+	if (this->pFrameThread != NULL) {
+		this->pFrameThread->stop();
+		this->pFrameThread->getPipeline().stop();
+	}
+	if (this->pSSDVThread != NULL) {
+		this->pSSDVThread->stop();
+	}
+	if (this->pPreviewServer != NULL) {
+		this->pPreviewServer->stop();
+	}
+	if (this->pFlightPhaseThread != NULL) {
+		this->pFlightPhaseThread->stop();
+	}
+	if (this->pResourceThread != NULL) {
+		this->pResourceThread->stop();
+	}
 	if (this->pCaptureThread != NULL) {
 		this->pCaptureThread->stop();
 	}
+	if (this->pGPSThread != NULL) {
+		this->pGPSThread->stop();
+	}
 }
 
-void * CaptureThread::run()
+CaptureThread::CaptureThread() : PosixThread(true), captureJob(this)
 {
-	bool			go = true;
-	unsigned long	frequency;
-	pid_t			pid;
+	pthread_condattr_t		attr;
+
+	pthread_mutex_init(&this->mutex, NULL);
 
+	/*
+	** Wait against the monotonic clock, so the capture
+	** schedule is unaffected by changes to the wall clock...
+	*/
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&this->wakeup, &attr);
+	pthread_condattr_destroy(&attr);
+
+	/*
+	** The backend is chosen once, at startup...
+	*/
+	this->pBackend = createCaptureBackend();
+
+	/*
+	** Set here rather than in run(), so a schedule set before
+	** the thread gets going isn't overwritten...
+	*/
+	this->intervalMs = (unsigned long)ConfigManager::getInstance().getValueAsInteger(CFG_CAPTURE_FREQUENCY) * 1000UL;
+	this->burstIntervalMs = (unsigned long)ConfigManager::getInstance().getValueAsInteger(CFG_CAPTURE_BURSTINTERVAL);
+	this->slackMs = (unsigned long)ConfigManager::getInstance().getValueAsInteger(CFG_CAPTURE_SLACK);
+
+	/*
+	** Changes to the camera arguments need the capture
+	** backend restarting, the rest we apply on the fly...
+	*/
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	cfg.subscribe(CFG_CAPTURE_BACKEND, this);
+	cfg.subscribe(CFG_CAPTURE_FREQUENCY, this);
+	cfg.subscribe(CFG_CAPTURE_BURSTINTERVAL, this);
+	cfg.subscribe(CFG_CAPTURE_SLACK, this);
+	cfg.subscribe(CFG_CAPTURE_PROGNAME, this);
+	cfg.subscribe(CFG_CAPTURE_ENCODING, this);
+	cfg.subscribe(CFG_CAPTURE_JPGQUALITY, this);
+	cfg.subscribe(CFG_CAPTURE_HRES, this);
+	cfg.subscribe(CFG_CAPTURE_VRES, this);
+	cfg.subscribe(CFG_CAPTURE_ISO, this);
+	cfg.subscribe(CFG_CAPTURE_OUTPUTTEMPLATE, this);
+	cfg.subscribe(CFG_SYNTHETIC_RATE, this);
+	cfg.subscribe(CFG_SYNTHETIC_FRAMESIZE, this);
+}
+
+CaptureThread::~CaptureThread()
+{
+	TimerWheel::getInstance().cancel(&this->captureJob);
+
+	delete this->pBackend;
+
+	pthread_cond_destroy(&this->wakeup);
+	pthread_mutex_destroy(&this->mutex);
+}
+
+/*
+** The next capture is an interval after the last one, or the
+** burst interval during a burst. Anything already due is
+** forgotten, the new schedule replaces it.
+**
+** Must be called with the mutex held...
+*/
+void CaptureThread::scheduleCapture()
+{
+	unsigned long		ms = (this->burstRemaining > 0 ? this->burstIntervalMs : this->intervalMs);
+
+	this->isCaptureDue = false;
+
+	TimerWheel::getInstance().schedule(
+						&this->captureJob,
+						this->lastCaptureTime + ((uint64_t)ms * 1000ULL),
+						0,
+						(uint64_t)this->slackMs * 1000ULL);
+}
+
+void CaptureThread::timerExpired(TimerJob * job)
+{
+	pthread_mutex_lock(&this->mutex);
+	this->isCaptureDue = true;
+	Clock::getInstance().signal(&this->wakeup);
+	pthread_mutex_unlock(&this->mutex);
+}
+
+void CaptureThread::triggerNow()
+{
+	pthread_mutex_lock(&this->mutex);
+	this->isTriggerPending = true;
+	Clock::getInstance().signal(&this->wakeup);
+	pthread_mutex_unlock(&this->mutex);
+}
+
+void CaptureThread::startBurst(int count)
+{
+	pthread_mutex_lock(&this->mutex);
+	this->burstRemaining = count;
+	scheduleCapture();
+	pthread_mutex_unlock(&this->mutex);
+}
+
+void CaptureThread::setInterval(unsigned long intervalMs)
+{
+	pthread_mutex_lock(&this->mutex);
+	this->intervalMs = intervalMs;
+	scheduleCapture();
+	pthread_mutex_unlock(&this->mutex);
+}
+
+/*
+** Only restarts the backend if the resolution actually
+** changed, 0x0 goes back to the configured resolution...
+*/
+void CaptureThread::setResolution(int width, int height)
+{
+	if (setCaptureResolution(width, height)) {
+		restartCapture();
+	}
+}
+
+void CaptureThread::restartCapture()
+{
+	pthread_mutex_lock(&this->mutex);
+	this->isRestartPending = true;
+	Clock::getInstance().signal(&this->wakeup);
+	pthread_mutex_unlock(&this->mutex);
+}
+
+void CaptureThread::configChanged(ConfigKey key, const char * value)
+{
 	ConfigManager & cfg = ConfigManager::getInstance();
 	Logger & log = Logger::getInstance();
 
-	frequency = (unsigned long)cfg.getValueAsInteger("capture.frequency");
+	switch (key) {
+		case CFG_CAPTURE_FREQUENCY:
+			log.logStatus("Capture frequency changed to %ss", value);
+			setInterval((unsigned long)cfg.getValueAsInteger(key) * 1000UL);
+			break;
+
+		case CFG_CAPTURE_BURSTINTERVAL:
+			pthread_mutex_lock(&this->mutex);
+			this->burstIntervalMs = (unsigned long)cfg.getValueAsInteger(key);
+			scheduleCapture();
+			pthread_mutex_unlock(&this->mutex);
+			break;
+
+		case CFG_CAPTURE_SLACK:
+			pthread_mutex_lock(&this->mutex);
+			this->slackMs = (unsigned long)cfg.getValueAsInteger(key);
+			scheduleCapture();
+			pthread_mutex_unlock(&this->mutex);
+			break;
 
-	log.logDebug("Capture frequency read as %ld", frequency);
+		case CFG_CAPTURE_BACKEND:
+			log.logError("Config %s changed to '%s', bctl must be restarted to change backend", cfg.getKeyName(key), value);
+			break;
+
+		default:
+			/*
+			** Several camera arguments changing in the same reload
+			** result in a single restart...
+			*/
+			log.logStatus("Config %s changed to '%s', restarting %s capture", cfg.getKeyName(key), value, this->pBackend->getName());
+			restartCapture();
+			break;
+	}
+}
+
+/*
+** (Re)start the backend with the current config and wait
+** until it can take the first photo...
+*/
+void CaptureThread::startBackend()
+{
+	Logger & log = Logger::getInstance();
 
-	const char * pipename = cfg.getValue("capture.pipename");
+	watchdogPoint("capture.start");
 
-	int pipeFd = open(pipename, O_RDONLY);
+	this->pBackend->shutdown();
+	this->pBackend->start();
 
-	if (pipeFd < 0) {
-		log.logFatal("Failed to open named pipe %s", pipename);
-		exit(-1);
+	while (!this->pBackend->isReady()) {
+		PosixThread::sleep(PosixThread::milliseconds, CAPTURE_READY_POLL_MS);
 	}
 
-	read(pipeFd, &pid, sizeof(pid_t));
+	StartupTimeline::getInstance().mark(STARTUP_CAPTURE_READY);
 
-	log.logDebug("Got capture process PID %d", pid);
+	watchdogPoint("capture.ready");
+
+	log.logStatus("Capture backend '%s' is ready", this->pBackend->getName());
+}
+
+void CaptureThread::getStats(CaptureStats * stats)
+{
+	pthread_mutex_lock(&this->mutex);
+
+	stats->pszBackend = this->pBackend->getName();
+	stats->pid = this->pBackend->getPID();
+	stats->intervalMs = this->intervalMs;
+	stats->burstIntervalMs = this->burstIntervalMs;
+	stats->slackMs = this->slackMs;
+	stats->burstRemaining = this->burstRemaining;
+	stats->captureCount = this->captureCount;
+	stats->manualCount = this->manualCount;
+	stats->burstCount = this->burstCount;
+	stats->lastCaptureTime = this->lastCaptureTime;
+
+	pthread_mutex_unlock(&this->mutex);
+}
+
+void * CaptureThread::run()
+{
+	bool			go = true;
+	uint64_t		now = 0;
+
+	/*
+	** The capture schedule drives a simulation...
+	*/
+	ClockAttachment	attachment;
+
+	Logger & log = Logger::getInstance();
+
+	traceSetThreadName("capture");
+
+	log.logDebug("Capture interval is %lums", this->intervalMs);
+
+	startBackend();
+
+	pthread_mutex_lock(&this->mutex);
+	scheduleCapture();
+	pthread_mutex_unlock(&this->mutex);
 
-	PosixThread::sleep(PosixThread::seconds, 10);
-	
 	while (go) {
+		pthread_mutex_lock(&this->mutex);
+
+		{
+			TRACE_SPAN("capture.wait");
+
+			/*
+			** Wait for the next scheduled capture, a manual trigger
+			** or the next shot in a burst, whichever comes first...
+			*/
+			while (1) {
+				if (this->isRestartPending) {
+					break;
+				}
+
+				if (this->isTriggerPending) {
+					this->isTriggerPending = false;
+					this->manualCount++;
+					TRACE_INSTANT("capture.manual");
+					break;
+				}
+
+				if (this->isCaptureDue) {
+					if (this->burstRemaining > 0) {
+						this->burstRemaining--;
+						this->burstCount++;
+					}
+
+					break;
+				}
+
+				Clock::getInstance().wait(&this->wakeup, &this->mutex);
+			}
+
+			now = CurrentTime::getMonotonicTime();
+		}
+
+		if (this->isRestartPending) {
+			this->isRestartPending = false;
+
+			pthread_mutex_unlock(&this->mutex);
+
+			TRACE_INSTANT("capture.restart");
+
+			startBackend();
+			continue;
+		}
+
+		this->lastCaptureTime = now;
+		this->captureCount++;
+
+		scheduleCapture();
+
+		pthread_mutex_unlock(&this->mutex);
+
 		log.logDebug("Capturing photo");
 
-		capturePhoto(pid);
+		TRACE_SPAN("capture.trigger");
 
-		PosixThread::sleep(PosixThread::seconds, frequency);
+		watchdogPoint("capture.trigger");
+
+		if (this->pBackend->trigger()) {
+			StartupTimeline::getInstance().mark(STARTUP_FIRST_TRIGGER);
+		}
+		else {
+			log.logError("Capture backend '%s' is not running", this->pBackend->getName());
+		}
 	}
 
-	close(pipeFd);
+	return NULL;
+}
+
+FrameThread::FrameThread(CaptureBackend * pBackend) : PosixThread(true)
+{
+	this->pBackend = pBackend;
+
+	pthread_mutex_init(&this->mutex, NULL);
+
+	memset(&this->stats, 0, sizeof(FrameStats));
+}
+
+FrameThread::~FrameThread()
+{
+	pthread_mutex_destroy(&this->mutex);
+}
+
+void FrameThread::addListener(FrameListener * listener)
+{
+	pthread_mutex_lock(&this->mutex);
+	this->listeners.push_back(listener);
+	pthread_mutex_unlock(&this->mutex);
+}
+
+void FrameThread::getStats(FrameStats * stats)
+{
+	pthread_mutex_lock(&this->mutex);
+	memcpy(stats, &this->stats, sizeof(FrameStats));
+	pthread_mutex_unlock(&this->mutex);
+}
+
+void FrameThread::frameCompleted(CaptureFrame * frame)
+{
+	Logger & log = Logger::getInstance();
+
+	TRACE_SPAN("frameCompleted");
+
+	pthread_mutex_lock(&this->mutex);
+
+	this->stats.frameCount++;
+	this->stats.lastSequence = frame->sequence;
+	this->stats.totalBytes += (uint64_t)frame->size;
+	this->stats.lastFrameTime = frame->completedTime;
+
+	/*
+	** Free running frames have no trigger to measure from...
+	*/
+	if (frame->triggerTime > 0 && frame->completedTime >= frame->triggerTime) {
+		uint64_t latency = frame->completedTime - frame->triggerTime;
+
+		this->stats.totalLatency += latency;
+		this->stats.latencyCount++;
+
+		if (latency > this->stats.maxLatency) {
+			this->stats.maxLatency = latency;
+		}
+	}
+
+	pthread_mutex_unlock(&this->mutex);
+
+	StartupTimeline::getInstance().mark(STARTUP_FIRST_FRAME);
+
+	log.logDebug("Frame %u complete: %s, %ld bytes", frame->sequence, frame->szPath, (long)frame->size);
+
+	for (auto it = this->listeners.begin(); it != this->listeners.end(); ++it) {
+		TRACE_SPAN("frame.listener");
+		(*it)->frameAvailable(*frame);
+	}
+
+	this->pipeline.submit(*frame);
+}
+
+void * FrameThread::run()
+{
+	struct pollfd	pfd;
+	CaptureFrame	frame;
+	int				rtn;
+
+	pfd.fd = this->pBackend->getFrameEventFd();
+	pfd.events = POLLIN;
+
+	traceSetThreadName("frame");
+
+	while (1) {
+		watchdogWait();
+
+		rtn = poll(&pfd, 1, -1);
+
+		watchdogBeat();
+
+		if (rtn < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			throw bctl_error(bctl_error::buildMsg("Failed polling for frames: %s", strerror(errno)), __FILE__, __LINE__);
+		}
+
+		while (this->pBackend->nextFrame(&frame)) {
+			frameCompleted(&frame);
+		}
+	}
 
 	return NULL;
 }
@@ -1,16 +1,145 @@
+#include <stdint.h>
+#include <pthread.h>
+#include <vector>
+
 #include "posixthread.h"
+#include "configmgr.h"
+#include "capturebackend.h"
+#include "timerwheel.h"
+#include "pipeline.h"
 
 #ifndef _INCL_THREADS
 #define _INCL_THREADS
 
-class CaptureThread : public PosixThread
+#define CAPTURE_READY_POLL_MS               10
+
+struct CaptureStats
+{
+    const char *        pszBackend;
+    pid_t               pid;
+    unsigned long       intervalMs;
+    unsigned long       burstIntervalMs;
+    unsigned long       slackMs;
+    int                 burstRemaining;
+    uint32_t            captureCount;
+    uint32_t            manualCount;
+    uint32_t            burstCount;
+    uint64_t            lastCaptureTime;
+};
+
+/*
+** Waits for the capture job on the timer wheel, a manual
+** trigger or a restart, and does the capturing. The job is
+** rescheduled after every capture and whenever the schedule
+** changes...
+*/
+class CaptureThread : public PosixThread, public ConfigListener, public TimerListener
 {
+private:
+    pthread_mutex_t     mutex;
+    pthread_cond_t      wakeup;
+
+    CaptureBackend *    pBackend = NULL;
+    TimerJob            captureJob;
+
+    unsigned long       intervalMs = 0;
+    unsigned long       burstIntervalMs = 0;
+    unsigned long       slackMs = 0;
+    int                 burstRemaining = 0;
+    bool                isCaptureDue = false;
+    bool                isTriggerPending = false;
+    bool                isRestartPending = false;
+
+    uint32_t            captureCount = 0;
+    uint32_t            manualCount = 0;
+    uint32_t            burstCount = 0;
+    uint64_t            lastCaptureTime = 0;
+
+    void                scheduleCapture();
+    void                startBackend();
+
 public:
-    CaptureThread() : PosixThread(true) {}
+    CaptureThread();
+    ~CaptureThread();
 
     void *      run();
+
+    /*
+    ** Runtime control, safe to call from any thread...
+    */
+    void        triggerNow();
+    void        startBurst(int count);
+    void        setInterval(unsigned long intervalMs);
+    void        setResolution(int width, int height);
+    void        restartCapture();
+
+    void        configChanged(ConfigKey key, const char * value);
+    void        timerExpired(TimerJob * job);
+
+    void        getStats(CaptureStats * stats);
+
+    CaptureBackend *    getBackend() {
+        return this->pBackend;
+    }
+};
+
+struct FrameStats
+{
+    uint32_t            frameCount;
+    uint32_t            lastSequence;
+    uint64_t            totalBytes;
+    uint64_t            lastFrameTime;
+    uint64_t            totalLatency;
+    uint64_t            maxLatency;
+    uint32_t            latencyCount;
+};
+
+/*
+** Collects completed frames from the capture backend, hands them
+** to each registered FrameListener, which should be quick, then
+** submits them to the pipeline for everything else...
+*/
+class FrameThread : public PosixThread
+{
+private:
+    CaptureBackend *    pBackend;
+    pthread_mutex_t     mutex;
+    FrameStats          stats;
+
+    vector<FrameListener *> listeners;
+    FramePipeline       pipeline;
+
+    void                frameCompleted(CaptureFrame * frame);
+
+public:
+    FrameThread(CaptureBackend * pBackend);
+    ~FrameThread();
+
+    void *      run();
+
+    void        addListener(FrameListener * listener);
+
+    void        getStats(FrameStats * stats);
+
+    FramePipeline &     getPipeline() {
+        return this->pipeline;
+    }
 };
 
+class ControlThread;
+class FrameCheckpoint;
+class FramePacker;
+class FrameChecksummer;
+class FramePublisher;
+class PreviewServer;
+class FrameMuxer;
+class FrameSimilarity;
+class SSDVThread;
+class GPSThread;
+class ExifTagger;
+class FlightPhaseThread;
+class ResourceThread;
+
 class ThreadManager
 {
 public:
@@ -23,10 +152,80 @@ private:
     ThreadManager() {}
 
     CaptureThread *         pCaptureThread = NULL;
+    FrameThread *           pFrameThread = NULL;
+    FrameCheckpoint *       pCheckpoint = NULL;
+    FramePacker *           pPacker = NULL;
+    FrameChecksummer *      pChecksummer = NULL;
+    FramePublisher *        pPublisher = NULL;
+    PreviewServer *         pPreviewServer = NULL;
+    FrameMuxer *            pMuxer = NULL;
+    FrameSimilarity *       pSimilarity = NULL;
+    SSDVThread *            pSSDVThread = NULL;
+    GPSThread *             pGPSThread = NULL;
+    ExifTagger *            pExifTagger = NULL;
+    FlightPhaseThread *     pFlightPhaseThread = NULL;
+    ResourceThread *        pResourceThread = NULL;
+    ControlThread *         pControlThread = NULL;
 
 public:
     void                    startThreads();
     void                    killThreads();
+
+    CaptureThread *         getCaptureThread() {
+        return this->pCaptureThread;
+    }
+
+    FrameThread *           getFrameThread() {
+        return this->pFrameThread;
+    }
+
+    FrameChecksummer *      getChecksummer() {
+        return this->pChecksummer;
+    }
+
+    FramePublisher *        getPublisher() {
+        return this->pPublisher;
+    }
+
+    PreviewServer *         getPreviewServer() {
+        return this->pPreviewServer;
+    }
+
+    FrameMuxer *            getMuxer() {
+        return this->pMuxer;
+    }
+
+    FrameSimilarity *       getSimilarity() {
+        return this->pSimilarity;
+    }
+
+    SSDVThread *            getSSDVThread() {
+        return this->pSSDVThread;
+    }
+
+    GPSThread *             getGPSThread() {
+        return this->pGPSThread;
+    }
+
+    ExifTagger *            getExifTagger() {
+        return this->pExifTagger;
+    }
+
+    FlightPhaseThread *     getFlightPhaseThread() {
+        return this->pFlightPhaseThread;
+    }
+
+    ResourceThread *        getResourceThread() {
+        return this->pResourceThread;
+    }
+
+    FramePacker *           getFramePacker() {
+        return this->pPacker;
+    }
+
+    ControlThread *         getControlThread() {
+        return this->pControlThread;
+    }
 };
 
 #endif
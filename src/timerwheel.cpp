@@ -0,0 +1,601 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+#include "logger.h"
+#include "bctl_error.h"
+#include "clock.h"
+#include "trace.h"
+#include "watchdog.h"
+#include "timerwheel.h"
+
+using namespace std;
+
+static inline int getLevelShift(int level)
+{
+	return level * TIMER_LEVEL_BITS;
+}
+
+/*
+** The tick a job fires on, never before its due time. With
+** some slack, it's rounded up to the coarsest power of 2
+** ticks that's still within the slack, so jobs with similar
+** due times end up on the same tick...
+*/
+static uint64_t getExpiryTick(uint64_t dueTime, uint64_t slack)
+{
+	uint64_t		first = (dueTime + TIMER_TICK_US - 1) / TIMER_TICK_US;
+	uint64_t		last = (dueTime + slack) / TIMER_TICK_US;
+	uint64_t		tick = first;
+	uint64_t		align;
+	uint64_t		rounded;
+
+	for (align = 2;align < TIMER_MAX_TICKS;align <<= 1) {
+		rounded = (first + align - 1) & ~(align - 1);
+
+		if (rounded > last) {
+			break;
+		}
+
+		tick = rounded;
+	}
+
+	return tick;
+}
+
+TimerWheel::TimerWheel() : PosixThread(true)
+{
+	int				level;
+	int				slot;
+
+	pthread_condattr_t		attr;
+
+	pthread_mutex_init(&this->mutex, NULL);
+
+	/*
+	** Only used on the virtual clock, which waits against
+	** CLOCK_MONOTONIC like the rest...
+	*/
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&this->wakeup, &attr);
+	pthread_condattr_destroy(&attr);
+
+	this->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+
+	if (this->timerFd < 0) {
+		throw bctl_error(bctl_error::buildMsg("Failed to create timer: %s", strerror(errno)), __FILE__, __LINE__);
+	}
+
+	this->stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (this->stopFd < 0) {
+		throw bctl_error(bctl_error::buildMsg("Failed to create eventfd: %s", strerror(errno)), __FILE__, __LINE__);
+	}
+
+	/*
+	** Each slot is the head of a circular list...
+	*/
+	for (level = 0;level < TIMER_LEVELS;level++) {
+		for (slot = 0;slot < TIMER_SLOTS;slot++) {
+			this->slots[level][slot].next = &this->slots[level][slot];
+			this->slots[level][slot].prev = &this->slots[level][slot];
+		}
+
+		this->occupied[level] = 0ULL;
+	}
+
+	memset(&this->stats, 0, sizeof(TimerStats));
+
+	this->nextTick = Clock::getInstance().getMonotonicTime() / TIMER_TICK_US;
+	this->armedTick = CLOCK_FOREVER;
+}
+
+TimerWheel::~TimerWheel()
+{
+	close(this->stopFd);
+	close(this->timerFd);
+
+	pthread_cond_destroy(&this->wakeup);
+	pthread_mutex_destroy(&this->mutex);
+}
+
+/*
+** Into the lowest level whose span covers it, relative to the
+** next tick to be processed...
+*/
+void TimerWheel::link(TimerJob * job)
+{
+	TimerJob *		head;
+	uint64_t		tick = job->expiryTick;
+	uint64_t		delta;
+	int				level = 0;
+
+	if (tick < this->nextTick) {
+		tick = this->nextTick;
+	}
+
+	delta = tick - this->nextTick;
+
+	if (delta >= TIMER_MAX_TICKS) {
+		tick = this->nextTick + TIMER_MAX_TICKS - 1;
+		delta = TIMER_MAX_TICKS - 1;
+	}
+
+	while (level < TIMER_LEVELS - 1 && delta >= (1ULL << getLevelShift(level + 1))) {
+		level++;
+	}
+
+	job->level = level;
+	job->slot = (int)((tick >> getLevelShift(level)) & TIMER_SLOT_MASK);
+
+	head = &this->slots[level][job->slot];
+
+	job->next = head;
+	job->prev = head->prev;
+	head->prev->next = job;
+	head->prev = job;
+
+	this->occupied[level] |= (1ULL << job->slot);
+
+	this->stats.levelCount[level]++;
+	this->stats.scheduledCount++;
+
+	if (this->stats.scheduledCount > this->stats.maxScheduledCount) {
+		this->stats.maxScheduledCount = this->stats.scheduledCount;
+	}
+}
+
+void TimerWheel::unlink(TimerJob * job)
+{
+	TimerJob *		head = &this->slots[job->level][job->slot];
+
+	job->prev->next = job->next;
+	job->next->prev = job->prev;
+	job->next = NULL;
+	job->prev = NULL;
+
+	if (head->next == head) {
+		this->occupied[job->level] &= ~(1ULL << job->slot);
+	}
+
+	this->stats.levelCount[job->level]--;
+	this->stats.scheduledCount--;
+}
+
+/*
+** A slot's time has come round, move its jobs down a level
+** or more. The list is taken off the slot first, as a job due
+** a whole turn later goes straight back into it...
+*/
+void TimerWheel::cascade(int level, int slot)
+{
+	TimerJob *		head = &this->slots[level][slot];
+	TimerJob *		job;
+	TimerJob *		next;
+
+	if (head->next == head) {
+		return;
+	}
+
+	job = head->next;
+	head->prev->next = NULL;
+
+	head->next = head;
+	head->prev = head;
+	this->occupied[level] &= ~(1ULL << slot);
+
+	while (job != NULL) {
+		next = job->next;
+
+		this->stats.levelCount[level]--;
+		this->stats.scheduledCount--;
+
+		link(job);
+
+		job = next;
+	}
+
+	this->stats.cascadeCount++;
+}
+
+/*
+** Fire everything in a bottom level slot. Listeners are called
+** without the mutex, so they may schedule and cancel, which is
+** why the slot is looked at afresh after each one...
+*/
+void TimerWheel::expire(int slot, uint64_t now)
+{
+	TimerJob *		head = &this->slots[0][slot];
+	TimerJob *		job;
+	uint64_t		deadline;
+	uint64_t		delay;
+	uint64_t		lateness;
+
+	while (head->next != head) {
+		job = head->next;
+
+		unlink(job);
+
+		/*
+		** The delay includes any slack the job allowed, it's
+		** only late once past the end of the tick it was put on...
+		*/
+		deadline = (job->expiryTick + 1) * TIMER_TICK_US;
+
+		delay = (now > job->dueTime ? now - job->dueTime : 0ULL);
+		lateness = (now > deadline ? now - deadline : 0ULL);
+
+		this->stats.expiredCount++;
+		this->stats.totalDelay += delay;
+
+		if (delay > this->stats.maxDelay) {
+			this->stats.maxDelay = delay;
+		}
+
+		if (lateness > 0) {
+			this->stats.lateCount++;
+			this->stats.totalLateness += lateness;
+
+			if (lateness > this->stats.maxLateness) {
+				this->stats.maxLateness = lateness;
+			}
+		}
+
+		/*
+		** Periodic jobs keep to their own schedule, missing
+		** any they were too late for rather than catching up...
+		*/
+		if (job->period > 0) {
+			job->dueTime += job->period;
+
+			if (job->dueTime <= now) {
+				job->dueTime += ((now - job->dueTime) / job->period + 1) * job->period;
+			}
+
+			job->expiryTick = getExpiryTick(job->dueTime, job->slack);
+
+			link(job);
+		}
+
+		if (job->pSleeper != NULL) {
+			job->isExpired = true;
+			Clock::getInstance().signal(job->pSleeper);
+		}
+		else if (job->listener != NULL) {
+			pthread_mutex_unlock(&this->mutex);
+
+			job->listener->timerExpired(job);
+
+			pthread_mutex_lock(&this->mutex);
+		}
+	}
+}
+
+/*
+** The next tick with something to do, expiring a job or
+** cascading a slot down. The occupied bitmaps mean empty
+** slots cost nothing, however long the wait...
+*/
+uint64_t TimerWheel::findNextTick()
+{
+	uint64_t		nextTick = CLOCK_FOREVER;
+	uint64_t		current;
+	uint64_t		tick;
+	uint64_t		bits;
+	int				distance;
+	int				shift;
+	int				level;
+
+	for (level = 0;level < TIMER_LEVELS;level++) {
+		if (this->occupied[level] == 0ULL) {
+			continue;
+		}
+
+		shift = getLevelShift(level);
+		current = this->nextTick >> shift;
+
+		/*
+		** Rotate so the current slot is bit 0, the first
+		** set bit is then the distance to the next slot...
+		*/
+		distance = (int)(current & TIMER_SLOT_MASK);
+		bits = this->occupied[level];
+
+		if (distance > 0) {
+			bits = (bits >> distance) | (bits << (TIMER_SLOTS - distance));
+		}
+
+		tick = (current + (uint64_t)__builtin_ctzll(bits)) << shift;
+
+		/*
+		** Part way through the current slot, so it must be
+		** waiting for the next time round...
+		*/
+		if (tick < this->nextTick) {
+			tick += (1ULL << (shift + TIMER_LEVEL_BITS));
+		}
+
+		if (tick < nextTick) {
+			nextTick = tick;
+		}
+	}
+
+	return nextTick;
+}
+
+void TimerWheel::advance(uint64_t now)
+{
+	uint64_t		nowTick = now / TIMER_TICK_US;
+	uint64_t		tick;
+	int				level;
+
+	while ((tick = findNextTick()) <= nowTick) {
+		this->nextTick = tick;
+
+		/*
+		** From the top, a job cascaded from one level may
+		** land in the slot cascading from the next...
+		*/
+		for (level = TIMER_LEVELS - 1;level > 0;level--) {
+			if ((tick & ((1ULL << getLevelShift(level)) - 1)) == 0) {
+				cascade(level, (int)((tick >> getLevelShift(level)) & TIMER_SLOT_MASK));
+			}
+		}
+
+		this->nextTick = tick + 1;
+
+		expire((int)(tick & TIMER_SLOT_MASK), now);
+	}
+
+	/*
+	** Nothing is due before the next tick, so it's safe to
+	** skip the ticks in between...
+	*/
+	if (this->nextTick <= nowTick) {
+		this->nextTick = nowTick + 1;
+	}
+}
+
+void TimerWheel::arm(uint64_t tick)
+{
+	struct itimerspec		its;
+	uint64_t				t;
+
+	this->armedTick = tick;
+
+	Clock & clock = Clock::getInstance();
+
+	if (clock.isVirtual()) {
+		clock.signal(&this->wakeup);
+		return;
+	}
+
+	/*
+	** All zero disarms it...
+	*/
+	memset(&its, 0, sizeof(struct itimerspec));
+
+	if (tick != CLOCK_FOREVER) {
+		t = tick * TIMER_TICK_US;
+
+		its.it_value.tv_sec = (time_t)(t / 1000000ULL);
+		its.it_value.tv_nsec = (long)((t % 1000000ULL) * 1000ULL);
+	}
+
+	if (timerfd_settime(this->timerFd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		Logger::getInstance().logError("Failed to set timer: %s", strerror(errno));
+	}
+}
+
+void TimerWheel::add(TimerJob * job, uint64_t dueTime, uint64_t period, uint64_t slack)
+{
+	uint64_t		now = Clock::getInstance().getMonotonicTime();
+
+	if (job->isScheduled()) {
+		unlink(job);
+	}
+
+	/*
+	** Already due, it's only late from now on...
+	*/
+	if (dueTime < now) {
+		dueTime = now;
+	}
+
+	job->dueTime = dueTime;
+	job->period = period;
+	job->slack = slack;
+	job->isExpired = false;
+	job->expiryTick = getExpiryTick(dueTime, slack);
+
+	link(job);
+
+	/*
+	** Earlier than the wheel is waiting for...
+	*/
+	if (job->expiryTick < this->armedTick) {
+		arm(job->expiryTick > this->nextTick ? job->expiryTick : this->nextTick);
+	}
+}
+
+void TimerWheel::schedule(TimerJob * job, uint64_t dueTime, uint64_t period, uint64_t slack)
+{
+	pthread_mutex_lock(&this->mutex);
+	add(job, dueTime, period, slack);
+	pthread_mutex_unlock(&this->mutex);
+}
+
+void TimerWheel::scheduleIn(TimerJob * job, uint64_t delay, uint64_t period, uint64_t slack)
+{
+	schedule(job, Clock::getInstance().getMonotonicTime() + delay, period, slack);
+}
+
+void TimerWheel::cancel(TimerJob * job)
+{
+	pthread_mutex_lock(&this->mutex);
+
+	if (job->isScheduled()) {
+		unlink(job);
+		this->stats.cancelledCount++;
+	}
+
+	pthread_mutex_unlock(&this->mutex);
+}
+
+void TimerWheel::sleep(uint64_t us, uint64_t slack)
+{
+	pthread_cond_t		sleeper;
+	TimerJob			job;
+
+	Clock & clock = Clock::getInstance();
+
+	pthread_mutex_lock(&this->mutex);
+
+	if (!this->isRunning) {
+		pthread_mutex_unlock(&this->mutex);
+
+		clock.sleep(us);
+		return;
+	}
+
+	pthread_cond_init(&sleeper, NULL);
+
+	job.pSleeper = &sleeper;
+
+	add(&job, clock.getMonotonicTime() + us, 0, slack);
+
+	/*
+	** The wheel signals with the mutex held, so the job
+	** and condition on the stack are safe to go once we
+	** have it back...
+	*/
+	while (!job.isExpired) {
+		clock.wait(&sleeper, &this->mutex);
+	}
+
+	pthread_mutex_unlock(&this->mutex);
+
+	pthread_cond_destroy(&sleeper);
+}
+
+void TimerWheel::getStats(TimerStats * stats)
+{
+	pthread_mutex_lock(&this->mutex);
+	memcpy(stats, &this->stats, sizeof(TimerStats));
+	pthread_mutex_unlock(&this->mutex);
+}
+
+void * TimerWheel::run()
+{
+	struct pollfd	pfd[2];
+	uint64_t		expirations;
+	uint64_t		tick;
+	ssize_t			rtn;
+
+	/*
+	** The wheel drives a simulation, as everything timed
+	** waits on it...
+	*/
+	ClockAttachment	attachment;
+
+	Clock & clock = Clock::getInstance();
+	Logger & log = Logger::getInstance();
+
+	/*
+	** The daemon's main thread keeps its name...
+	*/
+	if ((pid_t)syscall(SYS_gettid) != getpid()) {
+		traceSetThreadName("timer");
+	}
+
+	/*
+	** Jobs expire on this thread, a stuck one holds up all the
+	** rest...
+	*/
+	Watchdog::getInstance().attach(this, 0);
+
+	pfd[0].fd = this->timerFd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = this->stopFd;
+	pfd[1].events = POLLIN;
+
+	pthread_mutex_lock(&this->mutex);
+
+	this->isRunning = true;
+
+	while (1) {
+		{
+			TRACE_SPAN("timer.expire");
+			advance(clock.getMonotonicTime());
+		}
+
+		tick = findNextTick();
+
+		if (clock.isVirtual()) {
+			this->armedTick = tick;
+
+			clock.waitUntil(&this->wakeup, &this->mutex, (tick == CLOCK_FOREVER ? CLOCK_FOREVER : tick * TIMER_TICK_US));
+		}
+		else {
+			arm(tick);
+
+			pthread_mutex_unlock(&this->mutex);
+
+			/*
+			** Re-arming it from another thread moves this on,
+			** earlier or later...
+			*/
+			watchdogWait();
+
+			rtn = poll(pfd, 2, -1);
+
+			watchdogBeat();
+
+			if (rtn < 0 && errno != EINTR) {
+				log.logError("Failed polling timer: %s", strerror(errno));
+			}
+
+			pthread_mutex_lock(&this->mutex);
+
+			if (rtn > 0 && (pfd[1].revents & POLLIN)) {
+				break;
+			}
+
+			if (rtn > 0 && (pfd[0].revents & POLLIN)) {
+				rtn = read(this->timerFd, &expirations, sizeof(expirations));
+
+				if (rtn < 0 && errno != EINTR && errno != EAGAIN) {
+					log.logError("Failed reading timer: %s", strerror(errno));
+				}
+			}
+		}
+
+		this->stats.wakeupCount++;
+	}
+
+	/*
+	** Anyone sleeping from here on sleeps on the clock...
+	*/
+	this->isRunning = false;
+
+	pthread_mutex_unlock(&this->mutex);
+
+	Watchdog::getInstance().detach();
+
+	return NULL;
+}
+
+void TimerWheel::requestStop()
+{
+	uint64_t		one = 1;
+
+	write(this->stopFd, &one, sizeof(one));
+}
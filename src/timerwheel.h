@@ -0,0 +1,167 @@
+#include <stdint.h>
+#include <pthread.h>
+
+#include "posixthread.h"
+
+#ifndef _INCL_TIMERWHEEL
+#define _INCL_TIMERWHEEL
+
+/*
+** Four levels of 64 slots, 1ms a tick at the bottom, each
+** level 64 times coarser than the one below. That covers
+** about 4.6 hours, anything further out is parked in the top
+** level and placed again as it comes round...
+*/
+#define TIMER_TICK_US                       1000ULL
+#define TIMER_LEVELS                        4
+#define TIMER_LEVEL_BITS                    6
+#define TIMER_SLOTS                         (1 << TIMER_LEVEL_BITS)
+#define TIMER_SLOT_MASK                     (TIMER_SLOTS - 1)
+#define TIMER_MAX_TICKS                     (1ULL << (TIMER_LEVELS * TIMER_LEVEL_BITS))
+
+class TimerJob;
+
+class TimerListener
+{
+public:
+    virtual ~TimerListener() {}
+
+    /*
+    ** Called on the wheel's thread, without any lock held.
+    ** Keep it short, hand anything long to another thread...
+    */
+    virtual void        timerExpired(TimerJob * job) = 0;
+};
+
+/*
+** A job is owned by whoever schedules it and linked straight
+** into its slot, so scheduling and cancelling are O(1) and
+** never allocate...
+*/
+class TimerJob
+{
+    friend class TimerWheel;
+
+private:
+    TimerJob *          next = NULL;
+    TimerJob *          prev = NULL;
+
+    TimerListener *     listener;
+    pthread_cond_t *    pSleeper = NULL;
+    bool                isExpired = false;
+    int                 level = 0;
+    int                 slot = 0;
+
+    uint64_t            dueTime = 0;
+    uint64_t            period = 0;
+    uint64_t            slack = 0;
+    uint64_t            expiryTick = 0;
+
+public:
+    TimerJob(TimerListener * listener = NULL) {
+        this->listener = listener;
+    }
+
+    bool                isScheduled() {
+        return (this->prev != NULL);
+    }
+
+    uint64_t            getDueTime() {
+        return this->dueTime;
+    }
+};
+
+struct TimerStats
+{
+    uint32_t            scheduledCount;
+    uint32_t            maxScheduledCount;
+    uint32_t            levelCount[TIMER_LEVELS];
+    uint64_t            expiredCount;
+    uint64_t            cancelledCount;
+    uint64_t            wakeupCount;
+    uint64_t            cascadeCount;
+    uint64_t            totalDelay;
+    uint64_t            maxDelay;
+    uint64_t            lateCount;
+    uint64_t            totalLateness;
+    uint64_t            maxLateness;
+};
+
+/*
+** All the daemon's timed work hangs off this one wheel, woken
+** by a single timerfd. Times are microseconds on the clock,
+** a simulation waits on the virtual clock instead.
+**
+** A job may fire up to slack after its due time, which lets
+** jobs that don't need to be exact share a wake up...
+*/
+class TimerWheel : public PosixThread
+{
+public:
+    static TimerWheel & getInstance() {
+        static TimerWheel instance;
+        return instance;
+    }
+
+private:
+    TimerWheel();
+
+    pthread_mutex_t     mutex;
+    pthread_cond_t      wakeup;
+    int                 timerFd;
+    int                 stopFd;
+    bool                isRunning = false;
+
+    uint64_t            nextTick;
+    uint64_t            armedTick;
+
+    TimerJob            slots[TIMER_LEVELS][TIMER_SLOTS];
+    uint64_t            occupied[TIMER_LEVELS];
+
+    TimerStats          stats;
+
+    /*
+    ** All of these must be called with the mutex held...
+    */
+    void                add(TimerJob * job, uint64_t dueTime, uint64_t period, uint64_t slack);
+    void                link(TimerJob * job);
+    void                unlink(TimerJob * job);
+    void                cascade(int level, int slot);
+    void                expire(int slot, uint64_t now);
+    uint64_t            findNextTick();
+    void                advance(uint64_t now);
+    void                arm(uint64_t tick);
+
+public:
+    ~TimerWheel();
+
+    /*
+    ** Runs the wheel until requestStop(). The daemon's main
+    ** thread calls this, a simulation starts it as a thread...
+    */
+    void *              run();
+
+    /*
+    ** Makes run() return on the real clock. Only writes to an
+    ** eventfd, so it's safe from a signal handler...
+    */
+    void                requestStop();
+
+    /*
+    ** (Re)schedule a job due at dueTime, then every period
+    ** after that if period isn't 0...
+    */
+    void                schedule(TimerJob * job, uint64_t dueTime, uint64_t period, uint64_t slack);
+    void                scheduleIn(TimerJob * job, uint64_t delay, uint64_t period, uint64_t slack);
+    void                cancel(TimerJob * job);
+
+    /*
+    ** Block the calling thread for us on the wheel, or on
+    ** the clock if nothing is running the wheel yet...
+    */
+    void                sleep(uint64_t us, uint64_t slack);
+
+    void                getStats(TimerStats * stats);
+};
+
+#endif
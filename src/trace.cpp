@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+#include <vector>
+
+#include "trace.h"
+
+using namespace std;
+
+atomic<bool>						isTraceEnabled(false);
+
+static thread_local TraceBuffer *	pThreadBuffer = NULL;
+static thread_local char			szThreadName[TRACE_THREAD_NAME_LENGTH];
+
+/*
+** Nanoseconds on the real monotonic clock, a trace is about
+** where the time really went, even in a simulation...
+*/
+uint64_t traceGetTime()
+{
+	struct timespec		ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+void traceRecord(const char * pszName, char phase, uint64_t timestamp, uint64_t duration)
+{
+	TraceBuffer *	b = pThreadBuffer;
+	TraceEvent *	e;
+	uint64_t		head;
+
+	/*
+	** A thread's first event sets up its ring...
+	*/
+	if (b == NULL) {
+		b = Tracer::getInstance().createBuffer(szThreadName);
+
+		if (b == NULL) {
+			return;
+		}
+
+		pThreadBuffer = b;
+	}
+
+	head = b->head.load(memory_order_relaxed);
+
+	e = &b->events[head & b->mask];
+
+	e->timestamp = timestamp;
+	e->duration = duration;
+	e->pszName = pszName;
+	e->phase = phase;
+
+	b->head.store(head + 1, memory_order_release);
+}
+
+void traceSetThreadName(const char * pszName)
+{
+	snprintf(szThreadName, TRACE_THREAD_NAME_LENGTH, "%s", pszName);
+
+	/*
+	** The kernel's name too, for top -H and the resource
+	** sampler, but not the main thread's, that's the process
+	** name...
+	*/
+	if ((pid_t)syscall(SYS_gettid) != getpid()) {
+		pthread_setname_np(pthread_self(), szThreadName);
+	}
+
+	if (pThreadBuffer != NULL) {
+		snprintf(pThreadBuffer->szName, TRACE_THREAD_NAME_LENGTH, "%s", pszName);
+	}
+}
+
+Tracer::Tracer()
+{
+	pthread_mutex_init(&this->mutex, NULL);
+
+	memset(this->buffers, 0, sizeof(this->buffers));
+
+	this->numBuffers.store(0, memory_order_relaxed);
+	this->bufferLength.store(16384, memory_order_relaxed);
+}
+
+Tracer::~Tracer()
+{
+	pthread_mutex_destroy(&this->mutex);
+}
+
+void Tracer::enable(bool isEnabled)
+{
+	isTraceEnabled.store(isEnabled, memory_order_relaxed);
+}
+
+void Tracer::setBufferLength(uint32_t length)
+{
+	uint32_t	l = TRACE_MIN_BUFFER_LENGTH;
+
+	while (l < length && l < TRACE_MAX_BUFFER_LENGTH) {
+		l <<= 1;
+	}
+
+	this->bufferLength.store(l, memory_order_relaxed);
+}
+
+/*
+** Buffers live for the life of the process, a thread that
+** exits may still have events worth exporting...
+*/
+TraceBuffer * Tracer::createBuffer(const char * pszName)
+{
+	TraceBuffer *	b;
+	uint32_t		length = this->bufferLength.load(memory_order_relaxed);
+	int				n;
+
+	pthread_mutex_lock(&this->mutex);
+
+	n = this->numBuffers.load(memory_order_relaxed);
+
+	if (n == TRACE_MAX_THREADS) {
+		pthread_mutex_unlock(&this->mutex);
+		return NULL;
+	}
+
+	b = new TraceBuffer;
+
+	b->tid = (pid_t)syscall(SYS_gettid);
+	b->head.store(0, memory_order_relaxed);
+	b->mask = length - 1;
+	b->events = new TraceEvent[length];
+
+	if (pszName[0] != 0) {
+		snprintf(b->szName, TRACE_THREAD_NAME_LENGTH, "%s", pszName);
+	}
+	else {
+		snprintf(b->szName, TRACE_THREAD_NAME_LENGTH, "thread %d", (int)b->tid);
+	}
+
+	this->buffers[n] = b;
+	this->numBuffers.store(n + 1, memory_order_release);
+
+	pthread_mutex_unlock(&this->mutex);
+
+	return b;
+}
+
+/*
+** Copy out whatever survives in a ring. Anything the owner
+** may have overwritten during the copy is dropped, returns
+** the number lost to wrapping...
+*/
+static uint64_t copyEvents(TraceBuffer * b, vector<TraceEvent> & events)
+{
+	uint64_t		head;
+	uint64_t		first;
+	uint64_t		i;
+	uint64_t		capacity = (uint64_t)b->mask + 1;
+	size_t			start = events.size();
+
+	head = b->head.load(memory_order_acquire);
+	first = (head > capacity ? head - capacity : 0);
+
+	for (i = first;i < head;i++) {
+		events.push_back(b->events[i & b->mask]);
+	}
+
+	atomic_thread_fence(memory_order_acquire);
+
+	uint64_t after = b->head.load(memory_order_relaxed);
+
+	if (after > capacity && after - capacity > first) {
+		uint64_t lost = after - capacity - first;
+
+		if (lost > head - first) {
+			lost = head - first;
+		}
+
+		events.erase(events.begin() + start, events.begin() + start + lost);
+
+		first += lost;
+	}
+
+	return first;
+}
+
+bool Tracer::getLastEvent(pid_t tid, TraceEvent * event)
+{
+	uint64_t		head;
+	uint64_t		capacity;
+	int				numThreads;
+	int				i;
+
+	numThreads = this->numBuffers.load(memory_order_acquire);
+
+	for (i = 0;i < numThreads;i++) {
+		TraceBuffer * b = this->buffers[i];
+
+		if (b->tid != tid) {
+			continue;
+		}
+
+		head = b->head.load(memory_order_acquire);
+		capacity = (uint64_t)b->mask + 1;
+
+		if (head == 0) {
+			return false;
+		}
+
+		*event = b->events[(head - 1) & b->mask];
+
+		atomic_thread_fence(memory_order_acquire);
+
+		/*
+		** The owner lapped the ring while we copied...
+		*/
+		if (b->head.load(memory_order_relaxed) - head >= capacity - 1) {
+			return false;
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+int Tracer::writeJSON(const char * pszPath)
+{
+	vector<TraceEvent>	events;
+	FILE *				fptr;
+	pid_t				pid = getpid();
+	bool				isFirst = true;
+	int					numThreads;
+	int					i;
+
+	fptr = fopen(pszPath, "wt");
+
+	if (fptr == NULL) {
+		return -1;
+	}
+
+	fprintf(fptr, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	numThreads = this->numBuffers.load(memory_order_acquire);
+
+	for (i = 0;i < numThreads;i++) {
+		TraceBuffer * b = this->buffers[i];
+
+		events.clear();
+		copyEvents(b, events);
+
+		fprintf(
+			fptr,
+			"%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			(isFirst ? "" : ",\n"),
+			(int)pid,
+			(int)b->tid,
+			b->szName);
+
+		isFirst = false;
+
+		for (auto e = events.begin(); e != events.end(); ++e) {
+			if (e->phase == 'X') {
+				fprintf(
+					fptr,
+					",\n{\"name\":\"%s\",\"cat\":\"bctl\",\"ph\":\"X\",\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"pid\":%d,\"tid\":%d}",
+					e->pszName,
+					(unsigned long long)(e->timestamp / 1000ULL),
+					(unsigned)(e->timestamp % 1000ULL),
+					(unsigned long long)(e->duration / 1000ULL),
+					(unsigned)(e->duration % 1000ULL),
+					(int)pid,
+					(int)b->tid);
+			}
+			else {
+				fprintf(
+					fptr,
+					",\n{\"name\":\"%s\",\"cat\":\"bctl\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%llu.%03u,\"pid\":%d,\"tid\":%d}",
+					e->pszName,
+					(unsigned long long)(e->timestamp / 1000ULL),
+					(unsigned)(e->timestamp % 1000ULL),
+					(int)pid,
+					(int)b->tid);
+			}
+		}
+	}
+
+	fprintf(fptr, "\n]}\n");
+
+	if (fclose(fptr) != 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+void Tracer::getStats(TraceStats * stats)
+{
+	uint64_t		head;
+	uint64_t		capacity;
+	int				i;
+
+	memset(stats, 0, sizeof(TraceStats));
+
+	stats->isEnabled = isTraceEnabled.load(memory_order_relaxed);
+	stats->numThreads = this->numBuffers.load(memory_order_acquire);
+	stats->bufferLength = this->bufferLength.load(memory_order_relaxed);
+
+	for (i = 0;i < stats->numThreads;i++) {
+		head = this->buffers[i]->head.load(memory_order_relaxed);
+		capacity = (uint64_t)this->buffers[i]->mask + 1;
+
+		stats->eventCount += head;
+		stats->overwrittenCount += (head > capacity ? head - capacity : 0);
+	}
+}
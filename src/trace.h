@@ -0,0 +1,151 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <atomic>
+
+#ifndef _INCL_TRACE
+#define _INCL_TRACE
+
+#define TRACE_MAX_THREADS                   32
+#define TRACE_THREAD_NAME_LENGTH            16
+#define TRACE_MIN_BUFFER_LENGTH             256
+#define TRACE_MAX_BUFFER_LENGTH             1048576
+
+/*
+** One event in a thread's ring, names must be string
+** literals, they're stored as pointers...
+*/
+struct TraceEvent
+{
+    uint64_t            timestamp;
+    uint64_t            duration;
+    const char *        pszName;
+    char                phase;
+};
+
+/*
+** A thread's ring of events. Only the owning thread writes
+** it, the head is published with release ordering and the
+** exporter drops anything that may have been overwritten
+** while it was copying...
+*/
+struct TraceBuffer
+{
+    pid_t               tid;
+    char                szName[TRACE_THREAD_NAME_LENGTH];
+    std::atomic<uint64_t> head;
+    uint32_t            mask;
+    TraceEvent *        events;
+};
+
+struct TraceStats
+{
+    bool                isEnabled;
+    int                 numThreads;
+    uint32_t            bufferLength;
+    uint64_t            eventCount;
+    uint64_t            overwrittenCount;
+};
+
+/*
+** Tested inline by every span, so a disabled tracer costs
+** a relaxed load and a branch...
+*/
+extern std::atomic<bool>    isTraceEnabled;
+
+uint64_t    traceGetTime();
+void        traceRecord(const char * pszName, char phase, uint64_t timestamp, uint64_t duration);
+
+/*
+** Names the calling thread in the trace and, apart from the
+** main thread, to the kernel...
+*/
+void        traceSetThreadName(const char * pszName);
+
+class Tracer
+{
+public:
+    static Tracer & getInstance() {
+        static Tracer instance;
+        return instance;
+    }
+
+private:
+    Tracer();
+
+    pthread_mutex_t     mutex;
+    TraceBuffer *       buffers[TRACE_MAX_THREADS];
+    std::atomic<int>    numBuffers;
+    std::atomic<uint32_t> bufferLength;
+
+public:
+    ~Tracer();
+
+    void                enable(bool isEnabled);
+
+    /*
+    ** Events per thread, rounded up to a power of 2. Only
+    ** applies to threads that haven't traced yet...
+    */
+    void                setBufferLength(uint32_t length);
+
+    TraceBuffer *       createBuffer(const char * pszName);
+
+    /*
+    ** The last event a thread recorded, false if it never
+    ** has...
+    */
+    bool                getLastEvent(pid_t tid, TraceEvent * event);
+
+    /*
+    ** Chrome trace event JSON, loads in Perfetto or
+    ** chrome://tracing...
+    */
+    int                 writeJSON(const char * pszPath);
+
+    void                getStats(TraceStats * stats);
+};
+
+/*
+** Records a complete event covering the lifetime of the
+** span...
+*/
+class TraceSpan
+{
+private:
+    const char *        pszName;
+    uint64_t            startTime;
+
+public:
+    TraceSpan(const char * pszName) {
+        if (isTraceEnabled.load(std::memory_order_relaxed)) {
+            this->pszName = pszName;
+            this->startTime = traceGetTime();
+        }
+        else {
+            this->pszName = NULL;
+        }
+    }
+
+    ~TraceSpan() {
+        if (this->pszName != NULL) {
+            traceRecord(this->pszName, 'X', this->startTime, traceGetTime() - this->startTime);
+        }
+    }
+};
+
+#define TRACE_CONCAT_(a, b)                 a##b
+#define TRACE_CONCAT(a, b)                  TRACE_CONCAT_(a, b)
+
+#define TRACE_SPAN(name)                    TraceSpan TRACE_CONCAT(_traceSpan, __LINE__)(name)
+
+#define TRACE_INSTANT(name) \
+    do { \
+        if (isTraceEnabled.load(std::memory_order_relaxed)) { \
+            traceRecord((name), 'i', traceGetTime(), 0); \
+        } \
+    } while (0)
+
+#endif
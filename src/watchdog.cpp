@@ -0,0 +1,517 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+#include "configmgr.h"
+#include "logger.h"
+#include "bctl_error.h"
+#include "currenttime.h"
+#include "clock.h"
+#include "threads.h"
+#include "resources.h"
+#include "trace.h"
+#include "watchdog.h"
+#include "bctl.h"
+
+using namespace std;
+
+thread_local Heartbeat *	pThreadHeartbeat = NULL;
+
+/*
+** Installed without SA_RESTART, all it does is make the
+** interrupted call fail with EINTR...
+*/
+static void interruptHandler(int sig)
+{
+}
+
+/*
+** Whatever the exit was doing when the grace period ran
+** out...
+*/
+static void exitHandler(int sig)
+{
+	_exit(WATCHDOG_EXIT_STATUS);
+}
+
+/*
+** Strips the trailing newline, false if the thread has
+** gone...
+*/
+static bool readThreadFile(pid_t tid, const char * pszFile, char * buffer, size_t bufferLength)
+{
+	char			szPath[64];
+	int				length;
+
+	snprintf(szPath, sizeof(szPath), "/proc/self/task/%d/%s", (int)tid, pszFile);
+
+	length = readProcFile(szPath, buffer, bufferLength);
+
+	if (length < 0) {
+		buffer[0] = 0;
+		return false;
+	}
+
+	while (length > 0 && (buffer[length - 1] == '\n' || buffer[length - 1] == ' ')) {
+		buffer[--length] = 0;
+	}
+
+	return true;
+}
+
+const char * getWatchdogActionName(WatchdogAction action)
+{
+	switch (action) {
+		case watchdog_log:
+			return "log";
+
+		case watchdog_thread:
+			return "thread";
+
+		case watchdog_capture:
+			return "capture";
+
+		case watchdog_exit:
+			return "exit";
+	}
+
+	return "unknown";
+}
+
+Watchdog::Watchdog() : PosixThread(false)
+{
+	int				i;
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	pthread_mutex_init(&this->mutex, NULL);
+
+	memset(&this->stats, 0, sizeof(WatchdogStats));
+
+	for (i = 0;i < WATCHDOG_MAX_THREADS;i++) {
+		Heartbeat * h = &this->heartbeats[i];
+
+		h->beat.store(0, memory_order_relaxed);
+		h->pszPoint.store(NULL, memory_order_relaxed);
+		h->count = 0;
+		h->isAttached = false;
+		h->tid = 0;
+		h->pThread = NULL;
+		h->deadline = 0;
+		h->lastBeat = 0;
+		h->lastChangeTime = 0;
+		h->stepTime = 0;
+		h->level = 0;
+		h->isStalled = false;
+		h->stallCount = 0;
+	}
+
+	/*
+	** Nothing is watched when simulating, the threads run on
+	** virtual time...
+	*/
+	this->isEnabled = (cfg.getValueAsBoolean(CFG_WATCHDOG_ENABLE) && !Clock::getInstance().isVirtual());
+
+	readConfig();
+
+	cfg.subscribe(CFG_WATCHDOG_TIMEOUT, this);
+	cfg.subscribe(CFG_WATCHDOG_INTERVAL, this);
+	cfg.subscribe(CFG_WATCHDOG_ACTION, this);
+}
+
+Watchdog::~Watchdog()
+{
+	pthread_mutex_destroy(&this->mutex);
+}
+
+void Watchdog::readConfig()
+{
+	WatchdogAction		action = watchdog_capture;
+	int					i;
+
+	ConfigManager & cfg = ConfigManager::getInstance();
+
+	const char * pszAction = cfg.getValue(CFG_WATCHDOG_ACTION);
+
+	for (i = watchdog_log;i <= watchdog_exit;i++) {
+		if (strcmp(pszAction, getWatchdogActionName((WatchdogAction)i)) == 0) {
+			action = (WatchdogAction)i;
+			break;
+		}
+	}
+
+	if (i > watchdog_exit) {
+		Logger::getInstance().logError("Invalid watchdog.action '%s', restarting capture at most", pszAction);
+	}
+
+	pthread_mutex_lock(&this->mutex);
+	this->stats.action = action;
+	this->stats.timeout = (uint64_t)cfg.getValueAsInteger(CFG_WATCHDOG_TIMEOUT) * 1000000ULL;
+	this->interval = (uint64_t)cfg.getValueAsInteger(CFG_WATCHDOG_INTERVAL) * 1000ULL;
+	pthread_mutex_unlock(&this->mutex);
+}
+
+void Watchdog::configChanged(ConfigKey key, const char * value)
+{
+	readConfig();
+}
+
+void Watchdog::attach(PosixThread * pThread, uint64_t deadline)
+{
+	Heartbeat *		h = NULL;
+	int				i;
+
+	/*
+	** Nobody watches the watchdog...
+	*/
+	if (!this->isEnabled || pThreadHeartbeat != NULL || pThread == this) {
+		return;
+	}
+
+	pthread_mutex_lock(&this->mutex);
+
+	for (i = 0;i < WATCHDOG_MAX_THREADS;i++) {
+		if (!this->heartbeats[i].isAttached) {
+			h = &this->heartbeats[i];
+			break;
+		}
+	}
+
+	if (h != NULL) {
+		h->count = 0;
+		h->beat.store(0, memory_order_relaxed);
+		h->pszPoint.store(NULL, memory_order_relaxed);
+		h->tid = (pid_t)syscall(SYS_gettid);
+		h->thread = pthread_self();
+		h->pThread = pThread;
+		h->deadline = deadline;
+		h->lastBeat = 0;
+		h->lastChangeTime = CurrentTime::getStopwatchTime();
+		h->stepTime = 0;
+		h->level = 0;
+		h->isStalled = false;
+		h->stallCount = 0;
+		h->isAttached = true;
+
+		this->stats.numThreads++;
+	}
+
+	pthread_mutex_unlock(&this->mutex);
+
+	if (h == NULL) {
+		Logger::getInstance().logError("Watchdog can only watch %d threads, thread %d is unwatched", WATCHDOG_MAX_THREADS, (int)syscall(SYS_gettid));
+		return;
+	}
+
+	pThreadHeartbeat = h;
+}
+
+void Watchdog::detach()
+{
+	Heartbeat * h = pThreadHeartbeat;
+
+	if (h == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&this->mutex);
+	h->isAttached = false;
+	this->stats.numThreads--;
+	pthread_mutex_unlock(&this->mutex);
+
+	pThreadHeartbeat = NULL;
+}
+
+/*
+** Called with the lock held...
+*/
+void Watchdog::reportStall(Heartbeat * h, uint64_t age)
+{
+	char			szName[WATCHDOG_NAME_LENGTH];
+	char			szWaitChannel[WATCHDOG_WCHAN_LENGTH];
+	char			szEvent[64];
+	TraceEvent		event;
+
+	Logger & log = Logger::getInstance();
+
+	const char * pszPoint = h->pszPoint.load(memory_order_relaxed);
+
+	readThreadFile(h->tid, "comm", szName, sizeof(szName));
+
+	/*
+	** Where the kernel has it blocked, "0" if it's running...
+	*/
+	if (!readThreadFile(h->tid, "wchan", szWaitChannel, sizeof(szWaitChannel)) || szWaitChannel[0] == 0) {
+		strcpy(szWaitChannel, "?");
+	}
+
+	/*
+	** Only there if tracing is, or was, enabled...
+	*/
+	if (Tracer::getInstance().getLastEvent(h->tid, &event)) {
+		snprintf(
+			szEvent,
+			sizeof(szEvent),
+			"%s %lums ago",
+			event.pszName,
+			(unsigned long)((traceGetTime() - event.timestamp) / 1000000ULL));
+	}
+	else {
+		strcpy(szEvent, "none");
+	}
+
+	log.logError(
+			"Watchdog: thread %d (%s) has stalled for %lums, deadline %lums, last at %s, last trace %s, blocked in %s",
+			(int)h->tid,
+			szName,
+			(unsigned long)(age / 1000ULL),
+			(unsigned long)((h->deadline != 0 ? h->deadline : this->stats.timeout) / 1000ULL),
+			(pszPoint != NULL ? pszPoint : "-"),
+			szEvent,
+			szWaitChannel);
+}
+
+/*
+** Called with the lock held, nothing here blocks on the
+** stalled thread...
+*/
+void Watchdog::escalate(Heartbeat * h, WatchdogAction action)
+{
+	Logger & log = Logger::getInstance();
+
+	switch (action) {
+		case watchdog_log:
+			break;
+
+		case watchdog_thread:
+			log.logStatus("Watchdog: interrupting thread %d", (int)h->tid);
+
+			pthread_kill(h->thread, SIGRTMIN);
+			this->stats.interruptCount++;
+			break;
+
+		case watchdog_capture:
+			/*
+			** Only capture can be helped by restarting capture...
+			*/
+			if (h->pThread != NULL && h->pThread == ThreadManager::getInstance().getCaptureThread()) {
+				log.logStatus("Watchdog: restarting capture");
+
+				restartCapture();
+				this->stats.captureRestartCount++;
+			}
+			break;
+
+		case watchdog_exit:
+			/*
+			** Not a clean shutdown, that may need the stalled
+			** thread. Just what we can get out in the grace
+			** period, then the status a supervisor can act on...
+			*/
+			signal(SIGALRM, &exitHandler);
+			alarm(WATCHDOG_EXIT_GRACE_S);
+
+			log.logFatal("Watchdog: thread %d is still stalled, exiting for a supervisor to restart bctl", (int)h->tid);
+
+			saveTraceOnExit();
+
+			_exit(WATCHDOG_EXIT_STATUS);
+			break;
+	}
+}
+
+/*
+** Aborting gets capture out of the backend, the restart then
+** starts it over wherever it was stuck...
+*/
+void Watchdog::restartCapture()
+{
+	CaptureThread * pCaptureThread = ThreadManager::getInstance().getCaptureThread();
+
+	pCaptureThread->getBackend()->abort();
+	pCaptureThread->restartCapture();
+}
+
+void Watchdog::check(uint64_t now)
+{
+	uint64_t		beat;
+	uint64_t		deadline;
+	uint64_t		age;
+	int				step;
+	int				i;
+
+	Logger & log = Logger::getInstance();
+
+	pthread_mutex_lock(&this->mutex);
+
+	this->stats.checkCount++;
+
+	for (i = 0;i < WATCHDOG_MAX_THREADS;i++) {
+		Heartbeat * h = &this->heartbeats[i];
+
+		if (!h->isAttached) {
+			continue;
+		}
+
+		beat = h->beat.load(memory_order_relaxed);
+		deadline = (h->deadline != 0 ? h->deadline : this->stats.timeout);
+
+		if (beat != h->lastBeat) {
+			if (h->isStalled) {
+				log.logStatus("Watchdog: thread %d has recovered after %lums", (int)h->tid, (unsigned long)((now - h->lastChangeTime) / 1000ULL));
+
+				h->isStalled = false;
+				this->stats.recoveredCount++;
+			}
+
+			h->lastBeat = beat;
+			h->lastChangeTime = now;
+		}
+
+		/*
+		** A thread we've restarted may well get stuck in the same
+		** place, so it carries on up the ladder unless it keeps
+		** going for a while...
+		*/
+		if (!h->isStalled && h->level > 0 && now - h->stepTime >= 2 * deadline) {
+			h->level = 0;
+		}
+
+		/*
+		** Waiting for work, for as long as it takes...
+		*/
+		if ((beat & 1) || now - h->lastChangeTime < deadline) {
+			continue;
+		}
+
+		if (h->isStalled && now - h->stepTime < deadline) {
+			continue;
+		}
+
+		if (!h->isStalled) {
+			h->isStalled = true;
+			h->stallCount++;
+			this->stats.stallCount++;
+		}
+
+		age = now - h->lastChangeTime;
+
+		/*
+		** A step up the ladder for each deadline it stays stalled,
+		** then the last one watchdog.action allows again and again...
+		*/
+		step = (h->level < (int)this->stats.action ? h->level : (int)this->stats.action);
+
+		reportStall(h, age);
+		escalate(h, (WatchdogAction)step);
+
+		h->level = step + 1;
+		h->stepTime = now;
+	}
+
+	pthread_mutex_unlock(&this->mutex);
+}
+
+void * Watchdog::run()
+{
+	struct sigaction	action;
+	struct timespec		due;
+	uint64_t			nextTime;
+	uint64_t			interval;
+	uint64_t			now;
+
+	Logger & log = Logger::getInstance();
+
+	traceSetThreadName("watchdog");
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = &interruptHandler;
+	sigemptyset(&action.sa_mask);
+
+	if (sigaction(SIGRTMIN, &action, NULL) < 0) {
+		throw bctl_error(bctl_error::buildMsg("Failed to install the watchdog's signal handler: %s", strerror(errno)), __FILE__, __LINE__);
+	}
+
+	pthread_mutex_lock(&this->mutex);
+	this->stats.isRunning = true;
+	interval = this->interval;
+
+	log.logStatus(
+			"Watchdog checking every %lums, deadline %lus, going as far as '%s'",
+			(unsigned long)(interval / 1000ULL),
+			(unsigned long)(this->stats.timeout / 1000000ULL),
+			getWatchdogActionName(this->stats.action));
+
+	pthread_mutex_unlock(&this->mutex);
+
+	nextTime = CurrentTime::getStopwatchTime();
+
+	while (1) {
+		/*
+		** On real time, whatever else is stuck...
+		*/
+		nextTime += interval;
+
+		if (nextTime < CurrentTime::getStopwatchTime()) {
+			nextTime = CurrentTime::getStopwatchTime() + interval;
+		}
+
+		due.tv_sec = (time_t)(nextTime / 1000000ULL);
+		due.tv_nsec = (long)((nextTime % 1000000ULL) * 1000ULL);
+
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR);
+
+		now = CurrentTime::getStopwatchTime();
+
+		check(now);
+
+		pthread_mutex_lock(&this->mutex);
+		interval = this->interval;
+		pthread_mutex_unlock(&this->mutex);
+	}
+
+	return NULL;
+}
+
+int Watchdog::getStats(WatchdogStats * stats, WatchdogThreadStats * threads, int maxThreads)
+{
+	uint64_t		now = CurrentTime::getStopwatchTime();
+	int				numThreads = 0;
+	int				i;
+
+	pthread_mutex_lock(&this->mutex);
+
+	memcpy(stats, &this->stats, sizeof(WatchdogStats));
+
+	for (i = 0;i < WATCHDOG_MAX_THREADS && numThreads < maxThreads;i++) {
+		Heartbeat * h = &this->heartbeats[i];
+
+		if (!h->isAttached) {
+			continue;
+		}
+
+		WatchdogThreadStats * t = &threads[numThreads++];
+
+		t->tid = h->tid;
+		t->pszPoint = h->pszPoint.load(memory_order_relaxed);
+		t->isWaiting = ((h->beat.load(memory_order_relaxed) & 1) != 0);
+		t->isStalled = h->isStalled;
+		t->level = h->level;
+		t->age = now - h->lastChangeTime;
+		t->deadline = (h->deadline != 0 ? h->deadline : this->stats.timeout);
+		t->stallCount = h->stallCount;
+	}
+
+	pthread_mutex_unlock(&this->mutex);
+
+	for (i = 0;i < numThreads;i++) {
+		readThreadFile(threads[i].tid, "comm", threads[i].szName, sizeof(threads[i].szName));
+	}
+
+	return numThreads;
+}
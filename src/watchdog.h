@@ -0,0 +1,116 @@
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "posixthread.h"
+#include "heartbeat.h"
+#include "configmgr.h"
+
+#ifndef _INCL_WATCHDOG
+#define _INCL_WATCHDOG
+
+#define WATCHDOG_MAX_THREADS                64
+#define WATCHDOG_NAME_LENGTH                16
+#define WATCHDOG_WCHAN_LENGTH               32
+
+/*
+** Getting the log and trace out before exiting has this long,
+** either may need a lock the stalled thread is holding...
+*/
+#define WATCHDOG_EXIT_GRACE_S               5
+#define WATCHDOG_EXIT_STATUS                3
+
+/*
+** How far the watchdog goes with a stalled thread, a step for
+** each deadline it stays stalled, repeating the last:
+**
+**   log        log it, with where the thread last was
+**   thread     interrupt it, so a blocking call fails with EINTR
+**              and a restartable thread starts over
+**   capture    kill the capture program and restart capture,
+**              only for the capture thread
+**   exit       exit, for a supervisor to restart bctl
+*/
+enum WatchdogAction {
+    watchdog_log,
+    watchdog_thread,
+    watchdog_capture,
+    watchdog_exit
+};
+
+struct WatchdogThreadStats
+{
+    pid_t               tid;
+    char                szName[WATCHDOG_NAME_LENGTH];
+    const char *        pszPoint;
+    bool                isWaiting;
+    bool                isStalled;
+    int                 level;
+    uint64_t            age;
+    uint64_t            deadline;
+    uint32_t            stallCount;
+};
+
+struct WatchdogStats
+{
+    bool                isRunning;
+    WatchdogAction      action;
+    uint64_t            timeout;
+    int                 numThreads;
+    uint32_t            checkCount;
+    uint32_t            stallCount;
+    uint32_t            recoveredCount;
+    uint32_t            interruptCount;
+    uint32_t            captureRestartCount;
+};
+
+/*
+** Watches every PosixThread, and the main thread's timer wheel,
+** from a thread of its own, which sleeps on the real clock so it
+** keeps going whatever else is stuck. Threads attach themselves
+** as they start, with their deadline, 0 for watchdog.timeout...
+*/
+class Watchdog : public PosixThread, public ConfigListener
+{
+public:
+    static Watchdog &   getInstance() {
+        static Watchdog instance;
+        return instance;
+    }
+
+private:
+    Watchdog();
+
+    pthread_mutex_t     mutex;
+    Heartbeat           heartbeats[WATCHDOG_MAX_THREADS];
+    WatchdogStats       stats;
+    uint64_t            interval;
+    bool                isEnabled;
+
+    void                readConfig();
+    void                check(uint64_t now);
+    void                reportStall(Heartbeat * h, uint64_t age);
+    void                escalate(Heartbeat * h, WatchdogAction action);
+    void                restartCapture();
+
+public:
+    ~Watchdog();
+
+    /*
+    ** Called by the thread to be watched, a deadline of 0 is
+    ** watchdog.timeout. Does nothing if it's already attached,
+    ** or the watchdog is off...
+    */
+    void                attach(PosixThread * pThread, uint64_t deadline);
+    void                detach();
+
+    void *              run();
+
+    void                configChanged(ConfigKey key, const char * value);
+
+    int                 getStats(WatchdogStats * stats, WatchdogThreadStats * threads, int maxThreads);
+};
+
+const char *    getWatchdogActionName(WatchdogAction action);
+
+#endif